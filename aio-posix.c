@@ -17,6 +17,10 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
+
+/* First polling time tried once polling turned out to be worthwhile */
+#define AIO_POLL_INITIAL_NS     4000
 
 struct AioHandler
 {
@@ -24,6 +28,7 @@ struct AioHandler
     IOHandler *io_read;
     IOHandler *io_write;
     AioFlushHandler *io_flush;
+    AioPollHandler *io_poll;
     int deleted;
     int pollfds_idx;
     void *opaque;
@@ -105,6 +110,108 @@ void aio_set_event_notifier(AioContext *ctx,
                        (AioFlushHandler *)io_flush, notifier);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollHandler *io_poll)
+{
+    AioHandler *node = find_aio_handler(ctx, fd);
+
+    assert(node || !io_poll);
+    if (node) {
+        node->io_poll = io_poll;
+    }
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollEventNotifierHandler *io_poll)
+{
+    aio_set_fd_poll(ctx, event_notifier_get_fd(notifier),
+                    (AioPollHandler *)io_poll);
+}
+
+bool aio_busy_poll(AioContext *ctx, int64_t *start)
+{
+    AioHandler *node;
+    bool progress = false, have_poll = false;
+    int64_t end;
+
+    *start = 0;
+    if (!ctx->poll_max_ns) {
+        return false;
+    }
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll) {
+            have_poll = true;
+            break;
+        }
+    }
+    if (!have_poll) {
+        return false;
+    }
+
+    *start = ctx->poll_end = get_clock();
+    if (!ctx->poll_ns) {
+        /* Not polling right now, but measure the wakeup latency anyway */
+        return false;
+    }
+
+    end = *start + ctx->poll_ns;
+    ctx->walking_handlers++;
+    do {
+        QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+            if (!node->deleted && node->io_poll &&
+                node->io_poll(node->opaque)) {
+                progress = true;
+            }
+        }
+        ctx->poll_end = get_clock();
+    } while (!progress && ctx->poll_end < end);
+    ctx->walking_handlers--;
+
+    ctx->poll_time_ns += ctx->poll_end - *start;
+    if (progress) {
+        ctx->poll_hits++;
+    } else {
+        ctx->poll_misses++;
+    }
+    return progress;
+}
+
+void aio_busy_poll_done(AioContext *ctx, int64_t start)
+{
+    int64_t now, block_ns;
+
+    if (!start) {
+        return;
+    }
+
+    now = get_clock();
+    block_ns = now - start;
+    ctx->sleep_time_ns += now - ctx->poll_end;
+
+    if (block_ns <= ctx->poll_ns) {
+        /* Polling caught the event, keep the current polling time */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* Polling for longer would not have helped, back off */
+        if (ctx->poll_shrink) {
+            ctx->poll_ns /= ctx->poll_shrink;
+        } else {
+            ctx->poll_ns = 0;
+        }
+        if (ctx->poll_ns < AIO_POLL_INITIAL_NS) {
+            ctx->poll_ns = 0;
+        }
+    } else if (ctx->poll_ns < ctx->poll_max_ns) {
+        /* The event arrived shortly after we gave up, poll longer */
+        if (!ctx->poll_ns) {
+            ctx->poll_ns = AIO_POLL_INITIAL_NS;
+        } else {
+            ctx->poll_ns *= ctx->poll_grow ? ctx->poll_grow : 2;
+        }
+        ctx->poll_ns = MIN(ctx->poll_ns, ctx->poll_max_ns);
+    }
+}
+
 bool aio_pending(AioContext *ctx)
 {
     AioHandler *node;
@@ -172,6 +279,7 @@ static bool aio_dispatch(AioContext *ctx)
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
+    int64_t poll_start = 0;
     int ret;
     bool busy, progress;
 
@@ -231,11 +339,19 @@ bool aio_poll(AioContext *ctx, bool blocking)
         return progress;
     }
 
+    /* Spin for a while if it pays off, we may not have to block at all */
+    if (blocking && aio_busy_poll(ctx, &poll_start)) {
+        blocking = false;
+        progress = true;
+    }
+
     /* wait until next event */
     ret = g_poll((GPollFD *)ctx->pollfds->data,
                  ctx->pollfds->len,
                  blocking ? -1 : 0);
 
+    aio_busy_poll_done(ctx, poll_start);
+
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
         QLIST_FOREACH(node, &ctx->aio_handlers, node) {
@@ -329,14 +329,32 @@ static uint64_t migration_dirty_pages;
 static uint32_t last_version;
 static bool ram_bulk_stage;
 
+/* With local-ram-fds, shared blocks are handed over by file descriptor
+ * instead of being copied.
+ */
+static bool ram_block_passed_by_fd(RAMBlock *block)
+{
+    return migrate_local_ram_fds() && (block->flags & RAM_SHARED_MASK);
+}
+
 void migration_bitmap_init(void)
 {
     int64_t ram_pages = last_ram_offset() >> TARGET_PAGE_BITS;
+    RAMBlock *block;
+
     if (!migration_bitmap) {
         migration_bitmap = bitmap_new(ram_pages);
     }
     bitmap_set(migration_bitmap, 0, ram_pages);
     migration_dirty_pages = ram_pages;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (ram_block_passed_by_fd(block)) {
+            bitmap_clear(migration_bitmap, block->offset >> TARGET_PAGE_BITS,
+                         block->length >> TARGET_PAGE_BITS);
+            migration_dirty_pages -= block->length >> TARGET_PAGE_BITS;
+        }
+    }
 }
 
 void migration_bitmap_free(void)
@@ -411,7 +429,6 @@ static inline bool migration_bitmap_set_dirty(MemoryRegion *mr,
 void migration_bitmap_sync(void)
 {
     RAMBlock *block;
-    ram_addr_t addr;
     uint64_t num_dirty_pages_init = migration_dirty_pages;
     MigrationState *s = migrate_get_current();
     static int64_t start_time;
@@ -432,13 +449,12 @@ void migration_bitmap_sync(void)
     address_space_sync_dirty_bitmap(&address_space_memory);
 
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        for (addr = 0; addr < block->length; addr += TARGET_PAGE_SIZE) {
-            if (memory_region_test_and_clear_dirty(block->mr,
-                                                   addr, TARGET_PAGE_SIZE,
-                                                   DIRTY_MEMORY_MIGRATION)) {
-                migration_bitmap_set_dirty(block->mr, addr);
-            }
+        if (ram_block_passed_by_fd(block)) {
+            continue;
         }
+        migration_dirty_pages +=
+            memory_region_sync_dirty_to_bitmap(block->mr, migration_bitmap,
+                                               DIRTY_MEMORY_MIGRATION);
     }
     trace_migration_bitmap_sync_end(migration_dirty_pages
                                     - num_dirty_pages_init);
@@ -806,9 +822,41 @@ static int ram_save_iterate_bwidth(QEMUFile *f, void *opaque)
     return ram_save_iterate(f);
 }
 
+/* Set once a RAM block descriptor may have reached another process */
+static bool ram_fds_passed;
+
+bool ram_save_fds_passed(void)
+{
+    return ram_fds_passed;
+}
+
+/* Pass the descriptors of shared RAM blocks; the guest must be stopped */
+static void ram_save_fds(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!ram_block_passed_by_fd(block)) {
+            continue;
+        }
+        bytes_transferred += save_block_hdr(f, block, 0, 0, RAM_SAVE_FLAG_FD);
+        /*
+         * The destination may start writing to the block as soon as it
+         * holds the descriptor, so from here on this side must never run
+         * the guest again, even if the migration later fails.
+         */
+        ram_fds_passed = true;
+        if (qemu_file_send_fd(f, block->fd) < 0) {
+            fprintf(stderr, "Can't pass RAM block %s\n", block->idstr);
+            return;
+        }
+    }
+}
+
 static int ram_save_complete(QEMUFile *f, void *opaque)
 {
     qemu_mutex_lock_ramlist();
+    kvm_dirty_log_harvest();
     migration_bitmap_sync();
 
     ram_control_before_iterate(f, RAM_CONTROL_FINISH);
@@ -820,6 +868,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         /* nothing */
     }
 
+    if (migrate_local_ram_fds()) {
+        ram_save_fds(f);
+    }
+
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
     migration_end();
 
@@ -836,6 +888,10 @@ uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size)
     remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
 
     if (remaining_size < max_size) {
+        /* Fetch the dirty logs outside the BQL, only publish under it */
+        qemu_mutex_lock_ramlist();
+        kvm_dirty_log_harvest();
+        qemu_mutex_unlock_ramlist();
         qemu_mutex_lock_iothread();
         migration_bitmap_sync();
         qemu_mutex_unlock_iothread();
@@ -992,6 +1048,31 @@ int ram_load_mem_size(QEMUFile *f, ram_addr_t total_ram_bytes)
     return 0;
 }
 
+static int ram_load_fd(QEMUFile *f)
+{
+    RAMBlock *block;
+    char id[256];
+    uint8_t len;
+    int fd;
+
+    len = qemu_get_byte(f);
+    qemu_get_buffer(f, (uint8_t *)id, len);
+    id[len] = 0;
+    /* The descriptor arrives together with this marker byte */
+    qemu_get_byte(f);
+
+    block = ram_find_block(id, len);
+    fd = qemu_file_recv_fd(f);
+    if (!block || fd < 0) {
+        fprintf(stderr, "Can't take over RAM block %s!\n", id);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -EINVAL;
+    }
+    return qemu_ram_remap_fd(block, fd);
+}
+
 int ram_load_page(QEMUFile *f, void *host, int flags)
 {
     if (flags & RAM_SAVE_FLAG_COMPRESS) {
@@ -1053,6 +1134,12 @@ int ram_load(QEMUFile *f, void *opaque, int version_id,
                 goto done;
             }
         }
+        if (flags & RAM_SAVE_FLAG_FD) {
+            ret = ram_load_fd(f);
+            if (ret) {
+                goto done;
+            }
+        }
         ret = qemu_file_get_error(f);
         if (ret) {
             goto done;
@@ -26,6 +26,7 @@
 #include "block/aio.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
+#include "qmp-commands.h"
 
 /***********************************************************/
 /* bottom halves (can be seen as timers which expire ASAP) */
@@ -195,11 +196,66 @@ aio_ctx_dispatch(GSource     *source,
     return true;
 }
 
+/***********************************************************/
+/* busy polling parameters and statistics */
+
+static int64_t aio_poll_max_ns;
+static int64_t aio_poll_grow;
+static int64_t aio_poll_shrink;
+
+static QemuMutex aio_context_list_lock;
+static QTAILQ_HEAD(, AioContext) aio_context_list =
+    QTAILQ_HEAD_INITIALIZER(aio_context_list);
+
+static void __attribute__((constructor)) aio_context_list_init(void)
+{
+    qemu_mutex_init(&aio_context_list_lock);
+}
+
+void aio_set_poll_defaults(int64_t max_ns, int64_t grow, int64_t shrink)
+{
+    aio_poll_max_ns = max_ns;
+    aio_poll_grow = grow;
+    aio_poll_shrink = shrink;
+}
+
+AioPollInfoList *qmp_query_aio_poll(Error **errp)
+{
+    AioPollInfoList *head = NULL, **prev = &head;
+    AioContext *ctx;
+
+    qemu_mutex_lock(&aio_context_list_lock);
+    QTAILQ_FOREACH(ctx, &aio_context_list, next) {
+        AioPollInfoList *entry = g_malloc0(sizeof(*entry));
+        AioPollInfo *info = g_malloc0(sizeof(*info));
+
+        /* Statistics are updated locklessly by the context's own thread */
+        info->main = ctx == qemu_get_aio_context();
+        info->poll_max_ns = ctx->poll_max_ns;
+        info->poll_ns = ctx->poll_ns;
+        info->poll_hits = ctx->poll_hits;
+        info->poll_misses = ctx->poll_misses;
+        info->poll_time_ns = ctx->poll_time_ns;
+        info->sleep_time_ns = ctx->sleep_time_ns;
+
+        entry->value = info;
+        *prev = entry;
+        prev = &entry->next;
+    }
+    qemu_mutex_unlock(&aio_context_list_lock);
+
+    return head;
+}
+
 static void
 aio_ctx_finalize(GSource     *source)
 {
     AioContext *ctx = (AioContext *) source;
 
+    qemu_mutex_lock(&aio_context_list_lock);
+    QTAILQ_REMOVE(&aio_context_list, ctx, next);
+    qemu_mutex_unlock(&aio_context_list_lock);
+
     thread_pool_free(ctx->thread_pool);
     aio_set_event_notifier(ctx, &ctx->notifier, NULL, NULL);
     event_notifier_cleanup(&ctx->notifier);
@@ -245,6 +301,14 @@ AioContext *aio_context_new(void)
                            (EventNotifierHandler *)
                            event_notifier_test_and_clear, NULL);
 
+    ctx->poll_max_ns = aio_poll_max_ns;
+    ctx->poll_grow = aio_poll_grow;
+    ctx->poll_shrink = aio_poll_shrink;
+
+    qemu_mutex_lock(&aio_context_list_lock);
+    QTAILQ_INSERT_TAIL(&aio_context_list, ctx, next);
+    qemu_mutex_unlock(&aio_context_list_lock);
+
     return ctx;
 }
 
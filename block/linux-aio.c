@@ -12,6 +12,7 @@
 #include "qemu/queue.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
+#include "qemu/atomic.h"
 
 #include <libaio.h>
 
@@ -42,6 +43,31 @@ struct qemu_laio_state {
     int count;
 };
 
+/* Completion ring shared with the kernel, io_context_t points to it */
+struct aio_ring {
+    unsigned id;
+    unsigned nr;
+    unsigned head;
+    unsigned tail;
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;
+};
+
+#define AIO_RING_MAGIC 0xa10a10a1
+
+bool laio_ring_has_events(struct io_context *io_ctx)
+{
+    struct aio_ring *ring = (struct aio_ring *)io_ctx;
+
+    if (ring->magic != AIO_RING_MAGIC) {
+        /* Unknown ring layout, pretend there is something to reap */
+        return true;
+    }
+    return atomic_read(&ring->head) != atomic_read(&ring->tail);
+}
+
 static inline ssize_t io_event_ret(struct io_event *ev)
 {
     return (ssize_t)(((uint64_t)ev->res2 << 32) | ev->res);
@@ -77,28 +103,45 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
     qemu_aio_release(laiocb);
 }
 
+static void qemu_laio_process_events(struct qemu_laio_state *s)
+{
+    struct io_event events[MAX_EVENTS];
+    struct timespec ts = { 0 };
+    int nevents, i;
+
+    do {
+        nevents = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS, events, &ts);
+    } while (nevents == -EINTR);
+
+    for (i = 0; i < nevents; i++) {
+        struct iocb *iocb = events[i].obj;
+        struct qemu_laiocb *laiocb =
+                container_of(iocb, struct qemu_laiocb, iocb);
+
+        laiocb->ret = io_event_ret(&events[i]);
+        qemu_laio_process_completion(s, laiocb);
+    }
+}
+
 static void qemu_laio_completion_cb(EventNotifier *e)
 {
     struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
 
     while (event_notifier_test_and_clear(&s->e)) {
-        struct io_event events[MAX_EVENTS];
-        struct timespec ts = { 0 };
-        int nevents, i;
-
-        do {
-            nevents = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS, events, &ts);
-        } while (nevents == -EINTR);
+        qemu_laio_process_events(s);
+    }
+}
 
-        for (i = 0; i < nevents; i++) {
-            struct iocb *iocb = events[i].obj;
-            struct qemu_laiocb *laiocb =
-                    container_of(iocb, struct qemu_laiocb, iocb);
+static bool qemu_laio_poll_cb(EventNotifier *e)
+{
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
 
-            laiocb->ret = io_event_ret(&events[i]);
-            qemu_laio_process_completion(s, laiocb);
-        }
+    if (!s->count || !laio_ring_has_events(s->ctx)) {
+        return false;
     }
+
+    qemu_laio_process_events(s);
+    return true;
 }
 
 static int qemu_laio_flush_cb(EventNotifier *e)
@@ -205,6 +248,7 @@ void *laio_init(void)
 
     qemu_aio_set_event_notifier(&s->e, qemu_laio_completion_cb,
                                 qemu_laio_flush_cb);
+    qemu_aio_set_event_notifier_poll(&s->e, qemu_laio_poll_cb);
 
     return s;
 
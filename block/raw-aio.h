@@ -36,6 +36,10 @@ void *laio_init(void);
 BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque, int type);
+
+/* Check the completion ring of an io_context_t without entering the kernel */
+struct io_context;
+bool laio_ring_has_events(struct io_context *io_ctx);
 #endif
 
 #ifdef _WIN32
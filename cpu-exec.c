@@ -22,6 +22,10 @@
 #include "tcg.h"
 #include "qemu/atomic.h"
 #include "sysemu/qtest.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "sysemu/cpus.h"
+#include "qemu/main-loop.h"
+#endif
 
 bool qemu_cpu_has_work(CPUState *cpu)
 {
@@ -100,62 +104,126 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     tb_free(tb);
 }
 
+/* Search the physical PC hash table.  This does not need tb_lock. */
+static TranslationBlock *tb_find_physical(CPUArchState *env,
+                                          target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint64_t flags,
+                                          tb_page_addr_t phys_pc)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBHashTable *htab;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_page1, phys_page2;
+    target_ulong virt_page2;
+    uint32_t h;
+    unsigned int seq;
+    int steps;
+
+    phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, cs_base, flags);
+    do {
+        seq = tb_hash_read_begin(ctx);
+        htab = atomic_read(&ctx->tb_phys_hash);
+        smp_read_barrier_depends();
+        tb = atomic_read(&htab->buckets[h & htab->mask]);
+        for (steps = 0; tb != NULL; steps++) {
+            smp_read_barrier_depends();
+            if (steps > ctx->tb_phys_hash_count) {
+                /* went around a chain that is being relinked */
+                tb = NULL;
+                break;
+            }
+            if (tb->pc == pc &&
+                tb->page_addr[0] == phys_page1 &&
+                tb->cs_base == cs_base &&
+                tb->flags == flags) {
+                /* check next page if needed */
+                if (tb->page_addr[1] == -1) {
+                    break;
+                }
+                virt_page2 = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+                phys_page2 = get_page_addr_code(env, virt_page2);
+                if (tb->page_addr[1] == phys_page2) {
+                    break;
+                }
+            }
+            tb = atomic_read(&tb->phys_hash_next);
+        }
+    } while (tb_hash_read_retry(ctx, seq));
+
+    return tb;
+}
+
+/* Filling the TLB and translating can access device memory.  The BQL
+   ranks above tb_lock, so drop tb_lock to take it.  Returns true if the
+   BQL must be released again by tb_translate_end().  */
+static bool tb_translate_begin(void)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (qemu_tcg_mttcg_enabled() && !qemu_mutex_iothread_locked()) {
+        tb_unlock();
+        qemu_mutex_lock_iothread();
+        tb_lock();
+        return true;
+    }
+#endif
+    return false;
+}
+
+static void tb_translate_end(bool unlock_iothread)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (unlock_iothread) {
+        qemu_mutex_unlock_iothread();
+    }
+#endif
+}
+
 static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong pc,
                                       target_ulong cs_base,
                                       uint64_t flags)
 {
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+    bool unlock_iothread = tb_translate_begin();
 
     tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
 
     /* find translated block using physical mappings */
     phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb)
-            goto not_found;
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2)
-                    goto found;
-            } else {
-                goto found;
-            }
-        }
-        ptb1 = &tb->phys_hash_next;
-    }
- not_found:
-   /* if no translated code available, then translate it now */
-    tb = tb_gen_code(env, pc, cs_base, flags, 0);
-
- found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
+    tb = tb_find_physical(env, pc, cs_base, flags, phys_pc);
+    if (!tb) {
+        /* if no translated code available, then translate it now */
+        tb = tb_gen_code(env, pc, cs_base, flags, 0);
     }
+
     /* we add the TB in the virtual pc hash table */
     env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    tb_translate_end(unlock_iothread);
     return tb;
 }
 
+/* Keep the code region of a dispatched TB away from eviction, and count
+   lookups that did not need a translation after a flush.  The region
+   stamp is only written when it changes, i.e. rarely for hot code.  */
+static inline void tb_region_touch(TranslationBlock *tb)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
+
+    r = &ctx->regions[(tb->tc_ptr - tcg_ctx.code_gen_buffer) >>
+                      ctx->region_bits];
+    if (r->last_use != ctx->region_clock) {
+        r->last_use = ctx->region_clock;
+    }
+    if (unlikely(ctx->tb_recovery_start) &&
+        ++ctx->tb_recovery_hits >= TB_RECOVERY_HITS) {
+        tb_recovery_done();
+    }
+}
+
 static inline TranslationBlock *tb_find_fast(CPUArchState *env)
 {
     TranslationBlock *tb;
@@ -171,9 +239,30 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
                  tb->flags != flags)) {
         tb = tb_find_slow(env, pc, cs_base, flags);
     }
+    tb_region_touch(tb);
     return tb;
 }
 
+/* With multi-threaded TCG, cpu_exec() runs without the BQL; take it
+   around interrupt and exception delivery, which touch board state.  */
+static inline void cpu_exec_lock_iothread(void)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_lock_iothread();
+    }
+#endif
+}
+
+static inline void cpu_exec_unlock_iothread(void)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_unlock_iothread();
+    }
+#endif
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -287,7 +376,9 @@ int cpu_exec(CPUArchState *env)
                     ret = env->exception_index;
                     break;
 #else
+                    cpu_exec_lock_iothread();
                     cc->do_interrupt(cpu);
+                    cpu_exec_unlock_iothread();
                     env->exception_index = -1;
 #endif
                 }
@@ -297,6 +388,8 @@ int cpu_exec(CPUArchState *env)
             for(;;) {
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+                    cpu_exec_lock_iothread();
+                    interrupt_request = cpu->interrupt_request;
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -573,6 +666,7 @@ int cpu_exec(CPUArchState *env)
                            the program flow was changed */
                         next_tb = 0;
                     }
+                    cpu_exec_unlock_iothread();
                 }
                 if (unlikely(cpu->exit_request)) {
                     cpu->exit_request = 0;
@@ -595,7 +689,7 @@ int cpu_exec(CPUArchState *env)
 #endif
                 }
 #endif /* DEBUG_DISAS */
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+                tb_lock();
                 tb = tb_find_fast(env);
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
@@ -614,10 +708,24 @@ int cpu_exec(CPUArchState *env)
                    spans two pages, we cannot safely do a direct
                    jump. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    TranslationBlock *prev = (TranslationBlock *)
+                                             (next_tb & ~TB_EXIT_MASK);
+                    int n = next_tb & TB_EXIT_MASK;
+
+                    if (!tb_trace_profile(prev, n, tb)) {
+                        tb_add_jump(prev, n, tb);
+                    } else if (prev->exit_count[0] + prev->exit_count[1] >=
+                               TB_TRACE_THRESHOLD) {
+                        bool unlock_iothread = tb_translate_begin();
+
+                        tb_gen_trace(env, prev);
+                        tb_translate_end(unlock_iothread);
+                        /* translating may have evicted @tb */
+                        tb = tb_find_fast(env);
+                        tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
+                    }
                 }
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+                tb_unlock();
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -681,6 +789,14 @@ int cpu_exec(CPUArchState *env)
              * local variables as longjmp is marked 'noreturn'. */
             cpu = current_cpu;
             env = cpu->env_ptr;
+            /* Faults and exit requests can longjmp out of translation
+               or device emulation with locks held */
+            tb_lock_reset();
+#if !defined(CONFIG_USER_ONLY)
+            if (qemu_tcg_mttcg_enabled() && qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
+#endif
         }
     } /* for(;;) */
 
@@ -37,6 +37,10 @@
 #include "sysemu/qtest.h"
 #include "qemu/main-loop.h"
 #include "qemu/bitmap.h"
+#include "qemu/tls.h"
+#include "qemu/atomic.h"
+#include "qemu/seqlock.h"
+#include "qemu/error-report.h"
 
 #ifndef _WIN32
 #include "qemu/compatfd.h"
@@ -105,8 +109,14 @@ static int64_t vm_clock_warp_start;
 static int64_t qemu_icount;
 
 typedef struct TimersState {
+    /* Protected by the BQL.  */
     int64_t cpu_ticks_prev;
     int64_t cpu_ticks_offset;
+
+    /* cpu_clock_offset and cpu_ticks_enabled are also read without the
+     * BQL, by cpu_get_clock(); writers hold the BQL and this seqlock.
+     */
+    QemuSeqLock vm_clock_seqlock;
     int64_t cpu_clock_offset;
     int32_t cpu_ticks_enabled;
     int64_t dummy;
@@ -152,8 +162,7 @@ int64_t cpu_get_ticks(void)
     }
 }
 
-/* return the host CPU monotonic timer and handle stop/restart */
-int64_t cpu_get_clock(void)
+static int64_t cpu_get_clock_locked(void)
 {
     int64_t ti;
     if (!timers_state.cpu_ticks_enabled) {
@@ -164,25 +173,44 @@ int64_t cpu_get_clock(void)
     }
 }
 
+/* return the host CPU monotonic timer and handle stop/restart.  May be
+   called without the BQL.  */
+int64_t cpu_get_clock(void)
+{
+    int64_t ti;
+    unsigned start;
+
+    do {
+        start = seqlock_read_begin(&timers_state.vm_clock_seqlock);
+        ti = cpu_get_clock_locked();
+    } while (seqlock_read_retry(&timers_state.vm_clock_seqlock, start));
+
+    return ti;
+}
+
 /* enable cpu_get_ticks() */
 void cpu_enable_ticks(void)
 {
+    seqlock_write_lock(&timers_state.vm_clock_seqlock);
     if (!timers_state.cpu_ticks_enabled) {
         timers_state.cpu_ticks_offset -= cpu_get_real_ticks();
         timers_state.cpu_clock_offset -= get_clock();
         timers_state.cpu_ticks_enabled = 1;
     }
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock);
 }
 
 /* disable cpu_get_ticks() : the clock is stopped. You must not call
    cpu_get_ticks() after that.  */
 void cpu_disable_ticks(void)
 {
+    seqlock_write_lock(&timers_state.vm_clock_seqlock);
     if (timers_state.cpu_ticks_enabled) {
         timers_state.cpu_ticks_offset = cpu_get_ticks();
-        timers_state.cpu_clock_offset = cpu_get_clock();
+        timers_state.cpu_clock_offset = cpu_get_clock_locked();
         timers_state.cpu_ticks_enabled = 0;
     }
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock);
 }
 
 /* Correlation between real and virtual time is always going to be
@@ -353,6 +381,7 @@ static const VMStateDescription vmstate_timers = {
 
 void configure_icount(const char *option)
 {
+    seqlock_init(&timers_state.vm_clock_seqlock, NULL);
     vmstate_register(NULL, 0, &vmstate_timers, &timers_state);
     if (!option) {
         return;
@@ -384,6 +413,45 @@ void configure_icount(const char *option)
                    qemu_get_clock_ns(vm_clock) + get_ticks_per_sec() / 10);
 }
 
+void qemu_tcg_configure(QemuOpts *opts)
+{
+    const char *mode = qemu_opt_get(opts, "thread");
+
+    if (qemu_opt_get_bool(opts, "traces", false)) {
+#ifdef TARGET_HAS_TRACES
+        if (use_icount) {
+            error_report("TCG superblocks are not compatible with -icount");
+            exit(1);
+        }
+        tb_enable_traces();
+#else
+        error_report("TCG superblocks are not supported for this target");
+        exit(1);
+#endif
+    }
+
+    if (!mode || !strcmp(mode, "single")) {
+        mttcg_enabled = false;
+        return;
+    }
+    if (strcmp(mode, "multi") != 0) {
+        error_report("invalid TCG thread mode '%s'", mode);
+        exit(1);
+    }
+
+#if defined(TARGET_SUPPORTS_MTTCG) && defined(CONFIG_LINUX)
+    if (use_icount) {
+        error_report("multi-threaded TCG is not compatible with -icount");
+        exit(1);
+    }
+    mttcg_enabled = true;
+#else
+    error_report("multi-threaded TCG is not supported for this target "
+                 "or host");
+    exit(1);
+#endif
+}
+
 /***********************************************************/
 void hw_error(const char *fmt, ...)
 {
@@ -441,6 +509,9 @@ static int do_vm_stop(RunState state)
     if (runstate_is_running()) {
         cpu_disable_ticks();
         pause_all_vcpus();
+        /* Writes still sitting in the coalesced MMIO ring belong to the
+         * device state that is about to be looked at or saved. */
+        qemu_flush_coalesced_mmio_buffer();
         runstate_set(state);
         vm_state_notify(0, state);
         monitor_protocol_event(QEVENT_STOP, NULL);
@@ -618,6 +689,20 @@ static void qemu_tcg_init_cpu_signals(void)
 static QemuMutex qemu_global_mutex;
 static QemuCond qemu_io_proceeded_cond;
 static bool iothread_requesting_mutex;
+static DEFINE_TLS(bool, iothread_locked);
+
+bool mttcg_enabled;
+
+/* Exclusive sections for multi-threaded TCG, protected by the BQL.
+ * Modelled on start_exclusive()/end_exclusive() in linux-user.
+ */
+static QemuCond exclusive_cond;
+static QemuCond exclusive_resume;
+static int pending_cpus;
+static int tcg_tb_flush_pending;
+
+#define TCG_FLUSH_REGION    1
+#define TCG_FLUSH_ALL       2
 
 static QemuThread io_thread;
 
@@ -637,6 +722,8 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&exclusive_cond);
+    qemu_cond_init(&exclusive_resume);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
@@ -764,6 +851,7 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
     int r;
 
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     current_cpu = cpu;
@@ -836,6 +924,7 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 }
 
 static void tcg_exec_all(void);
+static int tcg_cpu_exec(CPUArchState *env);
 
 static void tcg_signal_cpu_creation(CPUState *cpu, void *data)
 {
@@ -851,6 +940,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     qemu_thread_get_self(cpu->thread);
 
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     qemu_for_each_cpu(tcg_signal_cpu_creation, NULL);
     qemu_cond_signal(&qemu_cpu_cond);
 
@@ -875,6 +965,194 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+/* Wait until no other vCPU is inside cpu_exec().  Called with the BQL
+ * held, from outside cpu_exec().
+ */
+static void start_exclusive(void)
+{
+    CPUState *cpu;
+
+    while (pending_cpus) {
+        qemu_cond_wait(&exclusive_resume, &qemu_global_mutex);
+    }
+
+    pending_cpus = 1;
+    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
+        if (cpu->running) {
+            pending_cpus++;
+            cpu_exit(cpu);
+        }
+    }
+    while (pending_cpus > 1) {
+        qemu_cond_wait(&exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+static void end_exclusive(void)
+{
+    pending_cpus = 0;
+    qemu_cond_broadcast(&exclusive_resume);
+}
+
+static void tcg_cpu_exec_start(CPUState *cpu)
+{
+    while (pending_cpus) {
+        qemu_cond_wait(&exclusive_resume, &qemu_global_mutex);
+    }
+    cpu->running = true;
+}
+
+static void tcg_cpu_exec_end(CPUState *cpu)
+{
+    cpu->running = false;
+    if (pending_cpus > 1) {
+        pending_cpus--;
+        if (pending_cpus == 1) {
+            qemu_cond_signal(&exclusive_cond);
+        }
+    }
+}
+
+/* True if no vCPU can be executing translated code, so that the code
+ * buffer may be modified freely.  Always true without multi-threaded TCG.
+ */
+bool qemu_tcg_cpus_quiescent(void)
+{
+    CPUState *cpu;
+
+    if (!mttcg_enabled) {
+        return true;
+    }
+    if (!qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
+        if (cpu->running) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Ask the vCPU threads to flush the translation cache, or with !full just
+ * its least recently used region, as soon as all of them have left
+ * cpu_exec().  May be called without the BQL.
+ */
+void qemu_tcg_request_tb_flush(bool full)
+{
+    CPUState *cpu;
+
+    atomic_or(&tcg_tb_flush_pending, full ? TCG_FLUSH_ALL : TCG_FLUSH_REGION);
+    smp_mb();
+    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
+        cpu_exit(cpu);
+    }
+}
+
+static void qemu_tcg_flush_pending(CPUState *cpu)
+{
+    int pending;
+
+    if (!atomic_mb_read(&tcg_tb_flush_pending)) {
+        return;
+    }
+
+    start_exclusive();
+    /* Another vCPU may have done it while we were waiting */
+    pending = atomic_xchg(&tcg_tb_flush_pending, 0);
+    if (pending & TCG_FLUSH_ALL) {
+        tb_flush(cpu->env_ptr);
+    } else if (pending & TCG_FLUSH_REGION) {
+        tb_evict_region(cpu->env_ptr);
+    }
+    end_exclusive();
+}
+
+/* Run func(data) while no other vCPU is executing translated code.
+ * 'cpu' is the calling vCPU, or NULL outside of a vCPU thread; if it is
+ * inside cpu_exec() it stops counting as running for the duration.
+ * func must not raise guest exceptions, so any TLB fill has to be done
+ * by the caller beforehand.
+ */
+void qemu_tcg_exec_exclusive(CPUState *cpu, void (*func)(void *data),
+                             void *data)
+{
+    bool locked = false;
+    bool running;
+
+    if (!mttcg_enabled) {
+        func(data);
+        return;
+    }
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
+    running = cpu && cpu->running;
+    if (running) {
+        tcg_cpu_exec_end(cpu);
+    }
+    start_exclusive();
+    func(data);
+    end_exclusive();
+    if (running) {
+        tcg_cpu_exec_start(cpu);
+    }
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+static void qemu_mttcg_wait_io_event(CPUState *cpu)
+{
+    while (cpu_thread_is_idle(cpu)) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(cpu);
+}
+
+static void *qemu_mttcg_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    int r;
+
+    qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
+    qemu_thread_get_self(cpu->thread);
+    cpu->thread_id = qemu_get_thread_id();
+
+    /* signal CPU creation */
+    cpu->created = true;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    /* wait for initial kick-off after machine start */
+    while (cpu->stopped) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        qemu_wait_io_event_common(cpu);
+    }
+
+    while (1) {
+        if (cpu_can_run(cpu)) {
+            /* Translated code runs without the BQL; it is taken on demand
+             * for device accesses, TLB fills and interrupt delivery.
+             */
+            tcg_cpu_exec_start(cpu);
+            qemu_mutex_unlock_iothread();
+            r = tcg_cpu_exec(cpu->env_ptr);
+            qemu_mutex_lock_iothread();
+            tcg_cpu_exec_end(cpu);
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(cpu);
+            }
+        }
+        qemu_tcg_flush_pending(cpu);
+        qemu_mttcg_wait_io_event(cpu);
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -917,7 +1195,9 @@ static void qemu_cpu_kick_thread(CPUState *cpu)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
-    if (!tcg_enabled() && !cpu->thread_kicked) {
+    if (tcg_enabled() && mttcg_enabled) {
+        cpu_exit(cpu);
+    } else if (!tcg_enabled() && !cpu->thread_kicked) {
         qemu_cpu_kick_thread(cpu);
         cpu->thread_kicked = true;
     }
@@ -949,7 +1229,7 @@ static bool qemu_in_vcpu_thread(void)
 
 void qemu_mutex_lock_iothread(void)
 {
-    if (!tcg_enabled()) {
+    if (!tcg_enabled() || mttcg_enabled) {
         qemu_mutex_lock(&qemu_global_mutex);
     } else {
         iothread_requesting_mutex = true;
@@ -960,13 +1240,20 @@ void qemu_mutex_lock_iothread(void)
         iothread_requesting_mutex = false;
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    tls_var(iothread_locked) = true;
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    tls_var(iothread_locked) = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return tls_var(iothread_locked);
+}
+
 static int all_vcpus_paused(void)
 {
     CPUState *cpu = first_cpu;
@@ -994,7 +1281,7 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !mttcg_enabled) {
             cpu = first_cpu;
             while (cpu) {
                 cpu->stop = false;
@@ -1033,8 +1320,25 @@ void resume_all_vcpus(void)
     }
 }
 
+static void qemu_mttcg_start_vcpu(CPUState *cpu)
+{
+    cpu->thread = g_malloc0(sizeof(QemuThread));
+    cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+    qemu_cond_init(cpu->halt_cond);
+    qemu_thread_create(cpu->thread, qemu_mttcg_cpu_thread_fn, cpu,
+                       QEMU_THREAD_JOINABLE);
+    while (!cpu->created) {
+        qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+    }
+}
+
 static void qemu_tcg_init_vcpu(CPUState *cpu)
 {
+    if (mttcg_enabled) {
+        qemu_mttcg_start_vcpu(cpu);
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
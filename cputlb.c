@@ -32,6 +32,8 @@
 
 /* statistics */
 int tlb_flush_count;
+uint64_t tlb_miss_count;
+uint64_t tlb_victim_hit_count;
 
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
@@ -52,10 +54,46 @@ static const CPUTLBEntry s_cputlb_empty_entry = {
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
+void tlb_init(CPUArchState *env)
+{
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        env->tlb_desc[mmu_idx].mask = (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS;
+        env->tlb_desc[mmu_idx].n_misses = 0;
+    }
+}
+
+static inline unsigned int tlb_n_entries(CPUArchState *env, int mmu_idx)
+{
+    return (env->tlb_desc[mmu_idx].mask >> CPU_TLB_ENTRY_BITS) + 1;
+}
+
+/* Pick the size of the TLB for the next flush interval.  If more than
+   half of the entries had to be refilled since the last flush, the
+   working set does not fit and the table is doubled; if fewer than a
+   sixteenth were, the table is halved so that flushing it stays cheap.  */
+static void tlb_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+#if CPU_TLB_DYN_MAX_BITS != CPU_TLB_DYN_MIN_BITS
+    unsigned int size = tlb_n_entries(env, mmu_idx);
+
+    if (desc->n_misses > size / 2 && size < CPU_TLB_MAX_SIZE) {
+        size *= 2;
+    } else if (desc->n_misses < size / 16 &&
+               size > (1 << CPU_TLB_DYN_MIN_BITS)) {
+        size /= 2;
+    }
+    desc->mask = (uintptr_t)(size - 1) << CPU_TLB_ENTRY_BITS;
+#endif
+    desc->n_misses = 0;
+}
+
 void tlb_flush(CPUArchState *env, int flush_global)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    int i;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -64,12 +102,17 @@ void tlb_flush(CPUArchState *env, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    for (i = 0; i < CPU_TLB_SIZE; i++) {
-        int mmu_idx;
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        unsigned int i, n;
 
-        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_resize(env, mmu_idx);
+        n = tlb_n_entries(env, mmu_idx);
+        for (i = 0; i < n; i++) {
             env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
     }
 
     memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
@@ -115,9 +158,12 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
     cpu->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_entry(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx,
+                                                           addr)], addr);
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
+        }
     }
 
     tb_flush_jmp_cache(env, addr);
@@ -127,9 +173,8 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
 {
-    cpu_physical_memory_reset_dirty(ram_addr,
-                                    ram_addr + TARGET_PAGE_SIZE,
-                                    CODE_DIRTY_FLAG);
+    cpu_physical_memory_reset_dirty(ram_addr, TARGET_PAGE_SIZE,
+                                    DIRTY_MEMORY_CODE);
 }
 
 /* update the TLB so that writes in physical page 'phys_addr' are no longer
@@ -137,7 +182,7 @@ void tlb_protect_code(ram_addr_t ram_addr)
 void tlb_unprotect_code_phys(CPUArchState *env, ram_addr_t ram_addr,
                              target_ulong vaddr)
 {
-    cpu_physical_memory_set_dirty_flags(ram_addr, CODE_DIRTY_FLAG);
+    cpu_physical_memory_set_dirty_flag(ram_addr, DIRTY_MEMORY_CODE);
 }
 
 static bool tlb_is_dirty_ram(CPUTLBEntry *tlbe)
@@ -194,12 +239,16 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
 
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            unsigned int i;
+            unsigned int i, n = tlb_n_entries(env, mmu_idx);
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < n; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -219,10 +268,46 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx,
+                                                          vaddr)], vaddr);
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][i], vaddr);
+        }
+    }
+}
+
+/* Called on a tlb_table miss for ADDR: if the victim TLB holds the page
+   for the access whose address field is at ELT_OFS in CPUTLBEntry, swap
+   it back into tlb_table and return true.  */
+bool tlb_victim_lookup(CPUArchState *env, int mmu_idx, target_ulong addr,
+                       size_t elt_ofs)
+{
+    unsigned int index = tlb_index(env, mmu_idx, addr);
+    int vidx;
+
+    env->tlb_desc[mmu_idx].n_misses++;
+    tlb_miss_count++;
+
+    addr &= TARGET_PAGE_MASK;
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        CPUTLBEntry *vte = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vte + elt_ofs);
+
+        if ((cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) == addr) {
+            CPUTLBEntry *te = &env->tlb_table[mmu_idx][index];
+            CPUTLBEntry tmp = *te;
+            hwaddr tmp_iotlb = env->iotlb[mmu_idx][index];
+
+            *te = *vte;
+            *vte = tmp;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmp_iotlb;
+            tlb_victim_hit_count++;
+            return true;
+        }
     }
+    return false;
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -256,7 +341,7 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   int mmu_idx, target_ulong size)
 {
     MemoryRegionSection *section;
-    unsigned int index;
+    unsigned int index, i;
     target_ulong address;
     target_ulong code_address;
     uintptr_t addend;
@@ -293,9 +378,26 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(env, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Drop stale copies of this page from the victim TLB, and keep the
+       entry being replaced there if it maps another page.  */
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][i],
+                        vaddr & TARGET_PAGE_MASK);
+    }
+    tlb_flush_entry(te, vaddr & TARGET_PAGE_MASK);
+    if (te->addr_read != (target_ulong)-1 ||
+        te->addr_write != (target_ulong)-1 ||
+        te->addr_code != (target_ulong)-1) {
+        unsigned int vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -324,6 +426,39 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     }
 }
 
+/* Return a host pointer for a guest store to 'addr', filling the TLB
+ * if needed, or NULL if the page is not RAM (I/O, ROM or watchpoints).
+ * Used to emulate guest atomic operations with host atomics.  If the
+ * page is RAM whose writes are tracked, *notdirty is set to its
+ * ram_addr_t and the store must be bracketed by
+ * cpu_notdirty_write_begin/end; otherwise it is set to RAM_ADDR_MAX.
+ * NOTE: this function can trigger an exception
+ */
+void *tlb_vaddr_to_host_write(CPUArchState *env, target_ulong addr,
+                              int mmu_idx, uintptr_t retaddr,
+                              ram_addr_t *notdirty)
+{
+    int index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
+    target_ulong flags;
+
+    if ((addr & TARGET_PAGE_MASK) !=
+        (tlbe->addr_write & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) &&
+        !tlb_victim_lookup(env, mmu_idx, addr,
+                           offsetof(CPUTLBEntry, addr_write))) {
+        tlb_fill(env, addr, 1, mmu_idx, retaddr);
+    }
+    flags = tlbe->addr_write & ~TARGET_PAGE_MASK;
+    if (flags == TLB_NOTDIRTY) {
+        *notdirty = (env->iotlb[mmu_idx][index] & TARGET_PAGE_MASK) + addr;
+    } else if (flags == 0) {
+        *notdirty = RAM_ADDR_MAX;
+    } else {
+        return NULL;
+    }
+    return (void *)((uintptr_t)addr + tlbe->addend);
+}
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
  * is actually a ram_addr_t (in system mode; the user mode emulation
@@ -335,8 +470,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     void *p;
     MemoryRegion *mr;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
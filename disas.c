@@ -407,14 +407,16 @@ monitor_fprintf(FILE *stream, const char *fmt, ...)
     return 0;
 }
 
-void monitor_disas(Monitor *mon, CPUArchState *env,
-                   target_ulong pc, int nb_insn, int is_physical, int flags)
+/* Disassemble up to @nb_insn instructions, and at most @size bytes */
+static void disas_to_stream(FILE *stream, fprintf_function fprintf_fn,
+                            CPUArchState *env, target_ulong pc, int nb_insn,
+                            target_ulong size, int is_physical, int flags)
 {
     int count, i;
     CPUDebug s;
     int (*print_insn)(bfd_vma pc, disassemble_info *info);
 
-    INIT_DISASSEMBLE_INFO(s.info, (FILE *)mon, monitor_fprintf);
+    INIT_DISASSEMBLE_INFO(s.info, stream, fprintf_fn);
 
     s.env = env;
     monitor_disas_is_physical = is_physical;
@@ -438,7 +440,18 @@ void monitor_disas(Monitor *mon, CPUArchState *env,
     }
     print_insn = print_insn_i386;
 #elif defined(TARGET_ARM)
-    print_insn = print_insn_arm;
+    if (flags & 1) {
+        print_insn = print_insn_thumb1;
+    } else {
+        print_insn = print_insn_arm;
+    }
+    if (flags & 2) {
+#ifdef TARGET_WORDS_BIGENDIAN
+        s.info.endian = BFD_ENDIAN_LITTLE;
+#else
+        s.info.endian = BFD_ENDIAN_BIG;
+#endif
+    }
 #elif defined(TARGET_ALPHA)
     print_insn = print_insn_alpha;
 #elif defined(TARGET_SPARC)
@@ -474,18 +487,50 @@ void monitor_disas(Monitor *mon, CPUArchState *env,
     s.info.mach = bfd_mach_lm32;
     print_insn = print_insn_lm32;
 #else
-    monitor_printf(mon, "0x" TARGET_FMT_lx
-                   ": Asm output not supported on this arch\n", pc);
+    fprintf_fn(stream, "0x" TARGET_FMT_lx
+               ": Asm output not supported on this arch\n", pc);
     return;
 #endif
 
     for(i = 0; i < nb_insn; i++) {
-	monitor_printf(mon, "0x" TARGET_FMT_lx ":  ", pc);
+        fprintf_fn(stream, "0x" TARGET_FMT_lx ":  ", pc);
         count = print_insn(pc, &s.info);
-	monitor_printf(mon, "\n");
-	if (count < 0)
+        fprintf_fn(stream, "\n");
+	if (count < 0 || count >= size)
 	    break;
         pc += count;
+        size -= count;
     }
 }
+
+void monitor_disas(Monitor *mon, CPUArchState *env,
+                   target_ulong pc, int nb_insn, int is_physical, int flags)
+{
+    disas_to_stream((FILE *)mon, monitor_fprintf, env, pc, nb_insn,
+                    (target_ulong)-1, is_physical, flags);
+}
+
+static int GCC_FMT_ATTR(2, 3)
+gstring_fprintf(FILE *stream, const char *fmt, ...)
+{
+    va_list ap;
+    char *str;
+
+    va_start(ap, fmt);
+    str = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    g_string_append((GString *)stream, str);
+    g_free(str);
+    return 0;
+}
+
+char *target_disas_str(CPUArchState *env, target_ulong pc, target_ulong size,
+                       int flags)
+{
+    GString *buf = g_string_new("");
+
+    disas_to_stream((FILE *)buf, gstring_fprintf, env, pc, INT_MAX, size, 0,
+                    flags);
+    return g_string_free(buf, FALSE);
+}
 #endif
@@ -44,6 +44,7 @@
 #include <qemu.h>
 #else /* !CONFIG_USER_ONLY */
 #include "sysemu/xen-mapcache.h"
+#include "sysemu/cpus.h"
 #include "trace.h"
 #endif
 #include "exec/cpu-all.h"
@@ -52,6 +53,8 @@
 #include "translate-all.h"
 
 #include "exec/memory-internal.h"
+#include "qemu/range.h"
+#include "qmp-commands.h"
 
 //#define DEBUG_SUBPAGE
 
@@ -85,9 +88,10 @@ int use_icount;
 typedef struct PhysPageEntry PhysPageEntry;
 
 struct PhysPageEntry {
-    uint16_t is_leaf : 1;
-     /* index into phys_sections (is_leaf) or phys_map_nodes (!is_leaf) */
-    uint16_t ptr : 15;
+    /* How many levels to skip to reach the next node; 0 for a leaf.  */
+    uint32_t skip : 6;
+     /* index into phys_sections (!skip) or phys_map_nodes (skip) */
+    uint32_t ptr : 26;
 };
 
 typedef PhysPageEntry Node[L2_SIZE];
@@ -99,7 +103,11 @@ struct AddressSpaceDispatch {
     PhysPageEntry phys_map;
     Node *nodes;
     MemoryRegionSection *sections;
+    /* Section of the last lookup, checked before walking the map */
+    MemoryRegionSection *mru_section;
     AddressSpace *as;
+    struct PhysPageMap *map;
+    int ref;
 };
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
@@ -110,12 +118,30 @@ typedef struct subpage_t {
     uint16_t sub_section[TARGET_PAGE_SIZE];
 } subpage_t;
 
+/* Upper bound on the bounce buffer memory mapped at once in an address space */
+#define BOUNCE_BUFFER_MAX_SIZE (1024 * 1024)
+
+typedef struct BounceBuffer {
+    MemoryRegion *mr;
+    void *buffer;
+    hwaddr addr;
+    hwaddr len;
+    QLIST_ENTRY(BounceBuffer) link;
+} BounceBuffer;
+
+typedef struct MapClient {
+    void *opaque;
+    void (*callback)(void *opaque);
+    QTAILQ_ENTRY(MapClient) link;
+} MapClient;
+
 #define PHYS_SECTION_UNASSIGNED 0
 #define PHYS_SECTION_NOTDIRTY 1
 #define PHYS_SECTION_ROM 2
 #define PHYS_SECTION_WATCH 3
 
 typedef struct PhysPageMap {
+    int ref;
     unsigned sections_nb;
     unsigned sections_nb_alloc;
     unsigned nodes_nb;
@@ -124,10 +150,20 @@ typedef struct PhysPageMap {
     MemoryRegionSection *sections;
 } PhysPageMap;
 
+/* Each memory map update builds a new PhysPageMap, shared by the
+ * AddressSpaceDispatch of every address space.  Maps and dispatch
+ * structures are reference counted, so that a thread that does not hold
+ * the BQL can keep using them while the memory map is updated.
+ */
 static PhysPageMap *prev_map;
-static PhysPageMap next_map;
+static PhysPageMap *next_map;
+
+/* Protects as->dispatch while a reference is taken to it; the writer also
+ * holds the BQL.
+ */
+static QemuMutex dispatch_mutex;
 
-#define PHYS_MAP_NODE_NIL (((uint16_t)~0) >> 1)
+#define PHYS_MAP_NODE_NIL (((uint32_t)~0) >> 6)
 
 static void io_mem_init(void);
 static void memory_map_init(void);
@@ -139,27 +175,30 @@ static MemoryRegion io_mem_watch;
 
 static void phys_map_node_reserve(unsigned nodes)
 {
-    if (next_map.nodes_nb + nodes > next_map.nodes_nb_alloc) {
-        next_map.nodes_nb_alloc = MAX(next_map.nodes_nb_alloc * 2,
+    if (next_map->nodes_nb + nodes > next_map->nodes_nb_alloc) {
+        next_map->nodes_nb_alloc = MAX(next_map->nodes_nb_alloc * 2,
                                             16);
-        next_map.nodes_nb_alloc = MAX(next_map.nodes_nb_alloc,
-                                      next_map.nodes_nb + nodes);
-        next_map.nodes = g_renew(Node, next_map.nodes,
-                                 next_map.nodes_nb_alloc);
+        next_map->nodes_nb_alloc = MAX(next_map->nodes_nb_alloc,
+                                      next_map->nodes_nb + nodes);
+        next_map->nodes = g_renew(Node, next_map->nodes,
+                                 next_map->nodes_nb_alloc);
     }
 }
 
-static uint16_t phys_map_node_alloc(void)
+static uint32_t phys_map_node_alloc(bool leaf)
 {
     unsigned i;
-    uint16_t ret;
+    uint32_t ret;
+    PhysPageEntry e;
 
-    ret = next_map.nodes_nb++;
+    ret = next_map->nodes_nb++;
     assert(ret != PHYS_MAP_NODE_NIL);
-    assert(ret != next_map.nodes_nb_alloc);
+    assert(ret != next_map->nodes_nb_alloc);
+
+    e.skip = leaf ? 0 : 1;
+    e.ptr = leaf ? PHYS_SECTION_UNASSIGNED : PHYS_MAP_NODE_NIL;
     for (i = 0; i < L2_SIZE; ++i) {
-        next_map.nodes[ret][i].is_leaf = 0;
-        next_map.nodes[ret][i].ptr = PHYS_MAP_NODE_NIL;
+        next_map->nodes[ret][i] = e;
     }
     return ret;
 }
@@ -169,26 +208,17 @@ static void phys_page_set_level(PhysPageEntry *lp, hwaddr *index,
                                 int level)
 {
     PhysPageEntry *p;
-    int i;
     hwaddr step = (hwaddr)1 << (level * L2_BITS);
 
-    if (!lp->is_leaf && lp->ptr == PHYS_MAP_NODE_NIL) {
-        lp->ptr = phys_map_node_alloc();
-        p = next_map.nodes[lp->ptr];
-        if (level == 0) {
-            for (i = 0; i < L2_SIZE; i++) {
-                p[i].is_leaf = 1;
-                p[i].ptr = PHYS_SECTION_UNASSIGNED;
-            }
-        }
-    } else {
-        p = next_map.nodes[lp->ptr];
+    if (lp->skip && lp->ptr == PHYS_MAP_NODE_NIL) {
+        lp->ptr = phys_map_node_alloc(level == 0);
     }
+    p = next_map->nodes[lp->ptr];
     lp = &p[(*index >> (level * L2_BITS)) & (L2_SIZE - 1)];
 
     while (*nb && lp < &p[L2_SIZE]) {
         if ((*index & (step - 1)) == 0 && *nb >= step) {
-            lp->is_leaf = true;
+            lp->skip = 0;
             lp->ptr = leaf;
             *index += step;
             *nb -= step;
@@ -209,20 +239,91 @@ static void phys_page_set(AddressSpaceDispatch *d,
     phys_page_set_level(&d->phys_map, &index, &nb, leaf, P_L2_LEVELS - 1);
 }
 
-static MemoryRegionSection *phys_page_find(PhysPageEntry lp, hwaddr index,
+/* Collapse chains of nodes that have a single child, so that lookups in
+ * sparse parts of the address space skip the intermediate levels.
+ */
+static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
+{
+    unsigned valid_ptr = L2_SIZE;
+    int valid = 0;
+    PhysPageEntry *p;
+    int i;
+
+    if (lp->ptr == PHYS_MAP_NODE_NIL) {
+        return;
+    }
+
+    p = nodes[lp->ptr];
+    for (i = 0; i < L2_SIZE; i++) {
+        if (p[i].ptr == PHYS_MAP_NODE_NIL) {
+            continue;
+        }
+
+        valid_ptr = i;
+        valid++;
+        if (p[i].skip) {
+            phys_page_compact(&p[i], nodes);
+        }
+    }
+
+    /* We can only compress if there's only one child. */
+    if (valid != 1) {
+        return;
+    }
+
+    assert(valid_ptr < L2_SIZE);
+
+    /* Don't compress if it won't fit in the # of bits we have. */
+    if (lp->skip + p[valid_ptr].skip >= (1 << 6)) {
+        return;
+    }
+
+    lp->ptr = p[valid_ptr].ptr;
+    if (!p[valid_ptr].skip) {
+        /* The only child is a leaf, make this a leaf. */
+        lp->skip = 0;
+    } else {
+        lp->skip += p[valid_ptr].skip;
+    }
+}
+
+static void phys_page_compact_all(AddressSpaceDispatch *d)
+{
+    if (d->phys_map.skip) {
+        phys_page_compact(&d->phys_map, d->nodes);
+    }
+}
+
+static inline bool section_covers_addr(const MemoryRegionSection *section,
+                                       hwaddr addr)
+{
+    /* The unassigned section covers the whole 2^64 address space */
+    return section->size.hi ||
+           range_covers_byte(section->offset_within_address_space,
+                             section->size.lo, addr);
+}
+
+static MemoryRegionSection *phys_page_find(PhysPageEntry lp, hwaddr addr,
                                            Node *nodes, MemoryRegionSection *sections)
 {
     PhysPageEntry *p;
+    hwaddr index = addr >> TARGET_PAGE_BITS;
     int i;
 
-    for (i = P_L2_LEVELS - 1; i >= 0 && !lp.is_leaf; i--) {
+    for (i = P_L2_LEVELS; lp.skip && (i -= lp.skip) >= 0;) {
         if (lp.ptr == PHYS_MAP_NODE_NIL) {
             return &sections[PHYS_SECTION_UNASSIGNED];
         }
         p = nodes[lp.ptr];
         lp = p[(index >> (i * L2_BITS)) & (L2_SIZE - 1)];
     }
-    return &sections[lp.ptr];
+
+    /* Skipped levels were not checked, so the leaf may belong elsewhere */
+    if (section_covers_addr(&sections[lp.ptr], addr)) {
+        return &sections[lp.ptr];
+    } else {
+        return &sections[PHYS_SECTION_UNASSIGNED];
+    }
 }
 
 bool memory_region_is_unassigned(MemoryRegion *mr)
@@ -235,11 +336,17 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section;
+    MemoryRegionSection *section = atomic_read(&d->mru_section);
     subpage_t *subpage;
 
-    section = phys_page_find(d->phys_map, addr >> TARGET_PAGE_BITS,
-                             d->nodes, d->sections);
+    /* The cache holds the phys_page_find() result, never a subpage's
+     * sub-section, so a hit still goes through subpage resolution.
+     */
+    if (section == NULL || section == &d->sections[PHYS_SECTION_UNASSIGNED] ||
+        !section_covers_addr(section, addr)) {
+        section = phys_page_find(d->phys_map, addr, d->nodes, d->sections);
+        atomic_set(&d->mru_section, section);
+    }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
         section = &d->sections[subpage->sub_section[SUBPAGE_IDX(addr)]];
@@ -266,17 +373,52 @@ address_space_translate_internal(AddressSpaceDispatch *d, hwaddr addr, hwaddr *x
     return section;
 }
 
-MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
-                                      hwaddr *xlat, hwaddr *plen,
-                                      bool is_write)
+static AddressSpaceDispatch *address_space_get_dispatch(AddressSpace *as)
+{
+    AddressSpaceDispatch *d;
+
+    qemu_mutex_lock(&dispatch_mutex);
+    d = as->dispatch;
+    atomic_inc(&d->ref);
+    qemu_mutex_unlock(&dispatch_mutex);
+    return d;
+}
+
+static void phys_sections_free(PhysPageMap *map);
+
+static void phys_map_unref(PhysPageMap *map)
+{
+    if (map && atomic_fetch_dec(&map->ref) == 1) {
+        phys_sections_free(map);
+    }
+}
+
+static void address_space_dispatch_unref(AddressSpaceDispatch *d)
+{
+    if (d && atomic_fetch_dec(&d->ref) == 1) {
+        phys_map_unref(d->map);
+        g_free(d);
+    }
+}
+
+/* Translate @addr, walking through IOMMUs.  If @ref is true, a reference
+ * to the returned region is taken while the memory map is known to be
+ * alive; the caller releases it with memory_region_unref().
+ */
+static MemoryRegion *address_space_do_translate(AddressSpace *as,
+                                                hwaddr addr, hwaddr *xlat,
+                                                hwaddr *plen, bool is_write,
+                                                bool ref)
 {
     IOMMUTLBEntry iotlb;
+    AddressSpaceDispatch *d;
     MemoryRegionSection *section;
     MemoryRegion *mr;
     hwaddr len = *plen;
 
     for (;;) {
-        section = address_space_translate_internal(as->dispatch, addr, &addr, plen, true);
+        d = address_space_get_dispatch(as);
+        section = address_space_translate_internal(d, addr, &addr, plen, true);
         mr = section->mr;
 
         if (!mr->iommu_ops) {
@@ -284,6 +426,8 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
         }
 
         iotlb = mr->iommu_ops->translate(mr, addr);
+        address_space_dispatch_unref(d);
+        d = NULL;
         addr = ((iotlb.translated_addr & ~iotlb.addr_mask)
                 | (addr & iotlb.addr_mask));
         len = MIN(len, (addr | iotlb.addr_mask) - addr + 1);
@@ -295,11 +439,23 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
         as = iotlb.target_as;
     }
 
+    if (ref) {
+        memory_region_ref(mr);
+    }
+    address_space_dispatch_unref(d);
+
     *plen = len;
     *xlat = addr;
     return mr;
 }
 
+MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
+                                      hwaddr *xlat, hwaddr *plen,
+                                      bool is_write)
+{
+    return address_space_do_translate(as, addr, xlat, plen, is_write, false);
+}
+
 MemoryRegionSection *
 address_space_translate_for_iotlb(AddressSpace *as, hwaddr addr, hwaddr *xlat,
                                   hwaddr *plen)
@@ -316,6 +472,7 @@ void cpu_exec_init_all(void)
 {
 #if !defined(CONFIG_USER_ONLY)
     qemu_mutex_init(&ram_list.mutex);
+    qemu_mutex_init(&dispatch_mutex);
     memory_map_init();
     io_mem_init();
 #endif
@@ -398,6 +555,7 @@ void cpu_exec_init(CPUArchState *env)
     QTAILQ_INIT(&env->watchpoints);
 #ifndef CONFIG_USER_ONLY
     cpu->thread_id = qemu_get_thread_id();
+    tlb_init(env);
 #endif
     *pcpu = cpu;
 #if defined(CONFIG_USER_ONLY)
@@ -695,22 +853,68 @@ static void tlb_reset_dirty_range_all(ram_addr_t start, ram_addr_t end,
 }
 
 /* Note: start and end must be within the same ram block.  */
-void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
-                                     int dirty_flags)
+void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t length,
+                                     unsigned client)
+{
+    cpu_physical_memory_test_and_clear_dirty(start, length, client);
+}
+
+/* Clear the dirty bits of @client for a range and report whether any of
+   them was set.  The range must be within a single ram block.  */
+bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
+                                              ram_addr_t length,
+                                              unsigned client)
 {
-    uintptr_t length;
+    unsigned long page, end;
+    bool dirty;
 
-    start &= TARGET_PAGE_MASK;
-    end = TARGET_PAGE_ALIGN(end);
+    assert(client < DIRTY_MEMORY_NUM);
 
-    length = end - start;
-    if (length == 0)
-        return;
-    cpu_physical_memory_mask_dirty_range(start, length, dirty_flags);
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    page = start >> TARGET_PAGE_BITS;
+    if (end == page) {
+        return false;
+    }
+    dirty = bitmap_test_and_clear_atomic(ram_list.dirty_memory[client],
+                                         page, end - page);
+
+    if (dirty && tcg_enabled()) {
+        tlb_reset_dirty_range_all(page << TARGET_PAGE_BITS,
+                                  end << TARGET_PAGE_BITS,
+                                  (end - page) << TARGET_PAGE_BITS);
+    }
+    return dirty;
+}
+
+/* Move the dirty bits of @client for a range into @dest, a bitmap indexed
+   like the dirty bitmaps, and return the number of bits newly set in @dest.
+   The range must be within a single ram block.  Bits already set in @dest
+   are cleared from the client's bitmap as well, so the TLB is reset for the
+   whole range.  */
+uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
+                                               ram_addr_t start,
+                                               ram_addr_t length,
+                                               unsigned client)
+{
+    unsigned long page, end;
+    uint64_t num_dirty;
+
+    assert(client < DIRTY_MEMORY_NUM);
+
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    page = start >> TARGET_PAGE_BITS;
+    if (end == page) {
+        return 0;
+    }
+    num_dirty = bitmap_move_atomic(dest, ram_list.dirty_memory[client],
+                                   page, end - page);
 
     if (tcg_enabled()) {
-        tlb_reset_dirty_range_all(start, end, length);
+        tlb_reset_dirty_range_all(page << TARGET_PAGE_BITS,
+                                  end << TARGET_PAGE_BITS,
+                                  (end - page) << TARGET_PAGE_BITS);
     }
+    return num_dirty;
 }
 
 static int cpu_physical_memory_set_dirty_tracking(int enable)
@@ -773,17 +977,17 @@ static uint16_t phys_section_add(MemoryRegionSection *section)
      * pointer to produce the iotlb entries.  Thus it should
      * never overflow into the page-aligned value.
      */
-    assert(next_map.sections_nb < TARGET_PAGE_SIZE);
+    assert(next_map->sections_nb < TARGET_PAGE_SIZE);
 
-    if (next_map.sections_nb == next_map.sections_nb_alloc) {
-        next_map.sections_nb_alloc = MAX(next_map.sections_nb_alloc * 2,
+    if (next_map->sections_nb == next_map->sections_nb_alloc) {
+        next_map->sections_nb_alloc = MAX(next_map->sections_nb_alloc * 2,
                                          16);
-        next_map.sections = g_renew(MemoryRegionSection, next_map.sections,
-                                    next_map.sections_nb_alloc);
+        next_map->sections = g_renew(MemoryRegionSection, next_map->sections,
+                                    next_map->sections_nb_alloc);
     }
-    next_map.sections[next_map.sections_nb] = *section;
+    next_map->sections[next_map->sections_nb] = *section;
     memory_region_ref(section->mr);
-    return next_map.sections_nb++;
+    return next_map->sections_nb++;
 }
 
 static void phys_section_destroy(MemoryRegion *mr)
@@ -813,8 +1017,8 @@ static void register_subpage(AddressSpaceDispatch *d, MemoryRegionSection *secti
     subpage_t *subpage;
     hwaddr base = section->offset_within_address_space
         & TARGET_PAGE_MASK;
-    MemoryRegionSection *existing = phys_page_find(d->phys_map, base >> TARGET_PAGE_BITS,
-                                                   next_map.nodes, next_map.sections);
+    MemoryRegionSection *existing = phys_page_find(d->phys_map, base,
+                                                   next_map->nodes, next_map->sections);
     MemoryRegionSection subsection = {
         .offset_within_address_space = base,
         .size = int128_make64(TARGET_PAGE_SIZE),
@@ -856,6 +1060,10 @@ static void mem_add(MemoryListener *listener, MemoryRegionSection *section)
     MemoryRegionSection now = *section, remain = *section;
     Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
 
+    if (!d) {
+        return;
+    }
+
     if (now.offset_within_address_space & ~TARGET_PAGE_MASK) {
         uint64_t left = TARGET_PAGE_ALIGN(now.offset_within_address_space)
                        - now.offset_within_address_space;
@@ -898,6 +1106,336 @@ void qemu_mutex_unlock_ramlist(void)
     qemu_mutex_unlock(&ram_list.mutex);
 }
 
+/* Startup statistics reported by query-ram-prealloc */
+typedef struct RAMPreallocStat {
+    char *name;
+    uint64_t size;
+    uint64_t page_size;
+    int threads;
+    bool numa_bound;
+    int64_t time_ms;
+    QTAILQ_ENTRY(RAMPreallocStat) next;
+} RAMPreallocStat;
+
+static QTAILQ_HEAD(, RAMPreallocStat) ram_prealloc_stats =
+    QTAILQ_HEAD_INITIALIZER(ram_prealloc_stats);
+
+RamPreallocInfoList *qmp_query_ram_prealloc(Error **errp)
+{
+    RamPreallocInfoList *head = NULL, **prev = &head;
+    RAMPreallocStat *stat;
+
+    QTAILQ_FOREACH(stat, &ram_prealloc_stats, next) {
+        RamPreallocInfoList *entry = g_malloc0(sizeof(*entry));
+        RamPreallocInfo *info = g_malloc0(sizeof(*info));
+
+        info->name = g_strdup(stat->name);
+        info->size = stat->size;
+        info->page_size = stat->page_size;
+        info->threads = stat->threads;
+        info->numa_bound = stat->numa_bound;
+        info->time_ms = stat->time_ms;
+
+        entry->value = info;
+        *prev = entry;
+        prev = &entry->next;
+    }
+
+    return head;
+}
+
+#ifdef __linux__
+
+#include <sys/syscall.h>
+#include <sched.h>
+
+#define RAM_PREALLOC_MAX_THREADS 64
+
+#ifndef MPOL_BIND
+#define MPOL_DEFAULT 0
+#define MPOL_BIND 2
+#define MPOL_MF_STRICT (1 << 0)
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+/* A part of a RAM block that belongs to one guest NUMA node */
+typedef struct RAMSegment {
+    char *addr;
+    size_t size;
+    int host_node;
+} RAMSegment;
+
+typedef struct RAMPreallocThread {
+    QemuThread thread;
+    char *addr;
+    size_t size;
+    size_t page_size;
+    int host_node;
+    bool failed;
+} RAMPreallocThread;
+
+/* Where a SIGBUS raised while touching guest RAM returns to */
+static DEFINE_TLS(sigjmp_buf *, ram_prealloc_jmp);
+
+/* Bind to @host_node, or drop the binding again if it is negative */
+static int ram_mbind(void *addr, size_t size, int host_node)
+{
+#ifdef __NR_mbind
+    unsigned long nodemask[BITS_TO_LONGS(MAX_NODES)] = { 0 };
+
+    if (host_node < 0) {
+        return syscall(__NR_mbind, addr, size, MPOL_DEFAULT, NULL, 0, 0);
+    }
+    set_bit(host_node, nodemask);
+    return syscall(__NR_mbind, addr, size, MPOL_BIND, nodemask, MAX_NODES + 1,
+                   MPOL_MF_STRICT | MPOL_MF_MOVE);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Run the calling thread on the host CPUs of @host_node, so that zeroing
+ * the pages happens close to the memory.  Failures are not fatal.
+ */
+static void ram_prealloc_bind_thread(int host_node)
+{
+    char *path, *cpulist = NULL, *p, *end;
+    unsigned long first, last;
+    cpu_set_t cpus;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%d/cpulist",
+                           host_node);
+    if (!g_file_get_contents(path, &cpulist, NULL, NULL)) {
+        g_free(path);
+        return;
+    }
+    g_free(path);
+
+    CPU_ZERO(&cpus);
+    for (p = cpulist; *p && *p != '\n'; p = end) {
+        first = last = strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+        }
+        while (first <= last && first < CPU_SETSIZE) {
+            CPU_SET(first++, &cpus);
+        }
+        if (*end == ',') {
+            end++;
+        }
+    }
+    g_free(cpulist);
+
+    if (CPU_COUNT(&cpus)) {
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+}
+
+static void ram_prealloc_sigbus(int signal)
+{
+    sigjmp_buf *jmp = tls_var(ram_prealloc_jmp);
+
+    if (!jmp) {
+        abort();
+    }
+    siglongjmp(*jmp, 1);
+}
+
+/* Fault in [addr, addr + size).  Running out of huge pages, or of memory
+ * on the node the range is bound to, raises SIGBUS; this returns false
+ * instead.  The caller must have installed ram_prealloc_sigbus.
+ */
+static bool ram_prealloc_touch(char *addr, size_t size, size_t page_size)
+{
+    sigjmp_buf jmp;
+    sigset_t set, oldset;
+    size_t off;
+    bool ok = true;
+
+    /* qemu_thread_create blocks all signals in the new thread */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+    tls_var(ram_prealloc_jmp) = &jmp;
+    if (sigsetjmp(jmp, 1)) {
+        ok = false;
+    } else {
+        /* Read and write back one byte per page, in case the backing file
+         * already has contents.
+         */
+        for (off = 0; off < size; off += page_size) {
+            volatile char *p = addr + off;
+            *p = *p;
+        }
+    }
+    tls_var(ram_prealloc_jmp) = NULL;
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    return ok;
+}
+
+static void *ram_prealloc_thread(void *opaque)
+{
+    RAMPreallocThread *t = opaque;
+
+    if (t->host_node >= 0) {
+        ram_prealloc_bind_thread(t->host_node);
+    }
+    t->failed = !ram_prealloc_touch(t->addr, t->size, t->page_size);
+    return NULL;
+}
+
+/* Split @block into per guest NUMA node segments.  Only the block holding
+ * main guest RAM, allocated with memory_region_init_system_ram(), is
+ * distributed over the nodes, in node order as the boards lay it out.
+ */
+static int ram_block_segments(RAMBlock *block, void *host, ram_addr_t size,
+                              RAMSegment *segs)
+{
+    ram_addr_t offset = 0;
+    int i, n = 0;
+
+    if (nb_numa_nodes > 0 && block->mr && block->mr->system_ram) {
+        for (i = 0; i < nb_numa_nodes && offset < size; i++) {
+            ram_addr_t len = MIN(node_mem[i], size - offset);
+
+            if (!len) {
+                continue;
+            }
+            segs[n].addr = (char *)host + offset;
+            segs[n].size = len;
+            segs[n].host_node = node_host_node[i];
+            offset += len;
+            n++;
+        }
+    }
+    if (offset < size) {
+        segs[n].addr = (char *)host + offset;
+        segs[n].size = size - offset;
+        segs[n].host_node = -1;
+        n++;
+    }
+    return n;
+}
+
+/* Bind the NUMA node segments of a new RAM block to the host nodes given
+ * with -numa node,hostnode=, and if @prealloc is set fault in all of its
+ * pages from several threads, each running on the host node its segment
+ * is bound to.
+ */
+static void ram_block_prepare(RAMBlock *block, void *host, ram_addr_t size,
+                              size_t page_size, bool prealloc)
+{
+    RAMSegment segs[MAX_NODES + 1];
+    RAMPreallocThread *threads;
+    RAMPreallocStat *stat;
+    struct sigaction act, oldact;
+    int nsegs, nthreads, i, j, t;
+    bool numa_bound = false;
+    int64_t start;
+
+    nsegs = ram_block_segments(block, host, size, segs);
+    for (i = 0; i < nsegs; i++) {
+        if (segs[i].host_node < 0) {
+            continue;
+        }
+        if (ram_mbind(segs[i].addr, segs[i].size, segs[i].host_node) < 0) {
+            fprintf(stderr, "warning: cannot bind guest RAM to host node %d: "
+                    "%s\n", segs[i].host_node, strerror(errno));
+            segs[i].host_node = -1;
+        } else {
+            numa_bound = true;
+        }
+    }
+
+    if (!prealloc) {
+        return;
+    }
+
+    start = get_clock();
+    nthreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1),
+                   RAM_PREALLOC_MAX_THREADS);
+    nthreads = MAX(nthreads, nsegs);
+    threads = g_new0(RAMPreallocThread, nthreads);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = ram_prealloc_sigbus;
+    sigaction(SIGBUS, &act, &oldact);
+
+    /* Give each segment a share of the threads proportional to its size */
+    for (i = 0, t = 0; i < nsegs; i++) {
+        size_t pages = segs[i].size / page_size;
+        int n = MAX(1, (int)((double)segs[i].size / size * nthreads));
+        size_t chunk;
+
+        n = MIN(n, nthreads - t - (nsegs - i - 1));
+        n = MAX(1, MIN((size_t)n, MAX(pages, 1)));
+        chunk = DIV_ROUND_UP(pages, n) * page_size;
+
+        for (j = 0; j < n; j++, t++) {
+            size_t off = j * chunk;
+
+            threads[t].addr = segs[i].addr + off;
+            threads[t].size = off < segs[i].size ?
+                              MIN(chunk, segs[i].size - off) : 0;
+            threads[t].page_size = page_size;
+            threads[t].host_node = segs[i].host_node;
+            qemu_thread_create(&threads[t].thread, ram_prealloc_thread,
+                               &threads[t], QEMU_THREAD_JOINABLE);
+        }
+    }
+    for (i = 0; i < t; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+
+    /* Huge page reservations are not per node, so a bound range can fail
+     * even though the pool has enough pages; retry those on any node.
+     */
+    for (i = 0; i < t; i++) {
+        if (!threads[i].failed) {
+            continue;
+        }
+        if (threads[i].host_node >= 0 &&
+            ram_mbind(threads[i].addr, threads[i].size, -1) == 0) {
+            fprintf(stderr, "warning: not enough free memory on host node %d "
+                    "for guest RAM, allocating it on any node\n",
+                    threads[i].host_node);
+            threads[i].host_node = -1;
+            if (ram_prealloc_touch(threads[i].addr, threads[i].size,
+                                   page_size)) {
+                continue;
+            }
+        }
+        fprintf(stderr, "Insufficient free host memory pages available to "
+                "allocate guest RAM %s\n", memory_region_name(block->mr));
+        exit(1);
+    }
+    sigaction(SIGBUS, &oldact, NULL);
+    g_free(threads);
+
+    stat = g_new0(RAMPreallocStat, 1);
+    stat->name = g_strdup(memory_region_name(block->mr));
+    stat->size = size;
+    stat->page_size = page_size;
+    stat->threads = t;
+    stat->numa_bound = numa_bound;
+    stat->time_ms = (get_clock() - start) / SCALE_MS;
+    QTAILQ_INSERT_TAIL(&ram_prealloc_stats, stat, next);
+}
+
+#else
+
+static void ram_block_prepare(RAMBlock *block, void *host, ram_addr_t size,
+                              size_t page_size, bool prealloc)
+{
+}
+
+#endif
+
 #if defined(__linux__) && !defined(TARGET_S390X)
 
 #include <sys/vfs.h>
@@ -933,9 +1471,6 @@ static void *file_ram_alloc(RAMBlock *block,
     char *c;
     void *area;
     int fd;
-#ifdef MAP_POPULATE
-    int flags;
-#endif
     unsigned long hpagesize;
 
     hpagesize = gethugepagesize(path);
@@ -983,22 +1518,77 @@ static void *file_ram_alloc(RAMBlock *block,
     if (ftruncate(fd, memory))
         perror("ftruncate");
 
-#ifdef MAP_POPULATE
-    /* NB: MAP_POPULATE won't exhaustively alloc all phys pages in the case
-     * MAP_PRIVATE is requested.  For mem_prealloc we mmap as MAP_SHARED
+    /* NB: touching the pages won't exhaustively alloc all phys pages in the
+     * case MAP_PRIVATE is requested.  For mem_prealloc we mmap as MAP_SHARED
      * to sidestep this quirk.
      */
-    flags = mem_prealloc ? MAP_POPULATE | MAP_SHARED : MAP_PRIVATE;
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, flags, fd, 0);
-#else
-    area = mmap(0, memory, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-#endif
+    area = mmap(0, memory, PROT_READ | PROT_WRITE,
+                mem_prealloc ? MAP_SHARED : MAP_PRIVATE, fd, 0);
     if (area == MAP_FAILED) {
         perror("file_ram_alloc: can't mmap RAM pages");
         close(fd);
         return (NULL);
     }
     block->fd = fd;
+
+    /* Instead of MAP_POPULATE, which faults in everything from this thread,
+     * bind the memory and touch it in parallel.
+     */
+    ram_block_prepare(block, area, memory, hpagesize, mem_prealloc);
+    return area;
+}
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/* Allocate guest RAM as a shared mapping of a memfd, or of an unlinked
+ * file in /dev/shm on hosts without memfd_create.
+ */
+static void *shared_ram_alloc(RAMBlock *block, ram_addr_t memory)
+{
+    char *filename;
+    void *area;
+    int fd = -1;
+
+    if (kvm_enabled() && !kvm_has_sync_mmu()) {
+        fprintf(stderr,
+                "host lacks kvm mmu notifiers, -mem-shared unsupported\n");
+        return NULL;
+    }
+
+#ifdef __NR_memfd_create
+    fd = syscall(__NR_memfd_create, block->mr->name, MFD_CLOEXEC);
+#endif
+    if (fd < 0) {
+        filename = g_strdup("/dev/shm/qemu_shared_mem.XXXXXX");
+        fd = mkstemp(filename);
+        if (fd >= 0) {
+            unlink(filename);
+        }
+        g_free(filename);
+    }
+    if (fd < 0) {
+        perror("unable to create shared backing store for guest RAM");
+        return NULL;
+    }
+
+    if (ftruncate(fd, memory)) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    area = mmap(0, memory, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        perror("shared_ram_alloc: can't mmap RAM pages");
+        close(fd);
+        return NULL;
+    }
+    block->fd = fd;
+    block->flags |= RAM_SHARED_MASK;
+
+    ram_block_prepare(block, area, memory, getpagesize(), mem_prealloc);
     return area;
 }
 #endif
@@ -1113,6 +1703,10 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                                    MemoryRegion *mr)
 {
     RAMBlock *block, *new_block;
+    ram_addr_t old_ram_size, new_ram_size;
+    int i;
+
+    old_ram_size = last_ram_offset() >> TARGET_PAGE_BITS;
 
     size = TARGET_PAGE_ALIGN(size);
     new_block = g_malloc0(sizeof(*new_block));
@@ -1137,6 +1731,16 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
 #else
             fprintf(stderr, "-mem-path option unsupported\n");
             exit(1);
+#endif
+        } else if (mem_shared) {
+#if defined (__linux__) && !defined(TARGET_S390X)
+            new_block->host = shared_ram_alloc(new_block, size);
+            if (!new_block->host) {
+                exit(1);
+            }
+#else
+            fprintf(stderr, "-mem-shared option unsupported\n");
+            exit(1);
 #endif
         } else {
             if (xen_enabled()) {
@@ -1148,6 +1752,10 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                 new_block->host = qemu_anon_ram_alloc(size);
             }
             memory_try_enable_merging(new_block->host, size);
+            if (new_block->host) {
+                ram_block_prepare(new_block, new_block->host, size,
+                                  page_size, false);
+            }
         }
     }
     new_block->length = size;
@@ -1166,13 +1774,21 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     ram_list.mru_block = NULL;
 
     ram_list.version++;
-    qemu_mutex_unlock_ramlist();
 
-    ram_list.phys_dirty = g_realloc(ram_list.phys_dirty,
-                                       last_ram_offset() >> TARGET_PAGE_BITS);
-    memset(ram_list.phys_dirty + (new_block->offset >> TARGET_PAGE_BITS),
-           0, size >> TARGET_PAGE_BITS);
-    cpu_physical_memory_set_dirty_range(new_block->offset, size, 0xff);
+    /* kvm_dirty_log_harvest writes the dirty bitmaps under the ramlist lock */
+    new_ram_size = last_ram_offset() >> TARGET_PAGE_BITS;
+    if (new_ram_size > old_ram_size) {
+        for (i = 0; i < DIRTY_MEMORY_NUM; i++) {
+            ram_list.dirty_memory[i] =
+                g_realloc(ram_list.dirty_memory[i],
+                          BITS_TO_LONGS(new_ram_size) * sizeof(unsigned long));
+            bitmap_clear(ram_list.dirty_memory[i], old_ram_size,
+                         new_ram_size - old_ram_size);
+        }
+    }
+    qemu_mutex_unlock_ramlist();
+    cpu_physical_memory_set_dirty_range(new_block->offset, size,
+                                        DIRTY_CLIENTS_ALL);
 
     qemu_ram_setup_dump(new_block->host, size);
     qemu_madvise(new_block->host, size, QEMU_MADV_HUGEPAGE);
@@ -1223,7 +1839,7 @@ void qemu_ram_free(ram_addr_t addr)
             }
             else if (block->flags & RAM_POSTCOPY_UMEM_MASK) {
                 postcopy_incoming_ram_free(block);
-            } else if (mem_path) {
+            } else if (mem_path || mem_shared) {
 #if defined (__linux__) && !defined(TARGET_S390X)
                 if (block->fd) {
                     munmap(block->host, block->length);
@@ -1266,9 +1882,13 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
             } else {
                 flags = MAP_FIXED;
                 munmap(vaddr, length);
-                if (mem_path) {
+                if (mem_path || mem_shared) {
 #if defined(__linux__) && !defined(TARGET_S390X)
-                    if (block->fd) {
+                    if (block->flags & RAM_SHARED_MASK) {
+                        flags |= MAP_SHARED;
+                        area = mmap(vaddr, length, PROT_READ | PROT_WRITE,
+                                    flags, block->fd, offset);
+                    } else if (block->fd) {
 #ifdef MAP_POPULATE
                         flags |= mem_prealloc ? MAP_POPULATE | MAP_SHARED :
                             MAP_PRIVATE;
@@ -1311,6 +1931,55 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
 }
 #endif /* !_WIN32 */
 
+#if defined(__linux__) && !defined(TARGET_S390X)
+/* Replace the memory of @block with the shared mapping of @fd, which was
+ * received from the QEMU process that ran the guest so far.  Takes
+ * ownership of @fd.
+ */
+int qemu_ram_remap_fd(RAMBlock *block, int fd)
+{
+    struct stat st;
+    void *area;
+    int ret;
+
+    if (!(block->flags & RAM_SHARED_MASK)) {
+        fprintf(stderr, "RAM block %s is not shared, start with -mem-shared\n",
+                block->idstr);
+        close(fd);
+        return -EINVAL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < block->length) {
+        fprintf(stderr, "RAM block %s: passed descriptor is too small\n",
+                block->idstr);
+        close(fd);
+        return -EINVAL;
+    }
+
+    area = mmap(block->host, block->length, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0);
+    if (area != block->host) {
+        ret = -errno;
+        perror("qemu_ram_remap_fd: can't mmap RAM pages");
+        close(fd);
+        return ret;
+    }
+    close(block->fd);
+    block->fd = fd;
+
+    qemu_ram_setup_dump(block->host, block->length);
+    qemu_madvise(block->host, block->length, QEMU_MADV_HUGEPAGE);
+    qemu_madvise(block->host, block->length, QEMU_MADV_DONTFORK);
+    return 0;
+}
+#else
+int qemu_ram_remap_fd(RAMBlock *block, int fd)
+{
+    close(fd);
+    return -ENOSYS;
+}
+#endif
+
 static RAMBlock *qemu_get_ram_block(ram_addr_t addr)
 {
     RAMBlock *block;
@@ -1454,15 +2123,34 @@ found:
     return block->mr;
 }
 
-static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
-                               uint64_t val, unsigned size)
+/* Bookkeeping for a guest store of 'size' bytes to dirty-tracked RAM
+   whose data is written by the caller, e.g. with a host atomic
+   operation.  Both must be called with the BQL held, _begin before
+   the store and _end after it.  */
+void cpu_notdirty_write_begin(ram_addr_t ram_addr, unsigned size)
 {
-    int dirty_flags;
-    dirty_flags = cpu_physical_memory_get_dirty_flags(ram_addr);
-    if (!(dirty_flags & CODE_DIRTY_FLAG)) {
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
         tb_invalidate_phys_page_fast(ram_addr, size);
-        dirty_flags = cpu_physical_memory_get_dirty_flags(ram_addr);
     }
+}
+
+void cpu_notdirty_write_end(CPUArchState *env, ram_addr_t ram_addr,
+                            target_ulong vaddr, unsigned size)
+{
+    cpu_physical_memory_set_dirty_range_nocode(ram_addr, size);
+    /* we remove the notdirty callback only if the code has been
+       flushed */
+    if (cpu_physical_memory_is_dirty(ram_addr)) {
+        tlb_set_dirty(env, vaddr);
+    }
+}
+
+static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
+                               uint64_t val, unsigned size)
+{
+    CPUArchState *env = current_cpu->env_ptr;
+
+    cpu_notdirty_write_begin(ram_addr, size);
     switch (size) {
     case 1:
         stb_p(qemu_get_ram_ptr(ram_addr), val);
@@ -1476,14 +2164,7 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
     default:
         abort();
     }
-    dirty_flags |= (0xff & ~CODE_DIRTY_FLAG);
-    cpu_physical_memory_set_dirty_flags(ram_addr, dirty_flags);
-    /* we remove the notdirty callback only if the code has been
-       flushed */
-    if (dirty_flags == 0xff) {
-        CPUArchState *env = current_cpu->env_ptr;
-        tlb_set_dirty(env, env->mem_io_vaddr);
-    }
+    cpu_notdirty_write_end(env, ram_addr, env->mem_io_vaddr, size);
 }
 
 static bool notdirty_mem_accepts(void *opaque, hwaddr addr,
@@ -1717,34 +2398,53 @@ static void io_mem_init(void)
 static void mem_begin(MemoryListener *listener)
 {
     AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *d = g_new(AddressSpaceDispatch, 1);
+    AddressSpaceDispatch *d;
+
+    /* Keep the current dispatch, and the map it points to, if the
+     * address space did not change.
+     */
+    if (!as->topology_changed && as->dispatch) {
+        as->next_dispatch = NULL;
+        return;
+    }
 
-    d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .is_leaf = 0 };
+    d = g_new0(AddressSpaceDispatch, 1);
+    d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
     d->as = as;
+    d->ref = 1;
     as->next_dispatch = d;
 }
 
 static void mem_commit(MemoryListener *listener)
 {
     AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *cur = as->dispatch;
+    AddressSpaceDispatch *cur;
     AddressSpaceDispatch *next = as->next_dispatch;
 
-    next->nodes = next_map.nodes;
-    next->sections = next_map.sections;
+    if (!next) {
+        return;
+    }
+
+    next->nodes = next_map->nodes;
+    next->sections = next_map->sections;
+    phys_page_compact_all(next);
+    next->map = next_map;
+    atomic_inc(&next_map->ref);
 
+    qemu_mutex_lock(&dispatch_mutex);
+    cur = as->dispatch;
     as->dispatch = next;
-    g_free(cur);
+    qemu_mutex_unlock(&dispatch_mutex);
+    address_space_dispatch_unref(cur);
 }
 
 static void core_begin(MemoryListener *listener)
 {
     uint16_t n;
 
-    prev_map = g_new(PhysPageMap, 1);
-    *prev_map = next_map;
-
-    memset(&next_map, 0, sizeof(next_map));
+    prev_map = next_map;
+    next_map = g_new0(PhysPageMap, 1);
+    next_map->ref = 1;
     n = dummy_section(&io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
     n = dummy_section(&io_mem_notdirty);
@@ -1760,21 +2460,28 @@ static void core_begin(MemoryListener *listener)
  */
 static void core_commit(MemoryListener *listener)
 {
-    phys_sections_free(prev_map);
+    phys_map_unref(prev_map);
+    prev_map = NULL;
 }
 
-static void tcg_commit(MemoryListener *listener)
+static void tcg_commit_all(void *opaque)
 {
     CPUState *cpu;
 
+    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
+        tlb_flush(cpu->env_ptr, 1);
+    }
+}
+
+static void tcg_commit(MemoryListener *listener)
+{
     /* since each CPU stores ram addresses in its TLB cache, we must
        reset the modified entries */
     /* XXX: slow ! */
-    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
-        CPUArchState *env = cpu->env_ptr;
-
-        tlb_flush(env, 1);
-    }
+    /* iotlb entries index the sections of the new dispatch from now on,
+       so with multi-threaded TCG no vCPU may run translated code until
+       every TLB has been flushed */
+    qemu_tcg_exec_exclusive(current_cpu, tcg_commit_all, NULL);
 }
 
 static void core_log_global_start(MemoryListener *listener)
@@ -1801,6 +2508,11 @@ static MemoryListener tcg_memory_listener = {
 
 void address_space_init_dispatch(AddressSpace *as)
 {
+    qemu_mutex_init(&as->map_lock);
+    as->bounce_buffer_size = 0;
+    QLIST_INIT(&as->bounce_buffers);
+    QTAILQ_INIT(&as->map_client_list);
+
     as->dispatch = NULL;
     as->dispatch_listener = (MemoryListener) {
         .begin = mem_begin,
@@ -1815,10 +2527,20 @@ void address_space_init_dispatch(AddressSpace *as)
 void address_space_destroy_dispatch(AddressSpace *as)
 {
     AddressSpaceDispatch *d = as->dispatch;
+    MapClient *client;
 
     memory_listener_unregister(&as->dispatch_listener);
-    g_free(d);
+    qemu_mutex_lock(&dispatch_mutex);
     as->dispatch = NULL;
+    qemu_mutex_unlock(&dispatch_mutex);
+    address_space_dispatch_unref(d);
+
+    assert(QLIST_EMPTY(&as->bounce_buffers));
+    while ((client = QTAILQ_FIRST(&as->map_client_list)) != NULL) {
+        QTAILQ_REMOVE(&as->map_client_list, client, link);
+        g_free(client);
+    }
+    qemu_mutex_destroy(&as->map_lock);
 }
 
 static void memory_map_init(void)
@@ -1896,11 +2618,14 @@ static void invalidate_and_set_dirty(hwaddr addr,
 {
     if (!cpu_physical_memory_is_dirty(addr)) {
         /* invalidate code */
-        tb_invalidate_phys_page_range(addr, addr + length, 0);
+        if (tcg_enabled()) {
+            tb_invalidate_phys_page_range(addr, addr + length, 0);
+        }
         /* set dirty bit */
-        cpu_physical_memory_set_dirty_flags(addr, (0xff & ~CODE_DIRTY_FLAG));
+        cpu_physical_memory_set_dirty_range_nocode(addr, length);
+    } else {
+        xen_modified_memory(addr, length);
     }
-    xen_modified_memory(addr, length);
 }
 
 static inline bool memory_access_is_direct(MemoryRegion *mr, bool is_write)
@@ -1944,6 +2669,21 @@ static int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
     return l;
 }
 
+/* Take the BQL around an access to @mr unless the region opted out of it
+ * or the caller already holds it.  Returns true if the lock was taken.
+ */
+static bool prepare_mmio_access(MemoryRegion *mr)
+{
+    bool release_lock = false;
+
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        release_lock = true;
+    }
+
+    return release_lock;
+}
+
 bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
                       int len, bool is_write)
 {
@@ -1953,13 +2693,21 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
     hwaddr addr1;
     MemoryRegion *mr;
     bool error = false;
+    bool unlocked = !qemu_mutex_iothread_locked();
+    bool release_lock;
 
     while (len > 0) {
         l = len;
-        mr = address_space_translate(as, addr, &addr1, &l, is_write);
+        /* Without the BQL the region may be unplugged under our feet, so
+         * pin it for the duration of the access.
+         */
+        mr = address_space_do_translate(as, addr, &addr1, &l, is_write,
+                                        unlocked);
+        release_lock = false;
 
         if (is_write) {
             if (!memory_access_is_direct(mr, is_write)) {
+                release_lock = prepare_mmio_access(mr);
                 l = memory_access_size(mr, l, addr1);
                 /* XXX: could force current_cpu to NULL to avoid
                    potential bugs */
@@ -1997,6 +2745,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
         } else {
             if (!memory_access_is_direct(mr, is_write)) {
                 /* I/O case */
+                release_lock = prepare_mmio_access(mr);
                 l = memory_access_size(mr, l, addr1);
                 switch (l) {
                 case 8:
@@ -2028,6 +2777,13 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
                 memcpy(buf, ptr, l);
             }
         }
+
+        if (release_lock) {
+            qemu_mutex_unlock_iothread();
+        }
+        if (unlocked) {
+            memory_region_unref(mr);
+        }
         len -= l;
         buf += l;
         addr += l;
@@ -2084,53 +2840,96 @@ void cpu_physical_memory_write_rom(hwaddr addr,
     }
 }
 
-typedef struct {
-    MemoryRegion *mr;
-    void *buffer;
-    hwaddr addr;
-    hwaddr len;
-} BounceBuffer;
-
-static BounceBuffer bounce;
-
-typedef struct MapClient {
-    void *opaque;
-    void (*callback)(void *opaque);
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-static QLIST_HEAD(map_client_list, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
-
-void *cpu_register_map_client(void *opaque, void (*callback)(void *opaque))
+void *address_space_register_map_client(AddressSpace *as, void *opaque,
+                                        void (*callback)(void *opaque))
 {
     MapClient *client = g_malloc(sizeof(*client));
 
     client->opaque = opaque;
     client->callback = callback;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
+    qemu_mutex_lock(&as->map_lock);
+    /* The last bounce buffer may have been unmapped since the caller's
+     * address_space_map() failed, and its notification found the list
+     * empty.  The unmap drops bounce_buffer_size before taking map_lock,
+     * so checking it under the lock closes that window.
+     */
+    if (atomic_read(&as->bounce_buffer_size) < BOUNCE_BUFFER_MAX_SIZE) {
+        qemu_mutex_unlock(&as->map_lock);
+        g_free(client);
+        callback(opaque);
+        return NULL;
+    }
+    QTAILQ_INSERT_TAIL(&as->map_client_list, client, link);
+    qemu_mutex_unlock(&as->map_lock);
     return client;
 }
 
-static void cpu_unregister_map_client(void *_client)
+void *cpu_register_map_client(void *opaque, void (*callback)(void *opaque))
 {
-    MapClient *client = (MapClient *)_client;
-
-    QLIST_REMOVE(client, link);
-    g_free(client);
+    return address_space_register_map_client(&address_space_memory, opaque,
+                                             callback);
 }
 
-static void cpu_notify_map_clients(void)
+static void address_space_notify_map_clients(AddressSpace *as)
 {
+    QTAILQ_HEAD(, MapClient) clients = QTAILQ_HEAD_INITIALIZER(clients);
     MapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    /* Callbacks may map again and re-register, so run them on a private
+     * copy of the list, in registration order.
+     */
+    qemu_mutex_lock(&as->map_lock);
+    while ((client = QTAILQ_FIRST(&as->map_client_list)) != NULL) {
+        QTAILQ_REMOVE(&as->map_client_list, client, link);
+        QTAILQ_INSERT_TAIL(&clients, client, link);
+    }
+    qemu_mutex_unlock(&as->map_lock);
+
+    while ((client = QTAILQ_FIRST(&clients)) != NULL) {
+        QTAILQ_REMOVE(&clients, client, link);
         client->callback(client->opaque);
-        cpu_unregister_map_client(client);
+        g_free(client);
+    }
+}
+
+/* Reserve up to @len bytes of the bounce buffer budget of @as and return
+ * the amount actually reserved, possibly 0.
+ */
+static hwaddr bounce_buffer_reserve(AddressSpace *as, hwaddr len)
+{
+    hwaddr used = atomic_read(&as->bounce_buffer_size);
+
+    for (;;) {
+        hwaddr alloc = MIN(BOUNCE_BUFFER_MAX_SIZE - used, len);
+        hwaddr actual = atomic_cmpxchg(&as->bounce_buffer_size, used,
+                                       used + alloc);
+        if (actual == used) {
+            return alloc;
+        }
+        used = actual;
     }
 }
 
+static BounceBuffer *bounce_buffer_find(AddressSpace *as, void *buffer)
+{
+    BounceBuffer *bounce;
+
+    /* Fast path for RAM mappings, nothing is bounced most of the time */
+    if (!atomic_read(&as->bounce_buffer_size)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&as->map_lock);
+    QLIST_FOREACH(bounce, &as->bounce_buffers, link) {
+        if (bounce->buffer == buffer) {
+            QLIST_REMOVE(bounce, link);
+            break;
+        }
+    }
+    qemu_mutex_unlock(&as->map_lock);
+    return bounce;
+}
+
 bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_write)
 {
     MemoryRegion *mr;
@@ -2177,21 +2976,31 @@ void *address_space_map(AddressSpace *as,
     l = len;
     mr = address_space_translate(as, addr, &xlat, &l, is_write);
     if (!memory_access_is_direct(mr, is_write)) {
-        if (bounce.buffer) {
+        BounceBuffer *bounce;
+
+        l = bounce_buffer_reserve(as, l);
+        if (l == 0) {
+            *plen = 0;
             return NULL;
         }
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, TARGET_PAGE_SIZE);
-        bounce.addr = addr;
-        bounce.len = l;
+
+        bounce = g_new(BounceBuffer, 1);
+        bounce->buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
+        bounce->addr = addr;
+        bounce->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
         if (!is_write) {
-            address_space_read(as, addr, bounce.buffer, l);
+            address_space_read(as, addr, bounce->buffer, l);
         }
 
+        qemu_mutex_lock(&as->map_lock);
+        QLIST_INSERT_HEAD(&as->bounce_buffers, bounce, link);
+        qemu_mutex_unlock(&as->map_lock);
+
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
     base = xlat;
@@ -2224,7 +3033,9 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *bounce = bounce_buffer_find(as, buffer);
+
+    if (!bounce) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -2248,12 +3059,13 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, bounce.buffer, access_len);
+        address_space_write(as, bounce->addr, bounce->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    cpu_notify_map_clients();
+    qemu_vfree(bounce->buffer);
+    memory_region_unref(bounce->mr);
+    atomic_sub(&as->bounce_buffer_size, bounce->len);
+    g_free(bounce);
+    address_space_notify_map_clients(as);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
@@ -2478,8 +3290,7 @@ void stl_phys_notdirty(hwaddr addr, uint32_t val)
                 /* invalidate code */
                 tb_invalidate_phys_page_range(addr1, addr1 + 4, 0);
                 /* set dirty bit */
-                cpu_physical_memory_set_dirty_flags(
-                    addr1, (0xff & ~CODE_DIRTY_FLAG));
+                cpu_physical_memory_set_dirty_range_nocode(addr1, 4);
             }
         }
     }
@@ -40,6 +40,8 @@ these four paragraphs for those parts of this code that are retained.
  */
 #include "config.h"
 
+#include <math.h>
+
 #include "fpu/softfloat.h"
 
 /*----------------------------------------------------------------------------
@@ -74,6 +76,85 @@ void set_floatx80_rounding_precision(int val STATUS_PARAM)
     STATUS(floatx80_rounding_precision) = val;
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  Once the inexact flag has been raised (it is sticky
+| for every target that keeps the flags accumulated in `status') and the
+| rounding mode is round-to-nearest-even, an operation on zero or normal
+| inputs can only add the overflow and underflow flags, so its result can be
+| computed by the host FPU.  Results that might be tiny are recomputed in
+| software so that underflow, tininess detection and flush_to_zero keep
+| their exact semantics.  This needs a host that evaluates float and double
+| expressions at their own precision (no x87 excess precision).
+*----------------------------------------------------------------------------*/
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0
+#define USE_HOST_FPU 1
+#else
+#define USE_HOST_FPU 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} float32_host;
+
+typedef union {
+    float64 s;
+    double h;
+} float64_host;
+
+INLINE flag can_use_host_fpu(float_status *status)
+{
+    return USE_HOST_FPU &&
+           (STATUS(float_exception_flags) & float_flag_inexact) &&
+           STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+INLINE flag float32_host_input_ok(float32 a)
+{
+    uint32_t exp = (float32_val(a) >> 23) & 0xff;
+
+    return exp != 0xff && (exp != 0 || (float32_val(a) << 1) == 0);
+}
+
+INLINE flag float64_host_input_ok(float64 a)
+{
+    uint64_t exp = (float64_val(a) >> 52) & 0x7ff;
+
+    return exp != 0x7ff && (exp != 0 || (float64_val(a) << 1) == 0);
+}
+
+/*----------------------------------------------------------------------------
+| Returns 1 if the host result `r' can be returned as is, raising overflow
+| if it is infinite.  Results at or below the smallest normal value are
+| left to softfloat, except for zeroes when `zero_exact' says that a zero
+| result cannot come from an underflow.
+*----------------------------------------------------------------------------*/
+INLINE flag float32_host_result_ok(float32 r, flag zero_exact STATUS_PARAM)
+{
+    uint32_t abs = float32_val(r) & 0x7fffffff;
+
+    if (abs > 0x00800000) {
+        if (abs == 0x7f800000) {
+            float_raise(float_flag_overflow STATUS_VAR);
+        }
+        return 1;
+    }
+    return zero_exact && abs == 0;
+}
+
+INLINE flag float64_host_result_ok(float64 r, flag zero_exact STATUS_PARAM)
+{
+    uint64_t abs = float64_val(r) & LIT64(0x7fffffffffffffff);
+
+    if (abs > LIT64(0x0010000000000000)) {
+        if (abs == LIT64(0x7ff0000000000000)) {
+            float_raise(float_flag_overflow STATUS_VAR);
+        }
+        return 1;
+    }
+    return zero_exact && abs == 0;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the half-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1870,6 +1951,19 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float32_host_input_ok(a) && float32_host_input_ok(b)) {
+        float32_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        /* The sum of two normals is exact whenever it is zero */
+        if (float32_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSign = extractFloat32Sign( a );
     bSign = extractFloat32Sign( b );
     if ( aSign == bSign ) {
@@ -1893,6 +1987,19 @@ float32 float32_sub( float32 a, float32 b STATUS_PARAM )
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float32_host_input_ok(a) && float32_host_input_ok(b)) {
+        float32_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        /* The sum of two normals is exact whenever it is zero */
+        if (float32_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSign = extractFloat32Sign( a );
     bSign = extractFloat32Sign( b );
     if ( aSign == bSign ) {
@@ -1921,6 +2028,19 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float32_host_input_ok(a) && float32_host_input_ok(b)) {
+        float32_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float32_host_result_ok(ur.s, float32_is_zero(a) ||
+                                   float32_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat32Frac( a );
     aExp = extractFloat32Exp( a );
     aSign = extractFloat32Sign( a );
@@ -1981,6 +2101,18 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) && float32_host_input_ok(a) &&
+        float32_host_input_ok(b) && !float32_is_zero(b)) {
+        float32_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float32_host_result_ok(ur.s, float32_is_zero(a) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat32Frac( a );
     aExp = extractFloat32Exp( a );
     aSign = extractFloat32Sign( a );
@@ -2353,6 +2485,17 @@ float32 float32_sqrt( float32 a STATUS_PARAM )
     uint64_t rem, term;
     a = float32_squash_input_denormal(a STATUS_VAR);
 
+    if (can_use_host_fpu(status) && float32_host_input_ok(a) &&
+        (!extractFloat32Sign(a) || float32_is_zero(a))) {
+        float32_host ua, ur;
+
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        if (float32_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat32Frac( a );
     aExp = extractFloat32Exp( a );
     aSign = extractFloat32Sign( a );
@@ -3433,6 +3576,19 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float64_host_input_ok(a) && float64_host_input_ok(b)) {
+        float64_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        /* The sum of two normals is exact whenever it is zero */
+        if (float64_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSign = extractFloat64Sign( a );
     bSign = extractFloat64Sign( b );
     if ( aSign == bSign ) {
@@ -3456,6 +3612,19 @@ float64 float64_sub( float64 a, float64 b STATUS_PARAM )
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float64_host_input_ok(a) && float64_host_input_ok(b)) {
+        float64_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        /* The sum of two normals is exact whenever it is zero */
+        if (float64_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSign = extractFloat64Sign( a );
     bSign = extractFloat64Sign( b );
     if ( aSign == bSign ) {
@@ -3482,6 +3651,19 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) &&
+        float64_host_input_ok(a) && float64_host_input_ok(b)) {
+        float64_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float64_host_result_ok(ur.s, float64_is_zero(a) ||
+                                   float64_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat64Frac( a );
     aExp = extractFloat64Exp( a );
     aSign = extractFloat64Sign( a );
@@ -3544,6 +3726,18 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
+    if (can_use_host_fpu(status) && float64_host_input_ok(a) &&
+        float64_host_input_ok(b) && !float64_is_zero(b)) {
+        float64_host ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float64_host_result_ok(ur.s, float64_is_zero(a) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat64Frac( a );
     aExp = extractFloat64Exp( a );
     aSign = extractFloat64Sign( a );
@@ -3926,6 +4120,17 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
     uint64_t rem0, rem1, term0, term1;
     a = float64_squash_input_denormal(a STATUS_VAR);
 
+    if (can_use_host_fpu(status) && float64_host_input_ok(a) &&
+        (!extractFloat64Sign(a) || float64_is_zero(a))) {
+        float64_host ua, ur;
+
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        if (float64_host_result_ok(ur.s, 1 STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+
     aSig = extractFloat64Frac( a );
     aExp = extractFloat64Exp( a );
     aSign = extractFloat64Sign( a );
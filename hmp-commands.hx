@@ -1632,6 +1632,21 @@ STEXI
 
 Executes a qemu-io command on the given block device.
 
+ETEXI
+
+    {
+        .name       = "jit_profile",
+        .args_type  = "enable:b",
+        .params     = "on|off",
+        .help       = "enable/disable the TCG block execution profiler",
+        .mhandler.cmd = hmp_jit_profile,
+    },
+
+STEXI
+@item jit_profile on|off
+@findex jit_profile
+Enable or disable the TCG block execution profiler.  Enabling it discards
+the previous profile; the result is shown by @code{info jit-profile}.
 ETEXI
 
     {
@@ -1677,6 +1692,8 @@ show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only
 show the active virtual memory mappings (i386 only)
 @item info jit
 show dynamic compiler info
+@item info jit-profile [@var{count}]
+show the @var{count} most executed guest code blocks (default 20)
 @item info numa
 show NUMA information
 @item info kvm
@@ -1542,3 +1542,46 @@ void hmp_qemu_io(Monitor *mon, const QDict *qdict)
 
     hmp_handle_error(mon, &err);
 }
+
+void hmp_info_jit_profile(Monitor *mon, const QDict *qdict)
+{
+    JitProfileBlockList *list, *entry;
+    Error *err = NULL;
+    bool has_count = qdict_haskey(qdict, "count");
+    int64_t count = qdict_get_try_int(qdict, "count", 0);
+
+    list = qmp_query_jit_profile(has_count, count, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+    if (!list) {
+        monitor_printf(mon, "No profiled blocks, use jit_profile on\n");
+        return;
+    }
+
+    for (entry = list; entry; entry = entry->next) {
+        JitProfileBlock *block = entry->value;
+
+        monitor_printf(mon, "pc 0x%" PRIx64 " cs_base 0x%" PRIx64
+                       " flags 0x%" PRIx64 " size %" PRId64
+                       " insns %" PRId64 "\n",
+                       block->pc, block->cs_base, block->flags,
+                       block->size, block->insns);
+        monitor_printf(mon, "  executed %" PRId64 " helper calls %" PRId64
+                       " slow path %" PRId64 "\n",
+                       block->exec_count, block->helper_calls,
+                       block->slow_path_hits);
+        monitor_printf(mon, "%s\n", block->disas);
+    }
+
+    qapi_free_JitProfileBlockList(list);
+}
+
+void hmp_jit_profile(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_jit_profile_set(qdict_get_bool(qdict, "enable"), &err);
+    hmp_handle_error(mon, &err);
+}
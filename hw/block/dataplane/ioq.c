@@ -13,6 +13,8 @@
  */
 
 #include "ioq.h"
+#include "block/aio.h"
+#include "block/raw-aio.h"
 
 void ioq_init(IOQueue *ioq, int fd, unsigned int max_reqs)
 {
@@ -94,6 +96,11 @@ int ioq_submit(IOQueue *ioq)
     return rc;
 }
 
+bool ioq_has_completions(IOQueue *ioq)
+{
+    return laio_ring_has_events(ioq->io_ctx);
+}
+
 int ioq_run_completion(IOQueue *ioq, IOQueueCompletion *completion,
                        void *opaque)
 {
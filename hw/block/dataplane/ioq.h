@@ -50,6 +50,9 @@ static inline unsigned int ioq_num_queued(IOQueue *ioq)
     return ioq->queue_idx;
 }
 
+/* Check for completed requests without a system call */
+bool ioq_has_completions(IOQueue *ioq);
+
 typedef void IOQueueCompletion(struct iocb *iocb, ssize_t ret, void *opaque);
 int ioq_run_completion(IOQueue *ioq, IOQueueCompletion *completion,
                        void *opaque);
@@ -372,6 +372,32 @@ static void handle_io(EventNotifier *e)
     }
 }
 
+static bool poll_notify(EventNotifier *e)
+{
+    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
+                                           host_notifier);
+
+    if (!vring_more_avail(&s->vring)) {
+        return false;
+    }
+
+    handle_notify(e);
+    return true;
+}
+
+static bool poll_io(EventNotifier *e)
+{
+    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
+                                           io_notifier);
+
+    if (!s->num_reqs || !ioq_has_completions(&s->ioqueue)) {
+        return false;
+    }
+
+    handle_io(e);
+    return true;
+}
+
 static void *data_plane_thread(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
@@ -486,6 +512,7 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     }
     s->host_notifier = *virtio_queue_get_host_notifier(vq);
     aio_set_event_notifier(s->ctx, &s->host_notifier, handle_notify, flush_true);
+    aio_set_event_notifier_poll(s->ctx, &s->host_notifier, poll_notify);
 
     /* Set up ioqueue */
     ioq_init(&s->ioqueue, s->fd, REQ_MAX);
@@ -494,6 +521,7 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     }
     s->io_notifier = *ioq_get_notifier(&s->ioqueue);
     aio_set_event_notifier(s->ctx, &s->io_notifier, handle_io, flush_io);
+    aio_set_event_notifier_poll(s->ctx, &s->io_notifier, poll_io);
 
     s->started = true;
     trace_virtio_blk_data_plane_start(s);
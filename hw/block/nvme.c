@@ -27,8 +27,24 @@
 
 #include "nvme.h"
 
+/*
+ * Completion queue head doorbells are only looked at when posting
+ * completions, so writes to them are coalesced instead of causing an exit
+ * each.  KVM has a small VM-wide budget of coalesced zones, and every CQ
+ * doorbell needs its own, hence the limit.
+ */
+#define NVME_MAX_COALESCED_CQ   16
+
+/* Retry interval for posting to a full CQ whose head doorbell is coalesced */
+#define NVME_CQ_FULL_POLL_NS    100000
+
 static void nvme_process_sq(void *opaque);
 
+static hwaddr nvme_cq_db_offset(uint16_t cqid)
+{
+    return 0x1000 + (((cqid << 1) + 1) << 2);
+}
+
 static int nvme_check_sqid(NvmeCtrl *n, uint16_t sqid)
 {
     return sqid < n->num_queues && n->sq[sqid] != NULL ? 0 : -1;
@@ -160,11 +176,19 @@ static void nvme_post_cqes(void *opaque)
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
 
+    memory_region_flush_coalesced(&n->iomem);
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
         if (nvme_cq_full(cq)) {
+            /* A synchronous head update rearms the timer by itself; a
+             * coalesced one is only seen when somebody flushes. */
+            if (cq->cqid < NVME_MAX_COALESCED_CQ) {
+                qemu_mod_timer(cq->timer, qemu_get_clock_ns(vm_clock) +
+                               NVME_CQ_FULL_POLL_NS);
+            }
             break;
         }
 
@@ -368,6 +392,10 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
 
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
+    if (cq->cqid < NVME_MAX_COALESCED_CQ) {
+        memory_region_del_coalescing(&n->iomem, nvme_cq_db_offset(cq->cqid),
+                                     4);
+    }
     n->cq[cq->cqid] = NULL;
     qemu_del_timer(cq->timer);
     qemu_free_timer(cq->timer);
@@ -411,6 +439,9 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
     cq->timer = qemu_new_timer_ns(vm_clock, nvme_post_cqes, cq);
+    if (cqid < NVME_MAX_COALESCED_CQ) {
+        memory_region_add_coalescing(&n->iomem, nvme_cq_db_offset(cqid), 4);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -1169,6 +1169,13 @@ void ahci_init(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
                           "ahci", AHCI_MEM_BAR_SIZE);
     memory_region_init_io(&s->idp, OBJECT(qdev), &ahci_idp_ops, s,
                           "ahci-idp", 32);
+    /* Drivers set PxSACT right before the PxCI doorbell, whose synchronous
+     * write flushes it; no need to exit for it on its own. */
+    for (i = 0; i < ports; i++) {
+        memory_region_add_coalescing(&s->mem, AHCI_PORT_REGS_START_ADDR +
+                                     i * AHCI_PORT_ADDR_OFFSET_LEN +
+                                     PORT_SCR_ACT, 4);
+    }
 
     irqs = qemu_allocate_irqs(ahci_irq_set, s, s->ports);
 
@@ -0,0 +1,646 @@
+/*
+ * Dedicated per-queue threads for virtio-net packet processing
+ *
+ * Each active queue pair gets its own thread and AioContext.  The thread
+ * services the rx and tx virtqueue doorbells (ioeventfd) and reads from
+ * and writes to the tap file descriptor of that queue pair directly, so
+ * neither the global mutex nor the net layer packet queues are involved
+ * in the fast path.  The guest is notified through irqfd.
+ *
+ * Like vhost-net, the data plane requires a tap backend with a vnet header
+ * that matches the one used by the guest, and does not apply the receive
+ * filter.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "trace.h"
+#include "qemu/iov.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "hw/virtio/dataplane/vring.h"
+#include "hw/virtio/virtio-net.h"
+#include "hw/virtio/virtio-bus.h"
+#include "block/aio.h"
+#include "net/net.h"
+#include "net/tap.h"
+#include "net/gso.h"
+#include "sysemu/kvm.h"
+#include "virtio-net.h"
+
+typedef struct {
+    Vring vring;                    /* virtqueue vring */
+    EventNotifier *guest_notifier;  /* irq */
+    EventNotifier masked_notifier;  /* irq while the guest masks the vector */
+    bool masked;
+
+    /* Note that this EventNotifier is assigned by value.  This is fine as
+     * long as you do not call event_notifier_cleanup on it (because you
+     * don't own the file descriptor or handle; you just use it).
+     */
+    EventNotifier host_notifier;    /* doorbell */
+} VirtIONetDataPlaneVq;
+
+typedef struct {
+    VirtIONetDataPlane *s;
+    QemuThread thread;
+    AioContext *ctx;
+
+    NetClientState *peer;           /* tap backend of this queue pair */
+    int fd;                         /* tap file descriptor */
+    bool read_poll;
+    bool write_poll;
+
+    VirtIONetDataPlaneVq rx;
+    VirtIONetDataPlaneVq tx;
+
+    /* Packet read from tap that does not fit in the rx vring yet */
+    uint8_t rx_buf[NET_BUFSIZE];
+    size_t rx_len;
+    uint16_t rx_avail_idx;          /* avail index seen when we ran out */
+    struct iovec rx_first_iov[VIRTQUEUE_MAX_SIZE];
+    struct iovec rx_iov[VIRTQUEUE_MAX_SIZE];
+
+    /* Packet popped from the tx vring that tap did not accept yet */
+    int tx_head;
+    unsigned int tx_iovcnt;
+    struct iovec tx_iov[VIRTQUEUE_MAX_SIZE];
+} VirtIONetDataPlaneQueue;
+
+struct VirtIONetDataPlane {
+    bool started;
+    bool stopping;
+    QEMUBH *start_bh;
+
+    VirtIONet *n;
+    VirtIODevice *vdev;
+
+    /* Device state sampled at start, constant while the threads run */
+    int queues;                     /* number of active queue pairs */
+    size_t hdr_len;                 /* vnet header length */
+    bool mergeable_rx_bufs;
+    bool has_ufo;
+    int32_t tx_burst;
+
+    VirtIONetDataPlaneQueue *vqs;   /* max_queues entries */
+};
+
+static VirtIONetDataPlaneVq *get_vq(VirtIONetDataPlane *s, int idx)
+{
+    VirtIONetDataPlaneQueue *q = &s->vqs[idx / 2];
+
+    return idx % 2 ? &q->tx : &q->rx;
+}
+
+/* Raise an interrupt to signal guest, if necessary */
+static void notify_guest(VirtIONetDataPlane *s, VirtIONetDataPlaneVq *vq)
+{
+    if (!vring_should_notify(s->vdev, &vq->vring)) {
+        return;
+    }
+
+    if (atomic_mb_read(&vq->masked)) {
+        event_notifier_set(&vq->masked_notifier);
+    } else {
+        event_notifier_set(vq->guest_notifier);
+    }
+}
+
+static int flush_true(EventNotifier *e)
+{
+    return true;
+}
+
+static int flush_tap(void *opaque)
+{
+    return true;
+}
+
+static void handle_tap_read(void *opaque);
+static void handle_tap_write(void *opaque);
+
+static void update_tap_handler(VirtIONetDataPlaneQueue *q)
+{
+    aio_set_fd_handler(q->ctx, q->fd,
+                       q->read_poll ? handle_tap_read : NULL,
+                       q->write_poll ? handle_tap_write : NULL,
+                       flush_tap, q);
+}
+
+static void tap_read_poll(VirtIONetDataPlaneQueue *q, bool enable)
+{
+    q->read_poll = enable;
+    update_tap_handler(q);
+}
+
+static void tap_write_poll(VirtIONetDataPlaneQueue *q, bool enable)
+{
+    q->write_poll = enable;
+    update_tap_handler(q);
+}
+
+static ssize_t tap_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    ssize_t len;
+
+    do {
+        len = writev(fd, iov, iovcnt);
+    } while (len == -1 && errno == EINTR);
+
+    return len;
+}
+
+static void tx_segment(const uint8_t *buf, size_t size, bool last,
+                       void *opaque)
+{
+    VirtIONetDataPlaneQueue *q = opaque;
+    struct virtio_net_hdr_mrg_rxbuf hdr = {};
+    struct iovec iov[] = {
+        { .iov_base = &hdr, .iov_len = q->s->hdr_len },
+        { .iov_base = (void *)buf, .iov_len = size },
+    };
+
+    /* Fragments that do not fit are dropped, like on a real link */
+    tap_writev(q->fd, iov, ARRAY_SIZE(iov));
+}
+
+/* Returns false if tap is full and the packet has to be retried later */
+static bool tx_packet(VirtIONetDataPlaneQueue *q)
+{
+    VirtIONetDataPlane *s = q->s;
+    struct virtio_net_hdr hdr;
+
+    if (!s->has_ufo &&
+        iov_to_buf(q->tx_iov, q->tx_iovcnt, 0, &hdr, sizeof(hdr)) ==
+        sizeof(hdr) &&
+        (hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN) == VIRTIO_NET_HDR_GSO_UDP) {
+        struct iovec sg[VIRTQUEUE_MAX_SIZE];
+        unsigned int sg_num;
+
+        sg_num = iov_copy(sg, ARRAY_SIZE(sg), q->tx_iov, q->tx_iovcnt,
+                          s->hdr_len, -1);
+        net_gso_segment(&hdr, sg, sg_num, tx_segment, q);
+        return true;
+    }
+
+    /* Other errors drop the packet, as the tap backend does */
+    return tap_writev(q->fd, q->tx_iov, q->tx_iovcnt) >= 0 || errno != EAGAIN;
+}
+
+static void handle_tx(VirtIONetDataPlaneQueue *q)
+{
+    VirtIONetDataPlane *s = q->s;
+    unsigned int out_num, in_num;
+    int num_packets = 0;
+    int head;
+
+    vring_disable_notification(s->vdev, &q->tx.vring);
+
+    for (;;) {
+        if (q->tx_head < 0) {
+            head = vring_pop(s->vdev, &q->tx.vring, q->tx_iov,
+                             q->tx_iov + ARRAY_SIZE(q->tx_iov),
+                             &out_num, &in_num);
+            if (head == -EAGAIN) {
+                /* Re-enable guest->host notifies and stop processing the
+                 * vring.  But if the guest has snuck in more descriptors,
+                 * keep processing.
+                 */
+                if (vring_enable_notification(s->vdev, &q->tx.vring)) {
+                    vring_disable_notification(s->vdev, &q->tx.vring);
+                    continue;
+                }
+                break;
+            }
+            if (head < 0) {
+                break; /* vring is broken */
+            }
+            q->tx_head = head;
+            q->tx_iovcnt = out_num;
+        }
+
+        if (!tx_packet(q)) {
+            tap_write_poll(q, true);
+            break;
+        }
+        vring_push(&q->tx.vring, q->tx_head, 0);
+        q->tx_head = -1;
+
+        if (++num_packets >= s->tx_burst) {
+            /* Let the rx side run, then come back for the rest */
+            event_notifier_set(&q->tx.host_notifier);
+            break;
+        }
+    }
+
+    if (num_packets) {
+        notify_guest(s, &q->tx);
+    }
+}
+
+static void handle_tx_notify(EventNotifier *e)
+{
+    VirtIONetDataPlaneQueue *q = container_of(e, VirtIONetDataPlaneQueue,
+                                              tx.host_notifier);
+
+    event_notifier_test_and_clear(e);
+    if (!q->write_poll) {
+        handle_tx(q);
+    }
+}
+
+static bool poll_tx_notify(EventNotifier *e)
+{
+    VirtIONetDataPlaneQueue *q = container_of(e, VirtIONetDataPlaneQueue,
+                                              tx.host_notifier);
+
+    if (q->write_poll || !vring_more_avail(&q->tx.vring)) {
+        return false;
+    }
+
+    handle_tx(q);
+    return true;
+}
+
+static void handle_tap_write(void *opaque)
+{
+    VirtIONetDataPlaneQueue *q = opaque;
+
+    tap_write_poll(q, false);
+    handle_tx(q);
+}
+
+/* Copy the packet in rx_buf to the guest.  Returns -EAGAIN if the guest has
+ * not posted enough receive buffers for it yet.
+ */
+static int rx_packet(VirtIONetDataPlaneQueue *q)
+{
+    VirtIONetDataPlane *s = q->s;
+    unsigned int out_num, in_num, first_out = 0, first_in = 0;
+    unsigned int num_buffers = 0;
+    size_t offset = 0;
+
+    while (offset < q->rx_len) {
+        struct iovec *iov = num_buffers ? q->rx_iov : q->rx_first_iov;
+        size_t len;
+        int head;
+
+        head = vring_pop(s->vdev, &q->rx.vring, iov,
+                         iov + VIRTQUEUE_MAX_SIZE, &out_num, &in_num);
+        if (head < 0) {
+            /* Return the buffers taken so far, they were not published */
+            q->rx_avail_idx = q->rx.vring.last_avail_idx;
+            q->rx.vring.last_avail_idx -= num_buffers;
+            return head;
+        }
+
+        len = iov_from_buf(iov + out_num, in_num, 0, q->rx_buf + offset,
+                           q->rx_len - offset);
+        if (!num_buffers) {
+            first_out = out_num;
+            first_in = in_num;
+        }
+        vring_fill(&q->rx.vring, head, len, num_buffers++);
+        offset += len;
+
+        if (!s->mergeable_rx_bufs) {
+            break;
+        }
+    }
+
+    if (s->mergeable_rx_bufs) {
+        uint16_t val;
+
+        stw_p(&val, num_buffers);
+        iov_from_buf(q->rx_first_iov + first_out, first_in,
+                     offsetof(struct virtio_net_hdr_mrg_rxbuf, num_buffers),
+                     &val, sizeof(val));
+    }
+
+    vring_flush(&q->rx.vring, num_buffers);
+    q->rx_len = 0;
+    return 0;
+}
+
+static void handle_tap_read(void *opaque)
+{
+    VirtIONetDataPlaneQueue *q = opaque;
+    VirtIONetDataPlane *s = q->s;
+    int num_packets = 0;
+    int ret;
+
+    while (num_packets < s->tx_burst) {
+        if (!q->rx_len) {
+            ssize_t len;
+
+            do {
+                len = read(q->fd, q->rx_buf, sizeof(q->rx_buf));
+            } while (len == -1 && errno == EINTR);
+            if (len <= 0) {
+                break;
+            }
+            q->rx_len = len;
+        }
+
+        ret = rx_packet(q);
+        if (ret == -EAGAIN) {
+            /* Out of receive buffers: stop reading tap until the guest
+             * posts more, unless it already did behind our back.
+             */
+            vring_enable_notification(s->vdev, &q->rx.vring);
+            if (q->rx.vring.vr.avail->idx == q->rx_avail_idx) {
+                tap_read_poll(q, false);
+                break;
+            }
+            vring_disable_notification(s->vdev, &q->rx.vring);
+            continue;
+        } else if (ret < 0) {
+            /* vring is broken, drop the packet and stop receiving */
+            q->rx_len = 0;
+            tap_read_poll(q, false);
+            break;
+        }
+        num_packets++;
+    }
+
+    if (num_packets) {
+        notify_guest(s, &q->rx);
+    }
+}
+
+static void handle_rx_notify(EventNotifier *e)
+{
+    VirtIONetDataPlaneQueue *q = container_of(e, VirtIONetDataPlaneQueue,
+                                              rx.host_notifier);
+
+    event_notifier_test_and_clear(e);
+
+    /* The guest refilled the rx vring, no need to hear about it again until
+     * we run out of buffers.
+     */
+    vring_disable_notification(q->s->vdev, &q->rx.vring);
+    if (!q->read_poll) {
+        tap_read_poll(q, true);
+    }
+    handle_tap_read(q);
+}
+
+static void *data_plane_thread(void *opaque)
+{
+    VirtIONetDataPlaneQueue *q = opaque;
+
+    do {
+        aio_poll(q->ctx, true);
+    } while (!q->s->stopping);
+    return NULL;
+}
+
+static void start_data_plane_bh(void *opaque)
+{
+    VirtIONetDataPlane *s = opaque;
+    int i;
+
+    qemu_bh_delete(s->start_bh);
+    s->start_bh = NULL;
+    for (i = 0; i < s->queues; i++) {
+        qemu_thread_create(&s->vqs[i].thread, data_plane_thread,
+                           &s->vqs[i], QEMU_THREAD_JOINABLE);
+    }
+}
+
+bool virtio_net_data_plane_create(VirtIONet *n,
+                                  VirtIONetDataPlane **dataplane)
+{
+    VirtIONetDataPlane *s;
+    NetClientState *nc = qemu_get_queue(n->nic);
+
+    *dataplane = NULL;
+
+    if (!n->net_conf.data_plane) {
+        return true;
+    }
+
+    if (!kvm_enabled()) {
+        error_report("x-data-plane requires KVM ioeventfd and irqfd support, "
+                     "ensure -enable-kvm is set");
+        return false;
+    }
+
+    if (!nc->peer || nc->peer->info->type != NET_CLIENT_OPTIONS_KIND_TAP ||
+        !tap_has_vnet_hdr(nc->peer)) {
+        error_report("x-data-plane requires a tap backend with vnet_hdr=on");
+        return false;
+    }
+
+    if (tap_get_vhost_net(nc->peer)) {
+        error_report("device is incompatible with x-data-plane, "
+                     "use vhost=off");
+        return false;
+    }
+
+    s = g_new0(VirtIONetDataPlane, 1);
+    s->n = n;
+    s->vdev = VIRTIO_DEVICE(n);
+    s->vqs = g_new0(VirtIONetDataPlaneQueue, n->max_queues);
+
+    *dataplane = s;
+    return true;
+}
+
+void virtio_net_data_plane_destroy(VirtIONetDataPlane *s)
+{
+    if (!s) {
+        return;
+    }
+
+    virtio_net_data_plane_stop(s);
+    g_free(s->vqs);
+    g_free(s);
+}
+
+static void data_plane_release_host_notifiers(VirtIONetDataPlane *s,
+                                              int nvqs)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    for (i = 0; i < nvqs; i++) {
+        k->set_host_notifier(qbus->parent, i, false);
+    }
+}
+
+static void data_plane_teardown_vrings(VirtIONetDataPlane *s, int nvqs)
+{
+    int i;
+
+    for (i = 0; i < nvqs; i++) {
+        VirtIONetDataPlaneVq *vq = get_vq(s, i);
+
+        /* Hand the queue back to the device model in the state it expects */
+        vring_enable_notification(s->vdev, &vq->vring);
+        vring_teardown(&vq->vring, s->vdev, i);
+        event_notifier_cleanup(&vq->masked_notifier);
+    }
+}
+
+bool virtio_net_data_plane_start(VirtIONetDataPlane *s, int queues)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = queues * 2;
+    int i, r;
+
+    if (s->started) {
+        return true;
+    }
+
+    for (i = 0; i < nvqs; i++) {
+        VirtIONetDataPlaneVq *vq = get_vq(s, i);
+
+        if (!vring_setup(&vq->vring, s->vdev, i)) {
+            data_plane_teardown_vrings(s, i);
+            return false;
+        }
+        event_notifier_init(&vq->masked_notifier, 0);
+        vq->masked = false;
+        vq->guest_notifier =
+            virtio_queue_get_guest_notifier(virtio_get_queue(s->vdev, i));
+    }
+
+    s->queues = queues;
+    s->hdr_len = s->n->guest_hdr_len;
+    s->mergeable_rx_bufs = s->n->mergeable_rx_bufs;
+    s->has_ufo = s->n->has_ufo;
+    s->tx_burst = s->n->tx_burst;
+
+    /* Set up guest notifiers (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifiers: %d", -r);
+        data_plane_teardown_vrings(s, nvqs);
+        return false;
+    }
+
+    /* Set up virtqueue notify */
+    for (i = 0; i < nvqs; i++) {
+        r = k->set_host_notifier(qbus->parent, i, true);
+        if (r != 0) {
+            error_report("virtio-net failed to set host notifier: %d", -r);
+            data_plane_release_host_notifiers(s, i);
+            k->set_guest_notifiers(qbus->parent, nvqs, false);
+            data_plane_teardown_vrings(s, nvqs);
+            return false;
+        }
+        get_vq(s, i)->host_notifier =
+            *virtio_queue_get_host_notifier(virtio_get_queue(s->vdev, i));
+    }
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetDataPlaneQueue *q = &s->vqs[i];
+
+        q->s = s;
+        q->ctx = aio_context_new();
+        q->rx_len = 0;
+        q->tx_head = -1;
+
+        /* Take the tap fd away from the main loop */
+        q->peer = qemu_get_subqueue(s->n->nic, i)->peer;
+        q->fd = tap_get_fd(q->peer);
+        q->peer->info->poll(q->peer, false);
+        q->read_poll = true;
+        q->write_poll = false;
+        update_tap_handler(q);
+
+        aio_set_event_notifier(q->ctx, &q->rx.host_notifier,
+                               handle_rx_notify, flush_true);
+        aio_set_event_notifier(q->ctx, &q->tx.host_notifier,
+                               handle_tx_notify, flush_true);
+        aio_set_event_notifier_poll(q->ctx, &q->tx.host_notifier,
+                                    poll_tx_notify);
+
+        /* Kick right away to begin processing packets already in vring */
+        event_notifier_set(&q->tx.host_notifier);
+    }
+
+    s->started = true;
+    trace_virtio_net_data_plane_start(s, queues);
+
+    /* Spawn threads in BH so they inherit iothread cpusets */
+    s->start_bh = qemu_bh_new(start_data_plane_bh, s);
+    qemu_bh_schedule(s->start_bh);
+    return true;
+}
+
+void virtio_net_data_plane_stop(VirtIONetDataPlane *s)
+{
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = s->queues * 2;
+    int i;
+
+    if (!s->started || s->stopping) {
+        return;
+    }
+    s->stopping = true;
+    trace_virtio_net_data_plane_stop(s);
+
+    /* Stop threads or cancel pending thread creation BH */
+    if (s->start_bh) {
+        qemu_bh_delete(s->start_bh);
+        s->start_bh = NULL;
+    } else {
+        for (i = 0; i < s->queues; i++) {
+            aio_notify(s->vqs[i].ctx);
+        }
+        for (i = 0; i < s->queues; i++) {
+            qemu_thread_join(&s->vqs[i].thread);
+        }
+    }
+
+    for (i = 0; i < s->queues; i++) {
+        VirtIONetDataPlaneQueue *q = &s->vqs[i];
+
+        aio_set_fd_handler(q->ctx, q->fd, NULL, NULL, NULL, NULL);
+        q->peer->info->poll(q->peer, true);
+
+        aio_set_event_notifier(q->ctx, &q->rx.host_notifier, NULL, NULL);
+        aio_set_event_notifier(q->ctx, &q->tx.host_notifier, NULL, NULL);
+        aio_context_unref(q->ctx);
+
+        /* A packet that tap did not accept is sent again by the device
+         * model.  A received packet still in rx_buf is dropped.
+         */
+        if (q->tx_head >= 0) {
+            q->tx.vring.last_avail_idx--;
+            q->tx_head = -1;
+        }
+    }
+    data_plane_release_host_notifiers(s, nvqs);
+
+    /* Clean up guest notifiers (irq) */
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+
+    data_plane_teardown_vrings(s, nvqs);
+
+    /* Transmit anything the guest queued after the last doorbell we saw */
+    for (i = 0; i < s->queues; i++) {
+        virtio_queue_notify(s->vdev, i * 2 + 1);
+    }
+
+    s->started = false;
+    s->stopping = false;
+}
+
+void virtio_net_data_plane_mask(VirtIONetDataPlane *s, int idx, bool mask)
+{
+    atomic_mb_set(&get_vq(s, idx)->masked, mask);
+}
+
+bool virtio_net_data_plane_pending(VirtIONetDataPlane *s, int idx)
+{
+    return event_notifier_test_and_clear(&get_vq(s, idx)->masked_notifier);
+}
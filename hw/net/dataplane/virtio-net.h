@@ -0,0 +1,24 @@
+/*
+ * Dedicated per-queue threads for virtio-net packet processing
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef HW_DATAPLANE_VIRTIO_NET_H
+#define HW_DATAPLANE_VIRTIO_NET_H
+
+#include "hw/virtio/virtio-net.h"
+
+typedef struct VirtIONetDataPlane VirtIONetDataPlane;
+
+bool virtio_net_data_plane_create(VirtIONet *n,
+                                  VirtIONetDataPlane **dataplane);
+void virtio_net_data_plane_destroy(VirtIONetDataPlane *s);
+bool virtio_net_data_plane_start(VirtIONetDataPlane *s, int queues);
+void virtio_net_data_plane_stop(VirtIONetDataPlane *s);
+void virtio_net_data_plane_mask(VirtIONetDataPlane *s, int idx, bool mask);
+bool virtio_net_data_plane_pending(VirtIONetDataPlane *s, int idx);
+
+#endif /* HW_DATAPLANE_VIRTIO_NET_H */
@@ -812,6 +812,9 @@ e1000_can_receive(NetClientState *nc)
 {
     E1000State *s = qemu_get_nic_opaque(nc);
 
+    /* RDT writes are coalesced; apply any the guest has queued since */
+    memory_region_flush_coalesced(&s->mmio);
+
     return (s->mac_reg[STATUS] & E1000_STATUS_LU) &&
         (s->mac_reg[RCTL] & E1000_RCTL_EN) && e1000_has_rxbufs(s, 1);
 }
@@ -15,6 +15,7 @@
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/gso.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -23,10 +24,13 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/qmp/qjson.h"
 #include "monitor/monitor.h"
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+# include "dataplane/virtio-net.h"
+# include "migration/migration.h"
+#endif
 
 #define VIRTIO_NET_VM_VERSION    11
 
-#define MAC_TABLE_ENTRIES    64
 #define MAX_VLAN    (1 << 12)   /* Per 802.1Q definition */
 
 /*
@@ -138,6 +142,70 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
     }
 }
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+static bool virtio_net_tx_in_flight(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        if (n->vqs[i].async_tx.elem.out_num) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void virtio_net_data_plane_status(VirtIONet *n, uint8_t status)
+{
+    NetClientState *nc = qemu_get_queue(n->nic);
+    int queues = n->multiqueue ? n->curr_queues : 1;
+    bool start;
+
+    if (!n->dataplane || n->vhost_started) {
+        return;
+    }
+
+    /* The data plane passes packets between tap and the guest unmodified,
+     * so both must use the same vnet header.  A packet the main loop still
+     * has queued on tap is completed there first, see
+     * virtio_net_tx_complete().
+     */
+    start = virtio_net_started(n, status) && !nc->peer->link_down &&
+            n->host_hdr_len == n->guest_hdr_len &&
+            !virtio_net_tx_in_flight(n);
+
+    if (n->dataplane_started == start &&
+        (!start || n->dataplane_queues == queues)) {
+        return;
+    }
+
+    if (n->dataplane_started) {
+        virtio_net_data_plane_stop(n->dataplane);
+        n->dataplane_started = false;
+    }
+    if (start) {
+        if (!virtio_net_data_plane_start(n->dataplane, queues)) {
+            error_report("unable to start virtio-net data plane: "
+                         "falling back on main loop");
+            return;
+        }
+        n->dataplane_started = true;
+        n->dataplane_queues = queues;
+    }
+}
+#endif
+
+/* Is packet processing offloaded from the main loop? */
+static bool virtio_net_backend_started(VirtIONet *n)
+{
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (n->dataplane_started) {
+        return true;
+    }
+#endif
+    return n->vhost_started;
+}
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -146,6 +214,9 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     uint8_t queue_status;
 
     virtio_net_vhost_status(n, status);
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    virtio_net_data_plane_status(n, status);
+#endif
 
     for (i = 0; i < n->max_queues; i++) {
         q = &n->vqs[i];
@@ -160,7 +231,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             continue;
         }
 
-        if (virtio_net_started(n, queue_status) && !n->vhost_started) {
+        if (virtio_net_started(n, queue_status) &&
+            !virtio_net_backend_started(n)) {
             if (q->tx_timer) {
                 qemu_mod_timer(q->tx_timer,
                                qemu_get_clock_ns(vm_clock) + n->tx_timeout);
@@ -194,6 +266,50 @@ static void virtio_net_set_link_status(NetClientState *nc)
     virtio_net_set_status(vdev, vdev->status);
 }
 
+static unsigned int virtio_net_mac_hash(const uint8_t *mac, int bits)
+{
+    uint32_t h = ldl_le_p(mac) ^ ((uint32_t)lduw_le_p(mac + 4) * 0x9e3779b1);
+
+    return (h * 0x9e3779b1) >> (32 - bits);
+}
+
+/* Rebuild the hash index after the MAC filter table was rewritten */
+static void virtio_net_mac_table_rehash(VirtIONet *n)
+{
+    unsigned int mask = (1U << n->mac_table.index_bits) - 1;
+    int i;
+
+    memset(n->mac_table.index, 0, (mask + 1) * sizeof(n->mac_table.index[0]));
+    for (i = 0; i < n->mac_table.in_use; i++) {
+        unsigned int h = virtio_net_mac_hash(&n->mac_table.macs[i * ETH_ALEN],
+                                             n->mac_table.index_bits);
+
+        while (n->mac_table.index[h]) {
+            h = (h + 1) & mask;
+        }
+        n->mac_table.index[h] = i + 1;
+    }
+}
+
+/* Look up @mac among the table entries [@start, @end) */
+static bool virtio_net_mac_table_find(VirtIONet *n, const uint8_t *mac,
+                                      int start, int end)
+{
+    unsigned int mask = (1U << n->mac_table.index_bits) - 1;
+    unsigned int h = virtio_net_mac_hash(mac, n->mac_table.index_bits);
+    int i;
+
+    while ((i = n->mac_table.index[h]) != 0) {
+        i--;
+        if (i >= start && i < end &&
+            !memcmp(mac, &n->mac_table.macs[i * ETH_ALEN], ETH_ALEN)) {
+            return true;
+        }
+        h = (h + 1) & mask;
+    }
+    return false;
+}
+
 static void rxfilter_notify(NetClientState *nc)
 {
     QObject *event_data;
@@ -312,7 +428,9 @@ static void virtio_net_reset(VirtIODevice *vdev)
     n->mac_table.first_multi = 0;
     n->mac_table.multi_overflow = 0;
     n->mac_table.uni_overflow = 0;
-    memset(n->mac_table.macs, 0, MAC_TABLE_ENTRIES * ETH_ALEN);
+    n->mac_table.multi_hash_valid = 0;
+    memset(n->mac_table.macs, 0, n->mac_table.size * ETH_ALEN);
+    virtio_net_mac_table_rehash(n);
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
     memset(n->vlans, 0, MAX_VLAN >> 3);
 }
@@ -419,11 +537,17 @@ static uint32_t virtio_net_get_features(VirtIODevice *vdev, uint32_t features)
 
     features |= (1 << VIRTIO_NET_F_MAC);
 
+    /* With x-sw-offload, host offloads (CSUM, HOST_TSO*, HOST_UFO) are
+     * always available: packets the peer cannot handle are segmented and
+     * checksummed in software on transmit, see virtio_net_needs_sw_offload().
+     */
     if (!peer_has_vnet_hdr(n)) {
-        features &= ~(0x1 << VIRTIO_NET_F_CSUM);
-        features &= ~(0x1 << VIRTIO_NET_F_HOST_TSO4);
-        features &= ~(0x1 << VIRTIO_NET_F_HOST_TSO6);
-        features &= ~(0x1 << VIRTIO_NET_F_HOST_ECN);
+        if (!n->net_conf.sw_offload) {
+            features &= ~(0x1 << VIRTIO_NET_F_CSUM);
+            features &= ~(0x1 << VIRTIO_NET_F_HOST_TSO4);
+            features &= ~(0x1 << VIRTIO_NET_F_HOST_TSO6);
+            features &= ~(0x1 << VIRTIO_NET_F_HOST_ECN);
+        }
 
         features &= ~(0x1 << VIRTIO_NET_F_GUEST_CSUM);
         features &= ~(0x1 << VIRTIO_NET_F_GUEST_TSO4);
@@ -433,7 +557,9 @@ static uint32_t virtio_net_get_features(VirtIODevice *vdev, uint32_t features)
 
     if (!peer_has_vnet_hdr(n) || !peer_has_ufo(n)) {
         features &= ~(0x1 << VIRTIO_NET_F_GUEST_UFO);
-        features &= ~(0x1 << VIRTIO_NET_F_HOST_UFO);
+        if (!n->net_conf.sw_offload) {
+            features &= ~(0x1 << VIRTIO_NET_F_HOST_UFO);
+        }
     }
 
     if (!nc->peer || nc->peer->info->type != NET_CLIENT_OPTIONS_KIND_TAP) {
@@ -613,7 +739,8 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
     n->mac_table.first_multi = 0;
     n->mac_table.uni_overflow = 0;
     n->mac_table.multi_overflow = 0;
-    memset(n->mac_table.macs, 0, MAC_TABLE_ENTRIES * ETH_ALEN);
+    n->mac_table.multi_hash_valid = 0;
+    memset(n->mac_table.macs, 0, n->mac_table.size * ETH_ALEN);
 
     s = iov_to_buf(iov, iov_cnt, 0, &mac_data.entries,
                    sizeof(mac_data.entries));
@@ -623,11 +750,12 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
     }
     iov_discard_front(&iov, &iov_cnt, s);
 
-    if (mac_data.entries * ETH_ALEN > iov_size(iov, iov_cnt)) {
+    /* entries is guest-controlled, divide rather than multiply */
+    if (mac_data.entries > iov_size(iov, iov_cnt) / ETH_ALEN) {
         goto error;
     }
 
-    if (mac_data.entries <= MAC_TABLE_ENTRIES) {
+    if (mac_data.entries <= n->mac_table.size) {
         s = iov_to_buf(iov, iov_cnt, 0, n->mac_table.macs,
                        mac_data.entries * ETH_ALEN);
         if (s != mac_data.entries * ETH_ALEN) {
@@ -651,26 +779,44 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
 
     iov_discard_front(&iov, &iov_cnt, s);
 
-    if (mac_data.entries * ETH_ALEN != iov_size(iov, iov_cnt)) {
+    if (mac_data.entries > iov_size(iov, iov_cnt) / ETH_ALEN ||
+        (size_t)mac_data.entries * ETH_ALEN != iov_size(iov, iov_cnt)) {
         goto error;
     }
 
-    if (n->mac_table.in_use + mac_data.entries <= MAC_TABLE_ENTRIES) {
-        s = iov_to_buf(iov, iov_cnt, 0, n->mac_table.macs,
+    if (n->mac_table.in_use + mac_data.entries <= n->mac_table.size) {
+        s = iov_to_buf(iov, iov_cnt, 0,
+                       &n->mac_table.macs[n->mac_table.in_use * ETH_ALEN],
                        mac_data.entries * ETH_ALEN);
         if (s != mac_data.entries * ETH_ALEN) {
             goto error;
         }
         n->mac_table.in_use += mac_data.entries;
     } else {
+        uint8_t mac[ETH_ALEN];
+        size_t i;
+
+        /* Fall back to an imperfect hash filter instead of allmulti */
         n->mac_table.multi_overflow = 1;
+        bitmap_zero(n->mac_table.multi_hash, VIRTIO_NET_MULTI_HASH_SIZE);
+        for (i = 0; i < mac_data.entries; i++) {
+            if (iov_to_buf(iov, iov_cnt, i * ETH_ALEN, mac, ETH_ALEN) !=
+                ETH_ALEN) {
+                goto error;
+            }
+            set_bit(virtio_net_mac_hash(mac, VIRTIO_NET_MULTI_HASH_BITS),
+                    n->mac_table.multi_hash);
+        }
+        n->mac_table.multi_hash_valid = 1;
     }
 
+    virtio_net_mac_table_rehash(n);
     rxfilter_notify(nc);
 
     return VIRTIO_NET_OK;
 
 error:
+    virtio_net_mac_table_rehash(n);
     rxfilter_notify(nc);
     return VIRTIO_NET_ERR;
 }
@@ -885,7 +1031,6 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     static const uint8_t bcast[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
     static const uint8_t vlan[] = {0x81, 0x00};
     uint8_t *ptr = (uint8_t *)buf;
-    int i;
 
     if (n->promisc)
         return 1;
@@ -903,15 +1048,16 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
             return !n->nobcast;
         } else if (n->nomulti) {
             return 0;
-        } else if (n->allmulti || n->mac_table.multi_overflow) {
+        } else if (n->allmulti) {
             return 1;
+        } else if (n->mac_table.multi_overflow) {
+            return !n->mac_table.multi_hash_valid ||
+                   test_bit(virtio_net_mac_hash(ptr, VIRTIO_NET_MULTI_HASH_BITS),
+                            n->mac_table.multi_hash);
         }
 
-        for (i = n->mac_table.first_multi; i < n->mac_table.in_use; i++) {
-            if (!memcmp(ptr, &n->mac_table.macs[i * ETH_ALEN], ETH_ALEN)) {
-                return 1;
-            }
-        }
+        return virtio_net_mac_table_find(n, ptr, n->mac_table.first_multi,
+                                         n->mac_table.in_use);
     } else { // unicast
         if (n->nouni) {
             return 0;
@@ -921,14 +1067,8 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
             return 1;
         }
 
-        for (i = 0; i < n->mac_table.first_multi; i++) {
-            if (!memcmp(ptr, &n->mac_table.macs[i * ETH_ALEN], ETH_ALEN)) {
-                return 1;
-            }
-        }
+        return virtio_net_mac_table_find(n, ptr, 0, n->mac_table.first_multi);
     }
-
-    return 0;
 }
 
 static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t size)
@@ -1046,6 +1186,25 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    /* The data plane waits for the main loop to go idle */
+    virtio_net_data_plane_status(n, vdev->status);
+#endif
+}
+
+/*
+ * Check whether the offloads requested by the guest for this packet have
+ * to be emulated before handing it to the peer.
+ */
+static bool virtio_net_needs_sw_offload(VirtIONet *n,
+                                        const struct virtio_net_hdr *hdr)
+{
+    if (!n->has_vnet_hdr) {
+        return net_gso_required(hdr);
+    }
+
+    return !n->has_ufo &&
+        (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) == VIRTIO_NET_HDR_GSO_UDP;
 }
 
 /* TX */
@@ -1072,33 +1231,45 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         unsigned int out_num = elem.out_num;
         struct iovec *out_sg = &elem.out_sg[0];
         struct iovec sg[VIRTQUEUE_MAX_SIZE];
+        struct virtio_net_hdr hdr;
 
         if (out_num < 1) {
             error_report("virtio-net header not in first element");
             exit(1);
         }
 
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
         len = n->guest_hdr_len;
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        if (iov_to_buf(out_sg, out_num, 0, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            virtio_net_needs_sw_offload(n, &hdr)) {
+            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg), out_sg, out_num,
+                                       n->guest_hdr_len, -1);
+
+            ret = qemu_sendv_packet_gso_async(
+                      qemu_get_subqueue(n->nic, queue_index), &hdr,
+                      n->host_hdr_len, sg, sg_num, virtio_net_tx_complete);
+        } else {
+            /*
+             * If host wants to see the guest header as is, we can
+             * pass it on unchanged. Otherwise, copy just the parts
+             * that host is interested in.
+             */
+            assert(n->host_hdr_len <= n->guest_hdr_len);
+            if (n->host_hdr_len != n->guest_hdr_len) {
+                unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                           out_sg, out_num,
+                                           0, n->host_hdr_len);
+                sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                                 out_sg, out_num,
+                                 n->guest_hdr_len, -1);
+                out_num = sg_num;
+                out_sg = sg;
+            }
+
+            ret = qemu_sendv_packet_async(
+                      qemu_get_subqueue(n->nic, queue_index),
+                      out_sg, out_num, virtio_net_tx_complete);
+        }
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
@@ -1330,12 +1501,12 @@ static int virtio_net_load(QEMUFile *f, void *opaque, int version_id)
 
     if (version_id >= 5) {
         n->mac_table.in_use = qemu_get_be32(f);
-        /* MAC_TABLE_ENTRIES may be different from the saved image */
-        if (n->mac_table.in_use <= MAC_TABLE_ENTRIES) {
+        /* The MAC table size may be different from the saved image */
+        if (n->mac_table.in_use <= n->mac_table.size) {
             qemu_get_buffer(f, n->mac_table.macs,
                             n->mac_table.in_use * ETH_ALEN);
         } else if (n->mac_table.in_use) {
-            uint8_t *buf = g_malloc0(n->mac_table.in_use);
+            uint8_t *buf = g_malloc0(n->mac_table.in_use * ETH_ALEN);
             qemu_get_buffer(f, buf, n->mac_table.in_use * ETH_ALEN);
             g_free(buf);
             n->mac_table.multi_overflow = n->mac_table.uni_overflow = 1;
@@ -1403,6 +1574,10 @@ static int virtio_net_load(QEMUFile *f, void *opaque, int version_id)
         }
     }
     n->mac_table.first_multi = i;
+    n->mac_table.multi_hash_valid = 0;
+    virtio_net_mac_table_rehash(n);
+    /* Let management program the filter on the destination host */
+    rxfilter_notify(qemu_get_queue(n->nic));
 
     /* nc.link_down can't be migrated, so infer link_down according
      * to link status bit in n->status */
@@ -1435,6 +1610,12 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (!n->vhost_started) {
+        assert(n->dataplane);
+        return virtio_net_data_plane_pending(n->dataplane, idx);
+    }
+#endif
     assert(n->vhost_started);
     return vhost_net_virtqueue_pending(tap_get_vhost_net(nc->peer), idx);
 }
@@ -1444,11 +1625,51 @@ static void virtio_net_guest_notifier_mask(VirtIODevice *vdev, int idx,
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (!n->vhost_started) {
+        assert(n->dataplane);
+        virtio_net_data_plane_mask(n->dataplane, idx, mask);
+        return;
+    }
+#endif
     assert(n->vhost_started);
     vhost_net_virtqueue_mask(tap_get_vhost_net(nc->peer),
                              vdev, idx, mask);
 }
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+/* Disable data plane threads during live migration since they do not
+ * update the dirty memory bitmap yet.
+ */
+static void virtio_net_migration_state_changed(Notifier *notifier, void *data)
+{
+    VirtIONet *n = container_of(notifier, VirtIONet,
+                                migration_state_notifier);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    MigrationState *mig = data;
+
+    if (migration_in_setup(mig)) {
+        if (!n->dataplane) {
+            return;
+        }
+        virtio_net_data_plane_destroy(n->dataplane);
+        n->dataplane = NULL;
+        n->dataplane_started = false;
+    } else if (migration_has_finished(mig) ||
+               migration_has_failed(mig)) {
+        if (n->dataplane) {
+            return;
+        }
+        virtio_net_data_plane_create(n, &n->dataplane);
+    } else {
+        return;
+    }
+
+    /* Hand the queues to whoever processes them now */
+    virtio_net_set_status(vdev, vdev->status);
+}
+#endif /* CONFIG_VIRTIO_NET_DATA_PLANE */
+
 void virtio_net_set_config_size(VirtIONet *n, uint32_t host_features)
 {
     int i, config_size = 0;
@@ -1548,12 +1769,41 @@ static int virtio_net_device_init(VirtIODevice *vdev)
 
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->nic_conf.macaddr.a);
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    if (!virtio_net_data_plane_create(n, &n->dataplane)) {
+        if (n->vqs[0].tx_timer) {
+            qemu_free_timer(n->vqs[0].tx_timer);
+        } else {
+            qemu_bh_delete(n->vqs[0].tx_bh);
+        }
+        qemu_del_nic(n->nic);
+        g_free(n->vqs);
+        virtio_cleanup(vdev);
+        return -1;
+    }
+    n->migration_state_notifier.notify = virtio_net_migration_state_changed;
+    add_migration_state_change_notifier(&n->migration_state_notifier);
+#endif
+
     n->vqs[0].tx_waiting = 0;
     n->tx_burst = n->net_conf.txburst;
     virtio_net_set_mrg_rx_bufs(n, 0);
     n->promisc = 1; /* for compatibility */
 
-    n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
+    n->mac_table.size = n->net_conf.mac_table_entries;
+    if (!n->mac_table.size || n->mac_table.size > VIRTIO_NET_MAC_TABLE_MAX) {
+        error_report("virtio-net: x-mac-table-entries must be between 1 and %d",
+                     VIRTIO_NET_MAC_TABLE_MAX);
+        error_report("Defaulting to %d", VIRTIO_NET_MAC_TABLE_ENTRIES);
+        n->mac_table.size = VIRTIO_NET_MAC_TABLE_ENTRIES;
+    }
+    n->mac_table.macs = g_malloc0(n->mac_table.size * ETH_ALEN);
+    /* Keep the hash index at most half full */
+    n->mac_table.index_bits = 1;
+    while ((1 << n->mac_table.index_bits) < 2 * n->mac_table.size) {
+        n->mac_table.index_bits++;
+    }
+    n->mac_table.index = g_new0(uint16_t, 1 << n->mac_table.index_bits);
 
     n->vlans = g_malloc0(MAX_VLAN >> 3);
 
@@ -1577,6 +1827,12 @@ static int virtio_net_device_exit(DeviceState *qdev)
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
 
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    remove_migration_state_change_notifier(&n->migration_state_notifier);
+    virtio_net_data_plane_destroy(n->dataplane);
+    n->dataplane = NULL;
+#endif
+
     unregister_savevm(qdev, "virtio-net", n);
 
     if (n->netclient_name) {
@@ -1589,6 +1845,7 @@ static int virtio_net_device_exit(DeviceState *qdev)
     }
 
     g_free(n->mac_table.macs);
+    g_free(n->mac_table.index);
     g_free(n->vlans);
 
     for (i = 0; i < n->max_queues; i++) {
@@ -1629,6 +1886,12 @@ static Property virtio_net_properties[] = {
                                                TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_UINT32("x-mac-table-entries", VirtIONet,
+                       net_conf.mac_table_entries, VIRTIO_NET_MAC_TABLE_ENTRIES),
+    DEFINE_PROP_BIT("x-sw-offload", VirtIONet, net_conf.sw_offload, 0, true),
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    DEFINE_PROP_BIT("x-data-plane", VirtIONet, net_conf.data_plane, 0, false),
+#endif
     DEFINE_PROP_END_OF_LIST(),
 };
 
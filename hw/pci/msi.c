@@ -20,6 +20,8 @@
 
 #include "hw/pci/msi.h"
 #include "qemu/range.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/kvm.h"
 
 /* Eventually those constants should go to Linux pci_regs.h */
 #define PCI_MSI_PENDING_32      0x10
@@ -269,6 +271,110 @@ static bool msi_is_masked(const PCIDevice *dev, unsigned int vector)
     return mask & (1U << vector);
 }
 
+struct PCIMSIIrqfd {
+    EventNotifier notifier;
+    MSIMessage msg;
+    int virq;               /* -1 until a KVM route is allocated */
+};
+
+static int msi_irqfd_setup(PCIMSIIrqfd *irqfd, MSIMessage msg)
+{
+    int virq, ret;
+
+    virq = kvm_irqchip_add_msi_route(kvm_state, msg);
+    if (virq < 0) {
+        return virq;
+    }
+    ret = event_notifier_init(&irqfd->notifier, 0);
+    if (ret < 0) {
+        goto fail_notifier;
+    }
+    ret = kvm_irqchip_add_irqfd_notifier(kvm_state, &irqfd->notifier, virq);
+    if (ret < 0) {
+        goto fail_irqfd;
+    }
+    irqfd->virq = virq;
+    irqfd->msg = msg;
+    return 0;
+
+fail_irqfd:
+    event_notifier_cleanup(&irqfd->notifier);
+fail_notifier:
+    kvm_irqchip_release_virq(kvm_state, virq);
+    return ret;
+}
+
+/*
+ * Deliver an MSI/MSI-X message through a KVM irqfd bound to a dedicated
+ * MSI route, so that signalling the vector is a single eventfd write
+ * instead of an emulated store to the interrupt controller.
+ *
+ * Routes are created on the first notification of each vector and
+ * retargeted whenever the guest has reprogrammed the message since.
+ * Returns false if the caller must inject @msg itself.
+ */
+bool msi_irqfd_notify(PCIDevice *dev, unsigned int vector, MSIMessage msg)
+{
+    PCIMSIIrqfd *irqfd;
+    unsigned int i;
+
+    if (!(dev->cap_present & QEMU_PCI_CAP_IRQFD) ||
+        !kvm_msi_via_irqfd_enabled() || dev->msi_irqfd_failed) {
+        return false;
+    }
+
+    if (!dev->msi_irqfd) {
+        dev->msi_irqfd_nr = MAX(dev->msix_entries_nr, PCI_MSI_VECTORS_MAX);
+        dev->msi_irqfd = g_new0(PCIMSIIrqfd, dev->msi_irqfd_nr);
+        for (i = 0; i < dev->msi_irqfd_nr; i++) {
+            dev->msi_irqfd[i].virq = -1;
+        }
+    }
+    if (vector >= dev->msi_irqfd_nr) {
+        return false;
+    }
+
+    irqfd = &dev->msi_irqfd[vector];
+    if (irqfd->virq < 0) {
+        if (msi_irqfd_setup(irqfd, msg) < 0) {
+            /* Out of GSIs or no kernel support: stay on the slow path
+             * until the next reset rather than retrying every time. */
+            dev->msi_irqfd_failed = true;
+            return false;
+        }
+    } else if (irqfd->msg.address != msg.address ||
+               irqfd->msg.data != msg.data) {
+        if (kvm_irqchip_update_msi_route(kvm_state, irqfd->virq, msg) < 0) {
+            return false;
+        }
+        irqfd->msg = msg;
+    }
+
+    event_notifier_set(&irqfd->notifier);
+    return true;
+}
+
+void msi_irqfd_release(PCIDevice *dev)
+{
+    PCIMSIIrqfd *irqfd;
+    unsigned int i;
+
+    for (i = 0; i < dev->msi_irqfd_nr; i++) {
+        irqfd = &dev->msi_irqfd[i];
+        if (irqfd->virq < 0) {
+            continue;
+        }
+        kvm_irqchip_remove_irqfd_notifier(kvm_state, &irqfd->notifier,
+                                          irqfd->virq);
+        kvm_irqchip_release_virq(kvm_state, irqfd->virq);
+        event_notifier_cleanup(&irqfd->notifier);
+    }
+    g_free(dev->msi_irqfd);
+    dev->msi_irqfd = NULL;
+    dev->msi_irqfd_nr = 0;
+    dev->msi_irqfd_failed = false;
+}
+
 void msi_notify(PCIDevice *dev, unsigned int vector)
 {
     uint16_t flags = pci_get_word(dev->config + msi_flags_off(dev));
@@ -291,6 +397,9 @@ void msi_notify(PCIDevice *dev, unsigned int vector)
                    "notify vector 0x%x"
                    " address: 0x%"PRIx64" data: 0x%"PRIx32"\n",
                    vector, msg.address, msg.data);
+    if (msi_irqfd_notify(dev, vector, msg)) {
+        return;
+    }
     stl_le_phys(msg.address, msg.data);
 }
 
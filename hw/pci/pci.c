@@ -35,6 +35,8 @@
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "exec/address-spaces.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/kvm.h"
 
 //#define DEBUG_PCI
 #ifdef DEBUG_PCI
@@ -57,6 +59,8 @@ static Property pci_props[] = {
                     QEMU_PCI_CAP_MULTIFUNCTION_BITNR, false),
     DEFINE_PROP_BIT("command_serr_enable", PCIDevice, cap_present,
                     QEMU_PCI_CAP_SERR_BITNR, true),
+    DEFINE_PROP_BIT("irqfd", PCIDevice, cap_present,
+                    QEMU_PCI_CAP_IRQFD_BITNR, true),
     DEFINE_PROP_END_OF_LIST()
 };
 
@@ -86,6 +90,8 @@ static const TypeInfo pcie_bus_info = {
 static PCIBus *pci_find_bus_nr(PCIBus *bus, int bus_num);
 static void pci_update_mappings(PCIDevice *d);
 static void pci_set_irq(void *opaque, int irq_num, int level);
+static void pci_intx_irqfd_release(PCIDevice *dev, bool keep_level);
+static void pci_intx_change_level(PCIDevice *dev, int pin, int change);
 static int pci_add_option_rom(PCIDevice *pdev, bool is_default_rom);
 static void pci_del_option_rom(PCIDevice *pdev);
 
@@ -180,6 +186,7 @@ void pci_device_reset(PCIDevice *dev)
     dev->irq_state = 0;
     pci_update_irq_status(dev);
     pci_device_deassert_intx(dev);
+    pci_intx_irqfd_release(dev, false);
     /* Clear all writable bits */
     pci_word_test_and_clear_mask(dev->config + PCI_COMMAND,
                                  pci_get_word(dev->wmask + PCI_COMMAND) |
@@ -206,6 +213,7 @@ void pci_device_reset(PCIDevice *dev)
 
     msi_reset(dev);
     msix_reset(dev);
+    msi_irqfd_release(dev);
 }
 
 /*
@@ -883,6 +891,9 @@ static PCIDevice *do_pci_register_device(PCIDevice *pci_dev, PCIBus *bus,
 
 static void do_pci_unregister_device(PCIDevice *pci_dev)
 {
+    pci_intx_irqfd_release(pci_dev, false);
+    g_free(pci_dev->intx_irqfd);
+    msi_irqfd_release(pci_dev);
     qemu_free_irqs(pci_dev->irq);
     pci_dev->bus->devices[pci_dev->devfn] = NULL;
     pci_config_free(pci_dev);
@@ -1099,6 +1110,7 @@ static void pci_update_mappings(PCIDevice *d)
     int i;
     pcibus_t new_addr;
 
+    memory_region_transaction_begin();
     for(i = 0; i < PCI_NUM_REGIONS; i++) {
         r = &d->io_regions[i];
 
@@ -1124,6 +1136,7 @@ static void pci_update_mappings(PCIDevice *d)
     }
 
     pci_update_vga(d);
+    memory_region_transaction_commit();
 }
 
 static inline int pci_irq_disabled(PCIDevice *d)
@@ -1141,7 +1154,7 @@ static void pci_update_irq_disabled(PCIDevice *d, int was_irq_disabled)
         return;
     for (i = 0; i < PCI_NUM_PINS; ++i) {
         int state = pci_irq_state(d, i);
-        pci_change_irq_level(d, i, disabled ? -state : state);
+        pci_intx_change_level(d, i, disabled ? -state : state);
     }
 }
 
@@ -1165,6 +1178,8 @@ void pci_default_write_config(PCIDevice *d, uint32_t addr, uint32_t val, int l)
         d->config[addr + i] = (d->config[addr + i] & ~wmask) | (val & wmask);
         d->config[addr + i] &= ~(val & w1cmask); /* W1C: Write 1 to Clear */
     }
+    /* Apply all BAR and bus master changes in a single topology update */
+    memory_region_transaction_begin();
     if (ranges_overlap(addr, l, PCI_BASE_ADDRESS_0, 24) ||
         ranges_overlap(addr, l, PCI_ROM_ADDRESS, 4) ||
         ranges_overlap(addr, l, PCI_ROM_ADDRESS1, 4) ||
@@ -1177,6 +1192,7 @@ void pci_default_write_config(PCIDevice *d, uint32_t addr, uint32_t val, int l)
                                   pci_get_word(d->config + PCI_COMMAND)
                                     & PCI_COMMAND_MASTER);
     }
+    memory_region_transaction_commit();
 
     msi_write_config(d, addr, val, l);
     msix_write_config(d, addr, val, l);
@@ -1185,6 +1201,182 @@ void pci_default_write_config(PCIDevice *d, uint32_t addr, uint32_t val, int l)
 /***********************************************************/
 /* generic PCI irq support */
 
+/*
+ * INTx through KVM irqfds.
+ *
+ * When the pin routes to a known GSI, an assertion is a write to the
+ * trigger eventfd and KVM keeps the line high until the guest EOIs it.
+ * KVM then lowers the line and signals the resample eventfd; if the pin
+ * is still asserted at that point it is simply triggered again.
+ * Deassertions therefore need no action at all.
+ *
+ * While a pin is backed by an irqfd its level is not accounted in the
+ * bus irq_count.  Releasing the irqfd (routing change, VM stop, reset)
+ * moves a pending level back to the emulated path, so that the state
+ * seen by migration is the same as without irqfds.
+ */
+struct PCIINTxIrqfd {
+    PCIDevice *dev;
+    int pin;
+    int gsi;
+    EventNotifier trigger;
+    EventNotifier resample;
+    bool enabled;
+    bool failed;
+};
+
+static void pci_intx_irqfd_resample(EventNotifier *n)
+{
+    PCIINTxIrqfd *irqfd = container_of(n, PCIINTxIrqfd, resample);
+    PCIDevice *dev = irqfd->dev;
+
+    if (!event_notifier_test_and_clear(n)) {
+        return;
+    }
+    if (pci_irq_state(dev, irqfd->pin) && !pci_irq_disabled(dev)) {
+        event_notifier_set(&irqfd->trigger);
+    }
+}
+
+static void pci_bus_release_intx_irqfds(PCIBus *bus)
+{
+    PCIBus *sec;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bus->devices); ++i) {
+        if (bus->devices[i]) {
+            pci_intx_irqfd_release(bus->devices[i], true);
+        }
+    }
+    QLIST_FOREACH(sec, &bus->child, sibling) {
+        pci_bus_release_intx_irqfds(sec);
+    }
+}
+
+/* Hand all INTx levels back to the emulated interrupt controllers before
+ * device state is saved; irqfds are set up again on the next assertion. */
+static void pci_intx_irqfd_vm_state_change(void *opaque, int running,
+                                           RunState state)
+{
+    PCIHostState *host_bridge;
+
+    if (running) {
+        return;
+    }
+    QLIST_FOREACH(host_bridge, &pci_host_bridges, next) {
+        pci_bus_release_intx_irqfds(host_bridge->bus);
+    }
+}
+
+static bool pci_intx_irqfd_enable(PCIDevice *dev, int pin)
+{
+    static bool vm_state_handler_added;
+    PCIINTxIrqfd *irqfd;
+    PCIINTxRoute route;
+    PCIBus *bus;
+
+    if (!(dev->cap_present & QEMU_PCI_CAP_IRQFD) || !kvm_irqfds_enabled() ||
+        !kvm_resamplefds_enabled()) {
+        return false;
+    }
+    if (dev->intx_irqfd && dev->intx_irqfd[pin].failed) {
+        return false;
+    }
+
+    /* Only host bridges that report their routing have a GSI to bind to */
+    for (bus = dev->bus; bus->parent_dev; bus = bus->parent_dev->bus) {
+        /* nothing */
+    }
+    if (!bus->route_intx_to_irq) {
+        return false;
+    }
+    route = pci_device_route_intx_to_irq(dev, pin);
+    if (route.mode != PCI_INTX_ENABLED) {
+        return false;
+    }
+
+    if (!dev->intx_irqfd) {
+        dev->intx_irqfd = g_new0(PCIINTxIrqfd, PCI_NUM_PINS);
+    }
+    irqfd = &dev->intx_irqfd[pin];
+    irqfd->dev = dev;
+    irqfd->pin = pin;
+    irqfd->gsi = route.irq;
+
+    if (event_notifier_init(&irqfd->trigger, 0) < 0) {
+        goto fail;
+    }
+    if (event_notifier_init(&irqfd->resample, 0) < 0) {
+        goto fail_resample;
+    }
+    if (kvm_irqchip_add_irqfd_notifier_resample(kvm_state, &irqfd->trigger,
+                                                &irqfd->resample,
+                                                irqfd->gsi) < 0) {
+        goto fail_irqfd;
+    }
+    event_notifier_set_handler(&irqfd->resample, pci_intx_irqfd_resample);
+    irqfd->enabled = true;
+
+    if (!vm_state_handler_added) {
+        qemu_add_vm_change_state_handler(pci_intx_irqfd_vm_state_change,
+                                         NULL);
+        vm_state_handler_added = true;
+    }
+    return true;
+
+fail_irqfd:
+    event_notifier_cleanup(&irqfd->resample);
+fail_resample:
+    event_notifier_cleanup(&irqfd->trigger);
+fail:
+    /* Don't retry on every assertion; a routing change clears this. */
+    irqfd->failed = true;
+    return false;
+}
+
+/* Tear down the INTx irqfds of @dev.  With @keep_level, pins that are
+ * still asserted are handed over to the emulated path. */
+static void pci_intx_irqfd_release(PCIDevice *dev, bool keep_level)
+{
+    PCIINTxIrqfd *irqfd;
+    int i;
+
+    if (!dev->intx_irqfd) {
+        return;
+    }
+    for (i = 0; i < PCI_NUM_PINS; ++i) {
+        irqfd = &dev->intx_irqfd[i];
+        irqfd->failed = false;
+        if (!irqfd->enabled) {
+            continue;
+        }
+        event_notifier_set_handler(&irqfd->resample, NULL);
+        /* KVM drops the line when the last resampler on the GSI goes */
+        kvm_irqchip_remove_irqfd_notifier(kvm_state, &irqfd->trigger,
+                                          irqfd->gsi);
+        event_notifier_cleanup(&irqfd->resample);
+        event_notifier_cleanup(&irqfd->trigger);
+        irqfd->enabled = false;
+
+        if (keep_level && pci_irq_state(dev, i) && !pci_irq_disabled(dev)) {
+            pci_change_irq_level(dev, i, 1);
+        }
+    }
+}
+
+/* Apply a level change of an enabled pin, through KVM if possible */
+static void pci_intx_change_level(PCIDevice *dev, int pin, int change)
+{
+    if ((dev->intx_irqfd && dev->intx_irqfd[pin].enabled) ||
+        (change > 0 && pci_intx_irqfd_enable(dev, pin))) {
+        if (change > 0) {
+            event_notifier_set(&dev->intx_irqfd[pin].trigger);
+        }
+        return;
+    }
+    pci_change_irq_level(dev, pin, change);
+}
+
 /* 0 <= irq_num <= 3. level must be 0 or 1 */
 static void pci_set_irq(void *opaque, int irq_num, int level)
 {
@@ -1199,7 +1391,7 @@ static void pci_set_irq(void *opaque, int irq_num, int level)
     pci_update_irq_status(pci_dev);
     if (pci_irq_disabled(pci_dev))
         return;
-    pci_change_irq_level(pci_dev, irq_num, change);
+    pci_intx_change_level(pci_dev, irq_num, change);
 }
 
 /* Special hooks used by device assignment */
@@ -1241,7 +1433,12 @@ void pci_bus_fire_intx_routing_notifier(PCIBus *bus)
 
     for (i = 0; i < ARRAY_SIZE(bus->devices); ++i) {
         dev = bus->devices[i];
-        if (dev && dev->intx_routing_notifier) {
+        if (!dev) {
+            continue;
+        }
+        /* irqfds bound to the old GSI are re-created on the next assert */
+        pci_intx_irqfd_release(dev, true);
+        if (dev->intx_routing_notifier) {
             dev->intx_routing_notifier(dev);
         }
     }
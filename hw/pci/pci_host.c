@@ -94,6 +94,9 @@ uint32_t pci_data_read(PCIBus *s, uint32_t addr, int len)
     return val;
 }
 
+/* The config address register only latches a value, so host bridges may
+ * dispatch it without the BQL; data accesses always run under it.
+ */
 static void pci_host_config_write(void *opaque, hwaddr addr,
                                   uint64_t val, unsigned len)
 {
@@ -80,6 +80,7 @@ struct VirtioCcwDevice {
     VirtIODevice *vdev;
     char *bus_id;
     uint32_t host_features[VIRTIO_CCW_FEATURE_SIZE];
+    VirtIOCoalesceConf coalesce;
     VirtioBusState bus;
     bool ioeventfd_started;
     bool ioeventfd_disabled;
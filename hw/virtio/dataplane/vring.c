@@ -90,12 +90,12 @@ bool vring_should_notify(VirtIODevice *vdev, Vring *vring)
      * interrupts. */
     smp_mb();
 
-    if ((vdev->guest_features & VIRTIO_F_NOTIFY_ON_EMPTY) &&
+    if ((vdev->guest_features & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)) &&
         unlikely(vring->vr.avail->idx == vring->last_avail_idx)) {
         return true;
     }
 
-    if (!(vdev->guest_features & VIRTIO_RING_F_EVENT_IDX)) {
+    if (!(vdev->guest_features & (1 << VIRTIO_RING_F_EVENT_IDX))) {
         return !(vring->vr.avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
     }
     old = vring->signalled_used;
@@ -336,14 +336,13 @@ int vring_pop(VirtIODevice *vdev, Vring *vring,
     return head;
 }
 
-/* After we've used one of their buffers, we tell them about it.
- *
- * Stolen from linux/drivers/vhost/vhost.c.
+/* Place a used buffer in the used ring without making it visible to the
+ * guest; @idx is the offset from the current used index.  Call
+ * vring_flush() to publish a batch of buffers at once.
  */
-void vring_push(Vring *vring, unsigned int head, int len)
+void vring_fill(Vring *vring, unsigned int head, int len, unsigned int idx)
 {
     struct vring_used_elem *used;
-    uint16_t new;
 
     /* Don't touch vring if a fatal error occurred */
     if (vring->broken) {
@@ -352,15 +351,37 @@ void vring_push(Vring *vring, unsigned int head, int len)
 
     /* The virtqueue contains a ring of used buffers.  Get a pointer to the
      * next entry in that used ring. */
-    used = &vring->vr.used->ring[vring->last_used_idx % vring->vr.num];
+    used = &vring->vr.used->ring[(uint16_t)(vring->last_used_idx + idx) %
+                                 vring->vr.num];
     used->id = head;
     used->len = len;
+}
+
+void vring_flush(Vring *vring, unsigned int count)
+{
+    uint16_t old, new;
+
+    if (vring->broken) {
+        return;
+    }
 
     /* Make sure buffer is written before we update index. */
     smp_wmb();
 
-    new = vring->vr.used->idx = ++vring->last_used_idx;
-    if (unlikely((int16_t)(new - vring->signalled_used) < (uint16_t)1)) {
+    old = vring->last_used_idx;
+    new = vring->vr.used->idx = vring->last_used_idx = old + count;
+    if (unlikely((int16_t)(new - vring->signalled_used) <
+                 (uint16_t)(new - old))) {
         vring->signalled_used_valid = false;
     }
 }
+
+/* After we've used one of their buffers, we tell them about it.
+ *
+ * Stolen from linux/drivers/vhost/vhost.c.
+ */
+void vring_push(Vring *vring, unsigned int head, int len)
+{
+    vring_fill(vring, head, len, 0);
+    vring_flush(vring, 1);
+}
@@ -32,6 +32,7 @@
 #include "sysemu/blockdev.h"
 #include "virtio-pci.h"
 #include "qemu/range.h"
+#include "qemu/main-loop.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/visitor.h"
 
@@ -201,9 +202,11 @@ static void virtio_pci_start_ioeventfd(VirtIOPCIProxy *proxy)
 {
     int n, r;
 
+    qemu_mutex_lock(&proxy->ioeventfd_lock);
     if (!(proxy->flags & VIRTIO_PCI_FLAG_USE_IOEVENTFD) ||
         proxy->ioeventfd_disabled ||
         proxy->ioeventfd_started) {
+        qemu_mutex_unlock(&proxy->ioeventfd_lock);
         return;
     }
 
@@ -218,6 +221,7 @@ static void virtio_pci_start_ioeventfd(VirtIOPCIProxy *proxy)
         }
     }
     proxy->ioeventfd_started = true;
+    qemu_mutex_unlock(&proxy->ioeventfd_lock);
     return;
 
 assign_error:
@@ -230,6 +234,7 @@ assign_error:
         assert(r >= 0);
     }
     proxy->ioeventfd_started = false;
+    qemu_mutex_unlock(&proxy->ioeventfd_lock);
     error_report("%s: failed. Fallback to a userspace (slower).", __func__);
 }
 
@@ -238,7 +243,9 @@ static void virtio_pci_stop_ioeventfd(VirtIOPCIProxy *proxy)
     int r;
     int n;
 
+    qemu_mutex_lock(&proxy->ioeventfd_lock);
     if (!proxy->ioeventfd_started) {
+        qemu_mutex_unlock(&proxy->ioeventfd_lock);
         return;
     }
 
@@ -251,6 +258,46 @@ static void virtio_pci_stop_ioeventfd(VirtIOPCIProxy *proxy)
         assert(r >= 0);
     }
     proxy->ioeventfd_started = false;
+    qemu_mutex_unlock(&proxy->ioeventfd_lock);
+}
+
+/* Kick the host notifier of queue @n directly if ioeventfd is active or a
+ * backend owns the queue, as the in-kernel ioeventfd would have done.  This
+ * needs neither the BQL nor the device.  Returns false if the notify must
+ * go through the device.
+ */
+static bool virtio_pci_notify_host_notifier(VirtIOPCIProxy *proxy, uint32_t n)
+{
+    bool done = false;
+
+    qemu_mutex_lock(&proxy->ioeventfd_lock);
+    if (n < VIRTIO_PCI_QUEUE_MAX &&
+        ((proxy->backend_notifiers & (1ULL << n)) ||
+         (proxy->ioeventfd_started && virtio_queue_get_num(proxy->vdev, n)))) {
+        VirtQueue *vq = virtio_get_queue(proxy->vdev, n);
+
+        event_notifier_set(virtio_queue_get_host_notifier(vq));
+        done = true;
+    }
+    qemu_mutex_unlock(&proxy->ioeventfd_lock);
+
+    return done;
+}
+
+static bool virtio_pci_lock(void)
+{
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+static void virtio_pci_unlock(bool release_lock)
+{
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 static void virtio_ioport_write(void *opaque, uint32_t addr, uint32_t val)
@@ -376,17 +423,35 @@ static uint32_t virtio_ioport_read(VirtIOPCIProxy *proxy, uint32_t addr)
     return ret;
 }
 
+/* The BAR is dispatched without the BQL.  Only plain register loads and
+ * queue notifies with ioeventfd active are handled without it; everything
+ * else runs the device code under the BQL.
+ */
 static uint64_t virtio_pci_config_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
     uint32_t config = VIRTIO_PCI_CONFIG(&proxy->pci_dev);
     uint64_t val = 0;
+    bool release_lock;
+
     if (addr < config) {
-        return virtio_ioport_read(proxy, addr);
+        switch (addr) {
+        case VIRTIO_PCI_HOST_FEATURES:
+        case VIRTIO_PCI_GUEST_FEATURES:
+        case VIRTIO_PCI_QUEUE_SEL:
+        case VIRTIO_PCI_STATUS:
+            return virtio_ioport_read(proxy, addr);
+        }
+        release_lock = virtio_pci_lock();
+        val = virtio_ioport_read(proxy, addr);
+        virtio_pci_unlock(release_lock);
+        return val;
     }
     addr -= config;
 
+    release_lock = virtio_pci_lock();
+
     switch (size) {
     case 1:
         val = virtio_config_readb(proxy->vdev, addr);
@@ -404,6 +469,7 @@ static uint64_t virtio_pci_config_read(void *opaque, hwaddr addr,
         }
         break;
     }
+    virtio_pci_unlock(release_lock);
     return val;
 }
 
@@ -412,11 +478,21 @@ static void virtio_pci_config_write(void *opaque, hwaddr addr,
 {
     VirtIOPCIProxy *proxy = opaque;
     uint32_t config = VIRTIO_PCI_CONFIG(&proxy->pci_dev);
+    bool release_lock;
+
     if (addr < config) {
+        if (addr == VIRTIO_PCI_QUEUE_NOTIFY &&
+            virtio_pci_notify_host_notifier(proxy, val)) {
+            return;
+        }
+        release_lock = virtio_pci_lock();
         virtio_ioport_write(proxy, addr, val);
+        virtio_pci_unlock(release_lock);
         return;
     }
     addr -= config;
+
+    release_lock = virtio_pci_lock();
     /*
      * Virtio-PCI is odd. Ioports are LE but config space is target native
      * endian.
@@ -438,6 +514,7 @@ static void virtio_pci_config_write(void *opaque, hwaddr addr,
         virtio_config_writel(proxy->vdev, addr, val);
         break;
     }
+    virtio_pci_unlock(release_lock);
 }
 
 static const MemoryRegionOps virtio_pci_config_ops = {
@@ -845,6 +922,7 @@ assign_error:
 static int virtio_pci_set_host_notifier(DeviceState *d, int n, bool assign)
 {
     VirtIOPCIProxy *proxy = to_virtio_pci_proxy(d);
+    int r;
 
     /* Stop using ioeventfd for virtqueue kick if the device starts using host
      * notifiers.  This makes it easy to avoid stepping on each others' toes.
@@ -857,7 +935,15 @@ static int virtio_pci_set_host_notifier(DeviceState *d, int n, bool assign)
      * currently only stops on status change away from ok,
      * reset, vmstop and such. If we do add code to start here,
      * need to check vmstate, device state etc. */
-    return virtio_pci_set_host_notifier_internal(proxy, n, assign, false);
+    qemu_mutex_lock(&proxy->ioeventfd_lock);
+    r = virtio_pci_set_host_notifier_internal(proxy, n, assign, false);
+    if (assign && r == 0) {
+        proxy->backend_notifiers |= 1ULL << n;
+    } else if (!assign) {
+        proxy->backend_notifiers &= ~(1ULL << n);
+    }
+    qemu_mutex_unlock(&proxy->ioeventfd_lock);
+    return r;
 }
 
 static void virtio_pci_vmstate_change(DeviceState *d, bool running)
@@ -895,6 +981,7 @@ static Property virtio_9p_pci_properties[] = {
                     VIRTIO_PCI_FLAG_USE_IOEVENTFD_BIT, true),
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors, 2),
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VIRTIO_9P_PROPERTIES(V9fsPCIState, vdev.fsconf),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -943,6 +1030,7 @@ static void virtio_pci_device_plugged(DeviceState *d)
     uint32_t size;
 
     proxy->vdev = bus->vdev;
+    virtio_set_coalesce(proxy->vdev, &proxy->coalesce);
 
     config = proxy->pci_dev.config;
     if (proxy->class_code) {
@@ -968,6 +1056,7 @@ static void virtio_pci_device_plugged(DeviceState *d)
 
     memory_region_init_io(&proxy->bar, OBJECT(proxy), &virtio_pci_config_ops,
                           proxy, "virtio-pci", size);
+    memory_region_clear_global_locking(&proxy->bar);
     pci_register_bar(&proxy->pci_dev, 0, PCI_BASE_ADDRESS_SPACE_IO,
                      &proxy->bar);
 
@@ -985,6 +1074,7 @@ static int virtio_pci_init(PCIDevice *pci_dev)
 {
     VirtIOPCIProxy *dev = VIRTIO_PCI(pci_dev);
     VirtioPCIClass *k = VIRTIO_PCI_GET_CLASS(pci_dev);
+    qemu_mutex_init(&dev->ioeventfd_lock);
     virtio_pci_bus_new(&dev->bus, dev);
     if (k->init != NULL) {
         return k->init(dev);
@@ -998,6 +1088,7 @@ static void virtio_pci_exit(PCIDevice *pci_dev)
     virtio_pci_stop_ioeventfd(proxy);
     memory_region_destroy(&proxy->bar);
     msix_uninit_exclusive_bar(pci_dev);
+    qemu_mutex_destroy(&proxy->ioeventfd_lock);
 }
 
 static void virtio_pci_reset(DeviceState *qdev)
@@ -1043,6 +1134,7 @@ static Property virtio_blk_pci_properties[] = {
     DEFINE_PROP_BIT("x-data-plane", VirtIOBlkPCI, blk.data_plane, 0, false),
 #endif
     DEFINE_VIRTIO_BLK_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VIRTIO_BLK_PROPERTIES(VirtIOBlkPCI, blk),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1097,6 +1189,7 @@ static Property virtio_scsi_pci_properties[] = {
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors,
                        DEV_NVECTORS_UNSPECIFIED),
     DEFINE_VIRTIO_SCSI_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VIRTIO_SCSI_PROPERTIES(VirtIOSCSIPCI, vdev.parent_obj.conf),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1166,6 +1259,7 @@ static Property vhost_scsi_pci_properties[] = {
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors,
                        DEV_NVECTORS_UNSPECIFIED),
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VHOST_SCSI_PROPERTIES(VHostSCSIPCI, vdev.parent_obj.conf),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1247,6 +1341,7 @@ static void balloon_pci_stats_set_poll_interval(Object *obj, struct Visitor *v,
 
 static Property virtio_balloon_pci_properties[] = {
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_PROP_HEX32("class", VirtIOPCIProxy, class_code, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1350,6 +1445,7 @@ static Property virtio_serial_pci_properties[] = {
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors, 2),
     DEFINE_PROP_HEX32("class", VirtIOPCIProxy, class_code, 0),
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VIRTIO_SERIAL_PROPERTIES(VirtIOSerialPCI, vdev.serial),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1390,7 +1486,12 @@ static Property virtio_net_properties[] = {
                     VIRTIO_PCI_FLAG_USE_IOEVENTFD_BIT, false),
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors, 3),
     DEFINE_VIRTIO_NET_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_NIC_PROPERTIES(VirtIONetPCI, vdev.nic_conf),
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    DEFINE_PROP_BIT("x-data-plane", VirtIONetPCI, vdev.net_conf.data_plane,
+                    0, false),
+#endif
     DEFINE_VIRTIO_NET_PROPERTIES(VirtIONetPCI, vdev.net_conf),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -1446,6 +1547,7 @@ static const TypeInfo virtio_net_pci_info = {
 
 static Property virtio_rng_pci_properties[] = {
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIOPCIProxy, host_features),
+    DEFINE_VIRTIO_COALESCE_PROPERTIES(VirtIOPCIProxy, coalesce),
     DEFINE_VIRTIO_RNG_PROPERTIES(VirtIORngPCI, vdev.conf),
     DEFINE_PROP_END_OF_LIST(),
 };
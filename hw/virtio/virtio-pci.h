@@ -88,8 +88,15 @@ struct VirtIOPCIProxy {
     uint32_t class_code;
     uint32_t nvectors;
     uint32_t host_features;
+    VirtIOCoalesceConf coalesce;
     bool ioeventfd_disabled;
     bool ioeventfd_started;
+    /* Queues whose host notifier a backend (vhost, data plane) assigned */
+    uint64_t backend_notifiers;
+    /* Protects ioeventfd_started, backend_notifiers and the host notifiers
+     * against the lockless queue notify path.
+     */
+    QemuMutex ioeventfd_lock;
     VirtIOIRQFD *vector_irqfd;
     int nvqs_with_notifiers;
     VirtioBusState bus;
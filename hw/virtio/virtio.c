@@ -17,6 +17,8 @@
 #include "qemu/error-report.h"
 #include "hw/virtio/virtio.h"
 #include "qemu/atomic.h"
+#include "qemu/timer.h"
+#include "qapi/visitor.h"
 #include "hw/virtio/virtio-bus.h"
 
 /*
@@ -86,6 +88,12 @@ struct VirtQueue
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
+
+    /* Notification coalescing */
+    QEMUTimer *notify_timer;
+    unsigned int notify_pending;    /* notifications held back */
+    int64_t notify_last;            /* vm_clock time of the last request */
+    int64_t notify_interval;        /* average time between requests */
 };
 
 /* virt queue functions */
@@ -564,6 +572,10 @@ void virtio_reset(void *opaque)
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
         vdev->vq[i].notification = true;
+        vdev->vq[i].notify_pending = 0;
+        if (vdev->vq[i].notify_timer) {
+            qemu_del_timer(vdev->vq[i].notify_timer);
+        }
     }
 }
 
@@ -738,6 +750,8 @@ void virtio_queue_set_vector(VirtIODevice *vdev, int n, uint16_t vector)
         vdev->vq[n].vector = vector;
 }
 
+static void virtio_notify_timer(void *opaque);
+
 VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
                             void (*handle_output)(VirtIODevice *, VirtQueue *))
 {
@@ -754,10 +768,22 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.num = queue_size;
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
+    vdev->vq[i].notify_timer = qemu_new_timer_ns(vm_clock, virtio_notify_timer,
+                                                 &vdev->vq[i]);
 
     return &vdev->vq[i];
 }
 
+static void virtio_queue_free_timer(VirtQueue *vq)
+{
+    if (vq->notify_timer) {
+        qemu_del_timer(vq->notify_timer);
+        qemu_free_timer(vq->notify_timer);
+        vq->notify_timer = NULL;
+    }
+    vq->notify_pending = 0;
+}
+
 void virtio_del_queue(VirtIODevice *vdev, int n)
 {
     if (n < 0 || n >= VIRTIO_PCI_QUEUE_MAX) {
@@ -765,6 +791,7 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
     }
 
     vdev->vq[n].vring.num = 0;
+    virtio_queue_free_timer(&vdev->vq[n]);
 }
 
 void virtio_irq(VirtQueue *vq)
@@ -810,17 +837,102 @@ static bool vring_notify(VirtIODevice *vdev, VirtQueue *vq)
     return !v || vring_need_event(vring_used_event(vq), new, old);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_notify_now(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (vq->notify_pending) {
+        vq->notify_pending = 0;
+        qemu_del_timer(vq->notify_timer);
+    }
+
     if (!vring_notify(vdev, vq)) {
         return;
     }
 
     trace_virtio_notify(vdev, vq);
+    vdev->notify_interrupts++;
     vdev->isr |= 0x01;
     virtio_notify_vector(vdev, vq->vector);
 }
 
+static void virtio_notify_timer(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    virtio_notify_now(vq->vdev, vq);
+}
+
+/* Decide whether a notification can be held back and merged with the
+ * following ones.  Requests that arrive further apart than the coalescing
+ * window are signalled right away, so an idle device keeps its latency.
+ * Under load the guest is notified once x-coalesce-frames requests are
+ * pending, or when the current request rate would have produced them,
+ * but never later than x-coalesce-usecs after the first one.
+ */
+static bool virtio_notify_coalesce(VirtIODevice *vdev, VirtQueue *vq)
+{
+    int64_t window = (int64_t)vdev->coalesce.usecs * SCALE_US;
+    int64_t now, delta, delay;
+
+    if (!window || !vq->notify_timer) {
+        return false;
+    }
+
+    now = qemu_get_clock_ns(vm_clock);
+    delta = MIN(now - vq->notify_last, window);
+    vq->notify_last = now;
+    vq->notify_interval += (delta - vq->notify_interval) / 8;
+
+    if (!vq->notify_pending &&
+        (delta >= window || vq->notify_interval >= window)) {
+        return false;
+    }
+
+    vq->notify_pending++;
+    if (vdev->coalesce.frames &&
+        vq->notify_pending >= vdev->coalesce.frames) {
+        return false;
+    }
+
+    if (vq->notify_pending == 1) {
+        delay = window;
+        if (vdev->coalesce.frames) {
+            delay = MIN(delay, vq->notify_interval * vdev->coalesce.frames);
+        }
+        qemu_mod_timer(vq->notify_timer, now + delay);
+    }
+    return true;
+}
+
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    vdev->notify_requests++;
+    if (virtio_notify_coalesce(vdev, vq)) {
+        return;
+    }
+
+    virtio_notify_now(vdev, vq);
+}
+
+/* Deliver notifications held back by coalescing */
+static void virtio_notify_flush(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        if (vdev->vq[i].notify_pending) {
+            virtio_notify_now(vdev, &vdev->vq[i]);
+        }
+    }
+}
+
+void virtio_set_coalesce(VirtIODevice *vdev, const VirtIOCoalesceConf *conf)
+{
+    vdev->coalesce = *conf;
+    if (!vdev->coalesce.usecs) {
+        virtio_notify_flush(vdev);
+    }
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -958,6 +1070,11 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
+    for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        virtio_queue_free_timer(&vdev->vq[i]);
+    }
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
     g_free(vdev->vq);
@@ -971,6 +1088,11 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     bool backend_run = running && (vdev->status & VIRTIO_CONFIG_S_DRIVER_OK);
     vdev->vm_running = running;
 
+    /* vm_clock stops with the VM, don't leave the guest waiting */
+    if (!running) {
+        virtio_notify_flush(vdev);
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -984,6 +1106,14 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     }
 }
 
+static void virtio_get_notify_stat(Object *obj, Visitor *v, void *opaque,
+                                   const char *name, Error **errp)
+{
+    uint64_t value = *(uint64_t *)opaque;
+
+    visit_type_uint64(v, &value, name, errp);
+}
+
 void virtio_init(VirtIODevice *vdev, const char *name,
                  uint16_t device_id, size_t config_size)
 {
@@ -1010,6 +1140,15 @@ void virtio_init(VirtIODevice *vdev, const char *name,
     }
     vdev->vmstate = qemu_add_vm_change_state_handler(virtio_vmstate_change,
                                                      vdev);
+
+    vdev->notify_requests = 0;
+    vdev->notify_interrupts = 0;
+    object_property_add(OBJECT(vdev), "x-notify-requests", "uint64",
+                        virtio_get_notify_stat, NULL, NULL,
+                        &vdev->notify_requests, NULL);
+    object_property_add(OBJECT(vdev), "x-notify-interrupts", "uint64",
+                        virtio_get_notify_stat, NULL, NULL,
+                        &vdev->notify_interrupts, NULL);
 }
 
 hwaddr virtio_queue_get_desc_addr(VirtIODevice *vdev, int n)
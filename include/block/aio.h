@@ -72,6 +72,22 @@ typedef struct AioContext {
 
     /* Thread pool for performing work and receiving completion callbacks */
     struct ThreadPool *thread_pool;
+
+    /* Adaptive busy polling before blocking, see aio_busy_poll().  Only
+     * touched by the thread that runs aio_poll() on this context.
+     */
+    int64_t poll_max_ns;    /* maximum polling time, 0 disables polling */
+    int64_t poll_ns;        /* current self-tuned polling time */
+    int64_t poll_grow;      /* polling time multiplier */
+    int64_t poll_shrink;    /* polling time divisor, 0 stops polling */
+    int64_t poll_end;       /* end of the last polling round */
+    uint64_t poll_hits;     /* polling rounds that found work */
+    uint64_t poll_misses;   /* polling rounds that timed out */
+    uint64_t poll_time_ns;  /* total time spent polling */
+    uint64_t sleep_time_ns; /* total time spent blocked after polling */
+
+    /* Link in the list of all AioContexts, for query-aio-poll */
+    QTAILQ_ENTRY(AioContext) next;
 } AioContext;
 
 /* Returns 1 if there are still outstanding AIO requests; 0 otherwise */
@@ -86,6 +102,17 @@ typedef int (AioFlushEventNotifierHandler)(EventNotifier *e);
  */
 AioContext *aio_context_new(void);
 
+/**
+ * aio_set_poll_defaults:
+ * @max_ns: Maximum busy polling time in nanoseconds, 0 disables polling.
+ * @grow: Factor by which the polling time grows, 0 selects the default.
+ * @shrink: Divisor by which the polling time shrinks, 0 stops polling
+ *          altogether when it was useless.
+ *
+ * Set the busy polling parameters of AioContexts created from now on.
+ */
+void aio_set_poll_defaults(int64_t max_ns, int64_t grow, int64_t shrink);
+
 /**
  * aio_context_ref:
  * @ctx: The AioContext to operate on.
@@ -214,6 +241,28 @@ void aio_set_fd_handler(AioContext *ctx,
                         IOHandler *io_write,
                         AioFlushHandler *io_flush,
                         void *opaque);
+
+/* Returns true if it found and processed work without blocking */
+typedef bool (AioPollHandler)(void *opaque);
+typedef bool (AioPollEventNotifierHandler)(EventNotifier *e);
+
+/* Attach a busy polling callback to a file descriptor already registered
+ * with aio_set_fd_handler.  Before blocking, aio_poll() spins on these
+ * callbacks for up to the context's current polling time.  Pass NULL to
+ * detach the callback.
+ */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollHandler *io_poll);
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollEventNotifierHandler *io_poll);
+
+/* Busy poll @ctx before blocking.  Returns true if a polling callback made
+ * progress, in which case the caller should not block.  *@start must be
+ * passed to aio_busy_poll_done() once the caller is done waiting, so that
+ * the polling time can adapt to the observed wakeup latency.
+ */
+bool aio_busy_poll(AioContext *ctx, int64_t *start);
+void aio_busy_poll_done(AioContext *ctx, int64_t start);
 #endif
 
 /* Register an event notifier and associated callbacks.  Behaves very similarly
@@ -249,6 +298,8 @@ void qemu_aio_set_fd_handler(int fd,
                              IOHandler *io_write,
                              AioFlushHandler *io_flush,
                              void *opaque);
+void qemu_aio_set_event_notifier_poll(EventNotifier *notifier,
+                                      AioPollEventNotifierHandler *io_poll);
 #endif
 
 #endif
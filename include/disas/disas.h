@@ -11,6 +11,11 @@ void target_disas(FILE *out, CPUArchState *env, target_ulong code,
 
 void monitor_disas(Monitor *mon, CPUArchState *env,
                    target_ulong pc, int nb_insn, int is_physical, int flags);
+/* Disassemble the @size bytes of guest code at virtual address @pc, as
+   seen by the CPU @env, into a newly allocated string; @flags as for
+   target_disas.  */
+char *target_disas_str(CPUArchState *env, target_ulong pc, target_ulong size,
+                       int flags);
 
 /* Look up symbol for debugging purpose.  Returns "" if unknown. */
 const char *lookup_symbol(target_ulong orig_addr);
@@ -445,6 +445,10 @@ extern ram_addr_t ram_size;
 /* RAM is allocated via umem for postcopy incoming mode */
 #define RAM_POSTCOPY_UMEM_MASK  (1 << 1)
 
+/* RAM is a shared mapping of block->fd, which can be passed to a new
+ * QEMU process on the same host (-mem-shared) */
+#define RAM_SHARED_MASK     (1 << 2)
+
 typedef struct RAMBlock {
     struct MemoryRegion *mr;
     uint8_t *host;
@@ -463,8 +467,11 @@ typedef struct RAMBlock {
 
 typedef struct RAMList {
     QemuMutex mutex;
-    /* Protected by the iothread lock.  */
-    uint8_t *phys_dirty;
+    /* One bitmap per DIRTY_MEMORY_* client, one bit per target page.
+     * Bits are set and cleared with atomic operations; the arrays are
+     * only reallocated with the iothread lock held.
+     */
+    unsigned long *dirty_memory[DIRTY_MEMORY_NUM];
     RAMBlock *mru_block;
     /* Protected by the ramlist lock.  */
     QTAILQ_HEAD(, RAMBlock) blocks;
@@ -474,6 +481,9 @@ extern RAMList ram_list;
 
 extern const char *mem_path;
 extern int mem_prealloc;
+extern int mem_shared;
+
+int qemu_ram_remap_fd(RAMBlock *block, int fd);
 
 /* Flags stored in the low bits of the TLB virtual address.  These are
    defined so that fast path ram access is all zeros.  */
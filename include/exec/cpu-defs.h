@@ -72,8 +72,25 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
+/* Initial number of entries in tlb_table.  The TLB of each MMU mode is
+   resized between CPU_TLB_DYN_MIN_BITS and CPU_TLB_DYN_MAX_BITS at flush
+   time, depending on its miss rate.  Only TCG backends that read the
+   index mask from env->tlb_desc support resizing; the others use
+   CPU_TLB_SIZE as an immediate.  */
 #define CPU_TLB_BITS 8
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_MAX_BITS 11
+#else
+#define CPU_TLB_DYN_MIN_BITS CPU_TLB_BITS
+#define CPU_TLB_DYN_MAX_BITS CPU_TLB_BITS
+#endif
+#define CPU_TLB_MAX_SIZE (1 << CPU_TLB_DYN_MAX_BITS)
+
+/* Fully associative TLB holding the entries last evicted from tlb_table,
+   searched before walking the guest page tables.  */
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -103,16 +120,40 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+typedef struct CPUTLBDesc {
+    /* (number of entries - 1) << CPU_TLB_ENTRY_BITS */
+    uintptr_t mask;
+    /* tlb_table misses since the last flush */
+    unsigned int n_misses;
+} CPUTLBDesc;
+
+#if CPU_TLB_DYN_MAX_BITS == CPU_TLB_BITS
+#define tlb_index(env, mmu_idx, addr) \
+    (((addr) >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1))
+#else
+#define tlb_index(env, mmu_idx, addr) \
+    (((addr) >> TARGET_PAGE_BITS) &                                     \
+     ((env)->tlb_desc[mmu_idx].mask >> CPU_TLB_ENTRY_BITS))
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_MAX_SIZE];              \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_MAX_SIZE];                       \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
     target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;
+    target_ulong tlb_flush_mask;                                        \
+    unsigned int vtlb_index;
+
+/* Preserved across CPU reset */
+#define CPU_COMMON_TLB_DESC \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];
 
 #else
 
 #define CPU_COMMON_TLB
+#define CPU_COMMON_TLB_DESC
 
 #endif
 
@@ -172,6 +213,8 @@ typedef struct CPUWatchpoint {
     QTAILQ_HEAD(watchpoints_head, CPUWatchpoint) watchpoints;            \
     CPUWatchpoint *watchpoint_hit;                                      \
                                                                         \
+    CPU_COMMON_TLB_DESC                                                 \
+                                                                        \
     /* Core interrupt code */                                           \
     sigjmp_buf jmp_env;                                                 \
     int exception_index;                                                \
@@ -42,6 +42,7 @@ typedef ram_addr_t tb_page_addr_t;
 
 struct TranslationBlock;
 typedef struct TranslationBlock TranslationBlock;
+typedef struct TBProfile TBProfile;
 
 /* XXX: make safe guess about sizes */
 #define MAX_OP_PER_INSTR 208
@@ -87,6 +88,10 @@ void QEMU_NORETURN cpu_io_recompile(CPUArchState *env, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUArchState *env, 
                               target_ulong pc, target_ulong cs_base, int flags,
                               int cflags);
+extern bool tb_profile_enabled;
+void tb_profile_set(bool enable);
+int tb_profile_top(TBProfile *top, int n);
+void tb_profile_slow_path(uintptr_t retaddr);
 void cpu_exec_init(CPUArchState *env);
 void QEMU_NORETURN cpu_loop_exit(CPUArchState *env1);
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc);
@@ -96,8 +101,11 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
                               int is_cpu_write_access);
 #if !defined(CONFIG_USER_ONLY)
 /* cputlb.c */
+void tlb_init(CPUArchState *env);
 void tlb_flush_page(CPUArchState *env, target_ulong addr);
 void tlb_flush(CPUArchState *env, int flush_global);
+bool tlb_victim_lookup(CPUArchState *env, int mmu_idx, target_ulong addr,
+                       size_t elt_ofs);
 void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
@@ -114,8 +122,8 @@ static inline void tlb_flush(CPUArchState *env, int flush_global)
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
+/* initial size of the physical PC hash table, it grows with the TB count */
 #define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
 
 /* estimated block size for TB allocation */
 /* XXX: use a per code average code fragment size and modulate it
@@ -133,6 +141,10 @@ static inline void tlb_flush(CPUArchState *env, int flush_global)
 #define USE_DIRECT_JUMP
 #endif
 
+/* Exits counted before a TB is considered hot, and longest superblock */
+#define TB_TRACE_THRESHOLD  128
+#define TB_TRACE_MAX_BLOCKS 8
+
 struct TranslationBlock {
     target_ulong pc;   /* simulated PC corresponding to this block (EIP + CS base) */
     target_ulong cs_base; /* CS base for this block */
@@ -166,24 +178,135 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* unlinked by tb_phys_invalidate(), but its code region is still live */
+    bool invalid;
+    /* code generated with its host addresses recorded in tcg_ctx.tb_relocs */
+    bool tc_relocs;
+
+    /* Superblocks.  A TB is first run unchained while its exits are
+       counted; once hot it is retranslated together with the blocks
+       that follow along its dominant exits.  trace_exits has one bit per
+       block telling which exit (0: branch taken, 1: fallthrough) leads
+       to the next block of the trace.  */
+    uint8_t trace_state;
+#define TB_TRACE_PROFILE 0
+#define TB_TRACE_DONE    1
+    uint8_t trace_len;
+    uint8_t trace_exits;
+    uint32_t exit_count[2];
+    target_ulong exit_pc[2];
+    /* Guest code of a superblock: block i spans [trace_range[i][0],
+       trace_range[i][1]) relative to pc.  Zero ranges for an ordinary
+       TB, which covers [pc, pc + size).  */
+    uint8_t nb_trace_ranges;
+    uint16_t trace_range[TB_TRACE_MAX_BLOCKS][2];
+
+    /* TCG profiler counters, updated by the generated code of blocks
+       translated while tb_profile_enabled was set, and the CPU that
+       translated it */
+    bool prof;
+    int prof_cpu_index;
+    uint64_t prof_exec_count;
+    uint64_t prof_helper_calls;
+    uint64_t prof_slow_path;
 };
 
 #include "exec/spinlock.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
 
 typedef struct TBContext TBContext;
+typedef struct TBHashTable TBHashTable;
+
+/* Buckets of the physical PC hash table.  Growing the table replaces the
+   whole structure so that a lookup always pairs the buckets with their
+   mask; the old one is kept on the retired list until the next tb_flush,
+   when no lookup can still be using it.  */
+struct TBHashTable {
+    unsigned int mask;
+    TBHashTable *retired_next;
+    TranslationBlock *buckets[];
+};
+
+/* A slice of the code buffer, together with the matching slice of tbs[].
+   TBs are allocated sequentially in the current region; when it fills up,
+   the least recently used region is emptied and becomes the current one.  */
+typedef struct TBRegion {
+    uint8_t *start;
+    uint8_t *end;
+    uint8_t *code_ptr;      /* end of the generated code, unless current */
+    int nb_tbs;
+    uint64_t last_use;
+} TBRegion;
+
+#define TB_RECOVERY_HITS 4096
+
+/* Execution profile of a guest block.  The counters of TBs that are
+   flushed or evicted while profiling are kept in a ring of these, so
+   that the profile outlives the translated code.  */
+struct TBProfile {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+    uint16_t size;
+    uint32_t icount;
+    int cpu_index;
+    /* guest code covered, as in TranslationBlock.trace_range */
+    uint8_t nb_ranges;
+    uint16_t ranges[TB_TRACE_MAX_BLOCKS][2];
+    uint64_t exec_count;
+    uint64_t helper_calls;
+    uint64_t slow_path;
+};
+
+#define TB_PROFILE_RING_SIZE 4096
 
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    TBRegion *regions;
+    int nb_regions;
+    int cur_region;
+    int region_max_blocks;
+    unsigned int region_bits;
+    uint64_t region_clock;
+    TBHashTable *tb_phys_hash;
+    TBHashTable *tb_phys_hash_retired;
+    int tb_phys_hash_count;
+    /* odd while hash chains are being relinked or shortened */
+    unsigned int tb_phys_hash_seq;
     int nb_tbs;
     /* any access to the tbs or the page table must use this lock */
+#if defined(CONFIG_USER_ONLY)
     spinlock_t tb_lock;
+#else
+    QemuMutex tb_lock;
+#endif
 
     /* statistics */
     int tb_flush_count;
+    int tb_region_evict_count;
     int tb_phys_invalidate_count;
 
+    /* Time needed to get back to a steady state after a flush or an
+       eviction, measured as TB_RECOVERY_HITS consecutive TB lookups that
+       did not need to translate.  */
+    int64_t tb_recovery_start;
+    int tb_recovery_hits;
+    int64_t tb_recovery_last;
+    int64_t tb_recovery_max;
+
+    /* superblock formation, see tb_trace_profile() */
+    bool traces;
+    int tb_trace_count;
+
+    /* TCG profiler: the TB being translated with counters, and the
+       profiles of retired TBs, oldest overwritten first */
+    TranslationBlock *prof_tb;
+    TBProfile *prof_ring;
+    unsigned int prof_ring_pos;
+    unsigned int prof_ring_count;
+
     int tb_invalidated_flag;
 };
 
@@ -202,13 +325,72 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+static inline uint64_t tb_hash_mix(uint64_t h, uint64_t v)
+{
+    h ^= v * 0x87c37b91114253d5ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0x4cf5ad432745937fULL;
+}
+
+/* Hash of everything that identifies a TB.  Aliased mappings of the same
+   code and blocks translated for different CPU modes end up in different
+   buckets instead of one long chain.  */
+static inline uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc,
+                                    target_ulong cs_base, uint64_t flags)
+{
+    uint64_t h;
+
+    h = tb_hash_mix(0, phys_pc);
+    h = tb_hash_mix(h, pc);
+    h = tb_hash_mix(h, cs_base);
+    h = tb_hash_mix(h, flags);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* The physical PC hash table can be searched without tb_lock:
+ *
+ *     do {
+ *         seq = tb_hash_read_begin(ctx);
+ *         ... walk the chain ...
+ *     } while (tb_hash_read_retry(ctx, seq));
+ *
+ * TB storage is never unmapped, so a walk that races with an update
+ * never faults, but it may follow a chain that is being relinked or
+ * reach a TB that is being unlinked.  Both bump the sequence count and
+ * a slot is only reused after its TB was unlinked (tb_free only backs
+ * out a TB that was never published), so the retry discards whatever
+ * such a walk found.
+ */
+static inline unsigned int tb_hash_read_begin(TBContext *ctx)
+{
+    unsigned int seq;
+
+    while ((seq = atomic_read(&ctx->tb_phys_hash_seq)) & 1) {
+        barrier();
+    }
+    smp_rmb();
+    return seq;
+}
+
+static inline int tb_hash_read_retry(TBContext *ctx, unsigned int seq)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    smp_rmb();
+    return atomic_read(&ctx->tb_phys_hash_seq) != seq;
 }
 
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUArchState *env);
+void tb_evict_region(CPUArchState *env);
+void tb_recovery_done(void);
+void tb_enable_traces(void);
+bool tb_trace_profile(TranslationBlock *tb, int n, TranslationBlock *next);
+void tb_gen_trace(CPUArchState *env, TranslationBlock *tb);
+void tb_lock(void);
+void tb_unlock(void);
+void tb_lock_reset(void);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 
 #if defined(USE_DIRECT_JUMP)
@@ -391,6 +573,12 @@ bool io_mem_write(struct MemoryRegion *mr, hwaddr addr,
 
 void tlb_fill(CPUArchState *env1, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
+void *tlb_vaddr_to_host_write(CPUArchState *env, target_ulong addr,
+                              int mmu_idx, uintptr_t retaddr,
+                              ram_addr_t *notdirty);
+void cpu_notdirty_write_begin(ram_addr_t ram_addr, unsigned size);
+void cpu_notdirty_write_end(CPUArchState *env, ram_addr_t ram_addr,
+                            target_ulong vaddr, unsigned size);
 
 #include "exec/softmmu_defs.h"
 
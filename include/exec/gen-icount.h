@@ -21,6 +21,10 @@ static inline void gen_tb_start(void)
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
     tcg_temp_free_i32(flag);
 
+    if (tcg_ctx.tb_ctx.prof_tb) {
+        tcg_gen_host_counter_inc(&tcg_ctx.tb_ctx.prof_tb->prof_exec_count);
+    }
+
     if (!use_icount)
         return;
 
@@ -26,6 +26,7 @@
 #include "qemu/queue.h"
 #include "qemu/int128.h"
 #include "qemu/notify.h"
+#include "qemu/thread.h"
 
 #define MAX_PHYS_ADDR_SPACE_BITS 62
 #define MAX_PHYS_ADDR            (((hwaddr)1 << MAX_PHYS_ADDR_SPACE_BITS) - 1)
@@ -33,13 +34,6 @@
 typedef struct MemoryRegionOps MemoryRegionOps;
 typedef struct MemoryRegionMmio MemoryRegionMmio;
 
-/* Must match *_DIRTY_FLAGS in cpu-all.h.  To be replaced with dynamic
- * registration.
- */
-#define DIRTY_MEMORY_VGA       0
-#define DIRTY_MEMORY_CODE      1
-#define DIRTY_MEMORY_MIGRATION 3
-
 struct MemoryRegionMmio {
     CPUReadMemoryFunc *read[3];
     CPUWriteMemoryFunc *write[3];
@@ -146,11 +140,13 @@ struct MemoryRegion {
     bool terminates;
     bool romd_mode;
     bool ram;
+    bool system_ram; /* Main guest RAM, laid out in NUMA node order */
     bool readonly; /* For RAM regions */
     bool enabled;
     bool rom_device;
     bool warning_printed; /* For reservations */
     bool flush_coalesced_mmio;
+    bool global_locking;
     MemoryRegion *alias;
     hwaddr alias_offset;
     unsigned priority;
@@ -206,12 +202,22 @@ struct AddressSpace {
     char *name;
     MemoryRegion *root;
     struct FlatView *current_map;
+    struct FlatView *next_map;
+    bool topology_changed;
     int ioeventfd_nb;
     struct MemoryRegionIoeventfd *ioeventfds;
     struct AddressSpaceDispatch *dispatch;
     struct AddressSpaceDispatch *next_dispatch;
     MemoryListener dispatch_listener;
 
+    /* Bounce buffers handed out by address_space_map() for non-RAM
+     * regions, and the clients waiting for some of them to be released.
+     */
+    QemuMutex map_lock;
+    hwaddr bounce_buffer_size;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    QTAILQ_HEAD(, MapClient) map_client_list;
+
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
 };
 
@@ -315,6 +321,24 @@ void memory_region_init_ram(MemoryRegion *mr,
                             const char *name,
                             uint64_t size);
 
+/**
+ * memory_region_init_system_ram:  Initialize the RAM memory region that
+ *                                 holds main guest RAM.
+ *
+ * Like memory_region_init_ram(), but the region is split over the guest
+ * NUMA nodes in node order, and bound to the host nodes given with
+ * -numa node,hostnode=.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @owner: the object that tracks the region's reference count
+ * @name: the name of the region.
+ * @size: size of the region.
+ */
+void memory_region_init_system_ram(MemoryRegion *mr,
+                                   struct Object *owner,
+                                   const char *name,
+                                   uint64_t size);
+
 /**
  * memory_region_init_ram_ptr:  Initialize RAM memory region from a
  *                              user-provided pointer.  Accesses into the
@@ -586,6 +610,42 @@ void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
  */
 bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
                                         hwaddr size, unsigned client);
+
+/**
+ * memory_region_sync_dirty_to_bitmap: Move the dirty bits of a client into
+ *                                     a bitmap.
+ *
+ * Atomically clears the @client dirty bits of the whole region and ORs them
+ * into @dest, which has one bit per target page indexed by ram_addr_t (like
+ * the migration bitmap).  This works a word at a time, so it is much
+ * cheaper than calling memory_region_test_and_clear_dirty() on every page.
+ *
+ * Returns the number of bits that were newly set in @dest.
+ *
+ * @mr: the RAM region being scanned.
+ * @dest: the bitmap receiving the dirty bits.
+ * @client: the user of the logging information, usually
+ *          %DIRTY_MEMORY_MIGRATION.
+ */
+uint64_t memory_region_sync_dirty_to_bitmap(MemoryRegion *mr,
+                                            unsigned long *dest,
+                                            unsigned client);
+
+/**
+ * memory_region_set_dirty_lebitmap: Mark pages dirty from a bitmap.
+ *
+ * Marks pages as dirty for all clients from a little endian bitmap with
+ * one bit per host page, such as the one returned by KVM_GET_DIRTY_LOG.
+ * Aligned bitmaps are merged a word at a time.
+ *
+ * @mr: the RAM region being dirtied.
+ * @addr: the address (relative to the start of the region) of the first
+ *        page described by @bitmap.
+ * @bitmap: the dirty bitmap.
+ * @pages: the number of host pages described by @bitmap.
+ */
+void memory_region_set_dirty_lebitmap(MemoryRegion *mr, hwaddr addr,
+                                      unsigned long *bitmap, uint64_t pages);
 /**
  * memory_region_sync_dirty_bitmap: Synchronize a region's dirty bitmap with
  *                                  any external TLBs (e.g. kvm)
@@ -663,6 +723,22 @@ void memory_region_add_coalescing(MemoryRegion *mr,
                                   hwaddr offset,
                                   uint64_t size);
 
+/**
+ * memory_region_del_coalescing: Disable memory coalescing for a sub-range of
+ *                               a region.
+ *
+ * Removes a range previously added with memory_region_add_coalescing(), after
+ * flushing any writes still queued for it.  @offset and @size must match the
+ * values passed when the range was added.
+ *
+ * @mr: the memory region to be updated.
+ * @offset: the start of the range within the region.
+ * @size: the size of the subrange.
+ */
+void memory_region_del_coalescing(MemoryRegion *mr,
+                                  hwaddr offset,
+                                  uint64_t size);
+
 /**
  * memory_region_clear_coalescing: Disable MMIO coalescing for the region.
  *
@@ -686,6 +762,20 @@ void memory_region_clear_coalescing(MemoryRegion *mr);
  */
 void memory_region_set_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_flush_coalesced: Apply pending coalesced writes to a region.
+ *
+ * Coalescing lets a device take writes to registers it only consumes lazily,
+ * such as ring head or tail doorbells, without a synchronous exit for each
+ * of them.  The ->write callbacks for such registers are delayed until the
+ * next access to the region, so the device must call this service before
+ * it looks at the state they update, e.g. before checking for free ring
+ * entries.  Does nothing if the region has no coalesced ranges.
+ *
+ * @mr: the memory region whose pending writes are applied.
+ */
+void memory_region_flush_coalesced(MemoryRegion *mr);
+
 /**
  * memory_region_clear_flush_coalesced: Disable memory coalescing flush before
  *                                      accesses.
@@ -699,6 +789,31 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_set_global_locking: Declares the access processing requires
+ *                                   the BQL.
+ *
+ * This is the default for all regions: accesses that arrive without the
+ * BQL held, such as MMIO and PIO exits of KVM vCPUs, take it around the
+ * call to the region's callbacks.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_set_global_locking(MemoryRegion *mr);
+
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the BQL.
+ *
+ * The region's callbacks may then run concurrently on several vCPU threads
+ * and concurrently with the main loop, with or without the BQL held.  They
+ * must either be safe against that or take the BQL themselves, using
+ * qemu_mutex_iothread_locked() to find out whether the caller holds it.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -1029,9 +1144,11 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
  *
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL if resources needed to perform the mapping are exhausted.
+ * Non-RAM regions are accessed through bounce buffers; the total size of
+ * the bounce buffers mapped at a time is capped per address space.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -1041,6 +1158,20 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
 void *address_space_map(AddressSpace *as, hwaddr addr,
                         hwaddr *plen, bool is_write);
 
+/* address_space_register_map_client: wait for bounce buffers to be released
+ *
+ * @callback is invoked once, the next time a bounce buffer of @as is
+ * unmapped.  Waiters are called back in the order they registered.
+ * If bounce buffer space is already available again, @callback is
+ * invoked before this function returns.
+ *
+ * @as: #AddressSpace whose address_space_map() failed
+ * @opaque: opaque pointer passed to @callback
+ * @callback: function to be called
+ */
+void *address_space_register_map_client(AddressSpace *as, void *opaque,
+                                        void (*callback)(void *opaque));
+
 /* address_space_unmap: Unmaps a memory region previously mapped by address_space_map()
  *
  * Will also mark the memory as dirty if @is_write == %true.  @access_len gives
@@ -225,7 +225,23 @@ void pvpanic_init(ISABus *bus);
 
 int e820_add_entry(uint64_t, uint64_t, uint32_t);
 
+#define PC_COMPAT_1_6 \
+        {\
+            .driver   = "virtio-net-pci",\
+            .property = "x-sw-offload",\
+            .value    = "off",\
+        },{\
+            .driver   = "virtio-net-pci",\
+            .property = "x-mac-table-entries",\
+            .value    = stringify(64),\
+        },{\
+            .driver   = TYPE_PCI_DEVICE,\
+            .property = "irqfd",\
+            .value    = "off",\
+        }
+
 #define PC_COMPAT_1_5 \
+        PC_COMPAT_1_6, \
         {\
             .driver   = "Conroe-" TYPE_X86_CPU,\
             .property = "model",\
@@ -39,6 +39,8 @@ int msi_init(struct PCIDevice *dev, uint8_t offset,
 void msi_uninit(struct PCIDevice *dev);
 void msi_reset(PCIDevice *dev);
 void msi_notify(PCIDevice *dev, unsigned int vector);
+bool msi_irqfd_notify(PCIDevice *dev, unsigned int vector, MSIMessage msg);
+void msi_irqfd_release(PCIDevice *dev);
 void msi_write_config(PCIDevice *dev, uint32_t addr, uint32_t val, int len);
 unsigned int msi_nr_vectors_allocated(const PCIDevice *dev);
 
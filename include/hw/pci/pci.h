@@ -157,6 +157,9 @@ enum {
     QEMU_PCI_CAP_SHPC = (1 << QEMU_PCI_SHPC_BITNR),
 #define QEMU_PCI_SLOTID_BITNR 6
     QEMU_PCI_CAP_SLOTID = (1 << QEMU_PCI_SLOTID_BITNR),
+    /* deliver INTx and MSI through KVM irqfds when possible */
+#define QEMU_PCI_CAP_IRQFD_BITNR 7
+    QEMU_PCI_CAP_IRQFD = (1 << QEMU_PCI_CAP_IRQFD_BITNR),
 };
 
 #define TYPE_PCI_DEVICE "pci-device"
@@ -208,6 +211,9 @@ typedef struct PCIDeviceClass {
     const char *romfile;
 } PCIDeviceClass;
 
+typedef struct PCIINTxIrqfd PCIINTxIrqfd;
+typedef struct PCIMSIIrqfd PCIMSIIrqfd;
+
 typedef void (*PCIINTxRoutingNotifier)(PCIDevice *dev);
 typedef int (*MSIVectorUseNotifier)(PCIDevice *dev, unsigned int vector,
                                       MSIMessage msg);
@@ -257,6 +263,10 @@ struct PCIDevice {
     /* Current IRQ levels.  Used internally by the generic PCI code.  */
     uint8_t irq_state;
 
+    /* KVM irqfd + resamplefd pairs carrying INTx levels, one per pin.
+     * Allocated on the first assertion that can be routed to a GSI. */
+    PCIINTxIrqfd *intx_irqfd;
+
     /* Capability bits */
     uint32_t cap_present;
 
@@ -284,6 +294,12 @@ struct PCIDevice {
     /* Offset of MSI capability in config space */
     uint8_t msi_cap;
 
+    /* KVM MSI routes and irqfds, one per MSI/MSI-X vector, set up lazily
+     * by msi_notify()/msix_notify() */
+    PCIMSIIrqfd *msi_irqfd;
+    unsigned int msi_irqfd_nr;
+    bool msi_irqfd_failed;
+
     /* PCI Express */
     PCIExpressDevice exp;
 
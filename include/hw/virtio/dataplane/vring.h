@@ -57,6 +57,8 @@ bool vring_should_notify(VirtIODevice *vdev, Vring *vring);
 int vring_pop(VirtIODevice *vdev, Vring *vring,
               struct iovec iov[], struct iovec *iov_end,
               unsigned int *out_num, unsigned int *in_num);
+void vring_fill(Vring *vring, unsigned int head, int len, unsigned int idx);
+void vring_flush(Vring *vring, unsigned int count);
 void vring_push(Vring *vring, unsigned int head, int len);
 
 #endif /* VRING_H */
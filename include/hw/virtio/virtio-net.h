@@ -16,6 +16,7 @@
 
 #include "hw/virtio/virtio.h"
 #include "hw/pci/pci.h"
+#include "qemu/bitops.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -70,8 +71,19 @@ typedef struct virtio_net_conf
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    uint32_t data_plane;
+    uint32_t mac_table_entries;
+    uint32_t sw_offload;
 } virtio_net_conf;
 
+/* Default and maximum number of entries in the MAC filter table */
+#define VIRTIO_NET_MAC_TABLE_ENTRIES    1024
+#define VIRTIO_NET_MAC_TABLE_MAX        16384
+
+/* Number of bins in the imperfect multicast filter used on table overflow */
+#define VIRTIO_NET_MULTI_HASH_BITS      9
+#define VIRTIO_NET_MULTI_HASH_SIZE      (1 << VIRTIO_NET_MULTI_HASH_BITS)
+
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 << 10))
 
@@ -154,6 +166,8 @@ typedef struct VirtIONetQueue {
     struct VirtIONet *n;
 } VirtIONetQueue;
 
+struct VirtIONetDataPlane;
+
 typedef struct VirtIONet {
     VirtIODevice parent_obj;
     uint8_t mac[ETH_ALEN];
@@ -175,12 +189,25 @@ typedef struct VirtIONet {
     uint8_t nouni;
     uint8_t nobcast;
     uint8_t vhost_started;
+#ifdef CONFIG_VIRTIO_NET_DATA_PLANE
+    Notifier migration_state_notifier;
+    struct VirtIONetDataPlane *dataplane;
+    bool dataplane_started;
+    int dataplane_queues;
+#endif
     struct {
         int in_use;
         int first_multi;
         uint8_t multi_overflow;
         uint8_t uni_overflow;
         uint8_t *macs;
+        int size;
+        /* Open addressed hash of macs, slots hold index + 1 or 0 if free */
+        uint16_t *index;
+        int index_bits;
+        /* Set if multi_hash covers all multicast addresses on overflow */
+        uint8_t multi_hash_valid;
+        unsigned long multi_hash[BITS_TO_LONGS(VIRTIO_NET_MULTI_HASH_SIZE)];
     } mac_table;
     uint32_t *vlans;
     virtio_net_conf net_conf;
@@ -268,7 +295,10 @@ struct virtio_net_ctrl_mq {
 #define DEFINE_VIRTIO_NET_PROPERTIES(_state, _field)                           \
     DEFINE_PROP_UINT32("x-txtimer", _state, _field.txtimer, TX_TIMER_INTERVAL),\
     DEFINE_PROP_INT32("x-txburst", _state, _field.txburst, TX_BURST),          \
-    DEFINE_PROP_STRING("tx", _state, _field.tx)
+    DEFINE_PROP_STRING("tx", _state, _field.tx),                               \
+    DEFINE_PROP_UINT32("x-mac-table-entries", _state, _field.mac_table_entries,\
+                       VIRTIO_NET_MAC_TABLE_ENTRIES),                          \
+    DEFINE_PROP_BIT("x-sw-offload", _state, _field.sw_offload, 0, true)
 
 void virtio_net_set_config_size(VirtIONet *n, uint32_t host_features);
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -104,6 +104,12 @@ typedef struct VirtQueueElement
 #define VIRTIO_DEVICE(obj) \
         OBJECT_CHECK(VirtIODevice, (obj), TYPE_VIRTIO_DEVICE)
 
+/* Guest notification (interrupt) coalescing, see virtio_notify() */
+typedef struct VirtIOCoalesceConf {
+    uint32_t usecs;     /* longest delay of a notification, 0 disables */
+    uint32_t frames;    /* notify as soon as this many are pending */
+} VirtIOCoalesceConf;
+
 struct VirtIODevice
 {
     DeviceState parent_obj;
@@ -121,6 +127,9 @@ struct VirtIODevice
     bool vm_running;
     VMChangeStateEntry *vmstate;
     char *bus_name;
+    VirtIOCoalesceConf coalesce;
+    uint64_t notify_requests;       /* virtio_notify() calls */
+    uint64_t notify_interrupts;     /* notifications sent to the guest */
 };
 
 typedef struct VirtioDeviceClass {
@@ -155,6 +164,8 @@ void virtio_cleanup(VirtIODevice *vdev);
 /* Set the child bus name. */
 void virtio_device_set_child_bus_name(VirtIODevice *vdev, char *bus_name);
 
+void virtio_set_coalesce(VirtIODevice *vdev, const VirtIOCoalesceConf *conf);
+
 VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
                             void (*handle_output)(VirtIODevice *,
                                                   VirtQueue *));
@@ -227,6 +238,10 @@ typedef struct VirtIORNGConf VirtIORNGConf;
 	DEFINE_PROP_BIT("event_idx", _state, _field, \
 			VIRTIO_RING_F_EVENT_IDX, true)
 
+#define DEFINE_VIRTIO_COALESCE_PROPERTIES(_state, _field) \
+    DEFINE_PROP_UINT32("x-coalesce-usecs", _state, _field.usecs, 0), \
+    DEFINE_PROP_UINT32("x-coalesce-frames", _state, _field.frames, 0)
+
 hwaddr virtio_queue_get_desc_addr(VirtIODevice *vdev, int n);
 hwaddr virtio_queue_get_avail_addr(VirtIODevice *vdev, int n);
 hwaddr virtio_queue_get_used_addr(VirtIODevice *vdev, int n);
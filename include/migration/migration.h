@@ -134,6 +134,7 @@ uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_transferred(void);
 uint64_t ram_bytes_total(void);
+bool ram_save_fds_passed(void);
 
 void acct_update_position(QEMUFile *f, size_t size, bool zero);
 
@@ -173,6 +174,7 @@ bool migrate_postcopy_outgoing_rdma_compress(void);
 
 bool migrate_rdma_pin_all(void);
 bool migrate_zero_blocks(void);
+bool migrate_local_ram_fds(void);
 
 bool migrate_auto_converge(void);
 
@@ -58,6 +58,16 @@ typedef int (QEMUFileGetFD)(void *opaque);
 typedef ssize_t (QEMUFileWritevBufferFunc)(void *opaque, struct iovec *iov,
                                            int iovcnt, int64_t pos);
 
+/* Pass a file descriptor to the peer out of band (SCM_RIGHTS).  It is
+ * attached to a single marker byte that the reader must consume before
+ * collecting the descriptor with QEMUFileRecvFDFunc.
+ */
+typedef int (QEMUFileSendFDFunc)(void *opaque, int fd);
+
+/* Return the oldest descriptor received out of band, or -1 if none.
+ */
+typedef int (QEMUFileRecvFDFunc)(void *opaque);
+
 /*
  * This function provides hooks around different
  * stages of RAM migration.
@@ -88,6 +98,8 @@ typedef struct QEMUFileOps {
     QEMUFileCloseFunc *close;
     QEMUFileGetFD *get_fd;
     QEMUFileWritevBufferFunc *writev_buffer;
+    QEMUFileSendFDFunc *send_fd;
+    QEMUFileRecvFDFunc *recv_fd;
     QEMURamHookFunc *before_ram_iterate;
     QEMURamHookFunc *after_ram_iterate;
     QEMURamHookFunc *hook_ram_load;
@@ -156,6 +168,8 @@ int qemu_file_get_error(QEMUFile *f);
 void qemu_file_set_error(QEMUFile *f, int ret);
 void qemu_file_set_thread(QEMUFile *f, bool thread);
 void qemu_fflush(QEMUFile *f);
+int qemu_file_send_fd(QEMUFile *f, int fd);
+int qemu_file_recv_fd(QEMUFile *f);
 
 static inline void qemu_put_be64s(QEMUFile *f, const uint64_t *pv)
 {
@@ -0,0 +1,58 @@
+/*
+ * QEMU software segmentation and checksum offload
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+#include "qemu-common.h"
+#include "net/tap.h"
+
+/* Largest L2 + L3 + L4 header block that will be segmented in software */
+#define NET_GSO_MAX_HDR_LEN 256
+
+typedef void (NetGSOSegmentFunc)(const uint8_t *buf, size_t size, bool last,
+                                 void *opaque);
+
+/**
+ * net_gso_required: check whether a packet needs software offload
+ *
+ * Returns true if the packet described by @hdr is a GSO frame or carries
+ * a partial checksum, i.e. if it cannot be handed as-is to a peer that
+ * does not understand virtio_net_hdr.
+ *
+ * @hdr: virtio-net header accompanying the packet
+ */
+static inline bool net_gso_required(const struct virtio_net_hdr *hdr)
+{
+    return hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE ||
+           (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM);
+}
+
+/**
+ * net_gso_segment: perform GSO and checksum offload in software
+ *
+ * Completes the partial checksum requested by @hdr and splits TSO (IPv4
+ * and IPv6) frames into gso_size sized TCP segments and UFO frames into
+ * IPv4 fragments.  Each resulting frame is passed to @func, the last one
+ * with @last set.  Frames whose headers cannot be parsed are passed on
+ * unmodified.
+ *
+ * Returns the number of frames passed to @func; frames larger than the
+ * maximum IP datagram are dropped and 0 is returned.
+ *
+ * @hdr: virtio-net header accompanying the packet
+ * @iov: packet data, starting with the ethernet header
+ * @iovcnt: number of elements in @iov
+ * @func: callback invoked for every resulting frame
+ * @opaque: opaque pointer passed to @func
+ */
+int net_gso_segment(const struct virtio_net_hdr *hdr,
+                    const struct iovec *iov, int iovcnt,
+                    NetGSOSegmentFunc *func, void *opaque);
+
+#endif /* QEMU_NET_GSO_H */
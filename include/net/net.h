@@ -113,6 +113,12 @@ ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
                           int iovcnt);
 ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
                                 int iovcnt, NetPacketSent *sent_cb);
+struct virtio_net_hdr;
+ssize_t qemu_sendv_packet_gso_async(NetClientState *nc,
+                                    const struct virtio_net_hdr *hdr,
+                                    size_t vnet_hdr_len,
+                                    const struct iovec *iov, int iovcnt,
+                                    NetPacketSent *sent_cb);
 void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
@@ -36,6 +36,11 @@
  * bitmap_full(src, nbits)			Are all bits set in *src?
  * bitmap_set(dst, pos, nbits)			Set specified bit area
  * bitmap_clear(dst, pos, nbits)		Clear specified bit area
+ * bitmap_set_atomic(dst, pos, nbits)		Set specified bit area with atomic ops
+ * bitmap_test_and_clear_atomic(dst, pos, nbits)	Atomically clear area,
+ *						return whether any bit was set
+ * bitmap_move_atomic(dst, src, pos, nbits)	Atomically clear area of src,
+ *						OR it into dst, count new bits
  * bitmap_find_next_zero_area(buf, len, pos, n, mask)	Find bit free area
  */
 
@@ -213,6 +218,10 @@ static inline int bitmap_intersects(const unsigned long *src1,
 
 void bitmap_set(unsigned long *map, int i, int len);
 void bitmap_clear(unsigned long *map, int start, int nr);
+void bitmap_set_atomic(unsigned long *map, long start, long nr);
+bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr);
+long bitmap_move_atomic(unsigned long *dst, unsigned long *src,
+                        long start, long nr);
 unsigned long bitmap_find_next_zero_area(unsigned long *map,
 					 unsigned long size,
 					 unsigned long start,
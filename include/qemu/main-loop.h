@@ -299,6 +299,17 @@ void qemu_mutex_lock_iothread(void);
  */
 void qemu_mutex_unlock_iothread(void);
 
+/**
+ * qemu_mutex_iothread_locked: Return lock status of the main loop mutex.
+ *
+ * Returns true if the calling thread holds the main loop mutex.  With
+ * multi-threaded TCG, code reachable from translated code uses this to
+ * take the mutex only when it is not held already.
+ *
+ * NOTE: tools currently are single-threaded and always return true here.
+ */
+bool qemu_mutex_iothread_locked(void);
+
 /* internal interfaces */
 
 void qemu_fd_register(int fd);
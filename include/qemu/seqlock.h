@@ -0,0 +1,72 @@
+/*
+ * Sequence locks
+ *
+ * Readers run without taking any lock and retry if a writer was active
+ * while they read; writers are serialized by an optional mutex, or by
+ * some other lock the caller holds (e.g. the BQL) if it is NULL.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_SEQLOCK_H
+#define QEMU_SEQLOCK_H 1
+
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+
+typedef struct QemuSeqLock QemuSeqLock;
+
+struct QemuSeqLock {
+    QemuMutex *mutex;
+    unsigned sequence;
+};
+
+static inline void seqlock_init(QemuSeqLock *sl, QemuMutex *mutex)
+{
+    sl->mutex = mutex;
+    sl->sequence = 0;
+}
+
+/* Lock out other writers and make readers retry.  */
+static inline void seqlock_write_lock(QemuSeqLock *sl)
+{
+    if (sl->mutex) {
+        qemu_mutex_lock(sl->mutex);
+    }
+    atomic_set(&sl->sequence, sl->sequence + 1);
+
+    /* Write the sequence before the protected fields.  */
+    smp_wmb();
+}
+
+static inline void seqlock_write_unlock(QemuSeqLock *sl)
+{
+    /* Write the protected fields before the final sequence.  */
+    smp_wmb();
+    atomic_set(&sl->sequence, sl->sequence + 1);
+
+    if (sl->mutex) {
+        qemu_mutex_unlock(sl->mutex);
+    }
+}
+
+static inline unsigned seqlock_read_begin(QemuSeqLock *sl)
+{
+    /* Make the read fail if a write is in progress.  */
+    unsigned ret = atomic_read(&sl->sequence) & ~1;
+
+    /* Read the sequence before the protected fields.  */
+    smp_rmb();
+    return ret;
+}
+
+static inline int seqlock_read_retry(QemuSeqLock *sl, unsigned start)
+{
+    /* Read the protected fields before the final sequence.  */
+    smp_rmb();
+    return atomic_read(&sl->sequence) != start;
+}
+
+#endif
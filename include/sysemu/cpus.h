@@ -1,6 +1,8 @@
 #ifndef QEMU_CPUS_H
 #define QEMU_CPUS_H
 
+#include "qemu/option.h"
+
 /* cpus.c */
 void qemu_init_cpu_loop(void);
 void resume_all_vcpus(void);
@@ -13,6 +15,20 @@ void cpu_synchronize_all_post_init(void);
 
 void qtest_clock_warp(int64_t dest);
 
+/* Multi-threaded TCG: one host thread per vCPU instead of round-robin */
+extern bool mttcg_enabled;
+
+static inline bool qemu_tcg_mttcg_enabled(void)
+{
+    return mttcg_enabled;
+}
+
+void qemu_tcg_configure(QemuOpts *opts);
+bool qemu_tcg_cpus_quiescent(void);
+void qemu_tcg_request_tb_flush(bool full);
+void qemu_tcg_exec_exclusive(CPUState *cpu, void (*func)(void *data),
+                             void *data);
+
 #ifndef CONFIG_USER_ONLY
 /* vl.c */
 extern int smp_cores;
@@ -45,6 +45,7 @@ extern bool kvm_async_interrupts_allowed;
 extern bool kvm_halt_in_kernel_allowed;
 extern bool kvm_irqfds_allowed;
 extern bool kvm_msi_via_irqfd_allowed;
+extern bool kvm_resamplefds_allowed;
 extern bool kvm_gsi_routing_allowed;
 extern bool kvm_readonly_mem_allowed;
 
@@ -99,6 +100,15 @@ extern bool kvm_readonly_mem_allowed;
  */
 #define kvm_msi_via_irqfd_enabled() (kvm_msi_via_irqfd_allowed)
 
+/**
+ * kvm_resamplefds_enabled:
+ *
+ * Returns: true if the kernel can signal an eventfd when a level
+ * triggered irqfd is deasserted on guest EOI (KVM_IRQFD_FLAG_RESAMPLE).
+ * Only meaningful together with kvm_irqfds_enabled().
+ */
+#define kvm_resamplefds_enabled() (kvm_resamplefds_allowed)
+
 /**
  * kvm_gsi_routing_enabled:
  *
@@ -122,6 +132,7 @@ extern bool kvm_readonly_mem_allowed;
 #define kvm_halt_in_kernel() (false)
 #define kvm_irqfds_enabled() (false)
 #define kvm_msi_via_irqfd_enabled() (false)
+#define kvm_resamplefds_enabled() (false)
 #define kvm_gsi_routing_allowed() (false)
 #define kvm_readonly_mem_enabled() (false)
 #endif
@@ -168,6 +179,7 @@ void *kvm_arch_ram_alloc(ram_addr_t size);
 
 void kvm_setup_guest_memory(void *start, size_t size);
 void kvm_flush_coalesced_mmio_buffer(void);
+void kvm_dirty_log_harvest(void);
 
 int kvm_insert_breakpoint(CPUState *cpu, target_ulong addr,
                           target_ulong len, int type);
@@ -194,6 +206,7 @@ int kvm_vcpu_ioctl(CPUState *cpu, int type, ...);
 
 extern const KVMCapabilityInfo kvm_arch_required_capabilities[];
 
+/* Called without the BQL; take it when touching device or shared state. */
 void kvm_arch_pre_run(CPUState *cpu, struct kvm_run *run);
 void kvm_arch_post_run(CPUState *cpu, struct kvm_run *run);
 
@@ -310,6 +323,8 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg);
 void kvm_irqchip_release_virq(KVMState *s, int virq);
 
 int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n, int virq);
+int kvm_irqchip_add_irqfd_notifier_resample(KVMState *s, EventNotifier *n,
+                                            EventNotifier *rn, int virq);
 int kvm_irqchip_remove_irqfd_notifier(KVMState *s, EventNotifier *n, int virq);
 void kvm_pc_gsi_handler(void *opaque, int n, int level);
 void kvm_pc_setup_irq_routing(bool pci_enabled);
@@ -33,6 +33,7 @@
 #include "exec/memory.h"
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
+#include "qemu/thread.h"
 #include "trace.h"
 
 /* This check must be after config-host.h is included */
@@ -59,13 +60,20 @@
 
 #define KVM_MSI_HASHTAB_SIZE    256
 
+/* Upper bound on threads fetching dirty logs in kvm_dirty_log_harvest */
+#define KVM_DIRTY_LOG_MAX_THREADS 8
+
 typedef struct KVMSlot
 {
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    MemoryRegion *mr;
+    hwaddr mr_offset;
     int slot;
     int flags;
+    /* dirty log already merged by kvm_dirty_log_harvest, skip next sync */
+    bool dirty_log_harvested;
 } KVMSlot;
 
 typedef struct kvm_dirty_log KVMDirtyLog;
@@ -73,6 +81,8 @@ typedef struct kvm_dirty_log KVMDirtyLog;
 struct KVMState
 {
     KVMSlot slots[32];
+    /* protects slots against kvm_dirty_log_harvest, which may run without BQL */
+    QemuMutex slots_lock;
     int fd;
     int vmfd;
     int coalesced_mmio;
@@ -110,6 +120,7 @@ bool kvm_async_interrupts_allowed;
 bool kvm_halt_in_kernel_allowed;
 bool kvm_irqfds_allowed;
 bool kvm_msi_via_irqfd_allowed;
+bool kvm_resamplefds_allowed;
 bool kvm_gsi_routing_allowed;
 bool kvm_allowed;
 bool kvm_readonly_mem_allowed;
@@ -126,6 +137,7 @@ static KVMSlot *kvm_alloc_slot(KVMState *s)
 
     for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
         if (s->slots[i].memory_size == 0) {
+            s->slots[i].dirty_log_harvested = false;
             return &s->slots[i];
         }
     }
@@ -303,15 +315,21 @@ static int kvm_dirty_pages_log_change(hwaddr phys_addr,
                                       ram_addr_t size, bool log_dirty)
 {
     KVMState *s = kvm_state;
-    KVMSlot *mem = kvm_lookup_matching_slot(s, phys_addr, phys_addr + size);
+    KVMSlot *mem;
+    int ret;
 
+    qemu_mutex_lock(&s->slots_lock);
+    mem = kvm_lookup_matching_slot(s, phys_addr, phys_addr + size);
     if (mem == NULL)  {
         fprintf(stderr, "BUG: %s: invalid parameters " TARGET_FMT_plx "-"
                 TARGET_FMT_plx "\n", __func__, phys_addr,
                 (hwaddr)(phys_addr + size - 1));
-        return -EINVAL;
+        ret = -EINVAL;
+    } else {
+        ret = kvm_slot_dirty_pages_log_change(mem, log_dirty);
     }
-    return kvm_slot_dirty_pages_log_change(mem, log_dirty);
+    qemu_mutex_unlock(&s->slots_lock);
+    return ret;
 }
 
 static void kvm_log_start(MemoryListener *listener,
@@ -342,8 +360,9 @@ static int kvm_set_migration_log(int enable)
 {
     KVMState *s = kvm_state;
     KVMSlot *mem;
-    int i, err;
+    int i, err = 0;
 
+    qemu_mutex_lock(&s->slots_lock);
     s->migration_log = enable;
 
     for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
@@ -357,110 +376,197 @@ static int kvm_set_migration_log(int enable)
         }
         err = kvm_set_user_memory_region(s, mem);
         if (err) {
-            return err;
+            break;
         }
     }
-    return 0;
+    qemu_mutex_unlock(&s->slots_lock);
+    return err;
 }
 
-/* get kvm's dirty pages bitmap and update qemu's */
-static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
-                                         unsigned long *bitmap)
+#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
+
+/* XXX bad kernel interface alert
+ * For dirty bitmap, kernel allocates array of size aligned to
+ * bits-per-long.  But for case when the kernel is 64bits and
+ * the userspace is 32bits, userspace can't align to the same
+ * bits-per-long, since sizeof(long) is different between kernel
+ * and user space.  This way, userspace will provide buffer which
+ * may be 4 bytes less than the kernel will use, resulting in
+ * userspace memory corruption (which is not detectable by valgrind
+ * too, in most cases).
+ * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
+ * a hope that sizeof(long) wont become >8 any time soon.
+ */
+static unsigned long kvm_dirty_log_size(KVMSlot *mem)
 {
-    unsigned int i, j;
-    unsigned long page_number, c;
-    hwaddr addr, addr1;
-    unsigned int pages = int128_get64(section->size) / getpagesize();
-    unsigned int len = (pages + HOST_LONG_BITS - 1) / HOST_LONG_BITS;
-    unsigned long hpratio = getpagesize() / TARGET_PAGE_SIZE;
+    return ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
+                 /*HOST_LONG_BITS*/ 64) / 8;
+}
 
-    /*
-     * bitmap-traveling is faster than memory-traveling (for addr...)
-     * especially when most of the memory is not dirty.
-     */
-    for (i = 0; i < len; i++) {
-        if (bitmap[i] != 0) {
-            c = leul_to_cpu(bitmap[i]);
-            do {
-                j = ffsl(c) - 1;
-                c &= ~(1ul << j);
-                page_number = (i * HOST_LONG_BITS + j) * hpratio;
-                addr1 = page_number * TARGET_PAGE_SIZE;
-                addr = section->offset_within_region + addr1;
-                memory_region_set_dirty(section->mr, addr,
-                                        TARGET_PAGE_SIZE * hpratio);
-            } while (c != 0);
-        }
+/* get kvm's dirty pages bitmap of @mem and update qemu's */
+static int kvm_slot_get_dirty_log(KVMState *s, KVMSlot *mem,
+                                  unsigned long *bitmap)
+{
+    KVMDirtyLog d;
+
+    memset(bitmap, 0, kvm_dirty_log_size(mem));
+    d.dirty_bitmap = bitmap;
+    d.slot = mem->slot;
+
+    if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
+        DPRINTF("ioctl failed %d\n", errno);
+        return -1;
     }
+
+    memory_region_set_dirty_lebitmap(mem->mr, mem->mr_offset, bitmap,
+                                     mem->memory_size / getpagesize());
     return 0;
 }
 
-#define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
-
 /**
  * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
  * This function updates qemu's dirty bitmap using
- * memory_region_set_dirty().  This means all bits are set
+ * memory_region_set_dirty_lebitmap().  This means all bits are set
  * to dirty.
  *
- * @start_add: start of logged region.
- * @end_addr: end of logged region.
+ * Slots whose log was already fetched by kvm_dirty_log_harvest() are
+ * skipped if @use_harvested is set.  Must be called with slots_lock held.
+ *
+ * @section: logged region.
+ * @use_harvested: whether a preceding harvest can stand in for the ioctl.
  */
-static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section)
+static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section,
+                                          bool use_harvested)
 {
     KVMState *s = kvm_state;
     unsigned long size, allocated_size = 0;
-    KVMDirtyLog d;
+    unsigned long *bitmap = NULL;
     KVMSlot *mem;
     int ret = 0;
     hwaddr start_addr = section->offset_within_address_space;
     hwaddr end_addr = start_addr + int128_get64(section->size);
 
-    d.dirty_bitmap = NULL;
     while (start_addr < end_addr) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, end_addr);
         if (mem == NULL) {
             break;
         }
+        start_addr = mem->start_addr + mem->memory_size;
 
-        /* XXX bad kernel interface alert
-         * For dirty bitmap, kernel allocates array of size aligned to
-         * bits-per-long.  But for case when the kernel is 64bits and
-         * the userspace is 32bits, userspace can't align to the same
-         * bits-per-long, since sizeof(long) is different between kernel
-         * and user space.  This way, userspace will provide buffer which
-         * may be 4 bytes less than the kernel will use, resulting in
-         * userspace memory corruption (which is not detectable by valgrind
-         * too, in most cases).
-         * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
-         * a hope that sizeof(long) wont become >8 any time soon.
-         */
-        size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
-                     /*HOST_LONG_BITS*/ 64) / 8;
-        if (!d.dirty_bitmap) {
-            d.dirty_bitmap = g_malloc(size);
-        } else if (size > allocated_size) {
-            d.dirty_bitmap = g_realloc(d.dirty_bitmap, size);
+        if (mem->dirty_log_harvested) {
+            mem->dirty_log_harvested = false;
+            if (use_harvested) {
+                continue;
+            }
         }
-        allocated_size = size;
-        memset(d.dirty_bitmap, 0, allocated_size);
 
-        d.slot = mem->slot;
+        size = kvm_dirty_log_size(mem);
+        if (size > allocated_size) {
+            bitmap = g_realloc(bitmap, size);
+            allocated_size = size;
+        }
 
-        if (kvm_vm_ioctl(s, KVM_GET_DIRTY_LOG, &d) == -1) {
-            DPRINTF("ioctl failed %d\n", errno);
+        if (kvm_slot_get_dirty_log(s, mem, bitmap) < 0) {
             ret = -1;
             break;
         }
-
-        kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
-        start_addr = mem->start_addr + mem->memory_size;
     }
-    g_free(d.dirty_bitmap);
+    g_free(bitmap);
 
     return ret;
 }
 
+typedef struct KVMDirtyLogHarvest {
+    KVMState *s;
+    KVMSlot **slots;
+    int nr_slots;
+    int next;
+    int ret;
+} KVMDirtyLogHarvest;
+
+static void *kvm_dirty_log_harvest_thread(void *opaque)
+{
+    KVMDirtyLogHarvest *h = opaque;
+    unsigned long size, allocated_size = 0;
+    unsigned long *bitmap = NULL;
+    KVMSlot *mem;
+    int i;
+
+    while ((i = atomic_fetch_inc(&h->next)) < h->nr_slots) {
+        mem = h->slots[i];
+        size = kvm_dirty_log_size(mem);
+        if (size > allocated_size) {
+            bitmap = g_realloc(bitmap, size);
+            allocated_size = size;
+        }
+        if (kvm_slot_get_dirty_log(h->s, mem, bitmap) < 0) {
+            atomic_set(&h->ret, -1);
+            continue;
+        }
+        mem->dirty_log_harvested = true;
+    }
+    g_free(bitmap);
+    return NULL;
+}
+
+/*
+ * Fetch the dirty logs of all logging slots and merge them into the global
+ * dirty bitmap, spreading the slots over up to KVM_DIRTY_LOG_MAX_THREADS
+ * workers.  The kernel serializes KVM_GET_DIRTY_LOG on its own slots_lock,
+ * so only the bitmap merges actually run in parallel; the ioctls still
+ * execute one at a time.  The next log_sync of each slot then only has to
+ * clear its harvested flag.
+ *
+ * Must be called with the ramlist lock held.  The workers never take the
+ * BQL, so the caller may hold it or not: the iterate path drops it to keep
+ * the harvest out of the BQL, the completion paths run with it held.
+ */
+void kvm_dirty_log_harvest(void)
+{
+    KVMState *s = kvm_state;
+    KVMDirtyLogHarvest h = { .s = s };
+    KVMSlot *slots[ARRAY_SIZE(s->slots)];
+    QemuThread *threads;
+    int i, nthreads;
+
+    if (!kvm_enabled()) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->slots_lock);
+    for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
+        KVMSlot *mem = &s->slots[i];
+
+        if (mem->memory_size &&
+            ((mem->flags & KVM_MEM_LOG_DIRTY_PAGES) || s->migration_log)) {
+            slots[h.nr_slots++] = mem;
+        }
+    }
+    h.slots = slots;
+
+    nthreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1),
+                   KVM_DIRTY_LOG_MAX_THREADS);
+    nthreads = MIN(nthreads, h.nr_slots);
+    if (nthreads <= 1) {
+        kvm_dirty_log_harvest_thread(&h);
+    } else {
+        threads = g_new(QemuThread, nthreads);
+        for (i = 0; i < nthreads; i++) {
+            qemu_thread_create(&threads[i], kvm_dirty_log_harvest_thread, &h,
+                               QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < nthreads; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+        g_free(threads);
+    }
+    qemu_mutex_unlock(&s->slots_lock);
+
+    if (h.ret < 0) {
+        abort();
+    }
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -626,6 +732,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     hwaddr start_addr = section->offset_within_address_space;
     ram_addr_t size = int128_get64(section->size);
     void *ram = NULL;
+    hwaddr mr_offset;
     unsigned delta;
 
     /* kvm works in page size chunks, but the function may be called
@@ -645,7 +752,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
         return;
     }
 
-    ram = memory_region_get_ram_ptr(mr) + section->offset_within_region + delta;
+    mr_offset = section->offset_within_region + delta;
+    ram = memory_region_get_ram_ptr(mr) + mr_offset;
 
     while (1) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, start_addr + size);
@@ -665,7 +773,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
         old = *mem;
 
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(section);
+            kvm_physical_sync_dirty_bitmap(section, false);
         }
 
         /* unregister the overlapping slot */
@@ -691,6 +799,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = old.memory_size;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->mr = old.mr;
+            mem->mr_offset = old.mr_offset;
             mem->flags = kvm_mem_flags(s, log_dirty);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -702,6 +812,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 
             start_addr += old.memory_size;
             ram += old.memory_size;
+            mr_offset += old.memory_size;
             size -= old.memory_size;
             continue;
         }
@@ -712,6 +823,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = start_addr - old.start_addr;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->mr = old.mr;
+            mem->mr_offset = old.mr_offset;
             mem->flags =  kvm_mem_flags(s, log_dirty);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -736,6 +849,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             size_delta = mem->start_addr - old.start_addr;
             mem->memory_size = old.memory_size - size_delta;
             mem->ram = old.ram + size_delta;
+            mem->mr = old.mr;
+            mem->mr_offset = old.mr_offset + size_delta;
             mem->flags = kvm_mem_flags(s, log_dirty);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -758,6 +873,8 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->mr = mr;
+    mem->mr_offset = mr_offset;
     mem->flags = kvm_mem_flags(s, log_dirty);
 
     err = kvm_set_user_memory_region(s, mem);
@@ -772,13 +889,17 @@ static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     memory_region_ref(section->mr);
+    qemu_mutex_lock(&kvm_state->slots_lock);
     kvm_set_phys_mem(section, true);
+    qemu_mutex_unlock(&kvm_state->slots_lock);
 }
 
 static void kvm_region_del(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
+    qemu_mutex_lock(&kvm_state->slots_lock);
     kvm_set_phys_mem(section, false);
+    qemu_mutex_unlock(&kvm_state->slots_lock);
     memory_region_unref(section->mr);
 }
 
@@ -787,7 +908,9 @@ static void kvm_log_sync(MemoryListener *listener,
 {
     int r;
 
-    r = kvm_physical_sync_dirty_bitmap(section);
+    qemu_mutex_lock(&kvm_state->slots_lock);
+    r = kvm_physical_sync_dirty_bitmap(section, true);
+    qemu_mutex_unlock(&kvm_state->slots_lock);
     if (r < 0) {
         abort();
     }
@@ -1212,7 +1335,8 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
     return kvm_update_routing_entry(s, &kroute);
 }
 
-static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int virq, bool assign)
+static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int rfd, int virq,
+                                    bool assign)
 {
     struct kvm_irqfd irqfd = {
         .fd = fd,
@@ -1224,6 +1348,14 @@ static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int virq, bool assign)
         return -ENOSYS;
     }
 
+    if (rfd >= 0) {
+        if (!kvm_resamplefds_enabled()) {
+            return -ENOSYS;
+        }
+        irqfd.flags |= KVM_IRQFD_FLAG_RESAMPLE;
+        irqfd.resamplefd = rfd;
+    }
+
     return kvm_vm_ioctl(s, KVM_IRQFD, &irqfd);
 }
 
@@ -1247,7 +1379,8 @@ int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg)
     return -ENOSYS;
 }
 
-static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int virq, bool assign)
+static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int rfd, int virq,
+                                    bool assign)
 {
     abort();
 }
@@ -1260,12 +1393,26 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 
 int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n, int virq)
 {
-    return kvm_irqchip_assign_irqfd(s, event_notifier_get_fd(n), virq, true);
+    return kvm_irqchip_assign_irqfd(s, event_notifier_get_fd(n), -1, virq,
+                                    true);
+}
+
+/*
+ * Level triggered variant: the GSI stays asserted after @n fires until the
+ * guest EOIs it, at which point KVM lowers it and signals @rn so that the
+ * caller can raise it again if the source is still pending.
+ */
+int kvm_irqchip_add_irqfd_notifier_resample(KVMState *s, EventNotifier *n,
+                                            EventNotifier *rn, int virq)
+{
+    return kvm_irqchip_assign_irqfd(s, event_notifier_get_fd(n),
+                                    event_notifier_get_fd(rn), virq, true);
 }
 
 int kvm_irqchip_remove_irqfd_notifier(KVMState *s, EventNotifier *n, int virq)
 {
-    return kvm_irqchip_assign_irqfd(s, event_notifier_get_fd(n), virq, false);
+    return kvm_irqchip_assign_irqfd(s, event_notifier_get_fd(n), -1, virq,
+                                    false);
 }
 
 static int kvm_irqchip_create(KVMState *s)
@@ -1339,6 +1486,7 @@ int kvm_init(void)
 #ifdef KVM_CAP_SET_GUEST_DEBUG
     QTAILQ_INIT(&s->kvm_sw_breakpoints);
 #endif
+    qemu_mutex_init(&s->slots_lock);
     for (i = 0; i < ARRAY_SIZE(s->slots); i++) {
         s->slots[i].slot = i;
     }
@@ -1437,6 +1585,11 @@ int kvm_init(void)
         s->irq_set_ioctl = KVM_IRQ_LINE_STATUS;
     }
 
+#ifdef KVM_CAP_IRQFD_RESAMPLE
+    kvm_resamplefds_allowed =
+        (kvm_check_extension(s, KVM_CAP_IRQFD_RESAMPLE) > 0);
+#endif
+
 #ifdef KVM_CAP_READONLY_MEM
     kvm_readonly_mem_allowed =
         (kvm_check_extension(s, KVM_CAP_READONLY_MEM) > 0);
@@ -1605,10 +1758,18 @@ int kvm_cpu_exec(CPUState *cpu)
         return EXCP_HLT;
     }
 
+    /* The run loop and IO/MMIO exits do not need the BQL; memory regions
+     * that rely on it take it in address_space_rw.  kvm_arch_pre_run and
+     * kvm_arch_post_run take it themselves where needed.
+     */
+    qemu_mutex_unlock_iothread();
+
     do {
         if (cpu->kvm_vcpu_dirty) {
+            qemu_mutex_lock_iothread();
             kvm_arch_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
             cpu->kvm_vcpu_dirty = false;
+            qemu_mutex_unlock_iothread();
         }
 
         kvm_arch_pre_run(cpu, run);
@@ -1621,11 +1782,9 @@ int kvm_cpu_exec(CPUState *cpu)
              */
             qemu_cpu_kick_self();
         }
-        qemu_mutex_unlock_iothread();
 
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
 
-        qemu_mutex_lock_iothread();
         kvm_arch_post_run(cpu, run);
 
         if (run_ret < 0) {
@@ -1664,7 +1823,9 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
+            qemu_mutex_lock_iothread();
             qemu_system_reset_request();
+            qemu_mutex_unlock_iothread();
             ret = EXCP_INTERRUPT;
             break;
         case KVM_EXIT_UNKNOWN:
@@ -1673,15 +1834,21 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = -1;
             break;
         case KVM_EXIT_INTERNAL_ERROR:
+            qemu_mutex_lock_iothread();
             ret = kvm_handle_internal_error(cpu, run);
+            qemu_mutex_unlock_iothread();
             break;
         default:
             DPRINTF("kvm_arch_handle_exit\n");
+            qemu_mutex_lock_iothread();
             ret = kvm_arch_handle_exit(cpu, run);
+            qemu_mutex_unlock_iothread();
             break;
         }
     } while (ret == 0);
 
+    qemu_mutex_lock_iothread();
+
     if (ret < 0) {
         cpu_dump_state(cpu, stderr, fprintf, CPU_DUMP_CODE);
         vm_stop(RUN_STATE_INTERNAL_ERROR);
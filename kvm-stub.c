@@ -24,6 +24,7 @@ bool kvm_kernel_irqchip;
 bool kvm_async_interrupts_allowed;
 bool kvm_irqfds_allowed;
 bool kvm_msi_via_irqfd_allowed;
+bool kvm_resamplefds_allowed;
 bool kvm_gsi_routing_allowed;
 bool kvm_allowed;
 bool kvm_readonly_mem_allowed;
@@ -42,6 +43,10 @@ void kvm_flush_coalesced_mmio_buffer(void)
 {
 }
 
+void kvm_dirty_log_harvest(void)
+{
+}
+
 void kvm_cpu_synchronize_state(CPUState *cpu)
 {
 }
@@ -140,6 +145,12 @@ int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n, int virq)
     return -ENOSYS;
 }
 
+int kvm_irqchip_add_irqfd_notifier_resample(KVMState *s, EventNotifier *n,
+                                            EventNotifier *rn, int virq)
+{
+    return -ENOSYS;
+}
+
 int kvm_irqchip_remove_irqfd_notifier(KVMState *s, EventNotifier *n, int virq)
 {
     return -ENOSYS;
@@ -3337,6 +3337,25 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static bool traces;
+
+static void handle_arg_traces(const char *arg)
+{
+#ifdef TARGET_HAS_TRACES
+    traces = true;
+#else
+    fprintf(stderr, "Superblocks are not supported for this target\n");
+    exit(1);
+#endif
+}
+
+static const char *tb_cache_dir;
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3392,6 +3411,10 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code of mapped files in 'dir'"},
+    {"traces",     "QEMU_TRACES",      false, handle_arg_traces,
+     "",           "translate hot code paths as superblocks"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -3641,6 +3664,14 @@ int main(int argc, char **argv, char **envp)
 
     thread_cpu = cpu;
 
+    if (traces && !singlestep) {
+        tb_enable_traces();
+    }
+
+    if (tb_cache_dir) {
+        tb_cache_init(tb_cache_dir, cpu_model);
+    }
+
     if (getenv("QEMU_STRACE")) {
         do_strace = 1;
     }
@@ -265,6 +265,16 @@ void cpu_list_unlock(void);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
+/* tbcache.c */
+void tb_cache_init(const char *dir, const char *cpu_model);
+void tb_cache_mmap(abi_ulong start, abi_ulong len, int prot, int flags,
+                   int fd, abi_ulong offset);
+void tb_cache_munmap(abi_ulong start, abi_ulong len);
+bool tb_cache_covers(abi_ulong pc);
+int tb_cache_fill(TranslationBlock *tb);
+void tb_cache_record(TranslationBlock *tb, int code_size);
+void tb_cache_save(void);
+
 /* main.c */
 extern unsigned long guest_stack_size;
 
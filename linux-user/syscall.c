@@ -5147,6 +5147,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        tb_cache_save();
         gdb_exit(cpu_env, arg1);
         _exit(arg1);
         ret = 0; /* avoid warning */
@@ -5338,6 +5339,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             }
             if (!(p = lock_user_string(arg1)))
                 goto execve_efault;
+            tb_cache_save();
             ret = get_errno(execve(p, argp, envp));
             unlock_user(p, arg1, 0);
 
@@ -6935,6 +6937,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        tb_cache_save();
         gdb_exit(cpu_env, arg1);
         ret = get_errno(exit_group(arg1));
         break;
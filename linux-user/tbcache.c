@@ -0,0 +1,575 @@
+/*
+ * Persistent translation cache
+ *
+ * Code translated from executable file mappings is saved when the guest
+ * exits and mapped back by the next process that maps the same file at
+ * the same guest address, so that the dynamic loader, libc and the main
+ * binary are not retranslated on every start.  A saved TB is only used
+ * after its guest code has been checked against the hash recorded when
+ * it was translated.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "qemu.h"
+#include "qemu-common.h"
+#include "qemu/thread.h"
+#include "tcg.h"
+
+#define TB_CACHE_MAGIC      0x43425451  /* "QTBC" */
+#define TB_CACHE_VERSION    1
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;          /* of the whole file */
+    uint32_t nb_entries;
+    uint32_t pad;
+} TBCacheHeader;
+
+/* One saved TB.  Host addresses inside the binary are stored relative
+   to tb_cache_anchor(), TB and prologue addresses are rebuilt from the
+   relocations.  */
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint64_t guest_hash;    /* of the size bytes of guest code at pc */
+    uint32_t size;
+    uint32_t icount;
+    uint32_t code_size;
+    uint32_t nb_relocs;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    /* followed by nb_relocs TCGTBReloc and code_size bytes of code */
+} TBCacheEntry;
+
+typedef struct TBCacheSegment {
+    abi_ulong start;
+    abi_ulong end;
+    uint64_t key;
+    void *map;              /* cache file loaded at mmap time */
+    size_t map_size;
+    GHashTable *index;      /* TBCacheEntry -> itself, by pc/cs_base/flags */
+    GPtrArray *added;       /* entries translated by this process */
+    bool dirty;
+    QLIST_ENTRY(TBCacheSegment) next;
+} TBCacheSegment;
+
+static char *tb_cache_dir;
+static uint64_t tb_cache_base_key;
+static QemuMutex tb_cache_lock;
+static QLIST_HEAD(, TBCacheSegment) tb_cache_segments =
+    QLIST_HEAD_INITIALIZER(tb_cache_segments);
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static uint64_t fnv_hash(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len--) {
+        h = (h ^ *p++) * FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t fnv_hash64(uint64_t h, uint64_t val)
+{
+    return fnv_hash(h, &val, sizeof(val));
+}
+
+static uintptr_t tb_cache_anchor(void)
+{
+    return (uintptr_t)tb_cache_anchor;
+}
+
+static TCGTBReloc *tb_cache_entry_relocs(TBCacheEntry *e)
+{
+    return (TCGTBReloc *)(e + 1);
+}
+
+static uint8_t *tb_cache_entry_code(TBCacheEntry *e)
+{
+    return (uint8_t *)(tb_cache_entry_relocs(e) + e->nb_relocs);
+}
+
+static size_t tb_cache_entry_size(TBCacheEntry *e)
+{
+    return ROUND_UP(sizeof(*e) + e->nb_relocs * sizeof(TCGTBReloc) +
+                    e->code_size, 8);
+}
+
+static guint tb_cache_entry_hash(gconstpointer key)
+{
+    const TBCacheEntry *e = key;
+
+    return e->pc ^ (e->pc >> 32) ^ e->flags ^ (e->flags >> 32) ^ e->cs_base;
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a, *eb = b;
+
+    return ea->pc == eb->pc && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags;
+}
+
+/* The cache directory and its files must be writable by us alone, as
+   their contents end up executed as host code.  */
+static bool tb_cache_trusted(const struct stat *st)
+{
+    return st->st_uid == getuid() && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/* Check that everything tb_cache_fill() and the jump patching write
+   stays within the code of the entry.  */
+static bool tb_cache_entry_valid(TBCacheEntry *e)
+{
+    TCGTBReloc *r = tb_cache_entry_relocs(e);
+    uint32_t i;
+    int n;
+
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        switch (r->type) {
+        case TCG_TB_RELOC_HOST_ABS64:
+        case TCG_TB_RELOC_TB_ABS64:
+            if ((uint64_t)r->offset + 8 > e->code_size) {
+                return false;
+            }
+            break;
+        case TCG_TB_RELOC_RET_REL32:
+            if ((uint64_t)r->offset + 4 > e->code_size) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    for (n = 0; n < 2; n++) {
+        if (e->tb_next_offset[n] == 0xffff) {
+            continue;
+        }
+        if (e->tb_next_offset[n] > e->code_size) {
+            return false;
+        }
+#ifdef USE_DIRECT_JUMP
+        if (e->tb_jmp_offset[n] + 4 > e->code_size) {
+            return false;
+        }
+#endif
+    }
+    return true;
+}
+
+static char *tb_cache_path(uint64_t key)
+{
+    return g_strdup_printf("%s/%016" PRIx64 ".tbc", tb_cache_dir, key);
+}
+
+static void tb_cache_load(TBCacheSegment *seg)
+{
+    char *path = tb_cache_path(seg->key);
+    TBCacheHeader *hdr;
+    struct stat st;
+    size_t off;
+    uint32_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    g_free(path);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !tb_cache_trusted(&st) || st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return;
+    }
+    seg->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (seg->map == MAP_FAILED) {
+        seg->map = NULL;
+        return;
+    }
+    seg->map_size = st.st_size;
+
+    hdr = seg->map;
+    if (hdr->magic != TB_CACHE_MAGIC || hdr->version != TB_CACHE_VERSION ||
+        hdr->key != seg->key || hdr->size != seg->map_size) {
+        return;
+    }
+    off = sizeof(*hdr);
+    for (i = 0; i < hdr->nb_entries; i++) {
+        TBCacheEntry *e = seg->map + off;
+
+        if (off + sizeof(*e) > seg->map_size ||
+            e->nb_relocs > TCG_MAX_TB_RELOCS ||
+            e->code_size > TCG_MAX_OP_SIZE * OPC_BUF_SIZE ||
+            off + tb_cache_entry_size(e) > seg->map_size ||
+            !tb_cache_entry_valid(e)) {
+            break;
+        }
+        g_hash_table_insert(seg->index, e, e);
+        off += tb_cache_entry_size(e);
+    }
+}
+
+static void tb_cache_count_entry(gpointer key, gpointer value,
+                                 gpointer opaque)
+{
+    TBCacheHeader *hdr = opaque;
+
+    hdr->size += tb_cache_entry_size(value);
+    hdr->nb_entries++;
+}
+
+static void tb_cache_write_entry(gpointer key, gpointer value,
+                                 gpointer opaque)
+{
+    fwrite(value, tb_cache_entry_size(value), 1, opaque);
+}
+
+/* Rewrite the cache file with the loaded and the new entries; readers
+   never see a partial file.  */
+static void tb_cache_save_segment(TBCacheSegment *seg)
+{
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+        .key = seg->key,
+        .size = sizeof(hdr),
+    };
+    char *path, *tmp;
+    FILE *f;
+    int fd;
+
+    if (!seg->dirty) {
+        return;
+    }
+    seg->dirty = false;
+    g_hash_table_foreach(seg->index, tb_cache_count_entry, &hdr);
+
+    path = tb_cache_path(seg->key);
+    tmp = g_strdup_printf("%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0 || !(f = fdopen(fd, "wb"))) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        goto out;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    g_hash_table_foreach(seg->index, tb_cache_write_entry, f);
+    if (ferror(f)) {
+        fclose(f);
+        unlink(tmp);
+    } else if (fclose(f) < 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+out:
+    g_free(tmp);
+    g_free(path);
+}
+
+static void tb_cache_free_segment(TBCacheSegment *seg)
+{
+    tb_cache_save_segment(seg);
+    QLIST_REMOVE(seg, next);
+    g_hash_table_destroy(seg->index);
+    g_ptr_array_foreach(seg->added, (GFunc)g_free, NULL);
+    g_ptr_array_free(seg->added, TRUE);
+    if (seg->map) {
+        munmap(seg->map, seg->map_size);
+    }
+    g_free(seg);
+}
+
+static TBCacheSegment *tb_cache_find(abi_ulong pc)
+{
+    TBCacheSegment *seg;
+
+    QLIST_FOREACH(seg, &tb_cache_segments, next) {
+        if (pc >= seg->start && pc < seg->end) {
+            return seg;
+        }
+    }
+    return NULL;
+}
+
+static void tb_cache_unmap_locked(abi_ulong start, abi_ulong end)
+{
+    TBCacheSegment *seg, *next_seg;
+
+    QLIST_FOREACH_SAFE(seg, &tb_cache_segments, next, next_seg) {
+        if (end <= seg->start || start >= seg->end) {
+            continue;
+        }
+        /* Keep the part below the hole, or else the part above it.  The
+           key still describes the original mapping, which is what the
+           remaining guest code comes from.  */
+        if (start > seg->start) {
+            seg->end = start;
+        } else if (end < seg->end) {
+            seg->start = end;
+        } else {
+            tb_cache_free_segment(seg);
+        }
+    }
+}
+
+void tb_cache_munmap(abi_ulong start, abi_ulong len)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    tb_cache_unmap_locked(start, start + len);
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+/* Called for every successful target_mmap().  */
+void tb_cache_mmap(abi_ulong start, abi_ulong len, int prot, int flags,
+                   int fd, abi_ulong offset)
+{
+    TBCacheSegment *seg;
+    struct stat st;
+    uint64_t key;
+
+    if (!tb_cache_dir || len == 0) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    tb_cache_unmap_locked(start, start + len);
+
+    if (!(prot & PROT_EXEC) || (flags & MAP_ANONYMOUS) ||
+        (flags & MAP_TYPE) != MAP_PRIVATE || fstat(fd, &st) < 0) {
+        goto out;
+    }
+
+    key = fnv_hash64(tb_cache_base_key, st.st_dev);
+    key = fnv_hash64(key, st.st_ino);
+    key = fnv_hash64(key, st.st_size);
+    key = fnv_hash64(key, st.st_mtim.tv_sec);
+    key = fnv_hash64(key, st.st_mtim.tv_nsec);
+    key = fnv_hash64(key, offset);
+    key = fnv_hash64(key, start);
+    key = fnv_hash64(key, len);
+    key = fnv_hash64(key, guest_base);
+
+    seg = g_new0(TBCacheSegment, 1);
+    seg->start = start;
+    seg->end = start + len;
+    seg->key = key;
+    seg->index = g_hash_table_new(tb_cache_entry_hash, tb_cache_entry_equal);
+    seg->added = g_ptr_array_new();
+    QLIST_INSERT_HEAD(&tb_cache_segments, seg, next);
+    tb_cache_load(seg);
+out:
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+bool tb_cache_covers(abi_ulong pc)
+{
+    bool ret;
+
+    if (!tb_cache_dir) {
+        return false;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    ret = tb_cache_find(pc) != NULL;
+    qemu_mutex_unlock(&tb_cache_lock);
+    return ret;
+}
+
+static TBCacheEntry *tb_cache_lookup(TBCacheSegment *seg, TranslationBlock *tb)
+{
+    TBCacheEntry key = {
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+    };
+
+    return g_hash_table_lookup(seg->index, &key);
+}
+
+/* Install the saved code for @tb at tb->tc_ptr.  Returns the size of the
+   code, or -1 if the TB must be translated.  */
+int tb_cache_fill(TranslationBlock *tb)
+{
+    TBCacheSegment *seg;
+    TBCacheEntry *e;
+    TCGTBReloc *r;
+    uint8_t *code = tb->tc_ptr;
+    uint32_t i;
+    int ret = -1;
+
+    qemu_mutex_lock(&tb_cache_lock);
+    seg = tb_cache_find(tb->pc);
+    if (!seg) {
+        goto out;
+    }
+    e = tb_cache_lookup(seg, tb);
+    if (!e || e->size == 0 || tb->pc + e->size > seg->end ||
+        page_check_range(tb->pc, e->size, PAGE_READ) < 0 ||
+        fnv_hash(FNV_OFFSET, g2h(tb->pc), e->size) != e->guest_hash) {
+        goto out;
+    }
+
+    memcpy(code, tb_cache_entry_code(e), e->code_size);
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        uint8_t *p = code + r->offset;
+
+        switch (r->type) {
+        case TCG_TB_RELOC_HOST_ABS64:
+            *(uint64_t *)p += tb_cache_anchor();
+            break;
+        case TCG_TB_RELOC_TB_ABS64:
+            *(uint64_t *)p = (uintptr_t)tb + r->value;
+            break;
+        case TCG_TB_RELOC_RET_REL32:
+            *(int32_t *)p = tcg_ctx.code_gen_prologue + r->value - (p + 4);
+            break;
+        default:
+            goto out;
+        }
+    }
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->tb_next_offset[0] = e->tb_next_offset[0];
+    tb->tb_next_offset[1] = e->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->tb_jmp_offset[0] = e->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = e->tb_jmp_offset[1];
+#endif
+    flush_icache_range((uintptr_t)code, (uintptr_t)code + e->code_size);
+    ret = e->code_size;
+out:
+    qemu_mutex_unlock(&tb_cache_lock);
+    return ret;
+}
+
+/* Save a TB that was just translated with tb->tc_relocs set; the code
+   has not been chained to other TBs yet.  */
+void tb_cache_record(TranslationBlock *tb, int code_size)
+{
+    TCGContext *s = &tcg_ctx;
+    TBCacheSegment *seg;
+    TBCacheEntry *e;
+    TCGTBReloc *r;
+    uint8_t *code;
+    int i;
+
+    if (s->tb_host_ptrs) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    seg = tb_cache_find(tb->pc);
+    if (!seg || tb->pc + tb->size > seg->end || tb_cache_lookup(seg, tb)) {
+        goto out;
+    }
+
+    e = g_malloc0(sizeof(*e) + s->nb_tb_relocs * sizeof(TCGTBReloc) +
+                  code_size + 8);
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->guest_hash = fnv_hash(FNV_OFFSET, g2h(tb->pc), tb->size);
+    e->size = tb->size;
+    e->icount = tb->icount;
+    e->code_size = code_size;
+    e->nb_relocs = s->nb_tb_relocs;
+    e->tb_next_offset[0] = tb->tb_next_offset[0];
+    e->tb_next_offset[1] = tb->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    e->tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    e->tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+#endif
+
+    r = tb_cache_entry_relocs(e);
+    memcpy(r, s->tb_relocs, e->nb_relocs * sizeof(TCGTBReloc));
+    code = tb_cache_entry_code(e);
+    memcpy(code, tb->tc_ptr, code_size);
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        if (r->type == TCG_TB_RELOC_HOST_ABS64) {
+            *(uint64_t *)(code + r->offset) -= tb_cache_anchor();
+        }
+    }
+
+    g_ptr_array_add(seg->added, e);
+    g_hash_table_insert(seg->index, e, e);
+    seg->dirty = true;
+out:
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+/* Called before the process exits or execs.  */
+void tb_cache_save(void)
+{
+    TBCacheSegment *seg;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache_lock);
+    QLIST_FOREACH(seg, &tb_cache_segments, next) {
+        tb_cache_save_segment(seg);
+    }
+    qemu_mutex_unlock(&tb_cache_lock);
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    struct stat st;
+    uint64_t key;
+
+    if (!TCG_TARGET_HAS_TB_RELOCS) {
+        fprintf(stderr, "qemu: translation cache not supported on this "
+                "host, ignoring\n");
+        return;
+    }
+    if ((mkdir(dir, 0700) < 0 && errno != EEXIST) || stat(dir, &st) < 0) {
+        fprintf(stderr, "qemu: cannot use translation cache %s: %s\n",
+                dir, strerror(errno));
+        return;
+    }
+    if (!S_ISDIR(st.st_mode) || !tb_cache_trusted(&st)) {
+        fprintf(stderr, "qemu: translation cache %s is not a directory "
+                "writable only by the current user, ignoring\n", dir);
+        return;
+    }
+    if (stat("/proc/self/exe", &st) < 0) {
+        fprintf(stderr, "qemu: cannot use translation cache %s: %s\n",
+                dir, strerror(errno));
+        return;
+    }
+
+    /* Any change to the translator invalidates every cache file.  */
+    key = fnv_hash(FNV_OFFSET, TARGET_NAME, strlen(TARGET_NAME));
+    key = fnv_hash(key, cpu_model, strlen(cpu_model));
+    key = fnv_hash64(key, st.st_dev);
+    key = fnv_hash64(key, st.st_ino);
+    key = fnv_hash64(key, st.st_size);
+    key = fnv_hash64(key, st.st_mtim.tv_sec);
+    key = fnv_hash64(key, st.st_mtim.tv_nsec);
+    key = fnv_hash64(key, singlestep);
+    tb_cache_base_key = key;
+
+    qemu_mutex_init(&tb_cache_lock);
+    tb_cache_dir = g_strdup(dir);
+}
@@ -193,11 +193,20 @@ static void glib_pollfds_poll(void)
 
 static int os_host_main_loop_wait(uint32_t timeout)
 {
+    int64_t poll_start = 0;
     int ret;
     static int spin_counter;
 
     glib_pollfds_fill(&timeout);
 
+    /* Busy poll the main AioContext before giving up the CPU.  This runs
+     * with the iothread lock held, so the polling time is bounded by the
+     * -aio-poll max-ns parameter.
+     */
+    if (timeout > 0 && aio_busy_poll(qemu_aio_context, &poll_start)) {
+        timeout = 0;
+    }
+
     /* If the I/O thread is very busy or we are incorrectly busy waiting in
      * the I/O thread, this can lead to starvation of the BQL such that the
      * VCPU threads never run.  To make sure we can detect the later case,
@@ -230,6 +239,8 @@ static int os_host_main_loop_wait(uint32_t timeout)
         qemu_mutex_lock_iothread();
     }
 
+    aio_busy_poll_done(qemu_aio_context, poll_start);
+
     glib_pollfds_poll();
     return ret;
 }
@@ -495,6 +506,12 @@ void qemu_aio_set_fd_handler(int fd,
     aio_set_fd_handler(qemu_aio_context, fd, io_read, io_write, io_flush,
                        opaque);
 }
+
+void qemu_aio_set_event_notifier_poll(EventNotifier *notifier,
+                                      AioPollEventNotifierHandler *io_poll)
+{
+    aio_set_event_notifier_poll(qemu_aio_context, notifier, io_poll);
+}
 #endif
 
 void qemu_aio_set_event_notifier(EventNotifier *notifier,
@@ -259,6 +259,24 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->readonly == b->readonly;
 }
 
+/* Compare the parts of two views that matter to the dispatch tree; dirty
+ * logging changes are not included.
+ */
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void flatview_init(FlatView *view)
 {
     view->ref = 1;
@@ -581,6 +599,50 @@ static void render_memory_region(FlatView *view,
     }
 }
 
+/* Look through aliases and containers that map a single region in its
+ * entirety, at offset 0 and without restricting it.  Address spaces whose
+ * roots resolve to the same region have the same FlatView, so it only has
+ * to be rendered once.
+ */
+static MemoryRegion *memory_region_unalias_entire(MemoryRegion *mr)
+{
+    MemoryRegion *child, *next;
+    unsigned found;
+
+    while (mr && mr->enabled && !mr->readonly) {
+        if (mr->alias) {
+            if (mr->alias_offset || mr->alias->addr ||
+                int128_lt(mr->size, mr->alias->size)) {
+                break;
+            }
+            mr = mr->alias;
+            continue;
+        }
+        if (mr->terminates) {
+            break;
+        }
+
+        found = 0;
+        next = NULL;
+        QTAILQ_FOREACH(child, &mr->subregions, subregions_link) {
+            if (child->enabled) {
+                if (++found > 1) {
+                    next = NULL;
+                    break;
+                }
+                if (!child->addr && int128_ge(mr->size, child->size)) {
+                    next = child;
+                }
+            }
+        }
+        if (!next) {
+            break;
+        }
+        mr = next;
+    }
+    return mr;
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
@@ -755,11 +817,37 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
+/* Compute the new view of @as, reusing views already rendered during this
+ * transaction for the same root.
+ */
+static void address_space_render_topology(AddressSpace *as, GHashTable *views)
+{
+    MemoryRegion *root = memory_region_unalias_entire(as->root);
+    FlatView *new_view = NULL;
+
+    if (root) {
+        new_view = g_hash_table_lookup(views, root);
+    }
+    if (!new_view) {
+        new_view = generate_memory_topology(root);
+        if (root) {
+            g_hash_table_insert(views, root, new_view);
+        }
+    }
+    if (root) {
+        flatview_ref(new_view);
+    }
+
+    as->next_map = new_view;
+    as->topology_changed = !flatview_equal(as->current_map, new_view);
+}
+
 static void address_space_update_topology(AddressSpace *as)
 {
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *new_view = as->next_map;
 
+    as->next_map = NULL;
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
 
@@ -792,7 +880,16 @@ void memory_region_transaction_commit(void)
     assert(memory_region_transaction_depth);
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth && memory_region_update_pending) {
+        GHashTable *views = g_hash_table_new_full(g_direct_hash,
+                                                  g_direct_equal, NULL,
+                                                  (GDestroyNotify)flatview_unref);
+
         memory_region_update_pending = false;
+        QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+            address_space_render_topology(as, views);
+        }
+        g_hash_table_destroy(views);
+
         MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
         QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
@@ -846,9 +943,11 @@ void memory_region_init(MemoryRegion *mr,
     mr->enabled = true;
     mr->terminates = false;
     mr->ram = false;
+    mr->system_ram = false;
     mr->romd_mode = true;
     mr->readonly = false;
     mr->rom_device = false;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     mr->priority = 0;
     mr->may_overlap = false;
@@ -1018,6 +1117,19 @@ void memory_region_init_ram(MemoryRegion *mr,
     mr->ram_addr = qemu_ram_alloc(size, mr);
 }
 
+void memory_region_init_system_ram(MemoryRegion *mr,
+                                   Object *owner,
+                                   const char *name,
+                                   uint64_t size)
+{
+    memory_region_init(mr, owner, name, size);
+    mr->ram = true;
+    mr->system_ram = true;
+    mr->terminates = true;
+    mr->destructor = memory_region_destructor_ram;
+    mr->ram_addr = qemu_ram_alloc(size, mr);
+}
+
 void memory_region_init_ram_ptr(MemoryRegion *mr,
                                 Object *owner,
                                 const char *name,
@@ -1174,30 +1286,40 @@ bool memory_region_get_dirty(MemoryRegion *mr, hwaddr addr,
                              hwaddr size, unsigned client)
 {
     assert(mr->terminates);
-    return cpu_physical_memory_get_dirty(mr->ram_addr + addr, size,
-                                         1 << client);
+    return cpu_physical_memory_get_dirty(mr->ram_addr + addr, size, client);
 }
 
 void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
                              hwaddr size)
 {
     assert(mr->terminates);
-    return cpu_physical_memory_set_dirty_range(mr->ram_addr + addr, size, -1);
+    cpu_physical_memory_set_dirty_range(mr->ram_addr + addr, size,
+                                        DIRTY_CLIENTS_ALL);
 }
 
 bool memory_region_test_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
                                         hwaddr size, unsigned client)
 {
-    bool ret;
     assert(mr->terminates);
-    ret = cpu_physical_memory_get_dirty(mr->ram_addr + addr, size,
-                                        1 << client);
-    if (ret) {
-        cpu_physical_memory_reset_dirty(mr->ram_addr + addr,
-                                        mr->ram_addr + addr + size,
-                                        1 << client);
-    }
-    return ret;
+    return cpu_physical_memory_test_and_clear_dirty(mr->ram_addr + addr,
+                                                    size, client);
+}
+
+uint64_t memory_region_sync_dirty_to_bitmap(MemoryRegion *mr,
+                                            unsigned long *dest,
+                                            unsigned client)
+{
+    assert(mr->terminates);
+    return cpu_physical_memory_sync_dirty_bitmap(dest, mr->ram_addr,
+                                                 int128_get64(mr->size),
+                                                 client);
+}
+
+void memory_region_set_dirty_lebitmap(MemoryRegion *mr, hwaddr addr,
+                                      unsigned long *bitmap, uint64_t pages)
+{
+    assert(mr->terminates);
+    cpu_physical_memory_set_dirty_lebitmap(bitmap, mr->ram_addr + addr, pages);
 }
 
 
@@ -1241,9 +1363,7 @@ void memory_region_reset_dirty(MemoryRegion *mr, hwaddr addr,
                                hwaddr size, unsigned client)
 {
     assert(mr->terminates);
-    cpu_physical_memory_reset_dirty(mr->ram_addr + addr,
-                                    mr->ram_addr + addr + size,
-                                    1 << client);
+    cpu_physical_memory_reset_dirty(mr->ram_addr + addr, size, client);
 }
 
 void *memory_region_get_ram_ptr(MemoryRegion *mr)
@@ -1321,6 +1441,26 @@ void memory_region_add_coalescing(MemoryRegion *mr,
     memory_region_set_flush_coalesced(mr);
 }
 
+void memory_region_del_coalescing(MemoryRegion *mr,
+                                  hwaddr offset,
+                                  uint64_t size)
+{
+    AddrRange tmp = addrrange_make(int128_make64(offset), int128_make64(size));
+    CoalescedMemoryRange *cmr;
+
+    QTAILQ_FOREACH(cmr, &mr->coalesced, link) {
+        if (addrrange_equal(cmr->addr, tmp)) {
+            break;
+        }
+    }
+    assert(cmr);
+
+    qemu_flush_coalesced_mmio_buffer();
+    QTAILQ_REMOVE(&mr->coalesced, cmr, link);
+    g_free(cmr);
+    memory_region_update_coalesced_range(mr);
+}
+
 void memory_region_clear_coalescing(MemoryRegion *mr)
 {
     CoalescedMemoryRange *cmr;
@@ -1341,6 +1481,13 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr)
     mr->flush_coalesced_mmio = true;
 }
 
+void memory_region_flush_coalesced(MemoryRegion *mr)
+{
+    if (!QTAILQ_EMPTY(&mr->coalesced)) {
+        qemu_flush_coalesced_mmio_buffer();
+    }
+}
+
 void memory_region_clear_flush_coalesced(MemoryRegion *mr)
 {
     qemu_flush_coalesced_mmio_buffer();
@@ -1349,6 +1496,16 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -1715,6 +1872,8 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->root = root;
     as->current_map = g_new(FlatView, 1);
     flatview_init(as->current_map);
+    as->next_map = NULL;
+    as->topology_changed = false;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
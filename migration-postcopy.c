@@ -377,6 +377,7 @@ int postcopy_outgoing_ram_save_complete(QEMUFile *f, void *opaque)
     if (ms->params.precopy_count > 0) {
         /* Make sure all dirty bits are set */
         qemu_mutex_lock_ramlist();
+        kvm_dirty_log_harvest();
         migration_bitmap_sync();
         ram_control_before_iterate(f, RAM_CONTROL_FINISH);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
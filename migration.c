@@ -462,6 +462,17 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    if (migrate_local_ram_fds()) {
+        if (!strstart(uri, "unix:", NULL)) {
+            error_setg(errp, "local-ram-fds requires a unix: migration URI");
+            return;
+        }
+        if (migrate_postcopy_outgoing()) {
+            error_setg(errp, "local-ram-fds cannot be combined with postcopy");
+            return;
+        }
+    }
+
     s = migrate_init(&params);
 
     if (strstart(uri, "tcp:", &p)) {
@@ -606,6 +617,15 @@ bool migrate_auto_converge(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_local_ram_fds(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_LOCAL_RAM_FDS];
+}
+
 bool migrate_zero_blocks(void)
 {
     MigrationState *s;
@@ -776,7 +796,10 @@ static void *migration_thread(void *opaque)
         }
         runstate_set(RUN_STATE_POSTMIGRATE);
     } else {
-        if (old_vm_running) {
+        if (ram_save_fds_passed()) {
+            /* Guest RAM is shared with the destination, stay stopped */
+            runstate_set(RUN_STATE_POSTMIGRATE);
+        } else if (old_vm_running) {
             if (s->substate != MIG_SUBSTATE_POSTCOPY) {
                 vm_start();
             } else {
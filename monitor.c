@@ -935,6 +935,95 @@ static void do_info_jit(Monitor *mon, const QDict *qdict)
     dump_exec_info((FILE *)mon, monitor_fprintf);
 }
 
+/* Disassembler flags (see target_disas) for code translated with FLAGS */
+static int jit_profile_disas_flags(uint64_t flags)
+{
+#if defined(TARGET_I386)
+    if (flags & HF_CS64_MASK) {
+        return 2;
+    }
+    return flags & HF_CS32_MASK ? 0 : 1;
+#elif defined(TARGET_ARM)
+    return ARM_TBFLAG_THUMB(flags) | (ARM_TBFLAG_BSWAP_CODE(flags) << 1);
+#else
+    return 0;
+#endif
+}
+
+/* Disassemble the guest code of a profiled block with the CPU that
+   translated it; superblocks cover several ranges.  */
+static char *jit_profile_disas(TBProfile *prof)
+{
+    CPUState *cpu = qemu_get_cpu(prof->cpu_index);
+    CPUArchState *env = cpu ? cpu->env_ptr : first_cpu->env_ptr;
+    int flags = jit_profile_disas_flags(prof->flags);
+    GString *buf = g_string_new("");
+    char *str;
+    int i;
+
+    for (i = 0; i < prof->nb_ranges; i++) {
+        str = target_disas_str(env, prof->pc + prof->ranges[i][0],
+                               prof->ranges[i][1] - prof->ranges[i][0],
+                               flags);
+        g_string_append(buf, str);
+        g_free(str);
+    }
+    return g_string_free(buf, FALSE);
+}
+
+JitProfileBlockList *qmp_query_jit_profile(bool has_count, int64_t count,
+                                           Error **errp)
+{
+    JitProfileBlockList *head = NULL, **prev = &head;
+    TBProfile *top;
+    int i, n;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "JIT profiling requires TCG");
+        return NULL;
+    }
+    if (!has_count) {
+        count = 20;
+    }
+    if (count <= 0 || count > TB_PROFILE_RING_SIZE) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "count",
+                  "a positive number up to " stringify(TB_PROFILE_RING_SIZE));
+        return NULL;
+    }
+
+    top = g_new(TBProfile, count);
+    n = tb_profile_top(top, count);
+    for (i = 0; i < n; i++) {
+        JitProfileBlockList *entry = g_malloc0(sizeof(*entry));
+        JitProfileBlock *block = g_malloc0(sizeof(*block));
+
+        block->pc = top[i].pc;
+        block->cs_base = top[i].cs_base;
+        block->flags = top[i].flags;
+        block->size = top[i].size;
+        block->insns = top[i].icount;
+        block->exec_count = top[i].exec_count;
+        block->helper_calls = top[i].helper_calls;
+        block->slow_path_hits = top[i].slow_path;
+        block->disas = jit_profile_disas(&top[i]);
+
+        entry->value = block;
+        *prev = entry;
+        prev = &entry->next;
+    }
+    g_free(top);
+    return head;
+}
+
+void qmp_jit_profile_set(bool enable, Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "JIT profiling requires TCG");
+        return;
+    }
+    tb_profile_set(enable);
+}
+
 static void do_info_history(Monitor *mon, const QDict *qdict)
 {
     int i;
@@ -2579,6 +2668,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler info",
         .mhandler.cmd = do_info_jit,
     },
+    {
+        .name       = "jit-profile",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the most executed guest code blocks",
+        .mhandler.cmd = hmp_info_jit_profile,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
@@ -209,6 +209,9 @@ bool eth_parse_ipv6_hdr(struct iovec *pkt, int pkt_frags,
     do {
         bytes_read = iov_to_buf(pkt, pkt_frags, ip6hdr_off + *full_hdr_len,
                                 &ext_hdr, sizeof(ext_hdr));
+        if (bytes_read < sizeof(ext_hdr)) {
+            return false;
+        }
         *full_hdr_len += (ext_hdr.ip6r_len + 1) * IP6_EXT_GRANULARITY;
     } while (eth_is_ip6_extension_header_type(ext_hdr.ip6r_nxt));
 
@@ -0,0 +1,291 @@
+/*
+ * QEMU software segmentation and checksum offload
+ *
+ * Used when a NIC model advertises TSO/UFO and checksum offload to the
+ * guest, but the peer that finally receives the frames cannot handle a
+ * virtio_net_hdr (slirp, socket, tap without IFF_VNET_HDR, ...).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gso.h"
+
+#define NET_GSO_TH_FLAGS_OFF    13
+#define NET_GSO_TH_CWR          0x80
+
+typedef struct NetGSOHeaders {
+    size_t l3_off;      /* offset of the IP header */
+    size_t l4_off;      /* offset of the TCP/UDP header */
+    size_t hdr_len;     /* length of all headers up to the L4 payload */
+    bool is_ip6;
+} NetGSOHeaders;
+
+static bool net_gso_parse_headers(const uint8_t *pkt, size_t size,
+                                  uint8_t l4proto, NetGSOHeaders *h)
+{
+    uint16_t l3proto;
+
+    if (size < ETH_MAX_L2_HDR_LEN) {
+        return false;
+    }
+
+    h->l3_off = eth_get_l2_hdr_length(pkt);
+    l3proto = eth_get_l3_proto(pkt, h->l3_off);
+
+    if (l3proto == ETH_P_IP) {
+        const struct ip_header *iphdr = (const struct ip_header *)
+                                        (pkt + h->l3_off);
+        size_t ip_hlen;
+
+        if (size < h->l3_off + sizeof(struct ip_header) ||
+            IP_HEADER_VERSION(iphdr) != IP_HEADER_VERSION_4 ||
+            iphdr->ip_p != l4proto) {
+            return false;
+        }
+        ip_hlen = IP_HDR_GET_LEN(iphdr);
+        if (ip_hlen < sizeof(struct ip_header)) {
+            return false;
+        }
+        h->l4_off = h->l3_off + ip_hlen;
+        h->is_ip6 = false;
+    } else if (l3proto == ETH_P_IPV6) {
+        struct iovec pkt_vec = {
+            .iov_base = (void *) pkt,
+            .iov_len = size,
+        };
+        uint8_t proto;
+        size_t ip6_hlen;
+
+        if (!eth_parse_ipv6_hdr(&pkt_vec, 1, h->l3_off, &proto, &ip6_hlen) ||
+            proto != l4proto) {
+            return false;
+        }
+        h->l4_off = h->l3_off + ip6_hlen;
+        h->is_ip6 = true;
+    } else {
+        return false;
+    }
+
+    if (l4proto == IP_PROTO_TCP) {
+        size_t th_len;
+
+        if (size < h->l4_off + sizeof(struct tcp_header)) {
+            return false;
+        }
+        th_len = (lduw_be_p(pkt + h->l4_off +
+                            offsetof(struct tcp_header, th_offset_flags))
+                  >> 12) * 4;
+        if (th_len < sizeof(struct tcp_header)) {
+            return false;
+        }
+        h->hdr_len = h->l4_off + th_len;
+    } else {
+        h->hdr_len = h->l4_off + sizeof(struct udp_header);
+    }
+
+    return h->hdr_len <= size && h->hdr_len <= NET_GSO_MAX_HDR_LEN;
+}
+
+static uint32_t net_gso_pseudo_hdr_csum(const NetGSOHeaders *h, uint8_t *l3hdr,
+                                        uint8_t l4proto, uint32_t l4_len)
+{
+    uint8_t ph[8];
+    uint32_t sum;
+
+    if (!h->is_ip6) {
+        return eth_calc_pseudo_hdr_csum((struct ip_header *) l3hdr, l4_len);
+    }
+
+    /* IPv6 pseudo header: addresses, upper layer length, next header */
+    sum = net_checksum_add(2 * sizeof(struct in6_addr),
+                           l3hdr + offsetof(struct ip6_header, ip6_src));
+    stl_be_p(ph, l4_len);
+    ph[4] = ph[5] = ph[6] = 0;
+    ph[7] = l4proto;
+    return sum + net_checksum_add(sizeof(ph), ph);
+}
+
+static void net_gso_fill_csum(const struct virtio_net_hdr *hdr,
+                              uint8_t *pkt, size_t size)
+{
+    size_t csum_off = hdr->csum_start + hdr->csum_offset;
+    uint32_t sum;
+
+    if (hdr->csum_start >= size || csum_off + sizeof(uint16_t) > size) {
+        return;
+    }
+
+    /* The checksum field already holds the pseudo header sum */
+    sum = net_checksum_add(size - hdr->csum_start, pkt + hdr->csum_start);
+    stw_be_p(pkt + csum_off, net_checksum_finish(sum));
+}
+
+static int net_gso_segment_tcp(const struct virtio_net_hdr *hdr,
+                               const uint8_t *pkt, size_t size,
+                               NetGSOSegmentFunc *func, void *opaque)
+{
+    NetGSOHeaders h;
+    size_t mss = hdr->gso_size;
+    size_t payload_len, off, len;
+    uint16_t ip_id = 0;
+    uint32_t seq;
+    uint8_t th_flags;
+    uint8_t *seg;
+    int nsegs = 0;
+
+    if (!mss || !net_gso_parse_headers(pkt, size, IP_PROTO_TCP, &h) ||
+        size <= h.hdr_len) {
+        return 0;
+    }
+
+    if (!h.is_ip6) {
+        ip_id = lduw_be_p(pkt + h.l3_off + offsetof(struct ip_header, ip_id));
+    }
+    seq = ldl_be_p(pkt + h.l4_off + offsetof(struct tcp_header, th_seq));
+    th_flags = pkt[h.l4_off + NET_GSO_TH_FLAGS_OFF];
+
+    payload_len = size - h.hdr_len;
+    seg = g_malloc(h.hdr_len + MIN(mss, payload_len));
+
+    for (off = 0; off < payload_len; off += len) {
+        uint8_t *l3hdr = seg + h.l3_off;
+        uint8_t *th = seg + h.l4_off;
+        size_t l4_len;
+        uint8_t flags = th_flags;
+        bool last;
+
+        len = MIN(mss, payload_len - off);
+        last = (off + len == payload_len);
+        l4_len = h.hdr_len - h.l4_off + len;
+
+        memcpy(seg, pkt, h.hdr_len);
+        memcpy(seg + h.hdr_len, pkt + h.hdr_len + off, len);
+
+        if (!h.is_ip6) {
+            stw_be_p(l3hdr + offsetof(struct ip_header, ip_len),
+                     h.l4_off - h.l3_off + l4_len);
+            stw_be_p(l3hdr + offsetof(struct ip_header, ip_id),
+                     ip_id + nsegs);
+            eth_fix_ip4_checksum(l3hdr, h.l4_off - h.l3_off);
+        } else {
+            stw_be_p(l3hdr + offsetof(struct ip6_header,
+                                      ip6_ctlun.ip6_un1.ip6_un1_plen),
+                     h.l4_off - h.l3_off - sizeof(struct ip6_header) + l4_len);
+        }
+
+        stl_be_p(th + offsetof(struct tcp_header, th_seq), seq + off);
+        if (!last) {
+            flags &= ~(TH_FIN | TH_PUSH);
+        }
+        if (off) {
+            flags &= ~NET_GSO_TH_CWR;
+        }
+        th[NET_GSO_TH_FLAGS_OFF] = flags;
+
+        stw_be_p(th + offsetof(struct tcp_header, th_sum), 0);
+        stw_be_p(th + offsetof(struct tcp_header, th_sum),
+                 net_checksum_finish(
+                     net_gso_pseudo_hdr_csum(&h, l3hdr, IP_PROTO_TCP, l4_len) +
+                     net_checksum_add(l4_len, th)));
+
+        func(seg, h.hdr_len + len, last, opaque);
+        nsegs++;
+    }
+
+    g_free(seg);
+    return nsegs;
+}
+
+static int net_gso_segment_udp(const struct virtio_net_hdr *hdr,
+                               uint8_t *pkt, size_t size,
+                               NetGSOSegmentFunc *func, void *opaque)
+{
+    NetGSOHeaders h;
+    size_t frag_size = IP_FRAG_ALIGN_SIZE(hdr->gso_size);
+    size_t l3_payload_len, ip_hlen, off, len;
+    uint8_t *frag;
+    int nfrags = 0;
+
+    /* UFO is IPv4 fragmentation of a single UDP datagram */
+    if (!frag_size || !net_gso_parse_headers(pkt, size, IP_PROTO_UDP, &h) ||
+        h.is_ip6) {
+        return 0;
+    }
+
+    /* The UDP checksum covers the whole datagram, fill it in before
+     * splitting.
+     */
+    if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        net_gso_fill_csum(hdr, pkt, size);
+    }
+
+    ip_hlen = h.l4_off - h.l3_off;
+    l3_payload_len = size - h.l4_off;
+    frag = g_malloc(h.l4_off + MIN(frag_size, l3_payload_len));
+
+    for (off = 0; off < l3_payload_len; off += len) {
+        bool more_frags;
+
+        len = MIN(frag_size, l3_payload_len - off);
+        more_frags = (off + len < l3_payload_len);
+
+        memcpy(frag, pkt, h.l4_off);
+        memcpy(frag + h.l4_off, pkt + h.l4_off + off, len);
+
+        eth_setup_ip4_fragmentation(frag, h.l3_off, frag + h.l3_off, ip_hlen,
+                                    len, off, more_frags);
+        eth_fix_ip4_checksum(frag + h.l3_off, ip_hlen);
+
+        func(frag, h.l4_off + len, !more_frags, opaque);
+        nfrags++;
+    }
+
+    g_free(frag);
+    return nfrags;
+}
+
+int net_gso_segment(const struct virtio_net_hdr *hdr,
+                    const struct iovec *iov, int iovcnt,
+                    NetGSOSegmentFunc *func, void *opaque)
+{
+    size_t size = iov_size(iov, iovcnt);
+    uint8_t *pkt;
+    int ret = 0;
+
+    if (size > ETH_MAX_IP_DGRAM_LEN + ETH_MAX_L2_HDR_LEN) {
+        /* Not something the guest can legitimately produce, drop it */
+        return 0;
+    }
+
+    pkt = g_malloc(size);
+    iov_to_buf(iov, iovcnt, 0, pkt, size);
+
+    switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        ret = net_gso_segment_tcp(hdr, pkt, size, func, opaque);
+        break;
+    case VIRTIO_NET_HDR_GSO_UDP:
+        ret = net_gso_segment_udp(hdr, pkt, size, func, opaque);
+        break;
+    default:
+        break;
+    }
+
+    if (!ret) {
+        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+            net_gso_fill_csum(hdr, pkt, size);
+        }
+        func(pkt, size, true, opaque);
+        ret = 1;
+    }
+
+    g_free(pkt);
+    return ret;
+}
@@ -24,6 +24,7 @@
 #include "config-host.h"
 
 #include "net/net.h"
+#include "net/gso.h"
 #include "clients.h"
 #include "hub.h"
 #include "net/slirp.h"
@@ -555,6 +556,63 @@ qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return qemu_sendv_packet_async(nc, iov, iovcnt, NULL);
 }
 
+typedef struct NetGSOSendState {
+    NetClientState *sender;
+    NetPacketSent *sent_cb;
+    size_t vnet_hdr_len;
+    ssize_t ret;
+} NetGSOSendState;
+
+static void qemu_sendv_gso_segment(const uint8_t *buf, size_t size,
+                                   bool last, void *opaque)
+{
+    NetGSOSendState *s = opaque;
+    struct virtio_net_hdr_mrg_rxbuf vnet_hdr = {};
+    struct iovec iov[] = {
+        {
+            .iov_base = &vnet_hdr,
+            .iov_len = s->vnet_hdr_len,
+        }, {
+            .iov_base = (void *) buf,
+            .iov_len = size,
+        },
+    };
+    ssize_t ret;
+
+    /* Only the last segment completes the guest buffer */
+    ret = qemu_sendv_packet_async(s->sender, iov, ARRAY_SIZE(iov),
+                                  last ? s->sent_cb : NULL);
+    if (last) {
+        s->ret = ret;
+    }
+}
+
+/*
+ * Send a packet that carries offload requests in @hdr to a peer that cannot
+ * handle them.  Segmentation and checksumming are done in software and the
+ * resulting frames are prefixed with a zeroed virtio_net_hdr of
+ * @vnet_hdr_len bytes.  Return values follow qemu_sendv_packet_async() for
+ * the last segment.
+ */
+ssize_t qemu_sendv_packet_gso_async(NetClientState *sender,
+                                    const struct virtio_net_hdr *hdr,
+                                    size_t vnet_hdr_len,
+                                    const struct iovec *iov, int iovcnt,
+                                    NetPacketSent *sent_cb)
+{
+    NetGSOSendState s = {
+        .sender = sender,
+        .sent_cb = sent_cb,
+        .vnet_hdr_len = vnet_hdr_len,
+        .ret = iov_size(iov, iovcnt),
+    };
+
+    assert(vnet_hdr_len <= sizeof(struct virtio_net_hdr_mrg_rxbuf));
+
+    net_gso_segment(hdr, iov, iovcnt, qemu_sendv_gso_segment, &s);
+    return s.ret;
+}
+
 NetClientState *qemu_find_netdev(const char *id)
 {
     NetClientState *nc;
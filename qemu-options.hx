@@ -95,12 +95,14 @@ specifies the maximum number of hotpluggable CPUs.
 ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node][,hostnode=node]\n", QEMU_ARCH_ALL)
 STEXI
 @item -numa @var{opts}
 @findex -numa
 Simulate a multi node NUMA system. If mem and cpus are omitted, resources
-are split equally.
+are split equally.  The guest RAM of a node with hostnode set is bound to
+that host NUMA node, and preallocated from threads running on it when
+@option{-mem-prealloc} is used.
 ETEXI
 
 DEF("add-fd", HAS_ARG, QEMU_OPTION_add_fd,
@@ -235,10 +237,23 @@ DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
 STEXI
 @item -mem-prealloc
 @findex -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate memory when using -mem-path.  Pages are faulted in by several
+threads in parallel; the time taken is reported by query-ram-prealloc.
 ETEXI
 #endif
 
+DEF("mem-shared", 0, QEMU_OPTION_mem_shared,
+    "-mem-shared     allocate guest RAM from shared memory file descriptors\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -mem-shared
+@findex -mem-shared
+Allocate guest RAM as shared mappings of anonymous memory files (memfd).
+Together with the @code{local-ram-fds} migration capability this lets a
+new QEMU process on the same host take over the guest memory without
+copying it.  Both the source and the destination must use this option.
+ETEXI
+
 DEF("k", HAS_ARG, QEMU_OPTION_k,
     "-k language     use keyboard layout (for example 'fr' for French)\n",
     QEMU_ARCH_ALL)
@@ -2604,6 +2619,47 @@ mlocking qemu and guest memory can be enabled via @option{mlock=on}
 (enabled by default).
 ETEXI
 
+DEF("aio-poll", HAS_ARG, QEMU_OPTION_aio_poll,
+    "-aio-poll [max-ns=]ns[,grow=n][,shrink=n]\n"
+    "                busy poll for up to ns nanoseconds before sleeping\n"
+    "                in the main loop and in data plane threads\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -aio-poll [max-ns=]@var{ns}[,grow=@var{n}][,shrink=@var{n}]
+@findex -aio-poll
+Before sleeping, spin on virtqueues and Linux AIO completion rings for up
+to @var{ns} nanoseconds.  This trades CPU time for lower I/O latency.
+The polling time adapts to the observed wakeup latency: it is multiplied
+by @option{grow} (default 2) when an event arrives shortly after polling
+stopped and divided by @option{shrink} when polling is not worthwhile.
+With @option{shrink=0}, the default, polling stops until it pays off
+again.  Statistics are available through the QMP command
+@code{query-aio-poll}.  Polling is disabled by default.
+ETEXI
+
+DEF("tcg", HAS_ARG, QEMU_OPTION_tcg,
+    "-tcg [thread=]single|multi[,traces=on|off]\n"
+    "                run all TCG vCPUs in a single thread (default) or\n"
+    "                each vCPU in its own host thread\n"
+    "                traces=on translates hot code paths as superblocks\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg [thread=]@var{single|multi}[,traces=on|off]
+@findex -tcg
+Select how the TCG accelerator schedules virtual CPUs.  With
+@option{thread=single}, the default, all vCPUs are run round-robin by one
+host thread.  With @option{thread=multi}, every vCPU gets its own host
+thread and runs without holding the global mutex, which is only taken for
+device access.  Multi-threaded TCG is supported for ARM guests on Linux
+hosts and cannot be combined with @option{-icount}.
+
+With @option{traces=on}, blocks that run often are profiled and, once one
+successor dominates, retranslated together with the blocks that follow
+them in the same page as a single superblock; a hot path that branches
+back to its start becomes a loop inside the translated code.  Superblocks
+are supported for ARM guests and cannot be combined with @option{-icount}.
+ETEXI
+
 DEF("gdb", HAS_ARG, QEMU_OPTION_gdb, \
     "-gdb dev        wait for gdb connection on 'dev'\n", QEMU_ARCH_ALL)
 STEXI
@@ -3127,4 +3127,155 @@ Example:
       ]
    }
 
+EQMP
+    {
+        .name       = "query-aio-poll",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_aio_poll,
+    },
+
+SQMP
+query-aio-poll
+--------------
+
+Show busy polling statistics of the main loop and of the data plane
+threads.  Polling is enabled with the -aio-poll command line option.
+
+Each array entry contains the following:
+
+- "main": true for the main loop, false for data plane threads (json-bool)
+- "poll-max-ns": maximum polling time, 0 if disabled (json-int)
+- "poll-ns": current self-tuned polling time (json-int)
+- "poll-hits": polling rounds that found work to do (json-int)
+- "poll-misses": polling rounds that timed out (json-int)
+- "poll-time-ns": total time spent polling (json-int)
+- "sleep-time-ns": total time spent blocked after polling (json-int)
+
+Example:
+
+-> { "execute": "query-aio-poll" }
+<- { "return": [
+        {
+            "main": true,
+            "poll-max-ns": 32768,
+            "poll-ns": 16000,
+            "poll-hits": 10324,
+            "poll-misses": 977,
+            "poll-time-ns": 48251220,
+            "sleep-time-ns": 3590228711
+        }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-jit-profile",
+        .args_type  = "count:i?",
+        .mhandler.cmd_new = qmp_marshal_input_query_jit_profile,
+    },
+
+SQMP
+query-jit-profile
+-----------------
+
+Show the most executed guest code blocks recorded by the TCG profiler.
+
+Arguments:
+
+- "count": maximum number of blocks to return, default 20 (json-int, optional)
+
+Each array entry contains the following:
+
+- "pc": guest virtual address of the block (json-int)
+- "cs-base": code segment base of the block (json-int)
+- "flags": translation flags of the block (json-int)
+- "size": size of the guest code in bytes (json-int)
+- "insns": number of guest instructions (json-int)
+- "exec-count": number of executions (json-int)
+- "helper-calls": number of helper calls (json-int)
+- "slow-path-hits": memory accesses that missed the TLB fast path (json-int)
+- "disas": disassembly of the guest code (json-string)
+
+Example:
+
+-> { "execute": "query-jit-profile", "arguments": { "count": 1 } }
+<- { "return": [
+        {
+            "pc": 3222274944,
+            "cs-base": 0,
+            "flags": 4244144,
+            "size": 6,
+            "insns": 2,
+            "exec-count": 1841733,
+            "helper-calls": 0,
+            "slow-path-hits": 12,
+            "disas": "0xc00fa080:  pause  \n0xc00fa082:  jmp    0xc00fa080\n"
+        }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "jit-profile-set",
+        .args_type  = "enable:b",
+        .mhandler.cmd_new = qmp_marshal_input_jit_profile_set,
+    },
+
+SQMP
+jit-profile-set
+---------------
+
+Enable or disable the TCG profiler.  Enabling it discards the previously
+collected profile.
+
+Arguments:
+
+- "enable": true to start profiling, false to stop (json-bool)
+
+Example:
+
+-> { "execute": "jit-profile-set", "arguments": { "enable": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "query-ram-prealloc",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_ram_prealloc,
+    },
+
+SQMP
+query-ram-prealloc
+------------------
+
+Show how guest RAM was preallocated at startup with -mem-prealloc.
+
+Each array entry contains the following:
+
+- "name": name of the memory region backed by the block (json-string)
+- "size": size of the block in bytes (json-int)
+- "page-size": size of the host pages that were faulted in (json-int)
+- "threads": number of threads that faulted in the pages (json-int)
+- "numa-bound": true if parts of the block are bound to host NUMA nodes
+                (json-bool)
+- "time-ms": time spent preallocating the block in milliseconds (json-int)
+
+Example:
+
+-> { "execute": "query-ram-prealloc" }
+<- { "return": [
+        {
+            "name": "pc.ram",
+            "size": 68719476736,
+            "page-size": 1073741824,
+            "threads": 32,
+            "numa-bound": true,
+            "time-ms": 2310
+        }
+      ]
+   }
+
 EQMP
@@ -21,6 +21,7 @@
 #include "ui/vnc.h"
 #include "sysemu/kvm.h"
 #include "sysemu/arch_init.h"
+#include "migration/migration.h"
 #include "hw/qdev.h"
 #include "sysemu/blockdev.h"
 #include "qom/qom-qobject.h"
@@ -162,6 +163,10 @@ void qmp_cont(Error **errp)
     if (runstate_needs_reset()) {
         error_set(errp, QERR_RESET_REQUIRED);
         return;
+    } else if (ram_save_fds_passed()) {
+        error_setg(errp, "Guest RAM was passed to another process, "
+                   "this VM cannot be resumed");
+        return;
     } else if (runstate_check(RUN_STATE_SUSPENDED)) {
         return;
     }
@@ -23,6 +23,7 @@
 #include "sysemu/kvm.h"
 #include "qemu/notify.h"
 #include "qemu/log.h"
+#include "qemu/atomic.h"
 #include "sysemu/sysemu.h"
 
 typedef struct CPUExistsArgs {
@@ -89,7 +90,7 @@ void qemu_register_cpu_added_notifier(Notifier *notifier)
 
 void cpu_reset_interrupt(CPUState *cpu, int mask)
 {
-    cpu->interrupt_request &= ~mask;
+    atomic_and(&cpu->interrupt_request, ~mask);
 }
 
 void cpu_exit(CPUState *cpu)
@@ -148,6 +148,9 @@ typedef struct QEMUFileSocket
 {
     int fd;
     QEMUFile *file;
+    /* descriptors received with SCM_RIGHTS, oldest first */
+    int *passed_fds;
+    int nr_passed_fds;
 } QEMUFileSocket;
 
 static ssize_t socket_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
@@ -171,13 +174,101 @@ static int socket_get_fd(void *opaque)
     return s->fd;
 }
 
+#ifndef _WIN32
+/* Like recv, but queues descriptors passed along with the data */
+static ssize_t socket_recv_fds(QEMUFileSocket *s, uint8_t *buf, int size)
+{
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(int) * 16)];
+    } msg_control;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = &msg_control,
+        .msg_controllen = sizeof(msg_control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t len;
+    int i, n;
+
+    len = recvmsg(s->fd, &msg, 0);
+    if (len <= 0) {
+        return len;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        s->passed_fds = g_renew(int, s->passed_fds, s->nr_passed_fds + n);
+        for (i = 0; i < n; i++) {
+            s->passed_fds[s->nr_passed_fds++] =
+                ((int *)CMSG_DATA(cmsg))[i];
+        }
+    }
+    return len;
+}
+
+static int socket_send_fd(void *opaque, int fd)
+{
+    QEMUFileSocket *s = opaque;
+    union {
+        struct cmsghdr cmsg;
+        char control[CMSG_SPACE(sizeof(int))];
+    } msg_control;
+    uint8_t marker = 0;
+    struct iovec iov = { .iov_base = &marker, .iov_len = 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = &msg_control,
+        .msg_controllen = sizeof(msg_control),
+    };
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    do {
+        ret = sendmsg(s->fd, &msg, 0);
+    } while (ret == -1 && errno == EINTR);
+
+    return ret == 1 ? 0 : -errno;
+}
+
+static int socket_recv_fd(void *opaque)
+{
+    QEMUFileSocket *s = opaque;
+    int fd;
+
+    if (!s->nr_passed_fds) {
+        return -1;
+    }
+    fd = s->passed_fds[0];
+    s->nr_passed_fds--;
+    memmove(s->passed_fds, s->passed_fds + 1, s->nr_passed_fds * sizeof(int));
+    return fd;
+}
+#endif
+
 static int socket_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
 {
     QEMUFileSocket *s = opaque;
     ssize_t len;
 
     for (;;) {
+#ifndef _WIN32
+        len = socket_recv_fds(s, buf, size);
+#else
         len = qemu_recv(s->fd, buf, size, 0);
+#endif
         if (len != -1) {
             break;
         }
@@ -197,6 +288,12 @@ static int socket_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
 static int socket_close(void *opaque)
 {
     QEMUFileSocket *s = opaque;
+    int i;
+
+    for (i = 0; i < s->nr_passed_fds; i++) {
+        close(s->passed_fds[i]);
+    }
+    g_free(s->passed_fds);
     closesocket(s->fd);
     g_free(s);
     return 0;
@@ -441,12 +538,18 @@ QEMUFile *qemu_fdopen(int fd, const char *mode)
 static const QEMUFileOps socket_read_ops = {
     .get_fd =     socket_get_fd,
     .get_buffer = socket_get_buffer,
+#ifndef _WIN32
+    .recv_fd =    socket_recv_fd,
+#endif
     .close =      socket_close
 };
 
 static const QEMUFileOps socket_write_ops = {
     .get_fd =     socket_get_fd,
     .writev_buffer = socket_writev_buffer,
+#ifndef _WIN32
+    .send_fd =    socket_send_fd,
+#endif
     .close =      socket_close
 };
 
@@ -797,6 +900,42 @@ int qemu_get_fd(QEMUFile *f)
     return -1;
 }
 
+/*
+ * Flushes the buffered data and passes @fd to the peer after it.  Only
+ * supported on UNIX domain sockets; the descriptor stays owned by the
+ * caller.
+ */
+int qemu_file_send_fd(QEMUFile *f, int fd)
+{
+    int ret;
+
+    if (!f->ops->send_fd) {
+        return -ENOTSUP;
+    }
+    qemu_fflush(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+    ret = f->ops->send_fd(f->opaque, fd);
+    if (ret) {
+        qemu_file_set_error(f, ret);
+    }
+    return ret;
+}
+
+/*
+ * Returns the next descriptor passed with qemu_file_send_fd, or -1.  The
+ * marker byte sent along with it must have been read already.
+ */
+int qemu_file_recv_fd(QEMUFile *f)
+{
+    if (!f->ops->recv_fd) {
+        return -1;
+    }
+    return f->ops->recv_fd(f->opaque);
+}
+
 void qemu_update_position(QEMUFile *f, size_t size)
 {
     f->pos += size;
@@ -33,6 +33,12 @@
 
 #define TARGET_HAS_ICE 1
 
+/* Store exclusive is emulated with host atomics under multi-threaded TCG */
+#define TARGET_SUPPORTS_MTTCG 1
+
+/* The translator can turn hot code into superblocks, see tb_gen_trace() */
+#define TARGET_HAS_TRACES 1
+
 #define EXCP_UDEF            1   /* undefined instruction */
 #define EXCP_SWI             2   /* software interrupt */
 #define EXCP_PREFETCH_ABORT  3
@@ -292,11 +292,42 @@ static int contextidr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     return 0;
 }
 
+#if !defined(CONFIG_USER_ONLY)
+static void tlb_flush_other_work(void *opaque)
+{
+    CPUState *cpu = opaque;
+
+    tlb_flush(cpu->env_ptr, 1);
+}
+#endif
+
+/* The inner shareable variants (crm == 3) apply to all cores.  Each
+ * vCPU thread owns its TLB, so the other cores are flushed entirely
+ * from their own thread.
+ */
+static void tlbi_is_other_cpus(CPUARMState *env, const ARMCPRegInfo *ri)
+{
+#if !defined(CONFIG_USER_ONLY)
+    CPUState *self = ENV_GET_CPU(env);
+    CPUState *cpu;
+
+    if (ri->crm != 3) {
+        return;
+    }
+    for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
+        if (cpu != self) {
+            async_run_on_cpu(cpu, tlb_flush_other_work, cpu);
+        }
+    }
+#endif
+}
+
 static int tlbiall_write(CPUARMState *env, const ARMCPRegInfo *ri,
                          uint64_t value)
 {
     /* Invalidate all (TLBIALL) */
     tlb_flush(env, 1);
+    tlbi_is_other_cpus(env, ri);
     return 0;
 }
 
@@ -305,6 +336,7 @@ static int tlbimva_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     /* Invalidate single TLB entry by MVA and ASID (TLBIMVA) */
     tlb_flush_page(env, value & TARGET_PAGE_MASK);
+    tlbi_is_other_cpus(env, ri);
     return 0;
 }
 
@@ -313,6 +345,7 @@ static int tlbiasid_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     /* Invalidate by ASID (TLBIASID) */
     tlb_flush(env, value == 0);
+    tlbi_is_other_cpus(env, ri);
     return 0;
 }
 
@@ -321,6 +354,7 @@ static int tlbimvaa_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     /* Invalidate single entry by MVA, all ASIDs (TLBIMVAA) */
     tlb_flush_page(env, value & TARGET_PAGE_MASK);
+    tlbi_is_other_cpus(env, ri);
     return 0;
 }
 
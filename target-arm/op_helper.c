@@ -18,6 +18,9 @@
  */
 #include "cpu.h"
 #include "helper.h"
+#include "qemu/main-loop.h"
+#include "qemu/atomic.h"
+#include "sysemu/cpus.h"
 
 #define SIGNBIT (uint32_t)0x80000000
 #define SIGNBIT64 ((uint64_t)1 << 63)
@@ -74,9 +77,18 @@ uint32_t HELPER(neon_tbl)(CPUARMState *env, uint32_t ireg, uint32_t def,
 void tlb_fill(CPUARMState *env, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr)
 {
+    bool locked = false;
     int ret;
 
+    /* The page table walk goes through the memory API */
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
     ret = cpu_arm_handle_mmu_fault(env, addr, is_write, mmu_idx);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
     if (unlikely(ret)) {
         if (retaddr) {
             /* now we have a real cpu fault */
@@ -85,6 +97,155 @@ void tlb_fill(CPUARMState *env, target_ulong addr, int is_write, int mmu_idx,
         raise_exception(env, env->exception_index);
     }
 }
+
+/* ldrexd/strexd values as they are laid out in memory */
+static inline uint64_t arm_exclusive_pair(uint32_t lo, uint32_t hi)
+{
+#ifdef TARGET_WORDS_BIGENDIAN
+    return ((uint64_t)lo << 32) | hi;
+#else
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+typedef struct ARMStoreExclusive {
+    CPUARMState *env;
+    uint32_t addr;
+    uint64_t val;
+    uint32_t size;
+    int mmu_idx;
+    bool ok;
+} ARMStoreExclusive;
+
+static bool arm_strex_cmpxchg(void *host, uint64_t cmp, uint64_t newval,
+                              uint32_t size)
+{
+    switch (size) {
+    case 0:
+        return atomic_cmpxchg((uint8_t *)host, (uint8_t)cmp,
+                              (uint8_t)newval) == (uint8_t)cmp;
+    case 1:
+        return atomic_cmpxchg((uint16_t *)host, tswap16(cmp),
+                              tswap16(newval)) == tswap16(cmp);
+    case 2:
+        return atomic_cmpxchg((uint32_t *)host, tswap32(cmp),
+                              tswap32(newval)) == tswap32(cmp);
+    default:
+        return atomic_cmpxchg((uint64_t *)host, tswap64(cmp),
+                              tswap64(newval)) == tswap64(cmp);
+    }
+}
+
+/* Compare and store through the MMU helpers; runs with all other
+   vCPUs stopped, so the load and store cannot be interleaved.  */
+static void arm_strex_slow(void *opaque)
+{
+    ARMStoreExclusive *s = opaque;
+    CPUARMState *env = s->env;
+    uint32_t addr = s->addr;
+    uint64_t val = s->val;
+    int mmu_idx = s->mmu_idx;
+
+    switch (s->size) {
+    case 0:
+        s->ok = helper_ldb_mmu(env, addr, mmu_idx) ==
+                (uint8_t)env->exclusive_val;
+        if (s->ok) {
+            helper_stb_mmu(env, addr, val, mmu_idx);
+        }
+        break;
+    case 1:
+        s->ok = helper_ldw_mmu(env, addr, mmu_idx) ==
+                (uint16_t)env->exclusive_val;
+        if (s->ok) {
+            helper_stw_mmu(env, addr, val, mmu_idx);
+        }
+        break;
+    case 2:
+        s->ok = helper_ldl_mmu(env, addr, mmu_idx) ==
+                (uint32_t)env->exclusive_val;
+        if (s->ok) {
+            helper_stl_mmu(env, addr, val, mmu_idx);
+        }
+        break;
+    default:
+        s->ok = helper_ldl_mmu(env, addr, mmu_idx) == env->exclusive_val &&
+                helper_ldl_mmu(env, addr + 4, mmu_idx) == env->exclusive_high;
+        if (s->ok) {
+            helper_stl_mmu(env, addr, val, mmu_idx);
+            helper_stl_mmu(env, addr + 4, val >> 32, mmu_idx);
+        }
+        break;
+    }
+}
+
+/* Store exclusive for multi-threaded TCG.  The exclusive address has
+   already been checked by the caller; compare memory against the value
+   seen by the load exclusive and store the new value as a single host
+   atomic operation.  Returns the value for Rd: 0 on success, 1 on
+   failure.  */
+uint32_t HELPER(strex)(CPUARMState *env, uint32_t addr, uint64_t val,
+                       uint32_t size)
+{
+    int mmu_idx = cpu_mmu_index(env);
+    uint32_t len = 1 << size;
+    uintptr_t retaddr = GETPC();
+    ram_addr_t notdirty;
+    ARMStoreExclusive s;
+    void *host = NULL;
+
+    if (!(addr & (len - 1))) {
+        host = tlb_vaddr_to_host_write(env, addr, mmu_idx, retaddr,
+                                       &notdirty);
+    }
+
+    if (host) {
+        uint64_t cmp = env->exclusive_val;
+        uint64_t newval = val;
+        bool locked = false;
+        bool ok;
+
+        if (size == 3) {
+            cmp = arm_exclusive_pair(env->exclusive_val, env->exclusive_high);
+            newval = arm_exclusive_pair(val, val >> 32);
+        }
+        if (notdirty != RAM_ADDR_MAX) {
+            /* Dirty-tracked RAM: invalidate any TB on the page and
+               update the dirty bitmap around the atomic store, as
+               notdirty_mem_write would.  */
+            if (!qemu_mutex_iothread_locked()) {
+                qemu_mutex_lock_iothread();
+                locked = true;
+            }
+            env->mem_io_vaddr = addr;
+            env->mem_io_pc = retaddr;
+            cpu_notdirty_write_begin(notdirty, len);
+        }
+        ok = arm_strex_cmpxchg(host, cmp, newval, size);
+        if (notdirty != RAM_ADDR_MAX) {
+            if (ok) {
+                cpu_notdirty_write_end(env, notdirty, addr, len);
+            }
+            if (locked) {
+                qemu_mutex_unlock_iothread();
+            }
+        }
+        return !ok;
+    }
+
+    /* Unaligned or I/O: fill the TLB for both ends of the access first,
+       so that no fault can be raised once the other vCPUs are stopped */
+    tlb_vaddr_to_host_write(env, addr, mmu_idx, retaddr, &notdirty);
+    tlb_vaddr_to_host_write(env, addr + len - 1, mmu_idx, retaddr, &notdirty);
+    s.env = env;
+    s.addr = addr;
+    s.val = val;
+    s.size = size;
+    s.mmu_idx = mmu_idx;
+    s.ok = false;
+    qemu_tcg_exec_exclusive(ENV_GET_CPU(env), arm_strex_slow, &s);
+    return !s.ok;
+}
 #endif
 
 uint32_t HELPER(add_setq)(CPUARMState *env, uint32_t a, uint32_t b)
@@ -273,10 +434,30 @@ void HELPER(set_user_reg)(CPUARMState *env, uint32_t regno, uint32_t val)
     }
 }
 
+/* Coprocessor registers can be backed by timers and other board state,
+   which multi-threaded TCG only lets us touch under the BQL.  */
+static inline bool arm_cp_lock_iothread(void)
+{
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+static inline void arm_cp_unlock_iothread(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 void HELPER(set_cp_reg)(CPUARMState *env, void *rip, uint32_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = arm_cp_lock_iothread();
     int excp = ri->writefn(env, ri, value);
+    arm_cp_unlock_iothread(locked);
     if (excp) {
         raise_exception(env, excp);
     }
@@ -286,7 +467,9 @@ uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
     uint64_t value;
+    bool locked = arm_cp_lock_iothread();
     int excp = ri->readfn(env, ri, &value);
+    arm_cp_unlock_iothread(locked);
     if (excp) {
         raise_exception(env, excp);
     }
@@ -296,7 +479,9 @@ uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
 void HELPER(set_cp_reg64)(CPUARMState *env, void *rip, uint64_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = arm_cp_lock_iothread();
     int excp = ri->writefn(env, ri, value);
+    arm_cp_unlock_iothread(locked);
     if (excp) {
         raise_exception(env, excp);
     }
@@ -306,7 +491,9 @@ uint64_t HELPER(get_cp_reg64)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
     uint64_t value;
+    bool locked = arm_cp_lock_iothread();
     int excp = ri->readfn(env, ri, &value);
+    arm_cp_unlock_iothread(locked);
     if (excp) {
         raise_exception(env, excp);
     }
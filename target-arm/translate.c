@@ -28,6 +28,9 @@
 #include "disas/disas.h"
 #include "tcg-op.h"
 #include "qemu/log.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "sysemu/cpus.h"
+#endif
 
 #include "helper.h"
 #define GEN_HELPER 1
@@ -67,6 +70,20 @@ typedef struct DisasContext {
     int vfp_enabled;
     int vec_len;
     int vec_stride;
+    /* Superblock state: number of guest blocks to translate, the block
+       being translated, goto_tb slots already used, the loop label at the
+       start of the TB, and the side exits to emit after the trace.  */
+    int trace_len;
+    int trace_block;
+    int goto_tb_mask;
+    int trace_loop_label;
+    uint32_t trace_end;         /* highest pc of the blocks left behind */
+    uint32_t trace_block_start;
+    int nb_trace_ranges;        /* blocks left behind, see trace_range */
+    uint16_t trace_range[TB_TRACE_MAX_BLOCKS][2];
+    int nb_trace_exits;
+    int trace_exit_label[TB_TRACE_MAX_BLOCKS];
+    uint32_t trace_exit_pc[TB_TRACE_MAX_BLOCKS];
 } DisasContext;
 
 static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
@@ -3353,7 +3370,11 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     TranslationBlock *tb;
 
     tb = s->tb;
-    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
+    /* A superblock may have more exits than jump slots; the extra ones
+       go back through the TB hash table.  */
+    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) &&
+        !(s->goto_tb_mask & (1 << n))) {
+        s->goto_tb_mask |= 1 << n;
         tcg_gen_goto_tb(n);
         gen_set_pc_im(dest);
         tcg_gen_exit_tb((tcg_target_long)tb + n);
@@ -3363,6 +3384,59 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     }
 }
 
+/* Within a superblock, decide what a direct branch to @dest ends.
+   Returns true if translation carries on in the same TB, either at
+   @dest or, when the trace follows the fallthrough of a conditional
+   branch, after the branch.  */
+static bool gen_trace_jmp(DisasContext *s, uint32_t dest)
+{
+    TranslationBlock *tb = s->tb;
+    int follow;
+
+    if (s->trace_block >= s->trace_len || s->condexec_mask) {
+        return false;
+    }
+    follow = (tb->trace_exits >> s->trace_block) & 1;
+
+    if (s->trace_block == s->trace_len - 1) {
+        /* last block: close the loop if it branches back to the head */
+        if (follow == 0 && dest == tb->pc) {
+            tcg_gen_br(s->trace_loop_label);
+            s->is_jmp = DISAS_TB_JUMP;
+            return true;
+        }
+        return false;
+    }
+
+    if (follow == 0) {
+        if (dest <= tb->pc ||
+            (dest & TARGET_PAGE_MASK) != (tb->pc & TARGET_PAGE_MASK)) {
+            return false;
+        }
+        /* the skipped path leaves the TB out of line */
+        if (s->condjmp) {
+            s->trace_exit_label[s->nb_trace_exits] = s->condlabel;
+            s->trace_exit_pc[s->nb_trace_exits] = s->pc;
+            s->nb_trace_exits++;
+            s->condjmp = 0;
+        }
+        s->trace_end = MAX(s->trace_end, s->pc);
+        s->trace_range[s->nb_trace_ranges][0] = s->trace_block_start - tb->pc;
+        s->trace_range[s->nb_trace_ranges][1] = s->pc - tb->pc;
+        s->nb_trace_ranges++;
+        s->trace_block_start = dest;
+        s->pc = dest;
+    } else {
+        if (!s->condjmp) {
+            return false;
+        }
+        /* the branch is the side exit, condlabel resumes the trace */
+        gen_goto_tb(s, 0, dest);
+    }
+    s->trace_block++;
+    return true;
+}
+
 static inline void gen_jmp (DisasContext *s, uint32_t dest)
 {
     if (unlikely(s->singlestep_enabled)) {
@@ -3370,6 +3444,8 @@ static inline void gen_jmp (DisasContext *s, uint32_t dest)
         if (s->thumb)
             dest |= 1;
         gen_bx_im(s, dest);
+    } else if (gen_trace_jmp(s, dest)) {
+        /* nothing more to generate */
     } else {
         gen_goto_tb(s, 0, dest);
         s->is_jmp = DISAS_TB_JUMP;
@@ -4437,6 +4513,46 @@ static const uint8_t neon_2rm_sizes[] = {
     [NEON_2RM_VCVT_UF] = 0x4,
 };
 
+/* Emit the three-register-same-length integer op as a TCG vector op on
+   the D registers, which the backend can map to host SIMD instructions.
+   Returns nonzero if the insn was handled.  */
+static int gen_neon_3r_vec(int op, int u, int size, int q,
+                           int rd, int rn, int rm)
+{
+    int oprsz = q ? 16 : 8;
+    long dofs = vfp_reg_offset(1, rd);
+    long aofs = vfp_reg_offset(1, rn);
+    long bofs = vfp_reg_offset(1, rm);
+
+    switch (op) {
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            tcg_gen_vec_sub(size, cpu_env, dofs, aofs, bofs, oprsz);
+        } else {
+            tcg_gen_vec_add(size, cpu_env, dofs, aofs, bofs, oprsz);
+        }
+        return 1;
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            tcg_gen_vec_and(cpu_env, dofs, aofs, bofs, oprsz);
+            return 1;
+        case 1: /* BIC */
+            tcg_gen_vec_andc(cpu_env, dofs, aofs, bofs, oprsz);
+            return 1;
+        case 2: /* VORR */
+            tcg_gen_vec_or(cpu_env, dofs, aofs, bofs, oprsz);
+            return 1;
+        case 4: /* VEOR */
+            tcg_gen_vec_xor(cpu_env, dofs, aofs, bofs, oprsz);
+            return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
 /* Translate a NEON data processing instruction.  Return nonzero if the
    instruction is invalid.
    We process data in a mixture of 32-bit and 64-bit chunks.
@@ -4478,6 +4594,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
         if (q && ((rd | rn | rm) & 1)) {
             return 1;
         }
+        if (gen_neon_3r_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -6444,8 +6563,10 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    regular stores.
 
    In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   this sequence is effectively atomic, unless multi-threaded TCG is
+   enabled; then the store is done by a helper with a host atomic
+   compare-and-swap.  In user emulation mode we throw an exception and
+   handle the atomic operation elsewhere.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
 {
@@ -6494,6 +6615,41 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     gen_exception_insn(s, 4, EXCP_STREX);
 }
 #else
+static void gen_store_exclusive_atomic(DisasContext *s, int rd, int rt,
+                                       int rt2, TCGv_i32 addr, int size)
+{
+    TCGv_i32 tmp, tmp2;
+    TCGv_i64 val;
+    int done_label;
+    int fail_label;
+
+    fail_label = gen_new_label();
+    done_label = gen_new_label();
+    tcg_gen_brcond_i32(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
+    /* The helper may fault */
+    gen_set_condexec(s);
+    gen_set_pc_im(s->pc - 4);
+    val = tcg_temp_new_i64();
+    tmp = load_reg(s, rt);
+    if (size == 3) {
+        tmp2 = load_reg(s, rt2);
+        tcg_gen_concat_i32_i64(val, tmp, tmp2);
+        tcg_temp_free_i32(tmp2);
+    } else {
+        tcg_gen_extu_i32_i64(val, tmp);
+    }
+    tcg_temp_free_i32(tmp);
+    tmp = tcg_const_i32(size);
+    gen_helper_strex(cpu_R[rd], cpu_env, addr, val, tmp);
+    tcg_temp_free_i32(tmp);
+    tcg_temp_free_i64(val);
+    tcg_gen_br(done_label);
+    gen_set_label(fail_label);
+    tcg_gen_movi_i32(cpu_R[rd], 1);
+    gen_set_label(done_label);
+    tcg_gen_movi_i32(cpu_exclusive_addr, -1);
+}
+
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i32 addr, int size)
 {
@@ -6501,6 +6657,11 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     int done_label;
     int fail_label;
 
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_store_exclusive_atomic(s, rd, rt, rt2, addr, size);
+        return;
+    }
+
     /* if (env->exclusive_addr == addr && env->exclusive_val == [addr]) {
          [addr] = {Rt};
          {Rd} = 0;
@@ -9943,6 +10104,13 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     dc->vfp_enabled = ARM_TBFLAG_VFPEN(tb->flags);
     dc->vec_len = ARM_TBFLAG_VECLEN(tb->flags);
     dc->vec_stride = ARM_TBFLAG_VECSTRIDE(tb->flags);
+    dc->trace_len = ARM_TBFLAG_CONDEXEC(tb->flags) ? 0 : tb->trace_len;
+    dc->trace_block = 0;
+    dc->trace_end = pc_start;
+    dc->trace_block_start = pc_start;
+    dc->nb_trace_ranges = 0;
+    dc->goto_tb_mask = 0;
+    dc->nb_trace_exits = 0;
     cpu_F0s = tcg_temp_new_i32();
     cpu_F1s = tcg_temp_new_i32();
     cpu_F0d = tcg_temp_new_i64();
@@ -9958,6 +10126,11 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     if (max_insns == 0)
         max_insns = CF_COUNT_MASK;
 
+    if (dc->trace_len) {
+        /* the loop re-enters before the exit request check */
+        dc->trace_loop_label = gen_new_label();
+        gen_set_label(dc->trace_loop_label);
+    }
     gen_tb_start();
 
     tcg_clear_temp_count();
@@ -10160,6 +10333,10 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     }
 
 done_generating:
+    for (j = 0; j < dc->nb_trace_exits; j++) {
+        gen_set_label(dc->trace_exit_label[j]);
+        gen_goto_tb(dc, 1, dc->trace_exit_pc[j]);
+    }
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
 
@@ -10167,7 +10344,7 @@ done_generating:
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
         qemu_log("----------------\n");
         qemu_log("IN: %s\n", lookup_symbol(pc_start));
-        log_target_disas(env, pc_start, dc->pc - pc_start,
+        log_target_disas(env, pc_start, MAX(dc->pc, dc->trace_end) - pc_start,
                          dc->thumb | (dc->bswap_code << 1));
         qemu_log("\n");
     }
@@ -10178,8 +10355,16 @@ done_generating:
         while (lj <= j)
             tcg_ctx.gen_opc_instr_start[lj++] = 0;
     } else {
-        tb->size = dc->pc - pc_start;
+        /* a superblock covers all the code between its blocks */
+        tb->size = MAX(dc->pc, dc->trace_end) - pc_start;
         tb->icount = num_insns;
+        if (dc->nb_trace_ranges) {
+            memcpy(tb->trace_range, dc->trace_range, sizeof(tb->trace_range));
+            tb->trace_range[dc->nb_trace_ranges][0] =
+                dc->trace_block_start - pc_start;
+            tb->trace_range[dc->nb_trace_ranges][1] = dc->pc - pc_start;
+            tb->nb_trace_ranges = dc->nb_trace_ranges + 1;
+        }
     }
 }
 
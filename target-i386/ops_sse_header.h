@@ -34,31 +34,31 @@
 #define dh_is_signed_XMMReg dh_is_signed_ptr
 #define dh_is_signed_MMXReg dh_is_signed_ptr
 
-DEF_HELPER_3(glue(psrlw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psraw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psllw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrld, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrad, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pslld, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrlq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psllq, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrlw, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psraw, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psllw, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrld, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrad, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pslld, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrlq, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psllq, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
 #if SHIFT == 1
-DEF_HELPER_3(glue(psrldq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pslldq, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrldq, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pslldq, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 #endif
 
 #define SSE_HELPER_B(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
 #define SSE_HELPER_W(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
 #define SSE_HELPER_L(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
 #define SSE_HELPER_Q(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
 SSE_HELPER_B(paddb, FADD)
 SSE_HELPER_W(paddw, FADD)
@@ -109,24 +109,24 @@ SSE_HELPER_W(pmulhw, FMULHW)
 SSE_HELPER_B(pavgb, FAVG)
 SSE_HELPER_W(pavgw, FAVG)
 
-DEF_HELPER_3(glue(pmuludq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaddwd, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmuludq, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaddwd, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 
-DEF_HELPER_3(glue(psadbw, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psadbw, SUFFIX), TCG_CALL_NO_WG, void, env, Reg, Reg)
 DEF_HELPER_4(glue(maskmov, SUFFIX), void, env, Reg, Reg, tl)
-DEF_HELPER_2(glue(movl_mm_T0, SUFFIX), void, Reg, i32)
+DEF_HELPER_FLAGS_2(glue(movl_mm_T0, SUFFIX), TCG_CALL_NO_WG, void, Reg, i32)
 #ifdef TARGET_X86_64
-DEF_HELPER_2(glue(movq_mm_T0, SUFFIX), void, Reg, i64)
+DEF_HELPER_FLAGS_2(glue(movq_mm_T0, SUFFIX), TCG_CALL_NO_WG, void, Reg, i64)
 #endif
 
 #if SHIFT == 0
-DEF_HELPER_3(glue(pshufw, SUFFIX), void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufw, SUFFIX), TCG_CALL_NO_WG, void, Reg, Reg, int)
 #else
-DEF_HELPER_3(shufps, void, Reg, Reg, int)
-DEF_HELPER_3(shufpd, void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshufd, SUFFIX), void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshuflw, SUFFIX), void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshufhw, SUFFIX), void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(shufps, TCG_CALL_NO_WG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(shufpd, TCG_CALL_NO_WG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufd, SUFFIX), TCG_CALL_NO_WG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshuflw, SUFFIX), TCG_CALL_NO_WG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufhw, SUFFIX), TCG_CALL_NO_WG, void, Reg, Reg, int)
 #endif
 
 #if SHIFT == 1
@@ -332,7 +332,7 @@ DEF_HELPER_4(glue(pcmpestri, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpestrm, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpistri, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpistrm, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_3(crc32, tl, i32, tl, i32)
+DEF_HELPER_FLAGS_3(crc32, TCG_CALL_NO_RWG_SE, tl, i32, tl, i32)
 DEF_HELPER_3(popcnt, tl, env, tl, i32)
 #endif
 
@@ -3234,6 +3234,50 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Emit the integer MMX/SSE operation B as a TCG vector op, which the
+   backend can translate to host SIMD instructions.  Returns 0 if the
+   operation needs its helper.  */
+static int gen_sse_vec(int b, int oprsz, int op1_offset, int op2_offset)
+{
+    switch (b) {
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddd */
+        tcg_gen_vec_add(b - 0xfc, cpu_env, op1_offset, op1_offset,
+                        op2_offset, oprsz);
+        return 1;
+    case 0xd4: /* paddq */
+        tcg_gen_vec_add(3, cpu_env, op1_offset, op1_offset, op2_offset,
+                        oprsz);
+        return 1;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubd */
+    case 0xfb: /* psubq */
+        tcg_gen_vec_sub(b - 0xf8, cpu_env, op1_offset, op1_offset,
+                        op2_offset, oprsz);
+        return 1;
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        tcg_gen_vec_and(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return 1;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        tcg_gen_vec_andc(cpu_env, op1_offset, op2_offset, op1_offset, oprsz);
+        return 1;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        tcg_gen_vec_or(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return 1;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        tcg_gen_vec_xor(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4610,6 +4654,13 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
         case 0x70: /* pshufx insn */
         case 0xc6: /* pshufx insn */
             val = cpu_ldub_code(env, s->pc++);
+#ifndef HOST_WORDS_BIGENDIAN
+            if (b == 0x70 && b1 == 1) {
+                /* pshufd */
+                tcg_gen_vec_shuf32(cpu_env, op1_offset, op2_offset, val);
+                break;
+            }
+#endif
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             /* XXX: introduce a new table? */
@@ -4650,6 +4701,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_vec(b, is_xmm ? 16 : 8, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
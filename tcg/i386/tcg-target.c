@@ -245,12 +245,14 @@ static inline int tcg_target_const_match(tcg_target_long val,
 # define P_REXB_R	0x1000		/* REG field as byte register */
 # define P_REXB_RM	0x2000		/* R/M field as byte register */
 # define P_GS           0x4000          /* gs segment override */
+# define P_SIMDF3       0x8000          /* 0xf3 opcode prefix */
 #else
 # define P_ADDR32	0
 # define P_REXW		0
 # define P_REXB_R	0
 # define P_REXB_RM	0
 # define P_GS           0
+# define P_SIMDF3       0
 #endif
 
 #define OPC_ARITH_EvIz	(0x81)
@@ -293,6 +295,23 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_SHIFT_cl	(0xd3)
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
 
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
@@ -374,6 +393,9 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
         assert((opc & P_REXW) == 0);
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
@@ -557,6 +579,18 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     }
 }
 
+#if TCG_TARGET_REG_BITS == 64
+/* Always the full movabs, so that a relocation can patch the value.  */
+static void tcg_out_movi_reloc(TCGContext *s, TCGReg ret, tcg_target_long arg,
+                               int type, uint64_t value)
+{
+    tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+    tcg_tb_reloc_add(s, s->code_ptr, type, value);
+    tcg_out32(s, arg);
+    tcg_out32(s, arg >> 31 >> 1);
+}
+#endif
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -979,6 +1013,14 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_target_long dest)
 {
     tcg_target_long disp = dest - (tcg_target_long)s->code_ptr - 5;
 
+#if TCG_TARGET_REG_BITS == 64
+    if (call && s->tb_record_relocs) {
+        /* The helper moves with the QEMU binary, not with the TB.  */
+        tcg_out_movi_reloc(s, TCG_REG_R10, dest, TCG_TB_RELOC_HOST_ABS64, 0);
+        tcg_out_modrm(s, OPC_GRP5, EXT5_CALLN_Ev, TCG_REG_R10);
+        return;
+    }
+#endif
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
         tcg_out32(s, disp);
@@ -1078,8 +1120,10 @@ static inline void tcg_out_tlb_load(TCGContext *s, int addrlo_idx,
 
     tgen_arithi(s, ARITH_AND + rexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + rexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* and tlb_desc[mem_index].mask(env), r0 */
+    tcg_out_modrm_offset(s, OPC_ARITH_GvEv + (ARITH_AND << 3) + rexw, r0,
+                         TCG_AREG0,
+                         offsetof(CPUArchState, tlb_desc[mem_index].mask));
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + P_REXW, r0, TCG_AREG0, r0, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
@@ -1662,6 +1706,76 @@ void tcg_out_tb_finalize(TCGContext *s)
 }
 #endif  /* CONFIG_SOFTMMU */
 
+#if TCG_TARGET_REG_BITS == 64
+/* Vector ops go through %xmm0 and %xmm1, which the register allocator
+   never uses and calls clobber anyway.  The memory operands need not be
+   aligned, so they are always loaded with movdqu or movq.  */
+static void tcg_out_vec_ld(TCGContext *s, int oprsz, int xmm, int base,
+                           tcg_target_long ofs)
+{
+    tcg_out_modrm_offset(s, oprsz == 16 ? OPC_MOVDQU_VxWx : OPC_MOVQ_VqWq,
+                         xmm, base, ofs);
+}
+
+static void tcg_out_vec_st(TCGContext *s, int oprsz, int xmm, int base,
+                           tcg_target_long ofs)
+{
+    tcg_out_modrm_offset(s, oprsz == 16 ? OPC_MOVDQU_WxVx : OPC_MOVQ_WqVq,
+                         xmm, base, ofs);
+}
+
+static void tcg_out_vec(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    static const int add_insn[4] = {
+        OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+    };
+    static const int sub_insn[4] = {
+        OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+    };
+    int base = args[0], oprsz = TCG_VEC_OPRSZ(args[4]);
+    int vece = TCG_VEC_VECE(args[4]);
+    tcg_target_long dofs = args[1], aofs = args[2], bofs = args[3];
+    int insn;
+
+    switch (opc) {
+    case INDEX_op_shuf32_vec:
+        tcg_out_vec_ld(s, 16, 0, base, aofs);
+        tcg_out_modrm(s, OPC_PSHUFD, 0, 0);
+        tcg_out8(s, args[3]);
+        tcg_out_vec_st(s, 16, 0, base, dofs);
+        return;
+    case INDEX_op_andc_vec:
+        /* pandn computes ~dst & src */
+        tcg_out_vec_ld(s, oprsz, 0, base, bofs);
+        tcg_out_vec_ld(s, oprsz, 1, base, aofs);
+        tcg_out_modrm(s, OPC_PANDN, 0, 1);
+        tcg_out_vec_st(s, oprsz, 0, base, dofs);
+        return;
+    case INDEX_op_add_vec:
+        insn = add_insn[vece];
+        break;
+    case INDEX_op_sub_vec:
+        insn = sub_insn[vece];
+        break;
+    case INDEX_op_and_vec:
+        insn = OPC_PAND;
+        break;
+    case INDEX_op_or_vec:
+        insn = OPC_POR;
+        break;
+    case INDEX_op_xor_vec:
+        insn = OPC_PXOR;
+        break;
+    default:
+        tcg_abort();
+    }
+    tcg_out_vec_ld(s, oprsz, 0, base, aofs);
+    tcg_out_vec_ld(s, oprsz, 1, base, bofs);
+    tcg_out_modrm(s, insn, 0, 1);
+    tcg_out_vec_st(s, oprsz, 0, base, dofs);
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1679,6 +1793,23 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
+#if TCG_TARGET_REG_BITS == 64
+        if (s->tb_record_relocs) {
+            if (args[0]) {
+                tcg_out_movi_reloc(s, TCG_REG_EAX, args[0],
+                                   TCG_TB_RELOC_TB_ABS64,
+                                   args[0] - s->tb_reloc_base);
+            } else {
+                tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, 0);
+            }
+            /* The prologue is always within reach of the code buffer.  */
+            tcg_out8(s, OPC_JMP_long);
+            tcg_tb_reloc_add(s, s->code_ptr, TCG_TB_RELOC_RET_REL32,
+                             tb_ret_addr - s->code_gen_prologue);
+            tcg_out32(s, tb_ret_addr - s->code_ptr - 4);
+            break;
+        }
+#endif
         tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
         tcg_out_jmp(s, (tcg_target_long) tb_ret_addr);
         break;
@@ -2005,6 +2136,16 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_ext32s_i64:
         tcg_out_ext32s(s, args[0], args[1]);
         break;
+
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_shuf32_vec:
+        tcg_out_vec(s, opc, args);
+        break;
 #endif
 
     OP_32_64(deposit):
@@ -2146,6 +2287,14 @@ static const TCGTargetOpDef x86_op_defs[] = {
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
+    { INDEX_op_add_vec, { "r" } },
+    { INDEX_op_sub_vec, { "r" } },
+    { INDEX_op_and_vec, { "r" } },
+    { INDEX_op_or_vec, { "r" } },
+    { INDEX_op_xor_vec, { "r" } },
+    { INDEX_op_andc_vec, { "r" } },
+    { INDEX_op_shuf32_vec, { "r" } },
+
     { INDEX_op_qemu_ld8u, { "r", "L" } },
     { INDEX_op_qemu_ld8s, { "r", "L" } },
     { INDEX_op_qemu_ld16u, { "r", "L" } },
@@ -124,6 +124,13 @@ typedef enum {
 #define TCG_TARGET_HAS_muls2_i64        1
 #endif
 
+/* Calls to helpers and exit_tb can be emitted in a form that records
+   their embedded host addresses, see tcg_tb_reloc_add().  */
+#define TCG_TARGET_HAS_TB_RELOCS        (TCG_TARGET_REG_BITS == 64)
+
+/* SSE2 is part of the x86-64 baseline.  */
+#define TCG_TARGET_HAS_vec              (TCG_TARGET_REG_BITS == 64)
+
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
      ((ofs) == 0 && (len) == 16))
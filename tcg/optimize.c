@@ -182,6 +182,259 @@ static void tcg_opt_gen_movi(TCGArg *gen_args, TCGArg dst, TCGArg val)
     gen_args[1] = val;
 }
 
+/* Explicit loads and stores of the CPU state, i.e. ld/st ops whose base
+   is env, are tracked within a basic block.  A load from a slot whose
+   value is still held by a temp becomes a move, and a store that is
+   overwritten before anything could observe it is removed.  */
+#define TCG_OPT_ENV_SLOTS 16
+
+struct tcg_env_slot {
+    tcg_target_long ofs;
+    int size;
+    TCGOpcode ld_op;        /* load that yields VAL, or 0 */
+    TCGArg val;
+    uint16_t *st_opc;       /* store not yet observed, or NULL */
+    TCGArg *st_args;
+};
+
+static struct tcg_env_slot env_slots[TCG_OPT_ENV_SLOTS];
+static int nb_env_slots;
+
+static void env_slot_remove(int i)
+{
+    nb_env_slots--;
+    memmove(&env_slots[i], &env_slots[i + 1],
+            (nb_env_slots - i) * sizeof(env_slots[0]));
+}
+
+/* TEMP is overwritten: slots can no longer be forwarded from it.  */
+static void env_slots_kill_temp(TCGArg temp)
+{
+    int i;
+
+    for (i = nb_env_slots - 1; i >= 0; i--) {
+        if (env_slots[i].ld_op && env_slots[i].val == temp) {
+            env_slots[i].ld_op = 0;
+            if (!env_slots[i].st_opc) {
+                env_slot_remove(i);
+            }
+        }
+    }
+}
+
+/* The CPU state may be read: pending stores must stay.  */
+static void env_slots_observe(tcg_target_long ofs, int size)
+{
+    int i;
+
+    for (i = nb_env_slots - 1; i >= 0; i--) {
+        if (ofs < env_slots[i].ofs + env_slots[i].size
+            && env_slots[i].ofs < ofs + size) {
+            env_slots[i].st_opc = NULL;
+            if (!env_slots[i].ld_op) {
+                env_slot_remove(i);
+            }
+        }
+    }
+}
+
+static void env_slots_observe_all(void)
+{
+    int i;
+
+    for (i = nb_env_slots - 1; i >= 0; i--) {
+        env_slots[i].st_opc = NULL;
+        if (!env_slots[i].ld_op) {
+            env_slot_remove(i);
+        }
+    }
+}
+
+static bool is_env_base(TCGContext *s, TCGArg base)
+{
+    return s->temps[base].fixed_reg && s->temps[base].reg == TCG_AREG0;
+}
+
+static int env_access_size(TCGOpcode op)
+{
+    switch (op) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        tcg_abort();
+    }
+}
+
+static struct tcg_env_slot *env_slot_new(tcg_target_long ofs, int size)
+{
+    if (nb_env_slots == TCG_OPT_ENV_SLOTS) {
+        env_slot_remove(0);
+    }
+    env_slots[nb_env_slots].ofs = ofs;
+    env_slots[nb_env_slots].size = size;
+    env_slots[nb_env_slots].ld_op = 0;
+    env_slots[nb_env_slots].st_opc = NULL;
+    return &env_slots[nb_env_slots++];
+}
+
+/* Load OP with arguments ARGS.  Returns the temp that already holds the
+   loaded value, or -1 if the load must be emitted.  */
+static TCGArg env_load(TCGContext *s, TCGOpcode op, TCGArg *args)
+{
+    tcg_target_long ofs = args[2];
+    int size = env_access_size(op);
+    struct tcg_env_slot *slot;
+    TCGArg val = (TCGArg)-1;
+    int i;
+
+    if (!is_env_base(s, args[1])) {
+        env_slots_observe_all();
+        env_slots_kill_temp(args[0]);
+        return (TCGArg)-1;
+    }
+    for (i = 0; i < nb_env_slots; i++) {
+        if (env_slots[i].ofs == ofs && env_slots[i].size == size
+            && env_slots[i].ld_op == op) {
+            val = env_slots[i].val;
+            break;
+        }
+    }
+    env_slots_observe(ofs, size);
+    if (val == args[0]) {
+        return val;
+    }
+    env_slots_kill_temp(args[0]);
+    if (val != (TCGArg)-1) {
+        return val;
+    }
+
+    slot = env_slot_new(ofs, size);
+    slot->ld_op = op;
+    slot->val = args[0];
+    return (TCGArg)-1;
+}
+
+/* Store OP with arguments ARGS, about to be emitted at ST_OPC/ST_ARGS.  */
+static void env_store(TCGContext *s, TCGOpcode op, TCGArg *args,
+                      uint16_t *st_opc, TCGArg *st_args)
+{
+    tcg_target_long ofs = args[2];
+    int size = env_access_size(op);
+    struct tcg_env_slot *slot;
+    int i;
+
+    if (!is_env_base(s, args[1])) {
+        /* Might alias anything in the CPU state.  */
+        env_slots_observe_all();
+        nb_env_slots = 0;
+        return;
+    }
+    for (i = nb_env_slots - 1; i >= 0; i--) {
+        slot = &env_slots[i];
+        if (ofs >= slot->ofs + slot->size || slot->ofs >= ofs + size) {
+            continue;
+        }
+        if (slot->st_opc && ofs <= slot->ofs
+            && slot->ofs + slot->size <= ofs + size) {
+            /* Dead store: turn it into a nop of the same length.  */
+            *slot->st_opc = INDEX_op_nopn;
+            slot->st_args[0] = 3;
+            slot->st_args[2] = 3;
+        }
+        env_slot_remove(i);
+    }
+
+    slot = env_slot_new(ofs, size);
+    slot->st_opc = st_opc;
+    slot->st_args = st_args;
+    if (op == INDEX_op_st_i32) {
+        slot->ld_op = INDEX_op_ld_i32;
+        slot->val = args[0];
+    } else if (op == INDEX_op_st_i64) {
+        slot->ld_op = INDEX_op_ld_i64;
+        slot->val = args[0];
+    }
+}
+
+/* Vector op OP reads and writes the CPU state directly.  */
+static void env_vec_op(TCGContext *s, TCGOpcode op, TCGArg *args)
+{
+    int oprsz = TCG_VEC_OPRSZ(args[4]);
+    int i;
+
+    if (!is_env_base(s, args[0])) {
+        env_slots_observe_all();
+        nb_env_slots = 0;
+        return;
+    }
+    env_slots_observe(args[2], oprsz);
+    if (op != INDEX_op_shuf32_vec) {
+        env_slots_observe(args[3], oprsz);
+    }
+    for (i = nb_env_slots - 1; i >= 0; i--) {
+        if (args[1] < env_slots[i].ofs + env_slots[i].size
+            && env_slots[i].ofs < args[1] + oprsz) {
+            env_slot_remove(i);
+        }
+    }
+}
+
+/* Any other op: update the slots for its outputs and side effects.  */
+static void env_track_op(TCGContext *s, TCGOpcode op, const TCGOpDef *def,
+                         TCGArg *args)
+{
+    int i, nb_oargs, nb_call_args;
+
+    if (op == INDEX_op_call) {
+        nb_oargs = args[0] >> 16;
+        nb_call_args = nb_oargs + (args[0] & 0xffff);
+        /* Helpers that may read globals can read and write any part of
+           the CPU state.  So can those that are passed env, whatever
+           their flags say: many of them only promise not to touch the
+           globals themselves.  */
+        if (!(args[nb_call_args + 1] & TCG_CALL_NO_READ_GLOBALS)) {
+            nb_env_slots = 0;
+            return;
+        }
+        for (i = nb_oargs + 1; i < nb_call_args + 1; i++) {
+            if (is_env_base(s, args[i])) {
+                nb_env_slots = 0;
+                return;
+            }
+        }
+        for (i = 0; i < nb_oargs; i++) {
+            env_slots_kill_temp(args[i + 1]);
+        }
+        return;
+    }
+    if (def->flags & TCG_OPF_BB_END) {
+        nb_env_slots = 0;
+        return;
+    }
+    if (def->flags & (TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS)) {
+        /* Guest memory accesses may fault and expose the CPU state.  */
+        env_slots_observe_all();
+    }
+    for (i = 0; i < def->nb_oargs; i++) {
+        env_slots_kill_temp(args[i]);
+    }
+}
+
 static TCGOpcode op_to_mov(TCGOpcode op)
 {
     switch (op_bits(op)) {
@@ -494,6 +747,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
     nb_temps = s->nb_temps;
     nb_globals = s->nb_globals;
     reset_all_temps(nb_temps);
+    nb_env_slots = 0;
 
     nb_ops = tcg_opc_ptr - s->gen_opc_buf;
     gen_args = args;
@@ -517,6 +771,54 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             }
         }
 
+        /* Forward explicit loads of the CPU state */
+        switch (op) {
+        CASE_OP_32_64(ld8u):
+        CASE_OP_32_64(ld8s):
+        CASE_OP_32_64(ld16u):
+        CASE_OP_32_64(ld16s):
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+        case INDEX_op_ld_i64:
+            tmp = env_load(s, op, args);
+            if (tmp == (TCGArg)-1) {
+                break;
+            }
+            if (temps[tmp].state == TCG_TEMP_CONST) {
+                s->gen_opc_buf[op_index] = op_to_movi(op);
+                tcg_opt_gen_movi(gen_args, args[0], temps[tmp].val);
+                gen_args += 2;
+            } else if (temps_are_copies(args[0], tmp)) {
+                s->gen_opc_buf[op_index] = INDEX_op_nop;
+            } else {
+                s->gen_opc_buf[op_index] = op_to_mov(op);
+                tcg_opt_gen_mov(s, gen_args, args[0], tmp);
+                gen_args += 2;
+            }
+            args += 3;
+            continue;
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st_i32:
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i64:
+            env_store(s, op, args, &s->gen_opc_buf[op_index], gen_args);
+            break;
+        case INDEX_op_add_vec:
+        case INDEX_op_sub_vec:
+        case INDEX_op_and_vec:
+        case INDEX_op_or_vec:
+        case INDEX_op_xor_vec:
+        case INDEX_op_andc_vec:
+        case INDEX_op_shuf32_vec:
+            env_vec_op(s, op, args);
+            break;
+        default:
+            env_track_op(s, op, def, args);
+            break;
+        }
+
         /* For commutative operations make constant second argument */
         switch (op) {
         CASE_OP_32_64(add):
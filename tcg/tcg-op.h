@@ -389,12 +389,13 @@ static inline int tcg_gen_sizemask(int n, int is_64bit, int is_signed)
     return (is_64bit << n*2) | (is_signed << (n*2 + 1));
 }
 
-/* helper calls */
+/* helper calls; the helper address is only ever used as the call
+   target, which backends can relocate (see TCG_TARGET_HAS_TB_RELOCS) */
 static inline void tcg_gen_helperN(void *func, int flags, int sizemask,
                                    TCGArg ret, int nargs, TCGArg *args)
 {
     TCGv_ptr fn;
-    fn = tcg_const_ptr(func);
+    fn = tcg_const_helper_ptr(func);
     tcg_gen_callN(&tcg_ctx, fn, flags, sizemask, ret,
                   nargs, args);
     tcg_temp_free_ptr(fn);
@@ -410,7 +411,7 @@ static inline void tcg_gen_helper32(void *func, int sizemask, TCGv_i32 ret,
 {
     TCGv_ptr fn;
     TCGArg args[2];
-    fn = tcg_const_ptr(func);
+    fn = tcg_const_helper_ptr(func);
     args[0] = GET_TCGV_I32(a);
     args[1] = GET_TCGV_I32(b);
     tcg_gen_callN(&tcg_ctx, fn,
@@ -424,7 +425,7 @@ static inline void tcg_gen_helper64(void *func, int sizemask, TCGv_i64 ret,
 {
     TCGv_ptr fn;
     TCGArg args[2];
-    fn = tcg_const_ptr(func);
+    fn = tcg_const_helper_ptr(func);
     args[0] = GET_TCGV_I64(a);
     args[1] = GET_TCGV_I64(b);
     tcg_gen_callN(&tcg_ctx, fn,
@@ -2964,6 +2965,227 @@ static inline void tcg_gen_qemu_st64(TCGv_i64 arg, TCGv addr, int mem_index)
 #define tcg_gen_muls2_tl tcg_gen_muls2_i32
 #endif
 
+/***************************************/
+/* Vector operations on memory.  Each operates on OPRSZ (8 or 16) bytes
+   at BASE + DOFS, BASE + AOFS and BASE + BOFS, split into lanes of
+   1 << VECE bytes.  The operands may overlap only if they are identical.
+   Without TCG_TARGET_HAS_vec they are expanded into 64-bit integer ops.  */
+
+static inline void tcg_gen_vec_op(TCGOpcode opc, TCGv_ptr base,
+                                  tcg_target_long dofs, tcg_target_long aofs,
+                                  TCGArg arg, TCGArg desc)
+{
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(base);
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = arg;
+    *tcg_ctx.gen_opparam_ptr++ = desc;
+}
+
+/* Replicate the lowest lane of C into all lanes of a 64-bit value.  */
+static inline uint64_t tcg_vec_dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case 0:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case 1:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case 2:
+        return 0x0000000100000001ull * (uint32_t)c;
+    default:
+        return c;
+    }
+}
+
+/* Lane-wise add and subtract in a 64-bit register: the top bit of each
+   lane is computed separately so that carries do not cross lanes.  */
+static inline void tcg_gen_vec_addv_i64(unsigned vece, TCGv_i64 d,
+                                        TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m, t1, t2, t3;
+
+    if (vece == 3) {
+        tcg_gen_add_i64(d, a, b);
+        return;
+    }
+    m = tcg_const_i64(tcg_vec_dup_const(vece, 1ull << ((8 << vece) - 1)));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_andc_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t3);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_subv_i64(unsigned vece, TCGv_i64 d,
+                                        TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m, t1, t2, t3;
+
+    if (vece == 3) {
+        tcg_gen_sub_i64(d, a, b);
+        return;
+    }
+    m = tcg_const_i64(tcg_vec_dup_const(vece, 1ull << ((8 << vece) - 1)));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_or_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t3);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_expand(TCGOpcode opc, unsigned vece,
+                                      TCGv_ptr base, tcg_target_long dofs,
+                                      tcg_target_long aofs,
+                                      tcg_target_long bofs, uint32_t oprsz)
+{
+    TCGv_i64 a = tcg_temp_new_i64();
+    TCGv_i64 b = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(a, base, aofs + i);
+        tcg_gen_ld_i64(b, base, bofs + i);
+        switch (opc) {
+        case INDEX_op_add_vec:
+            tcg_gen_vec_addv_i64(vece, a, a, b);
+            break;
+        case INDEX_op_sub_vec:
+            tcg_gen_vec_subv_i64(vece, a, a, b);
+            break;
+        case INDEX_op_and_vec:
+            tcg_gen_and_i64(a, a, b);
+            break;
+        case INDEX_op_or_vec:
+            tcg_gen_or_i64(a, a, b);
+            break;
+        case INDEX_op_xor_vec:
+            tcg_gen_xor_i64(a, a, b);
+            break;
+        case INDEX_op_andc_vec:
+            tcg_gen_andc_i64(a, a, b);
+            break;
+        default:
+            tcg_abort();
+        }
+        tcg_gen_st_i64(a, base, dofs + i);
+    }
+    tcg_temp_free_i64(b);
+    tcg_temp_free_i64(a);
+}
+
+static inline void tcg_gen_vec_3(TCGOpcode opc, unsigned vece, TCGv_ptr base,
+                                 tcg_target_long dofs, tcg_target_long aofs,
+                                 tcg_target_long bofs, uint32_t oprsz)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(opc, base, dofs, aofs, bofs,
+                       TCG_VEC_DESC(oprsz, vece));
+    } else {
+        tcg_gen_vec_expand(opc, vece, base, dofs, aofs, bofs, oprsz);
+    }
+}
+
+/* D = A + B */
+static inline void tcg_gen_vec_add(unsigned vece, TCGv_ptr base,
+                                   tcg_target_long dofs, tcg_target_long aofs,
+                                   tcg_target_long bofs, uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_add_vec, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+/* D = A - B */
+static inline void tcg_gen_vec_sub(unsigned vece, TCGv_ptr base,
+                                   tcg_target_long dofs, tcg_target_long aofs,
+                                   tcg_target_long bofs, uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_sub_vec, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+/* D = A & B */
+static inline void tcg_gen_vec_and(TCGv_ptr base, tcg_target_long dofs,
+                                   tcg_target_long aofs, tcg_target_long bofs,
+                                   uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_and_vec, 3, base, dofs, aofs, bofs, oprsz);
+}
+
+/* D = A | B */
+static inline void tcg_gen_vec_or(TCGv_ptr base, tcg_target_long dofs,
+                                  tcg_target_long aofs, tcg_target_long bofs,
+                                  uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_or_vec, 3, base, dofs, aofs, bofs, oprsz);
+}
+
+/* D = A ^ B */
+static inline void tcg_gen_vec_xor(TCGv_ptr base, tcg_target_long dofs,
+                                   tcg_target_long aofs, tcg_target_long bofs,
+                                   uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_xor_vec, 3, base, dofs, aofs, bofs, oprsz);
+}
+
+/* D = A & ~B */
+static inline void tcg_gen_vec_andc(TCGv_ptr base, tcg_target_long dofs,
+                                    tcg_target_long aofs, tcg_target_long bofs,
+                                    uint32_t oprsz)
+{
+    tcg_gen_vec_3(INDEX_op_andc_vec, 3, base, dofs, aofs, bofs, oprsz);
+}
+
+/* 32-bit lane I of the 16 bytes at D is set to lane (IMM >> 2 * I) & 3
+   of A, with lanes numbered in host memory order.  */
+static inline void tcg_gen_vec_shuf32(TCGv_ptr base, tcg_target_long dofs,
+                                      tcg_target_long aofs, unsigned imm)
+{
+    if (TCG_TARGET_HAS_vec) {
+        tcg_gen_vec_op(INDEX_op_shuf32_vec, base, dofs, aofs, imm & 0xff,
+                       TCG_VEC_DESC(16, 2));
+    } else {
+        TCGv_i32 t[4];
+        int i;
+
+        for (i = 0; i < 4; i++) {
+            t[i] = tcg_temp_new_i32();
+            tcg_gen_ld_i32(t[i], base, aofs + 4 * ((imm >> (2 * i)) & 3));
+        }
+        for (i = 0; i < 4; i++) {
+            tcg_gen_st_i32(t[i], base, dofs + 4 * i);
+            tcg_temp_free_i32(t[i]);
+        }
+    }
+}
+
+/* Increment the 64-bit host counter at COUNTER */
+static inline void tcg_gen_host_counter_inc(uint64_t *counter)
+{
+    TCGv_ptr ptr = tcg_const_ptr(counter);
+    TCGv_i64 val = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_addi_i64(val, val, 1);
+    tcg_gen_st_i64(val, ptr, 0);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
 #if TCG_TARGET_REG_BITS == 32
 #define tcg_gen_add_ptr(R, A, B) tcg_gen_add_i32(TCGV_PTR_TO_NAT(R), \
                                                TCGV_PTR_TO_NAT(A), \
@@ -306,6 +306,22 @@ void tcg_set_frame(TCGContext *s, int reg,
     s->frame_reg = reg;
 }
 
+/* Record a host address embedded at @ptr in the code being generated.
+   Code with more relocations than fit is simply not relocatable.  */
+void tcg_tb_reloc_add(TCGContext *s, uint8_t *ptr, int type, uint64_t value)
+{
+    TCGTBReloc *r;
+
+    if (s->nb_tb_relocs == TCG_MAX_TB_RELOCS) {
+        s->tb_host_ptrs = true;
+        return;
+    }
+    r = &s->tb_relocs[s->nb_tb_relocs++];
+    r->offset = ptr - s->code_buf;
+    r->type = type;
+    r->value = value;
+}
+
 void tcg_func_start(TCGContext *s)
 {
     int i;
@@ -324,6 +340,9 @@ void tcg_func_start(TCGContext *s)
     s->gen_opc_ptr = s->gen_opc_buf;
     s->gen_opparam_ptr = s->gen_opparam_buf;
 
+    s->nb_tb_relocs = 0;
+    s->tb_host_ptrs = false;
+
 #if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
     /* Initialize qemu_ld/st labels to assist code generation at the end of TB
        for TLB miss cases at the end of TB */
@@ -648,6 +667,10 @@ void tcg_gen_callN(TCGContext *s, TCGv_ptr func, unsigned int flags,
     int nb_rets;
     TCGArg *nparam;
 
+    if (s->tb_ctx.prof_tb) {
+        tcg_gen_host_counter_inc(&s->tb_ctx.prof_tb->prof_helper_calls);
+    }
+
 #if defined(TCG_TARGET_EXTEND_ARGS) && TCG_TARGET_REG_BITS == 64
     for (i = 0; i < nargs; ++i) {
         int is_64bit = sizemask & (1 << (i+1)*2);
@@ -1237,6 +1260,25 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     }
 }
 
+/* liveness analysis: at a conditional branch, the taken path finds
+   globals and local temps in memory while the fallthrough path may still
+   use their registers; temps are dead on both paths.  */
+static inline void tcg_la_cond_branch(TCGContext *s, uint8_t *dead_temps,
+                                      uint8_t *mem_temps)
+{
+    int i;
+
+    memset(mem_temps, 1, s->nb_globals);
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        if (s->temps[i].temp_local) {
+            mem_temps[i] = 1;
+        } else {
+            dead_temps[i] = 1;
+            mem_temps[i] = 0;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_dead_args array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1450,7 +1492,10 @@ static void tcg_liveness_analysis(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if ((def->flags & TCG_OPF_COND_BRANCH) &&
+                    s->tb_cond_branch_regs) {
+                    tcg_la_cond_branch(s, dead_temps, mem_temps);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s, dead_temps, mem_temps);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -1695,8 +1740,12 @@ static inline void temp_save(TCGContext *s, int temp, TCGRegSet allocated_regs)
 {
 #ifdef USE_LIVENESS_ANALYSIS
     /* The liveness analysis already ensures that globals are back
-       in memory. Keep an assert for safety. */
-    assert(s->temps[temp].val_type == TEMP_VAL_MEM || s->temps[temp].fixed_reg);
+       in memory; after a conditional branch they may still be cached
+       in a synced register. Keep an assert for safety. */
+    assert(s->temps[temp].val_type == TEMP_VAL_MEM || s->temps[temp].fixed_reg
+           || (s->temps[temp].val_type == TEMP_VAL_REG &&
+               s->temps[temp].mem_coherent));
+    temp_dead(s, temp);
 #else
     temp_sync(s, temp, allocated_regs);
     temp_dead(s, temp);
@@ -1757,6 +1806,30 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* before a conditional branch, globals and local temporaries are
+   stored to their canonical location but stay in their registers for
+   the fallthrough path. */
+static void tcg_reg_alloc_cond_branch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    TCGTemp *ts;
+    int i;
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        ts = &s->temps[i];
+        if (ts->temp_local) {
+            temp_sync(s, i, allocated_regs);
+        } else {
+#ifdef USE_LIVENESS_ANALYSIS
+            assert(ts->val_type == TEMP_VAL_DEAD);
+#else
+            temp_dead(s, i);
+#endif
+        }
+    }
+
+    sync_globals(s, allocated_regs);
+}
+
 #define IS_DEAD_ARG(n) ((dead_args >> (n)) & 1)
 #define NEED_SYNC_ARG(n) ((sync_args >> (n)) & 1)
 
@@ -1959,7 +2032,9 @@ static void tcg_reg_alloc_op(TCGContext *s,
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if ((def->flags & TCG_OPF_COND_BRANCH) && s->tb_cond_branch_regs) {
+        tcg_reg_alloc_cond_branch(s, allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -91,6 +91,21 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_mulu2_i32        1
 #endif
 
+#ifndef TCG_TARGET_HAS_TB_RELOCS
+#define TCG_TARGET_HAS_TB_RELOCS        0
+#endif
+
+/* Vector ops operate on 8 or 16 bytes of memory, split into lanes of
+   1 << vece bytes; see tcg_gen_vec_add().  Backends without them get
+   an expansion into 64-bit integer ops.  */
+#ifndef TCG_TARGET_HAS_vec
+#define TCG_TARGET_HAS_vec              0
+#endif
+
+#define TCG_VEC_DESC(oprsz, vece)       (((oprsz) << 2) | (vece))
+#define TCG_VEC_OPRSZ(desc)             ((desc) >> 2)
+#define TCG_VEC_VECE(desc)              ((desc) & 3)
+
 #ifndef TCG_TARGET_deposit_i32_valid
 #define TCG_TARGET_deposit_i32_valid(ofs, len) 1
 #endif
@@ -157,6 +172,20 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 
+#define TCG_MAX_TB_RELOCS 64
+
+typedef enum TCGTBRelocType {
+    TCG_TB_RELOC_HOST_ABS64,    /* 64-bit address inside the QEMU binary */
+    TCG_TB_RELOC_TB_ABS64,      /* 64-bit TB pointer plus value */
+    TCG_TB_RELOC_RET_REL32,     /* 32-bit pc-relative, to the prologue */
+} TCGTBRelocType;
+
+typedef struct TCGTBReloc {
+    uint32_t offset;            /* from the start of the TB code */
+    uint32_t type;
+    uint64_t value;
+} TCGTBReloc;
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -484,6 +513,22 @@ struct TCGContext {
 
     TBContext tb_ctx;
 
+    /* Set while a superblock is generated: TCG_OPF_COND_BRANCH ops then
+       keep globals and local temps in registers on the fallthrough path;
+       otherwise they end the basic block like any other branch.  */
+    bool tb_cond_branch_regs;
+
+    /* Host addresses embedded in the code of the TB being generated, so
+       that it can be saved and loaded back at another address.  Only
+       recorded when tb_record_relocs is set, by backends that define
+       TCG_TARGET_HAS_TB_RELOCS.  */
+    bool tb_record_relocs;
+    bool tb_host_ptrs;          /* unrecorded host addresses, e.g. from
+                                   tcg_const_ptr(); not relocatable */
+    uintptr_t tb_reloc_base;    /* TB pointer passed to exit_tb */
+    int nb_tb_relocs;
+    TCGTBReloc tb_relocs[TCG_MAX_TB_RELOCS];
+
 #if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
     /* labels info for qemu_ld/st IRs
        The labels help to generate TLB miss case codes at the end of TB */
@@ -494,6 +539,8 @@ struct TCGContext {
 
 extern TCGContext tcg_ctx;
 
+void tcg_tb_reloc_add(TCGContext *s, uint8_t *ptr, int type, uint64_t value);
+
 /* pool based memory allocation */
 
 void *tcg_malloc_internal(TCGContext *s, int size);
@@ -599,6 +646,10 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Conditional branch: ends a basic block, but if tb_cond_branch_regs
+       is set the code that follows can keep globals and local temps in
+       the registers they were in.  */
+    TCG_OPF_COND_BRANCH  = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -641,7 +692,11 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((tcg_target_long)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.tb_host_ptrs = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i32((tcg_target_long)(V))))
+#define tcg_const_helper_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i32((tcg_target_long)(V)))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -652,7 +707,11 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((tcg_target_long)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.tb_host_ptrs = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i64((tcg_target_long)(V))))
+#define tcg_const_helper_ptr(V) \
+    TCGV_NAT_TO_PTR(tcg_const_i64((tcg_target_long)(V)))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
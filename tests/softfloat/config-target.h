@@ -0,0 +1,5 @@
+/*
+ * softfloat.c is normally built once per target.  test-softfloat builds
+ * it with no target selected, which only affects the NaN conventions in
+ * softfloat-specialize.h.
+ */
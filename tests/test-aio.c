@@ -76,6 +76,24 @@ static void event_ready_cb(EventNotifier *e)
     }
 }
 
+typedef struct {
+    EventNotifierTestData ev;
+    int polls;
+    int ready_at;
+} PollTestData;
+
+static bool event_poll_cb(EventNotifier *e)
+{
+    PollTestData *data = container_of(e, PollTestData, ev.e);
+
+    if (++data->polls < data->ready_at) {
+        return false;
+    }
+    data->ev.n++;
+    data->ev.active--;
+    return true;
+}
+
 /* Tests using aio_*.  */
 
 static void test_notify(void)
@@ -622,6 +640,42 @@ static void test_source_wait_event_notifier_noflush(void)
     event_notifier_cleanup(&data.e);
 }
 
+static void test_poll_event_notifier(void)
+{
+    PollTestData data = { .ev = { .n = 0, .active = 1 }, .ready_at = 3 };
+    AioContext *poll_ctx;
+
+    aio_set_poll_defaults(1000000000, 0, 0);
+    poll_ctx = aio_context_new();
+    aio_set_poll_defaults(0, 0, 0);
+    g_assert_cmpint(poll_ctx->poll_max_ns, ==, 1000000000);
+
+    /* Start with the maximum polling time instead of waiting for it to grow */
+    poll_ctx->poll_ns = poll_ctx->poll_max_ns;
+
+    event_notifier_init(&data.ev.e, false);
+    aio_set_event_notifier(poll_ctx, &data.ev.e, event_ready_cb,
+                           event_active_cb);
+    aio_set_event_notifier_poll(poll_ctx, &data.ev.e, event_poll_cb);
+
+    /* The notifier is never set, only polling can make progress */
+    g_assert(aio_poll(poll_ctx, true));
+    g_assert_cmpint(data.polls, ==, 3);
+    g_assert_cmpint(data.ev.n, ==, 1);
+    g_assert_cmpint(data.ev.active, ==, 0);
+    g_assert_cmpint(poll_ctx->poll_hits, ==, 1);
+    g_assert_cmpint(poll_ctx->poll_misses, ==, 0);
+    g_assert_cmpint(poll_ctx->poll_ns, ==, poll_ctx->poll_max_ns);
+
+    /* Nothing left to do, aio_poll must not block nor poll */
+    g_assert(!aio_poll(poll_ctx, true));
+    g_assert_cmpint(data.polls, ==, 3);
+
+    aio_set_event_notifier(poll_ctx, &data.ev.e, NULL, NULL);
+    event_notifier_cleanup(&data.ev.e);
+    aio_context_unref(poll_ctx);
+}
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -648,6 +702,7 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+    g_test_add_func("/aio/event/poll",              test_poll_event_notifier);
 
     g_test_add_func("/aio-gsource/notify",                  test_source_notify);
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
@@ -0,0 +1,86 @@
+/*
+ * Test bitmap routines
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include <stdint.h>
+#include "qemu/bitmap.h"
+
+#define BMAP_SIZE 1024
+
+static void check_range(unsigned long *map, long start, long nr)
+{
+    long i;
+
+    for (i = 0; i < BMAP_SIZE; i++) {
+        g_assert_cmpint(!!test_bit(i, map), ==, i >= start && i < start + nr);
+    }
+}
+
+static void test_bitmap_set_atomic(void)
+{
+    static const long ranges[][2] = {
+        { 0, 1 }, { 3, 60 }, { 60, 10 }, { 64, 128 }, { 100, 700 },
+    };
+    unsigned long *map = bitmap_new(BMAP_SIZE);
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        bitmap_zero(map, BMAP_SIZE);
+        bitmap_set_atomic(map, ranges[i][0], ranges[i][1]);
+        check_range(map, ranges[i][0], ranges[i][1]);
+    }
+    g_free(map);
+}
+
+static void test_bitmap_test_and_clear_atomic(void)
+{
+    unsigned long *map = bitmap_new(BMAP_SIZE);
+
+    bitmap_set(map, 70, 200);
+    g_assert(!bitmap_test_and_clear_atomic(map, 0, 70));
+    g_assert(!bitmap_test_and_clear_atomic(map, 270, 500));
+    check_range(map, 70, 200);
+
+    g_assert(bitmap_test_and_clear_atomic(map, 60, 20));
+    check_range(map, 80, 190);
+    g_assert(bitmap_test_and_clear_atomic(map, 200, 300));
+    check_range(map, 80, 120);
+    g_assert(bitmap_test_and_clear_atomic(map, 0, BMAP_SIZE));
+    g_assert(bitmap_empty(map, BMAP_SIZE));
+    g_free(map);
+}
+
+static void test_bitmap_move_atomic(void)
+{
+    unsigned long *src = bitmap_new(BMAP_SIZE);
+    unsigned long *dst = bitmap_new(BMAP_SIZE);
+
+    bitmap_set(src, 10, 300);
+    bitmap_set(dst, 100, 20);
+
+    /* Bits outside the range stay in src; bits already in dst don't count */
+    g_assert_cmpint(bitmap_move_atomic(dst, src, 5, 200), ==, 195 - 20);
+    check_range(src, 205, 105);
+    check_range(dst, 10, 195);
+
+    g_assert_cmpint(bitmap_move_atomic(dst, src, 0, BMAP_SIZE), ==, 105);
+    g_assert(bitmap_empty(src, BMAP_SIZE));
+    check_range(dst, 10, 300);
+    g_free(src);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/set_atomic", test_bitmap_set_atomic);
+    g_test_add_func("/bitmap/test_and_clear_atomic",
+                    test_bitmap_test_and_clear_atomic);
+    g_test_add_func("/bitmap/move_atomic", test_bitmap_move_atomic);
+    return g_test_run();
+}
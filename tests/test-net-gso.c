@@ -0,0 +1,238 @@
+/*
+ * Software segmentation offload unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "qemu-common.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gso.h"
+
+#define TEST_L2_LEN     sizeof(struct eth_header)
+#define TEST_IP_LEN     sizeof(struct ip_header)
+#define TEST_TCP_LEN    sizeof(struct tcp_header)
+#define TEST_UDP_LEN    sizeof(struct udp_header)
+
+typedef struct TestSegments {
+    int count;
+    int last_seen;
+    uint8_t *frames[64];
+    size_t sizes[64];
+} TestSegments;
+
+static void collect_segment(const uint8_t *buf, size_t size, bool last,
+                            void *opaque)
+{
+    TestSegments *segs = opaque;
+
+    g_assert(segs->count < ARRAY_SIZE(segs->frames));
+    g_assert(!segs->last_seen);
+    segs->frames[segs->count] = g_memdup(buf, size);
+    segs->sizes[segs->count] = size;
+    segs->count++;
+    segs->last_seen = last;
+}
+
+static void free_segments(TestSegments *segs)
+{
+    int i;
+
+    for (i = 0; i < segs->count; i++) {
+        g_free(segs->frames[i]);
+    }
+}
+
+static size_t build_ip4_packet(uint8_t *pkt, uint8_t proto, size_t l4_len)
+{
+    struct eth_header *eh = (struct eth_header *) pkt;
+    struct ip_header *iph = (struct ip_header *) (pkt + TEST_L2_LEN);
+    size_t i;
+
+    memset(pkt, 0, TEST_L2_LEN + TEST_IP_LEN);
+    eh->h_proto = cpu_to_be16(ETH_P_IP);
+    iph->ip_ver_len = 0x45;
+    iph->ip_len = cpu_to_be16(TEST_IP_LEN + l4_len);
+    iph->ip_id = cpu_to_be16(0x1000);
+    iph->ip_ttl = 64;
+    iph->ip_p = proto;
+    iph->ip_src = cpu_to_be32(0x0a000001);
+    iph->ip_dst = cpu_to_be32(0x0a000002);
+
+    for (i = 0; i < l4_len; i++) {
+        pkt[TEST_L2_LEN + TEST_IP_LEN + i] = i * 7;
+    }
+    return TEST_L2_LEN + TEST_IP_LEN + l4_len;
+}
+
+static uint16_t ip4_l4_csum(uint8_t *frame, size_t size, uint8_t proto)
+{
+    uint8_t *l4 = frame + TEST_L2_LEN + TEST_IP_LEN;
+
+    return net_checksum_tcpudp(size - TEST_L2_LEN - TEST_IP_LEN, proto,
+                               frame + TEST_L2_LEN + 12, l4);
+}
+
+static void test_gso_csum_only(void)
+{
+    uint8_t pkt[TEST_L2_LEN + TEST_IP_LEN + TEST_UDP_LEN + 100];
+    struct virtio_net_hdr hdr = {
+        .flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+        .csum_start = TEST_L2_LEN + TEST_IP_LEN,
+        .csum_offset = offsetof(struct udp_header, uh_sum),
+    };
+    struct iovec iov = { .iov_base = pkt, .iov_len = sizeof(pkt) };
+    struct ip_header *iph = (struct ip_header *) (pkt + TEST_L2_LEN);
+    struct udp_header *uh = (struct udp_header *)
+                            (pkt + TEST_L2_LEN + TEST_IP_LEN);
+    TestSegments segs = {};
+
+    build_ip4_packet(pkt, IP_PROTO_UDP, TEST_UDP_LEN + 100);
+    uh->uh_ulen = cpu_to_be16(TEST_UDP_LEN + 100);
+    /* Like the guest, seed the checksum field with the pseudo header sum */
+    uh->uh_sum = cpu_to_be16((uint16_t)
+        ~net_checksum_finish(eth_calc_pseudo_hdr_csum(iph,
+                                                      TEST_UDP_LEN + 100)));
+
+    g_assert(net_gso_required(&hdr));
+    g_assert_cmpint(net_gso_segment(&hdr, &iov, 1, collect_segment, &segs),
+                    ==, 1);
+    g_assert(segs.last_seen);
+    g_assert_cmpint(segs.sizes[0], ==, sizeof(pkt));
+    g_assert_cmpint(ip4_l4_csum(segs.frames[0], segs.sizes[0], IP_PROTO_UDP),
+                    ==, 0);
+    free_segments(&segs);
+}
+
+static void test_gso_tcp4(void)
+{
+    const size_t payload = 3500, mss = 1000;
+    size_t size;
+    uint8_t *pkt = g_malloc0(TEST_L2_LEN + TEST_IP_LEN + TEST_TCP_LEN +
+                             payload);
+    struct tcp_header *th = (struct tcp_header *)
+                            (pkt + TEST_L2_LEN + TEST_IP_LEN);
+    struct virtio_net_hdr hdr = {
+        .flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+        .gso_type = VIRTIO_NET_HDR_GSO_TCPV4,
+        .gso_size = mss,
+        .csum_start = TEST_L2_LEN + TEST_IP_LEN,
+        .csum_offset = offsetof(struct tcp_header, th_sum),
+    };
+    struct iovec iov;
+    TestSegments segs = {};
+    size_t off = 0;
+    int i;
+
+    size = build_ip4_packet(pkt, IP_PROTO_TCP, TEST_TCP_LEN + payload);
+    th->th_seq = cpu_to_be32(0xfffffc00);
+    th->th_offset_flags = cpu_to_be16((5 << 12) | TH_ACK | TH_PUSH | TH_FIN);
+    iov.iov_base = pkt;
+    iov.iov_len = size;
+
+    g_assert_cmpint(net_gso_segment(&hdr, &iov, 1, collect_segment, &segs),
+                    ==, 4);
+    g_assert(segs.last_seen);
+
+    for (i = 0; i < segs.count; i++) {
+        uint8_t *f = segs.frames[i];
+        struct ip_header *iph = (struct ip_header *) (f + TEST_L2_LEN);
+        struct tcp_header *sth = (struct tcp_header *)
+                                 (f + TEST_L2_LEN + TEST_IP_LEN);
+        size_t seg_payload = MIN(mss, payload - off);
+        uint8_t flags = be16_to_cpu(sth->th_offset_flags) & 0xff;
+
+        g_assert_cmpint(segs.sizes[i], ==, TEST_L2_LEN + TEST_IP_LEN +
+                        TEST_TCP_LEN + seg_payload);
+        g_assert_cmpint(be16_to_cpu(iph->ip_len), ==,
+                        TEST_IP_LEN + TEST_TCP_LEN + seg_payload);
+        g_assert_cmpint(be16_to_cpu(iph->ip_id), ==, 0x1000 + i);
+        g_assert_cmpint(net_raw_checksum((uint8_t *) iph, TEST_IP_LEN), ==, 0);
+        g_assert_cmpint(ip4_l4_csum(f, segs.sizes[i], IP_PROTO_TCP), ==, 0);
+        g_assert_cmphex(be32_to_cpu(sth->th_seq), ==,
+                        (uint32_t)(0xfffffc00 + off));
+        g_assert(!memcmp(f + TEST_L2_LEN + TEST_IP_LEN + TEST_TCP_LEN,
+                         pkt + TEST_L2_LEN + TEST_IP_LEN + TEST_TCP_LEN + off,
+                         seg_payload));
+        if (i == segs.count - 1) {
+            g_assert_cmphex(flags, ==, TH_ACK | TH_PUSH | TH_FIN);
+        } else {
+            g_assert_cmphex(flags, ==, TH_ACK);
+        }
+        off += seg_payload;
+    }
+    g_assert_cmpint(off, ==, payload);
+
+    free_segments(&segs);
+    g_free(pkt);
+}
+
+static void test_gso_udp4(void)
+{
+    const size_t l4_len = TEST_UDP_LEN + 4000;
+    const size_t frag = 1480;
+    uint8_t *pkt = g_malloc0(TEST_L2_LEN + TEST_IP_LEN + l4_len);
+    struct virtio_net_hdr hdr = {
+        .gso_type = VIRTIO_NET_HDR_GSO_UDP,
+        .gso_size = frag,
+    };
+    struct iovec iov;
+    TestSegments segs = {};
+    size_t off = 0;
+    int i;
+
+    iov.iov_base = pkt;
+    iov.iov_len = build_ip4_packet(pkt, IP_PROTO_UDP, l4_len);
+
+    g_assert_cmpint(net_gso_segment(&hdr, &iov, 1, collect_segment, &segs),
+                    ==, 3);
+
+    for (i = 0; i < segs.count; i++) {
+        struct ip_header *iph = (struct ip_header *)
+                                (segs.frames[i] + TEST_L2_LEN);
+        size_t len = MIN(frag, l4_len - off);
+        uint16_t ip_off = be16_to_cpu(iph->ip_off);
+
+        g_assert_cmpint(be16_to_cpu(iph->ip_len), ==, TEST_IP_LEN + len);
+        g_assert_cmpint((ip_off & IP_OFFMASK) * IP_FRAG_UNIT_SIZE, ==, off);
+        g_assert_cmpint(!!(ip_off & IP_MF), ==, i != segs.count - 1);
+        g_assert_cmpint(net_raw_checksum((uint8_t *) iph, TEST_IP_LEN), ==, 0);
+        off += len;
+    }
+    g_assert_cmpint(off, ==, l4_len);
+
+    free_segments(&segs);
+    g_free(pkt);
+}
+
+static void test_gso_unparsable(void)
+{
+    uint8_t pkt[128] = {};
+    struct virtio_net_hdr hdr = {
+        .gso_type = VIRTIO_NET_HDR_GSO_TCPV4,
+        .gso_size = 16,
+    };
+    struct iovec iov = { .iov_base = pkt, .iov_len = sizeof(pkt) };
+    TestSegments segs = {};
+
+    /* Not an IP packet: passed through unmodified */
+    g_assert_cmpint(net_gso_segment(&hdr, &iov, 1, collect_segment, &segs),
+                    ==, 1);
+    g_assert_cmpint(segs.sizes[0], ==, sizeof(pkt));
+    g_assert(!memcmp(segs.frames[0], pkt, sizeof(pkt)));
+    free_segments(&segs);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gso/csum-only", test_gso_csum_only);
+    g_test_add_func("/net/gso/tcp4", test_gso_tcp4);
+    g_test_add_func("/net/gso/udp4", test_gso_udp4);
+    g_test_add_func("/net/gso/unparsable", test_gso_unparsable);
+    return g_test_run();
+}
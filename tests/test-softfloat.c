@@ -0,0 +1,184 @@
+/*
+ * Test the softfloat host FPU fast path
+ *
+ * Once the inexact flag is set, float32/float64 add, sub, mul, div and
+ * sqrt may compute their result with the host FPU.  Compare every such
+ * operation on random inputs with the same operation started with clear
+ * flags, which always takes the software path.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include "fpu/softfloat.c"
+
+#define TEST_OPS_PER_CASE   200000
+
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+} TestOp;
+
+typedef struct TestCase {
+    const char *name;
+    TestOp op;
+    bool is_double;
+    bool flush;
+} TestCase;
+
+static uint64_t rand_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t rand64(void)
+{
+    /* xorshift64*, so that failures can be reproduced */
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Random operand with an exponent field of 'ebits' bits and a fraction of
+   'fbits' bits.  Exponents are biased towards both ends of the range to
+   exercise overflow, underflow and denormals, and 'near' is sometimes
+   returned with a perturbed fraction to exercise cancellation.  */
+static uint64_t rand_operand(int ebits, int fbits, uint64_t near)
+{
+    uint64_t emax = (1ULL << ebits) - 1;
+    uint64_t r = rand64();
+    uint64_t sign = r & 1;
+    uint64_t exp, frac;
+
+    switch ((r >> 1) & 7) {
+    case 0:
+        exp = (r >> 8) % 4;
+        break;
+    case 1:
+        exp = emax - 1 - (r >> 8) % 4;
+        break;
+    case 2:
+        exp = 0;
+        break;
+    case 3:
+        if (near) {
+            return near ^ ((r >> 8) & 0xff) ^ (sign << (ebits + fbits));
+        }
+        /* fall through */
+    default:
+        exp = (r >> 8) % (emax - 1) + 1;
+        break;
+    }
+    frac = rand64() & ((1ULL << fbits) - 1);
+    if ((r >> 4) % 16 == 0) {
+        frac = 0;
+    }
+    return (sign << (ebits + fbits)) | (exp << fbits) | frac;
+}
+
+static uint64_t do_op(const TestCase *tc, uint64_t a, uint64_t b,
+                      float_status *s)
+{
+    if (tc->is_double) {
+        float64 fa = make_float64(a), fb = make_float64(b);
+
+        switch (tc->op) {
+        case OP_ADD:
+            return float64_val(float64_add(fa, fb, s));
+        case OP_SUB:
+            return float64_val(float64_sub(fa, fb, s));
+        case OP_MUL:
+            return float64_val(float64_mul(fa, fb, s));
+        case OP_DIV:
+            return float64_val(float64_div(fa, fb, s));
+        default:
+            return float64_val(float64_sqrt(fa, s));
+        }
+    } else {
+        float32 fa = make_float32(a), fb = make_float32(b);
+
+        switch (tc->op) {
+        case OP_ADD:
+            return float32_val(float32_add(fa, fb, s));
+        case OP_SUB:
+            return float32_val(float32_sub(fa, fb, s));
+        case OP_MUL:
+            return float32_val(float32_mul(fa, fb, s));
+        case OP_DIV:
+            return float32_val(float32_div(fa, fb, s));
+        default:
+            return float32_val(float32_sqrt(fa, s));
+        }
+    }
+}
+
+static void test_host_fpu(gconstpointer opaque)
+{
+    const TestCase *tc = opaque;
+    int ebits = tc->is_double ? 11 : 8;
+    int fbits = tc->is_double ? 52 : 23;
+    int i;
+
+    for (i = 0; i < TEST_OPS_PER_CASE; i++) {
+        float_status soft = { 0 }, host = { 0 };
+        uint64_t a, b, rs, rh;
+
+        a = rand_operand(ebits, fbits, 0);
+        b = rand_operand(ebits, fbits, a);
+        if (tc->op == OP_SQRT) {
+            a &= ~(1ULL << (ebits + fbits));
+        }
+
+        soft.float_rounding_mode = float_round_nearest_even;
+        soft.flush_to_zero = tc->flush;
+        soft.flush_inputs_to_zero = tc->flush;
+        host = soft;
+        host.float_exception_flags = float_flag_inexact;
+
+        rs = do_op(tc, a, b, &soft);
+        rh = do_op(tc, a, b, &host);
+        if (rs != rh || (soft.float_exception_flags | float_flag_inexact) !=
+                        host.float_exception_flags) {
+            fprintf(stderr, "%s: a=%#" PRIx64 " b=%#" PRIx64 ": software "
+                    "%#" PRIx64 " flags %#x, fast path %#" PRIx64
+                    " flags %#x\n", tc->name, a, b, rs,
+                    (uint8_t)(soft.float_exception_flags | float_flag_inexact),
+                    rh, (uint8_t)host.float_exception_flags);
+        }
+        g_assert_cmphex(rs, ==, rh);
+        g_assert_cmphex(soft.float_exception_flags | float_flag_inexact, ==,
+                        host.float_exception_flags);
+    }
+}
+
+#define TEST_CASES(name, op, is_double) \
+    { "/softfloat/host-fpu/" name, op, is_double, false }, \
+    { "/softfloat/host-fpu/" name "-ftz", op, is_double, true }
+
+static const TestCase test_cases[] = {
+    TEST_CASES("float32_add", OP_ADD, false),
+    TEST_CASES("float32_sub", OP_SUB, false),
+    TEST_CASES("float32_mul", OP_MUL, false),
+    TEST_CASES("float32_div", OP_DIV, false),
+    TEST_CASES("float32_sqrt", OP_SQRT, false),
+    TEST_CASES("float64_add", OP_ADD, true),
+    TEST_CASES("float64_sub", OP_SUB, true),
+    TEST_CASES("float64_mul", OP_MUL, true),
+    TEST_CASES("float64_div", OP_DIV, true),
+    TEST_CASES("float64_sqrt", OP_SQRT, true),
+};
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(test_cases); i++) {
+        g_test_add_data_func(test_cases[i].name, &test_cases[i],
+                             test_host_fpu);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,453 @@
+/*
+ * QTest testcase for the virtio-net data plane
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+
+#include "qemu-common.h"
+#include "hw/pci/pci_regs.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netpacket/packet.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#endif
+
+#define PCI_VENDOR_ID_REDHAT_QUMRANET   0x1af4
+#define PCI_DEVICE_ID_VIRTIO_NET        0x1000
+
+#define VIRTIO_NET_PCI_SLOT     4
+
+/* Legacy virtio PCI registers in BAR 0, without MSI-X */
+#define VIRTIO_PCI_HOST_FEATURES        0
+#define VIRTIO_PCI_GUEST_FEATURES       4
+#define VIRTIO_PCI_QUEUE_PFN            8
+#define VIRTIO_PCI_QUEUE_NUM            12
+#define VIRTIO_PCI_QUEUE_SEL            14
+#define VIRTIO_PCI_QUEUE_NOTIFY         16
+#define VIRTIO_PCI_STATUS               18
+
+#define VIRTIO_CONFIG_S_ACKNOWLEDGE     1
+#define VIRTIO_CONFIG_S_DRIVER          2
+#define VIRTIO_CONFIG_S_DRIVER_OK       4
+
+#define VIRTIO_NET_F_CTRL_VQ            17
+#define VIRTIO_NET_F_MQ                 22
+
+#define VIRTIO_NET_CTRL_MQ              4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+#define VIRTIO_NET_OK                   0
+
+#define VRING_DESC_F_NEXT               1
+#define VRING_DESC_F_WRITE              2
+#define VRING_ALIGN                     4096
+
+#define QUEUE_PAIRS     2
+#define NUM_QUEUES      (QUEUE_PAIRS * 2 + 1)
+#define CTRL_QUEUE      (QUEUE_PAIRS * 2)
+
+/* Guest physical memory used by the test driver; the guest itself only
+ * runs a hlt instruction, so nothing else touches it.
+ */
+#define RING_BASE       0x100000
+#define RING_STRIDE     0x4000
+#define CTRL_BUF        0x200000
+#define TX_BUF          0x201000
+
+#define VNET_HDR_LEN    10
+#define TEST_ETHERTYPE  0x88b5
+#define TIMEOUT_MS      5000
+
+typedef struct TestVirtQueue {
+    uint64_t desc;
+    uint64_t avail;
+    uint64_t used;
+    uint16_t num;
+    uint16_t avail_idx;
+    uint16_t used_idx;
+} TestVirtQueue;
+
+typedef struct TestVirtioNet {
+    QPCIDevice *dev;
+    void *base;
+    TestVirtQueue vq[NUM_QUEUES];
+} TestVirtioNet;
+
+static QPCIBus *pcibus;
+
+static QPCIDevice *get_virtio_net(void)
+{
+    QPCIDevice *dev;
+
+    if (!pcibus) {
+        pcibus = qpci_init_pc();
+    }
+
+    dev = qpci_device_find(pcibus, QPCI_DEVFN(VIRTIO_NET_PCI_SLOT, 0));
+    if (dev) {
+        g_assert_cmphex(qpci_config_readw(dev, PCI_VENDOR_ID), ==,
+                        PCI_VENDOR_ID_REDHAT_QUMRANET);
+        g_assert_cmphex(qpci_config_readw(dev, PCI_DEVICE_ID), ==,
+                        PCI_DEVICE_ID_VIRTIO_NET);
+    }
+    return dev;
+}
+
+/* Without KVM the data plane cannot get ioeventfds and irqfds; hotplug
+ * must fail cleanly and leave a working monitor behind.
+ */
+static void test_data_plane_needs_kvm(void)
+{
+    QPCIDevice *dev;
+
+    qtest_start("-netdev hubport,id=n0,hubid=0 "
+                "-netdev hubport,id=n1,hubid=1");
+
+    qmp("{ 'execute': 'device_add', 'arguments': {"
+        " 'driver': 'virtio-net-pci', 'id': 'net0', 'netdev': 'n0',"
+        " 'addr': '%02x.0', 'x-data-plane': 'on' } }", VIRTIO_NET_PCI_SLOT);
+    g_assert(get_virtio_net() == NULL);
+
+    qmp("{ 'execute': 'device_add', 'arguments': {"
+        " 'driver': 'virtio-net-pci', 'id': 'net1', 'netdev': 'n1',"
+        " 'addr': '%02x.0' } }", VIRTIO_NET_PCI_SLOT);
+    dev = get_virtio_net();
+    g_assert(dev != NULL);
+    g_free(dev);
+
+    qtest_end();
+    g_free(pcibus);
+    pcibus = NULL;
+}
+
+#ifdef __linux__
+
+static void vnet_writeb(TestVirtioNet *d, int reg, uint8_t val)
+{
+    qpci_io_writeb(d->dev, (char *)d->base + reg, val);
+}
+
+static void vnet_writew(TestVirtioNet *d, int reg, uint16_t val)
+{
+    qpci_io_writew(d->dev, (char *)d->base + reg, val);
+}
+
+static void vnet_writel(TestVirtioNet *d, int reg, uint32_t val)
+{
+    qpci_io_writel(d->dev, (char *)d->base + reg, val);
+}
+
+static uint8_t vnet_readb(TestVirtioNet *d, int reg)
+{
+    return qpci_io_readb(d->dev, (char *)d->base + reg);
+}
+
+static uint16_t vnet_readw(TestVirtioNet *d, int reg)
+{
+    return qpci_io_readw(d->dev, (char *)d->base + reg);
+}
+
+static uint32_t vnet_readl(TestVirtioNet *d, int reg)
+{
+    return qpci_io_readl(d->dev, (char *)d->base + reg);
+}
+
+static void vq_init(TestVirtioNet *d, int idx)
+{
+    TestVirtQueue *vq = &d->vq[idx];
+    uint64_t addr = RING_BASE + idx * RING_STRIDE;
+    void *zero = g_malloc0(RING_STRIDE);
+
+    vnet_writew(d, VIRTIO_PCI_QUEUE_SEL, idx);
+    vq->num = vnet_readw(d, VIRTIO_PCI_QUEUE_NUM);
+    g_assert_cmpint(vq->num, >, 0);
+
+    vq->desc = addr;
+    vq->avail = addr + vq->num * 16;
+    vq->used = QEMU_ALIGN_UP(vq->avail + 6 + vq->num * 2, VRING_ALIGN);
+    vq->avail_idx = 0;
+    vq->used_idx = 0;
+    g_assert_cmpint(vq->used + 6 + vq->num * 8, <=, addr + RING_STRIDE);
+
+    memwrite(addr, zero, RING_STRIDE);
+    g_free(zero);
+    vnet_writel(d, VIRTIO_PCI_QUEUE_PFN, addr / VRING_ALIGN);
+}
+
+/* Post a chain of one device-readable and, if @in_len is not zero, one
+ * device-writable buffer.
+ */
+static void vq_add(TestVirtioNet *d, int idx, uint64_t out, uint32_t out_len,
+                   uint64_t in, uint32_t in_len)
+{
+    TestVirtQueue *vq = &d->vq[idx];
+    uint16_t head = (vq->avail_idx * 2) % vq->num;
+    uint64_t desc = vq->desc + head * 16;
+
+    writeq(desc, out);
+    writel(desc + 8, out_len);
+    writew(desc + 12, in_len ? VRING_DESC_F_NEXT : 0);
+    writew(desc + 14, head + 1);
+    if (in_len) {
+        writeq(desc + 16, in);
+        writel(desc + 24, in_len);
+        writew(desc + 28, VRING_DESC_F_WRITE);
+        writew(desc + 30, 0);
+    }
+
+    writew(vq->avail + 4 + (vq->avail_idx % vq->num) * 2, head);
+    vq->avail_idx++;
+    writew(vq->avail + 2, vq->avail_idx);
+
+    vnet_writew(d, VIRTIO_PCI_QUEUE_NOTIFY, idx);
+}
+
+static void vq_wait_used(TestVirtioNet *d, int idx)
+{
+    TestVirtQueue *vq = &d->vq[idx];
+    int i;
+
+    for (i = 0; readw(vq->used + 2) == vq->used_idx; i++) {
+        g_assert_cmpint(i, <, TIMEOUT_MS);
+        g_usleep(1000);
+    }
+    vq->used_idx++;
+}
+
+/* Reset the device and bring it up with multiqueue negotiated; the data
+ * plane starts on the first queue pair at DRIVER_OK.
+ */
+static void vnet_start(TestVirtioNet *d)
+{
+    uint32_t features;
+    int i;
+
+    vnet_writeb(d, VIRTIO_PCI_STATUS, 0);
+    g_assert_cmpint(vnet_readb(d, VIRTIO_PCI_STATUS), ==, 0);
+    vnet_writeb(d, VIRTIO_PCI_STATUS,
+                VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER);
+
+    features = vnet_readl(d, VIRTIO_PCI_HOST_FEATURES);
+    g_assert(features & (1u << VIRTIO_NET_F_MQ));
+    g_assert(features & (1u << VIRTIO_NET_F_CTRL_VQ));
+    vnet_writel(d, VIRTIO_PCI_GUEST_FEATURES,
+                (1u << VIRTIO_NET_F_MQ) | (1u << VIRTIO_NET_F_CTRL_VQ));
+
+    for (i = 0; i < NUM_QUEUES; i++) {
+        vq_init(d, i);
+    }
+    vnet_writeb(d, VIRTIO_PCI_STATUS,
+                VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER |
+                VIRTIO_CONFIG_S_DRIVER_OK);
+}
+
+static void vnet_set_queue_pairs(TestVirtioNet *d, uint16_t pairs)
+{
+    uint8_t cmd[4] = {
+        VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+        pairs & 0xff, pairs >> 8,
+    };
+
+    memwrite(CTRL_BUF, cmd, sizeof(cmd));
+    writeb(CTRL_BUF + sizeof(cmd), 0xff);
+    vq_add(d, CTRL_QUEUE, CTRL_BUF, sizeof(cmd), CTRL_BUF + sizeof(cmd), 1);
+    vq_wait_used(d, CTRL_QUEUE);
+    g_assert_cmpint(readb(CTRL_BUF + sizeof(cmd)), ==, VIRTIO_NET_OK);
+}
+
+static bool tap_wait_frame(int sock, uint8_t tag)
+{
+    uint8_t frame[ETH_FRAME_LEN];
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    ssize_t len;
+    int i;
+
+    for (i = 0; i < TIMEOUT_MS / 100; i++) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        len = recv(sock, frame, sizeof(frame), 0);
+        if (len > ETH_HLEN &&
+            frame[12] == (TEST_ETHERTYPE >> 8) &&
+            frame[13] == (TEST_ETHERTYPE & 0xff) &&
+            frame[ETH_HLEN] == tag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Transmit a frame on queue pair @pair and check that it comes out of the
+ * tap device.
+ */
+static void vnet_send(TestVirtioNet *d, int pair, int sock, uint8_t tag)
+{
+    uint8_t buf[VNET_HDR_LEN + ETH_ZLEN] = { 0 };
+    uint8_t *eth = buf + VNET_HDR_LEN;
+    static const uint8_t src[ETH_ALEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+
+    memset(eth, 0xff, ETH_ALEN);
+    memcpy(eth + ETH_ALEN, src, ETH_ALEN);
+    eth[12] = TEST_ETHERTYPE >> 8;
+    eth[13] = TEST_ETHERTYPE & 0xff;
+    eth[ETH_HLEN] = tag;
+
+    memwrite(TX_BUF, buf, sizeof(buf));
+    vq_add(d, pair * 2 + 1, TX_BUF, sizeof(buf), 0, 0);
+    vq_wait_used(d, pair * 2 + 1);
+    g_assert(tap_wait_frame(sock, tag));
+}
+
+static int tap_open_socket(const char *ifname)
+{
+    struct sockaddr_ll sll = { 0 };
+    struct ifreq ifr;
+    int sock;
+
+    sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    g_assert(sock >= 0);
+
+    memset(&ifr, 0, sizeof(ifr));
+    pstrcpy(ifr.ifr_name, sizeof(ifr.ifr_name), ifname);
+    g_assert(ioctl(sock, SIOCGIFFLAGS, &ifr) == 0);
+    ifr.ifr_flags |= IFF_UP;
+    g_assert(ioctl(sock, SIOCSIFFLAGS, &ifr) == 0);
+
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(ifname);
+    g_assert(sll.sll_ifindex != 0);
+    g_assert(bind(sock, (struct sockaddr *)&sll, sizeof(sll)) == 0);
+    return sock;
+}
+
+/* Write a firmware image that only halts, so that the vCPU stays out of
+ * the way of the test driver.
+ */
+static char *make_hlt_bios(void)
+{
+    char *path = g_strdup("/tmp/qtest-bios.XXXXXX");
+    uint8_t *image;
+    int fd;
+
+    fd = mkstemp(path);
+    g_assert(fd >= 0);
+    image = g_malloc(64 * 1024);
+    memset(image, 0xf4, 64 * 1024);
+    g_assert(write(fd, image, 64 * 1024) == 64 * 1024);
+    close(fd);
+    g_free(image);
+    return path;
+}
+
+static void test_data_plane_start_stop(void)
+{
+    TestVirtioNet d;
+    char *bios, *ifname, *cmdline;
+    int sock;
+
+    bios = make_hlt_bios();
+    ifname = g_strdup_printf("qtnet%d", (int)getpid() % 100000);
+
+    cmdline = g_strdup_printf(
+        "-machine accel=kvm -bios %s "
+        "-netdev tap,id=n0,ifname=%s,queues=%d,vnet_hdr=on,"
+        "script=no,downscript=no "
+        "-device virtio-net-pci,netdev=n0,mq=on,vectors=0,romfile=,"
+        "x-data-plane=on,addr=%02x.0",
+        bios, ifname, QUEUE_PAIRS, VIRTIO_NET_PCI_SLOT);
+    qtest_start(cmdline);
+
+    memset(&d, 0, sizeof(d));
+    d.dev = get_virtio_net();
+    g_assert(d.dev != NULL);
+    d.base = qpci_iomap(d.dev, 0);
+    qpci_device_enable(d.dev);
+    sock = tap_open_socket(ifname);
+
+    /* Started on one queue pair, then restarted on all of them */
+    vnet_start(&d);
+    vnet_send(&d, 0, sock, 1);
+    vnet_set_queue_pairs(&d, QUEUE_PAIRS);
+    vnet_send(&d, 1, sock, 2);
+    vnet_send(&d, 0, sock, 3);
+
+    /* Reset stops the data plane; it must start again afterwards */
+    vnet_writeb(&d, VIRTIO_PCI_STATUS, 0);
+    g_assert_cmpint(vnet_readb(&d, VIRTIO_PCI_STATUS), ==, 0);
+    vnet_start(&d);
+    vnet_send(&d, 0, sock, 4);
+    vnet_set_queue_pairs(&d, QUEUE_PAIRS);
+    vnet_send(&d, 1, sock, 5);
+
+    /* Clearing DRIVER_OK stops it too */
+    vnet_writeb(&d, VIRTIO_PCI_STATUS,
+                VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER);
+    vnet_writeb(&d, VIRTIO_PCI_STATUS, 0);
+
+    close(sock);
+    g_free(d.dev);
+    qtest_end();
+    g_free(pcibus);
+    pcibus = NULL;
+
+    unlink(bios);
+    g_free(bios);
+    g_free(ifname);
+    g_free(cmdline);
+}
+
+/* Starting the data plane needs KVM, and creating the tap device needs
+ * CAP_NET_ADMIN.
+ */
+static bool data_plane_host_supported(void)
+{
+    return geteuid() == 0 &&
+           access("/dev/kvm", R_OK | W_OK) == 0 &&
+           access("/dev/net/tun", R_OK | W_OK) == 0;
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+    const char *arch = qtest_get_arch();
+
+    /* Check architecture */
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        g_test_message("Skipping test for non-x86\n");
+        return 0;
+    }
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtio-net/data-plane/needs-kvm",
+                   test_data_plane_needs_kvm);
+#ifdef __linux__
+    if (data_plane_host_supported()) {
+        qtest_add_func("/virtio-net/data-plane/start-stop",
+                       test_data_plane_start_stop);
+    } else {
+        g_test_message("Skipping data plane start/stop test, it needs root, "
+                       "/dev/kvm and /dev/net/tun\n");
+    }
+#endif
+
+    return g_test_run();
+}
@@ -54,11 +54,14 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "sysemu/cpus.h"
 #endif
 
 #include "exec/cputlb.h"
 #include "translate-all.h"
 #include "qemu/timer.h"
+#include "qemu/tls.h"
+#include "qemu/atomic.h"
 
 //#define DEBUG_TB_INVALIDATE
 //#define DEBUG_FLUSH
@@ -151,6 +154,9 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     ti = profile_getclock();
 #endif
     tcg_func_start(s);
+    s->tb_record_relocs = tb->tc_relocs;
+    s->tb_reloc_base = (uintptr_t)tb;
+    s->tb_cond_branch_regs = tb->trace_len != 0;
 
     gen_intermediate_code(env, tb);
 
@@ -207,8 +213,14 @@ static int cpu_restore_state_from_tb(TranslationBlock *tb, CPUArchState *env,
     ti = profile_getclock();
 #endif
     tcg_func_start(s);
+    /* must regenerate exactly the same code */
+    s->tb_record_relocs = tb->tc_relocs;
+    s->tb_reloc_base = (uintptr_t)tb;
+    s->tb_cond_branch_regs = tb->trace_len != 0;
+    s->tb_ctx.prof_tb = tb->prof ? tb : NULL;
 
     gen_intermediate_code_pc(env, tb);
+    s->tb_ctx.prof_tb = NULL;
 
     if (use_icount) {
         /* Reset the cycle counter to the start of the block.  */
@@ -251,13 +263,16 @@ static int cpu_restore_state_from_tb(TranslationBlock *tb, CPUArchState *env,
 bool cpu_restore_state(CPUArchState *env, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool found = false;
 
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(tb, env, retaddr);
-        return true;
+        found = true;
     }
-    return false;
+    tb_unlock();
+    return found;
 }
 
 #ifdef _WIN32
@@ -555,6 +570,82 @@ static inline void *alloc_code_gen_buffer(void)
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, USE_MMAP */
 
+/* Split the code buffer into about TB_REGIONS regions, each big enough to
+   hold many blocks beyond the worst case size of a single one.  Region
+   sizes are a power of two so that the region of a TB is a shift away.  */
+#define TB_REGIONS          8
+#define TB_REGION_SLACK     (TCG_MAX_OP_SIZE * OPC_BUF_SIZE)
+
+static void tb_regions_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t region_size;
+    unsigned int bits = 0;
+    int i;
+
+    while (((size_t)1 << bits) < MAX(size / TB_REGIONS, 4 * TB_REGION_SLACK)) {
+        bits++;
+    }
+    region_size = MIN((size_t)1 << bits, size);
+    ctx->region_bits = bits;
+    ctx->nb_regions = DIV_ROUND_UP(size, region_size);
+    if (ctx->nb_regions > 1 &&
+        size - ((size_t)(ctx->nb_regions - 1) << bits) < 2 * TB_REGION_SLACK) {
+        /* too short to be worth a region of its own */
+        ctx->nb_regions--;
+    }
+    ctx->regions = g_new0(TBRegion, ctx->nb_regions);
+    for (i = 0; i < ctx->nb_regions; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + ((size_t)i << bits);
+        r->end = MIN(r->start + region_size,
+                     tcg_ctx.code_gen_buffer + size);
+        r->code_ptr = r->start;
+    }
+    ctx->cur_region = 0;
+
+    ctx->region_max_blocks = region_size / CODE_GEN_AVG_BLOCK_SIZE;
+    tcg_ctx.code_gen_buffer_max_size = ctx->regions[ctx->nb_regions - 1].end -
+        tcg_ctx.code_gen_buffer;
+    tcg_ctx.code_gen_max_blocks = ctx->nb_regions * ctx->region_max_blocks;
+    ctx->tbs = g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
+}
+
+static inline TBRegion *tb_cur_region(void)
+{
+    return &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+}
+
+static inline TranslationBlock *tb_region_tbs(int region)
+{
+    return &tcg_ctx.tb_ctx.tbs[region * tcg_ctx.tb_ctx.region_max_blocks];
+}
+
+static inline uint8_t *tb_region_code_end(int region)
+{
+    if (region == tcg_ctx.tb_ctx.cur_region) {
+        return tcg_ctx.code_gen_ptr;
+    }
+    return tcg_ctx.tb_ctx.regions[region].code_ptr;
+}
+
+static inline void tb_recovery_start(void)
+{
+    tcg_ctx.tb_ctx.tb_recovery_start = get_clock();
+    tcg_ctx.tb_ctx.tb_recovery_hits = 0;
+}
+
+void tb_recovery_done(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+
+    ctx->tb_recovery_last = get_clock() - ctx->tb_recovery_start;
+    ctx->tb_recovery_max = MAX(ctx->tb_recovery_max, ctx->tb_recovery_last);
+    ctx->tb_recovery_start = 0;
+}
+
 static inline void code_gen_alloc(size_t tb_size)
 {
     tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
@@ -576,12 +667,38 @@ static inline void code_gen_alloc(size_t tb_size)
             tcg_ctx.code_gen_buffer_size - 1024;
     tcg_ctx.code_gen_buffer_size -= 1024;
 
-    tcg_ctx.code_gen_buffer_max_size = tcg_ctx.code_gen_buffer_size -
-        (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
-    tcg_ctx.code_gen_max_blocks = tcg_ctx.code_gen_buffer_size /
-            CODE_GEN_AVG_BLOCK_SIZE;
-    tcg_ctx.tb_ctx.tbs =
-            g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
+    tb_regions_init();
+}
+
+static TBHashTable *tb_hash_alloc(unsigned int bits)
+{
+    TBHashTable *htab;
+
+    htab = g_malloc0(sizeof(*htab) + (sizeof(TranslationBlock *) << bits));
+    htab->mask = (1u << bits) - 1;
+    return htab;
+}
+
+/* Free the bucket arrays replaced by tb_hash_grow().  Only called when no
+   lookup can be in progress.  */
+static void tb_hash_free_retired(TBContext *ctx)
+{
+    TBHashTable *htab, *next;
+
+    for (htab = ctx->tb_phys_hash_retired; htab != NULL; htab = next) {
+        next = htab->retired_next;
+        g_free(htab);
+    }
+    ctx->tb_phys_hash_retired = NULL;
+}
+
+/* Empty the hash table, keeping its current size */
+static void tb_hash_reset(TBContext *ctx)
+{
+    tb_hash_free_retired(ctx);
+    memset(ctx->tb_phys_hash->buckets, 0,
+           (ctx->tb_phys_hash->mask + 1) * sizeof(TranslationBlock *));
+    ctx->tb_phys_hash_count = 0;
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -594,6 +711,10 @@ void tcg_exec_init(unsigned long tb_size)
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
     page_init();
+    tcg_ctx.tb_ctx.tb_phys_hash = tb_hash_alloc(CODE_GEN_PHYS_HASH_BITS);
+#if !defined(CONFIG_USER_ONLY)
+    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+#endif
 #if !defined(CONFIG_USER_ONLY) || !defined(CONFIG_USE_GUEST_BASE)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
@@ -606,32 +727,94 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* tb_lock nests: translating a block can end up invalidating code */
+static DEFINE_TLS(int, tb_lock_count);
+
+void tb_lock(void)
+{
+#if !defined(CONFIG_USER_ONLY)
+    /* With a single TCG thread everything runs under the BQL */
+    if (!qemu_tcg_mttcg_enabled()) {
+        return;
+    }
+#endif
+    if (tls_var(tb_lock_count)++ == 0) {
+#if defined(CONFIG_USER_ONLY)
+        spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+#else
+        qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+#endif
+    }
+}
+
+void tb_unlock(void)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (!qemu_tcg_mttcg_enabled()) {
+        return;
+    }
+#endif
+    assert(tls_var(tb_lock_count) > 0);
+    if (--tls_var(tb_lock_count) == 0) {
+#if defined(CONFIG_USER_ONLY)
+        spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+#else
+        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+#endif
+    }
+}
+
+/* Drop tb_lock if it is still held after a longjmp out of translation
+   or code invalidation */
+void tb_lock_reset(void)
+{
+    if (tls_var(tb_lock_count)) {
+        tls_var(tb_lock_count) = 1;
+        tb_unlock();
+    }
+}
+
+/* Allocate a new translation block in the current region.  Return NULL
+   if the region has too many translation blocks or too much generated
+   code. */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = tb_cur_region();
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
+    if (r->nb_tbs >= ctx->region_max_blocks ||
+        tcg_ctx.code_gen_ptr >= r->end - TB_REGION_SLACK) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &tb_region_tbs(ctx->cur_region)[r->nb_tbs++];
+    ctx->nb_tbs++;
+    r->last_use = ++ctx->region_clock;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->invalid = false;
+    tb->tc_relocs = false;
+    tb->trace_state = TB_TRACE_PROFILE;
+    tb->exit_count[0] = tb->exit_count[1] = 0;
+    tb->prof_exec_count = 0;
+    tb->prof_helper_calls = 0;
+    tb->prof_slow_path = 0;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = tb_cur_region();
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 &&
+            tb == &tb_region_tbs(ctx->cur_region)[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+        r->nb_tbs--;
+        ctx->nb_tbs--;
     }
 }
 
@@ -677,11 +860,63 @@ static void page_flush_tb(void)
     }
 }
 
+static void tb_profile_save(TranslationBlock *tb, TBProfile *prof)
+{
+    prof->pc = tb->pc;
+    prof->cs_base = tb->cs_base;
+    prof->flags = tb->flags;
+    prof->size = tb->size;
+    prof->icount = tb->icount;
+    prof->cpu_index = tb->prof_cpu_index;
+    if (tb->nb_trace_ranges) {
+        prof->nb_ranges = tb->nb_trace_ranges;
+        memcpy(prof->ranges, tb->trace_range, sizeof(prof->ranges));
+    } else {
+        prof->nb_ranges = 1;
+        prof->ranges[0][0] = 0;
+        prof->ranges[0][1] = tb->size;
+    }
+    prof->exec_count = tb->prof_exec_count;
+    prof->helper_calls = tb->prof_helper_calls;
+    prof->slow_path = tb->prof_slow_path;
+}
+
+/* Keep the profile of TBs whose code is about to be discarded */
+static void tb_profile_retire(TranslationBlock *tbs, int nb_tbs)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int i;
+
+    if (!ctx->prof_ring) {
+        return;
+    }
+    for (i = 0; i < nb_tbs; i++) {
+        if (tbs[i].prof_exec_count == 0) {
+            continue;
+        }
+        tb_profile_save(&tbs[i], &ctx->prof_ring[ctx->prof_ring_pos]);
+        ctx->prof_ring_pos = (ctx->prof_ring_pos + 1) % TB_PROFILE_RING_SIZE;
+        if (ctx->prof_ring_count < TB_PROFILE_RING_SIZE) {
+            ctx->prof_ring_count++;
+        }
+    }
+}
+
 /* flush all the translation blocks */
 /* XXX: tb_flush is currently not thread safe */
 void tb_flush(CPUArchState *env1)
 {
     CPUState *cpu;
+    int i;
+
+#if !defined(CONFIG_USER_ONLY)
+    if (!qemu_tcg_cpus_quiescent()) {
+        /* Other vCPUs may be running translated code, let them all
+           leave cpu_exec() first */
+        qemu_tcg_request_tb_flush(true);
+        return;
+    }
+#endif
 
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -690,11 +925,19 @@ void tb_flush(CPUArchState *env1)
            ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
            tcg_ctx.tb_ctx.nb_tbs : 0);
 #endif
-    if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
-        > tcg_ctx.code_gen_buffer_size) {
+    if (tcg_ctx.code_gen_ptr > tb_cur_region()->end) {
         cpu_abort(env1, "Internal error: code buffer overflow\n");
     }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        tb_profile_retire(tb_region_tbs(i), r->nb_tbs);
+        r->nb_tbs = 0;
+        r->code_ptr = r->start;
+        r->last_use = 0;
+    }
+    tcg_ctx.tb_ctx.cur_region = 0;
 
     for (cpu = first_cpu; cpu != NULL; cpu = cpu->next_cpu) {
         CPUArchState *env = cpu->env_ptr;
@@ -702,14 +945,71 @@ void tb_flush(CPUArchState *env1)
         memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof(void *));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0,
-            CODE_GEN_PHYS_HASH_SIZE * sizeof(void *));
+    tb_hash_reset(&tcg_ctx.tb_ctx);
     page_flush_tb();
 
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tcg_ctx.tb_ctx.tb_flush_count++;
+    tb_recovery_start();
+}
+
+/* Make room for new code by emptying the least recently used region, and
+   continue translating there.  Its TBs are unlinked one by one, so blocks
+   in the other regions stay valid and chained.  Like tb_flush, this must
+   not run while other vCPUs execute translated code.  */
+void tb_evict_region(CPUArchState *env)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TranslationBlock *tbs;
+    TBRegion *r;
+    int i, victim;
+
+    if (ctx->nb_regions == 1) {
+        tb_flush(env);
+        return;
+    }
+
+#if !defined(CONFIG_USER_ONLY)
+    if (!qemu_tcg_cpus_quiescent()) {
+        qemu_tcg_request_tb_flush(false);
+        return;
+    }
+#endif
+
+    victim = -1;
+    for (i = 0; i < ctx->nb_regions; i++) {
+        if (i != ctx->cur_region &&
+            (victim < 0 ||
+             ctx->regions[i].last_use < ctx->regions[victim].last_use)) {
+            victim = i;
+        }
+    }
+
+    tb_cur_region()->code_ptr = tcg_ctx.code_gen_ptr;
+
+    r = &ctx->regions[victim];
+    tbs = tb_region_tbs(victim);
+    for (i = 0; i < r->nb_tbs; i++) {
+        if (!tbs[i].invalid) {
+            tb_phys_invalidate(&tbs[i], -1);
+        }
+    }
+    tb_profile_retire(tbs, r->nb_tbs);
+    ctx->nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->code_ptr = r->start;
+    r->last_use = ++ctx->region_clock;
+
+    ctx->cur_region = victim;
+    tcg_ctx.code_gen_ptr = r->start;
+
+    /* no lookup can be in progress either */
+    tb_hash_free_retired(ctx);
+
+    ctx->tb_region_evict_count++;
+    tb_recovery_start();
 }
 
 #ifdef DEBUG_TB_CHECK
@@ -720,8 +1020,9 @@ static void tb_invalidate_check(target_ulong address)
     int i;
 
     address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
+    for (i = 0; i <= tcg_ctx.tb_ctx.tb_phys_hash->mask; i++) {
+        for (tb = tcg_ctx.tb_ctx.tb_phys_hash->buckets[i]; tb != NULL;
+             tb = tb->phys_hash_next) {
             if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
                   address >= tb->pc + tb->size)) {
                 printf("ERROR invalidate: address=" TARGET_FMT_lx
@@ -738,8 +1039,8 @@ static void tb_page_check(void)
     TranslationBlock *tb;
     int i, flags1, flags2;
 
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
+    for (i = 0; i <= tcg_ctx.tb_ctx.tb_phys_hash->mask; i++) {
+        for (tb = tcg_ctx.tb_ctx.tb_phys_hash->buckets[i]; tb != NULL;
                 tb = tb->phys_hash_next) {
             flags1 = page_get_flags(tb->pc);
             flags2 = page_get_flags(tb->pc + tb->size - 1);
@@ -753,18 +1054,83 @@ static void tb_page_check(void)
 
 #endif
 
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static inline uint32_t tb_hash_of(TranslationBlock *tb)
 {
-    TranslationBlock *tb1;
+    tb_page_addr_t phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+
+    return tb_hash_func(phys_pc, tb->pc, tb->cs_base, tb->flags);
+}
+
+static inline void tb_hash_write_begin(TBContext *ctx)
+{
+    atomic_set(&ctx->tb_phys_hash_seq, ctx->tb_phys_hash_seq + 1);
+    smp_wmb();
+}
+
+static inline void tb_hash_write_end(TBContext *ctx)
+{
+    smp_wmb();
+    atomic_set(&ctx->tb_phys_hash_seq, ctx->tb_phys_hash_seq + 1);
+}
+
+/* Double the number of buckets.  Chains are relinked in place, so
+   concurrent lookups are told to retry.  */
+static void tb_hash_grow(TBContext *ctx)
+{
+    TBHashTable *old = ctx->tb_phys_hash;
+    TBHashTable *htab = tb_hash_alloc(ctz32(old->mask + 1) + 1);
+    TranslationBlock *tb, *next, **head;
+    unsigned int i;
+
+    tb_hash_write_begin(ctx);
+    for (i = 0; i <= old->mask; i++) {
+        for (tb = old->buckets[i]; tb != NULL; tb = next) {
+            next = tb->phys_hash_next;
+            head = &htab->buckets[tb_hash_of(tb) & htab->mask];
+            atomic_set(&tb->phys_hash_next, *head);
+            *head = tb;
+        }
+    }
+    smp_wmb();
+    atomic_set(&ctx->tb_phys_hash, htab);
+    tb_hash_write_end(ctx);
+
+    old->retired_next = ctx->tb_phys_hash_retired;
+    ctx->tb_phys_hash_retired = old;
+}
+
+/* Publish a fully initialized TB to lookups */
+static void tb_hash_insert(TBContext *ctx, TranslationBlock *tb, uint32_t h)
+{
+    TranslationBlock **head = &ctx->tb_phys_hash->buckets[h &
+                                                   ctx->tb_phys_hash->mask];
 
+    tb->phys_hash_next = *head;
+    smp_wmb();
+    atomic_set(head, tb);
+
+    /* keep the average chain length at or below one */
+    if (++ctx->tb_phys_hash_count > ctx->tb_phys_hash->mask + 1) {
+        tb_hash_grow(ctx);
+    }
+}
+
+static void tb_hash_remove(TBContext *ctx, TranslationBlock *tb)
+{
+    TranslationBlock **ptb, *tb1;
+
+    ptb = &ctx->tb_phys_hash->buckets[tb_hash_of(tb) & ctx->tb_phys_hash->mask];
+    tb_hash_write_begin(ctx);
     for (;;) {
         tb1 = *ptb;
         if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
+            atomic_set(ptb, tb1->phys_hash_next);
             break;
         }
         ptb = &tb1->phys_hash_next;
     }
+    tb_hash_write_end(ctx);
+    ctx->tb_phys_hash_count--;
 }
 
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
@@ -826,13 +1192,11 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     CPUState *cpu;
     PageDesc *p;
     unsigned int h, n1;
-    tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
     /* remove the TB from the hash list */
-    phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    tb_hash_remove(&tcg_ctx.tb_ctx, tb);
+    tb->invalid = true;
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -936,9 +1300,11 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
-TranslationBlock *tb_gen_code(CPUArchState *env,
-                              target_ulong pc, target_ulong cs_base,
-                              int flags, int cflags)
+static TranslationBlock *tb_gen_code_internal(CPUArchState *env,
+                                              target_ulong pc,
+                                              target_ulong cs_base,
+                                              uint64_t flags, int cflags,
+                                              int trace_len, int trace_exits)
 {
     TranslationBlock *tb;
     uint8_t *tc_ptr;
@@ -949,19 +1315,51 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+#if !defined(CONFIG_USER_ONLY)
+        if (!qemu_tcg_cpus_quiescent()) {
+            /* A region can only be reused once every vCPU has left
+               the generated code; translate again after that.  */
+            qemu_tcg_request_tb_flush(false);
+            env->exception_index = EXCP_INTERRUPT;
+            cpu_loop_exit(env);
+        }
+#endif
+        tb_evict_region(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
         tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
     }
+    tcg_ctx.tb_ctx.tb_recovery_hits = 0;
     tc_ptr = tcg_ctx.code_gen_ptr;
     tb->tc_ptr = tc_ptr;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->trace_len = trace_len;
+    tb->trace_exits = trace_exits;
+    tb->nb_trace_ranges = 0;
+    if (cflags || trace_len || !tcg_ctx.tb_ctx.traces) {
+        tb->trace_state = TB_TRACE_DONE;
+    }
+    tb->prof = tb_profile_enabled;
+    tb->prof_cpu_index = ENV_GET_CPU(env)->cpu_index;
+    tcg_ctx.tb_ctx.prof_tb = tb->prof ? tb : NULL;
+#if defined(CONFIG_LINUX_USER) && TCG_TARGET_HAS_TB_RELOCS
+    /* Code from file mappings is generated relocatable, and saved for or
+       loaded from the persistent translation cache.  */
+    tb->tc_relocs = cflags == 0 && !trace_len && !tb_profile_enabled &&
+                    tb_cache_covers(pc);
+    if (!tb->tc_relocs || (code_gen_size = tb_cache_fill(tb)) < 0) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        if (tb->tc_relocs) {
+            tb_cache_record(tb, code_gen_size);
+        }
+    }
+#else
     cpu_gen_code(env, tb, &code_gen_size);
+#endif
+    tcg_ctx.tb_ctx.prof_tb = NULL;
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -975,6 +1373,209 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUArchState *env,
+                              target_ulong pc, target_ulong cs_base,
+                              int flags, int cflags)
+{
+    return tb_gen_code_internal(env, pc, cs_base, flags, cflags, 0, 0);
+}
+
+/* Start profiling newly translated blocks for superblock formation.  */
+void tb_enable_traces(void)
+{
+    tcg_ctx.tb_ctx.traces = true;
+}
+
+/* TCG profiler.  Blocks translated while it is enabled count their
+   executions and helper calls in generated code; softmmu helpers count
+   slow path accesses through tb_profile_slow_path().  Switching it on
+   discards the previous profile, and both switching it on and off flush
+   the translated code so that every block is retranslated accordingly.  */
+bool tb_profile_enabled;
+
+void tb_profile_set(bool enable)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+
+    if (enable == tb_profile_enabled) {
+        return;
+    }
+    tb_lock();
+    if (enable) {
+        if (!ctx->prof_ring) {
+            ctx->prof_ring = g_new(TBProfile, TB_PROFILE_RING_SIZE);
+        }
+        ctx->prof_ring_pos = 0;
+        ctx->prof_ring_count = 0;
+    }
+    tb_profile_enabled = enable;
+    if (first_cpu) {
+        tb_flush(first_cpu->env_ptr);
+    }
+    tb_unlock();
+}
+
+void tb_profile_slow_path(uintptr_t retaddr)
+{
+    TranslationBlock *tb = tb_find_pc(retaddr);
+
+    if (tb) {
+        tb->prof_slow_path++;
+    }
+}
+
+static int tb_profile_cmp_block(const void *a, const void *b)
+{
+    const TBProfile *pa = a, *pb = b;
+
+    if (pa->pc != pb->pc) {
+        return pa->pc < pb->pc ? -1 : 1;
+    }
+    if (pa->cs_base != pb->cs_base) {
+        return pa->cs_base < pb->cs_base ? -1 : 1;
+    }
+    if (pa->flags != pb->flags) {
+        return pa->flags < pb->flags ? -1 : 1;
+    }
+    /* a superblock and the block at its head are different code */
+    if (pa->nb_ranges != pb->nb_ranges) {
+        return pa->nb_ranges < pb->nb_ranges ? -1 : 1;
+    }
+    return memcmp(pa->ranges, pb->ranges,
+                  pa->nb_ranges * sizeof(pa->ranges[0]));
+}
+
+static int tb_profile_cmp_count(const void *a, const void *b)
+{
+    const TBProfile *pa = a, *pb = b;
+
+    if (pa->exec_count != pb->exec_count) {
+        return pa->exec_count > pb->exec_count ? -1 : 1;
+    }
+    return tb_profile_cmp_block(a, b);
+}
+
+/* Fill TOP with the N most executed guest blocks, merging the profiles
+   of blocks that were translated several times.  Returns the number of
+   entries filled.  */
+int tb_profile_top(TBProfile *top, int n)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBProfile *all;
+    int i, j, nb = 0;
+
+    tb_lock();
+    all = g_new(TBProfile, ctx->nb_tbs + ctx->prof_ring_count + 1);
+    for (i = 0; i < ctx->nb_regions; i++) {
+        TranslationBlock *tbs = tb_region_tbs(i);
+
+        for (j = 0; j < ctx->regions[i].nb_tbs; j++) {
+            if (tbs[j].prof_exec_count) {
+                tb_profile_save(&tbs[j], &all[nb++]);
+            }
+        }
+    }
+    for (i = 0; i < ctx->prof_ring_count; i++) {
+        all[nb++] = ctx->prof_ring[i];
+    }
+    tb_unlock();
+
+    qsort(all, nb, sizeof(*all), tb_profile_cmp_block);
+    for (i = 0, j = -1; i < nb; i++) {
+        if (j >= 0 && tb_profile_cmp_block(&all[j], &all[i]) == 0) {
+            all[j].exec_count += all[i].exec_count;
+            all[j].helper_calls += all[i].helper_calls;
+            all[j].slow_path += all[i].slow_path;
+        } else {
+            all[++j] = all[i];
+        }
+    }
+    nb = j + 1;
+    qsort(all, nb, sizeof(*all), tb_profile_cmp_count);
+
+    n = MIN(n, nb);
+    memcpy(top, all, n * sizeof(*top));
+    g_free(all);
+    return n;
+}
+
+/* Called from cpu_exec() when @tb left through exit @n and @next is
+   about to run.  Returns true if the jump must not be chained because
+   @tb is still being profiled.  */
+bool tb_trace_profile(TranslationBlock *tb, int n, TranslationBlock *next)
+{
+    if (tb->trace_state != TB_TRACE_PROFILE) {
+        return false;
+    }
+    tb->exit_count[n]++;
+    tb->exit_pc[n] = next->pc;
+    return true;
+}
+
+/* The exit that @tb takes at least 7 times out of 8, or -1.  */
+static int tb_trace_exit(TranslationBlock *tb)
+{
+    uint32_t total = tb->exit_count[0] + tb->exit_count[1];
+    int n;
+
+    if (total < TB_TRACE_THRESHOLD / 4) {
+        return -1;
+    }
+    for (n = 0; n < 2; n++) {
+        if ((uint64_t)tb->exit_count[n] * 8 >= (uint64_t)total * 7) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+/* Retranslate the hot block @tb as a superblock that also contains the
+   blocks following it along dominant exits.  The blocks must lie after
+   @tb in the same page, so that the TB still describes a single range
+   of guest code; a trace whose last block branches back to @tb becomes
+   a loop inside the TB.  Successors are found through the virtual PC
+   cache of the vCPU that ran them.  */
+void tb_gen_trace(CPUArchState *env, TranslationBlock *tb)
+{
+    target_ulong pc = tb->pc, cs_base = tb->cs_base;
+    target_ulong page_end = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+    uint64_t flags = tb->flags;
+    TranslationBlock *b = tb;
+    int len = 0, exits = 0, n;
+    target_ulong next_pc;
+
+    tb->trace_state = TB_TRACE_DONE;
+    if (tb->page_addr[1] != -1 || tb->invalid) {
+        return;
+    }
+    while (len < TB_TRACE_MAX_BLOCKS) {
+        n = tb_trace_exit(b);
+        if (n < 0) {
+            break;
+        }
+        exits |= n << len;
+        len++;
+        next_pc = b->exit_pc[n];
+        if (next_pc <= pc || next_pc >= page_end) {
+            break;
+        }
+        b = env->tb_jmp_cache[tb_jmp_cache_hash_func(next_pc)];
+        if (!b || b->pc != next_pc || b->cs_base != cs_base ||
+            b->flags != flags || b->invalid || b->trace_len ||
+            b->page_addr[1] != -1) {
+            break;
+        }
+    }
+    if (len < 2) {
+        return;
+    }
+
+    tb_phys_invalidate(tb, -1);
+    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    tb_gen_code_internal(env, pc, cs_base, flags, 0, len, exits);
+    tcg_ctx.tb_ctx.tb_trace_count++;
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -999,8 +1600,9 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
  * access: the virtual CPU will exit the current TB if code is modified inside
  * this TB.
  */
-void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
-                                   int is_cpu_write_access)
+static void do_tb_invalidate_phys_page_range(tb_page_addr_t start,
+                                             tb_page_addr_t end,
+                                             int is_cpu_write_access)
 {
     TranslationBlock *tb, *tb_next, *saved_tb;
     CPUState *cpu = current_cpu;
@@ -1115,6 +1717,14 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 #endif
 }
 
+void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
+                                   int is_cpu_write_access)
+{
+    tb_lock();
+    do_tb_invalidate_phys_page_range(start, end, is_cpu_write_access);
+    tb_unlock();
+}
+
 /* len must be <= 8 and start must be a multiple of len */
 void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
@@ -1130,9 +1740,10 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
                   (intptr_t)cpu_single_env->segs[R_CS].base);
     }
 #endif
+    tb_lock();
     p = page_find(start >> TARGET_PAGE_BITS);
     if (!p) {
-        return;
+        goto out;
     }
     if (p->code_bitmap) {
         offset = start & ~TARGET_PAGE_MASK;
@@ -1142,8 +1753,10 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
         }
     } else {
     do_invalidate:
-        tb_invalidate_phys_page_range(start, start + len, 1);
+        do_tb_invalidate_phys_page_range(start, start + len, 1);
     }
+out:
+    tb_unlock();
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1280,17 +1893,9 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
-
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1312,6 +1917,10 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the physical hash table, last, as lookups may see it at once */
+    tb_hash_insert(&tcg_ctx.tb_ctx, tb,
+                   tb_hash_func(phys_pc, tb->pc, tb->cs_base, tb->flags));
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1334,23 +1943,30 @@ bool is_tcg_gen_code(uintptr_t tc_ptr)
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
-    uintptr_t v;
-    TranslationBlock *tb;
+    int m_min, m_max, m, region;
+    uintptr_t v, off;
+    TranslationBlock *tb, *tbs;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer) {
+        return NULL;
+    }
+    off = (tc_ptr - (uintptr_t)tcg_ctx.code_gen_buffer) >>
+          tcg_ctx.tb_ctx.region_bits;
+    if (off >= tcg_ctx.tb_ctx.nb_regions) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    region = off;
+    if (tcg_ctx.tb_ctx.regions[region].nb_tbs <= 0 ||
+        tc_ptr >= (uintptr_t)tb_region_code_end(region)) {
         return NULL;
     }
-    /* binary search (cf Knuth) */
+    /* binary search (cf Knuth); TBs of a region are sorted by tc_ptr */
+    tbs = tb_region_tbs(region);
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = tcg_ctx.tb_ctx.regions[region].nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1360,7 +1976,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &tbs[m_max];
 }
 
 #if defined(TARGET_HAS_ICE) && !defined(CONFIG_USER_ONLY)
@@ -1385,6 +2001,7 @@ void tb_check_watchpoint(CPUArchState *env)
 {
     TranslationBlock *tb;
 
+    tb_lock();
     tb = tb_find_pc(env->mem_io_pc);
     if (!tb) {
         cpu_abort(env, "check_watchpoint: could not find TB for pc=%p",
@@ -1392,6 +2009,7 @@ void tb_check_watchpoint(CPUArchState *env)
     }
     cpu_restore_state_from_tb(tb, env, env->mem_io_pc);
     tb_phys_invalidate(tb, -1);
+    tb_unlock();
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -1401,8 +2019,9 @@ static void tcg_handle_interrupt(CPUState *cpu, int mask)
     CPUArchState *env = cpu->env_ptr;
     int old_mask;
 
-    old_mask = cpu->interrupt_request;
-    cpu->interrupt_request |= mask;
+    /* Helpers running without the BQL may raise interrupts on their
+       own vCPU concurrently with the iothread */
+    old_mask = atomic_fetch_or(&cpu->interrupt_request, mask);
 
     /*
      * If called from iothread context, wake the target cpu in
@@ -1435,6 +2054,8 @@ void cpu_io_recompile(CPUArchState *env, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint64_t flags;
 
+    /* Released by cpu_exec() after cpu_resume_from_signal() */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(env, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1501,10 +2122,50 @@ void tb_flush_jmp_cache(CPUArchState *env, target_ulong addr)
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+#define TB_HASH_HIST_SIZE 8
+
+static void dump_tb_hash_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    TBHashTable *htab = tcg_ctx.tb_ctx.tb_phys_hash;
+    int hist[TB_HASH_HIST_SIZE + 1] = { 0 };
+    int used = 0, total = 0, max_chain = 0;
+    TranslationBlock *tb;
+    unsigned int i;
+    int len;
+
+    for (i = 0; i <= htab->mask; i++) {
+        len = 0;
+        for (tb = htab->buckets[i]; tb != NULL; tb = tb->phys_hash_next) {
+            len++;
+        }
+        if (len) {
+            used++;
+            total += len;
+            max_chain = MAX(max_chain, len);
+        }
+        hist[MIN(len, TB_HASH_HIST_SIZE)]++;
+    }
+
+    cpu_fprintf(f, "TB hash buckets     %d/%u (%d%% used)\n", used,
+                htab->mask + 1, used * 100 / (htab->mask + 1));
+    cpu_fprintf(f, "TB hash avg chain   %0.2f max=%d\n",
+                used ? (double) total / used : 0, max_chain);
+    cpu_fprintf(f, "TB hash chain length histogram (used buckets):\n");
+    for (len = 1; len <= TB_HASH_HIST_SIZE; len++) {
+        if (!hist[len]) {
+            continue;
+        }
+        cpu_fprintf(f, "  %2d%s %8d (%d%%)\n", len,
+                    len == TB_HASH_HIST_SIZE ? "+" : " ", hist[len],
+                    hist[len] * 100 / used);
+    }
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t code_size;
     TranslationBlock *tb;
 
     target_code_size = 0;
@@ -1512,40 +2173,45 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        code_size += tb_region_code_end(i) - tcg_ctx.tb_ctx.regions[i].start;
+    }
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        for (j = 0; j < tcg_ctx.tb_ctx.regions[i].nb_tbs; j++) {
+            tb = &tb_region_tbs(i)[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "gen code size       %zu/%zu\n",
+                code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d x %zu KB, current %d\n",
+                tcg_ctx.tb_ctx.nb_regions,
+                ((size_t)1 << tcg_ctx.tb_ctx.region_bits) / 1024,
+                tcg_ctx.tb_ctx.cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zu bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1556,11 +2222,23 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 direct_jmp2_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
+    dump_tb_hash_info(f, cpu_fprintf);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n",
+                tcg_ctx.tb_ctx.tb_region_evict_count);
+    cpu_fprintf(f, "TB flush recovery   last=%" PRId64 "us max=%" PRId64 "us%s\n",
+                tcg_ctx.tb_ctx.tb_recovery_last / SCALE_US,
+                tcg_ctx.tb_ctx.tb_recovery_max / SCALE_US,
+                tcg_ctx.tb_ctx.tb_recovery_start ? " (recovering)" : "");
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "superblock count    %d%s\n",
+                tcg_ctx.tb_ctx.tb_trace_count,
+                tcg_ctx.tb_ctx.traces ? "" : " (disabled)");
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB miss count      %" PRIu64 " (victim TLB hits %"
+                PRIu64 ")\n", tlb_miss_count, tlb_victim_hit_count);
     tcg_dump_info(f, cpu_fprintf);
 }
 
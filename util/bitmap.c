@@ -11,6 +11,8 @@
 
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
 
 /*
  * bitmaps provide an array of bits, implemented using an an
@@ -197,6 +199,86 @@ void bitmap_clear(unsigned long *map, int start, int nr)
     }
 }
 
+void bitmap_set_atomic(unsigned long *map, long start, long nr)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    const long size = start + nr;
+    int bits_to_set = BITS_PER_LONG - (start % BITS_PER_LONG);
+    unsigned long mask_to_set = BITMAP_FIRST_WORD_MASK(start);
+
+    /* Words that are already fully set need no locked operation */
+    while (nr - bits_to_set >= 0) {
+        if ((*p & mask_to_set) != mask_to_set) {
+            atomic_or(p, mask_to_set);
+        }
+        nr -= bits_to_set;
+        bits_to_set = BITS_PER_LONG;
+        mask_to_set = ~0UL;
+        p++;
+    }
+    if (nr) {
+        mask_to_set &= BITMAP_LAST_WORD_MASK(size);
+        if ((*p & mask_to_set) != mask_to_set) {
+            atomic_or(p, mask_to_set);
+        }
+    }
+}
+
+bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    const long size = start + nr;
+    int bits_to_clear = BITS_PER_LONG - (start % BITS_PER_LONG);
+    unsigned long mask_to_clear = BITMAP_FIRST_WORD_MASK(start);
+    unsigned long dirty = 0;
+
+    while (nr - bits_to_clear >= 0) {
+        if (*p & mask_to_clear) {
+            dirty |= atomic_fetch_and(p, ~mask_to_clear) & mask_to_clear;
+        }
+        nr -= bits_to_clear;
+        bits_to_clear = BITS_PER_LONG;
+        mask_to_clear = ~0UL;
+        p++;
+    }
+    if (nr) {
+        mask_to_clear &= BITMAP_LAST_WORD_MASK(size);
+        if (*p & mask_to_clear) {
+            dirty |= atomic_fetch_and(p, ~mask_to_clear) & mask_to_clear;
+        }
+    }
+    return dirty != 0;
+}
+
+long bitmap_move_atomic(unsigned long *dst, unsigned long *src,
+                        long start, long nr)
+{
+    unsigned long *s = src + BIT_WORD(start);
+    unsigned long *d = dst + BIT_WORD(start);
+    const long size = start + nr;
+    int bits_to_move = BITS_PER_LONG - (start % BITS_PER_LONG);
+    unsigned long mask = BITMAP_FIRST_WORD_MASK(start);
+    unsigned long bits;
+    long count = 0;
+
+    while (nr > 0) {
+        if (nr < bits_to_move) {
+            mask &= BITMAP_LAST_WORD_MASK(size);
+        }
+        if (*s & mask) {
+            bits = atomic_fetch_and(s, ~mask) & mask;
+            count += ctpopl(bits & ~*d);
+            *d |= bits;
+        }
+        nr -= bits_to_move;
+        bits_to_move = BITS_PER_LONG;
+        mask = ~0UL;
+        s++;
+        d++;
+    }
+    return count;
+}
+
 #define ALIGN_MASK(x,mask)      (((x)+(mask))&~(mask))
 
 /**
@@ -191,6 +191,7 @@ const char *mem_path = NULL;
 #ifdef MAP_POPULATE
 int mem_prealloc = 0; /* force preallocation of physical target memory */
 #endif
+int mem_shared = 0; /* back guest RAM with descriptors that can be passed on */
 int nb_nics;
 NICInfo nd_table[MAX_NICS];
 int autostart;
@@ -251,6 +252,7 @@ static QTAILQ_HEAD(, FWBootEntry) fw_boot_order =
 
 int nb_numa_nodes;
 uint64_t node_mem[MAX_NODES];
+int node_host_node[MAX_NODES];
 unsigned long *node_cpumask[MAX_NODES];
 
 uint8_t qemu_uuid[16];
@@ -516,6 +518,41 @@ static QemuOptsList qemu_realtime_opts = {
     },
 };
 
+static QemuOptsList qemu_aio_poll_opts = {
+    .name = "aio-poll",
+    .implied_opt_name = "max-ns",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_aio_poll_opts.head),
+    .desc = {
+        {
+            .name = "max-ns",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "grow",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "shrink",
+            .type = QEMU_OPT_NUMBER,
+        },
+        { /* end of list */ }
+    },
+};
+
+static QemuOptsList qemu_tcg_opts = {
+    .name = "tcg",
+    .implied_opt_name = "thread",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_tcg_opts.head),
+    .desc = {
+        {
+            .name = "thread",
+            .type = QEMU_OPT_STRING,
+        }, {
+            .name = "traces",
+            .type = QEMU_OPT_BOOL,
+        },
+        { /* end of list */ }
+    },
+};
+
 static QemuOptsList qemu_msg_opts = {
     .name = "msg",
     .head = QTAILQ_HEAD_INITIALIZER(qemu_msg_opts.head),
@@ -1419,6 +1456,16 @@ static void numa_add(const char *optarg)
         if (get_param_value(option, 128, "cpus", optarg) != 0) {
             numa_node_parse_cpus(nodenr, option);
         }
+        if (get_param_value(option, 128, "hostnode", optarg) != 0) {
+            unsigned long long hostnode;
+
+            if (parse_uint_full(option, &hostnode, 10) < 0 ||
+                hostnode >= MAX_NODES) {
+                fprintf(stderr, "qemu: invalid NUMA hostnode: %s\n", option);
+                exit(1);
+            }
+            node_host_node[nodenr] = hostnode;
+        }
         nb_numa_nodes++;
     } else {
         fprintf(stderr, "Invalid -numa option: %s\n", option);
@@ -1516,6 +1563,13 @@ static void configure_realtime(QemuOpts *opts)
 }
 
 
+static void configure_aio_poll(QemuOpts *opts)
+{
+    aio_set_poll_defaults(qemu_opt_get_number(opts, "max-ns", 0),
+                          qemu_opt_get_number(opts, "grow", 0),
+                          qemu_opt_get_number(opts, "shrink", 0));
+}
+
 static void configure_msg(QemuOpts *opts)
 {
     enable_timestamp_msg = qemu_opt_get_bool(opts, "timestamp", true);
@@ -1767,6 +1821,11 @@ void vm_state_notify(int running, RunState state)
 
 void vm_start(void)
 {
+    if (ram_save_fds_passed()) {
+        error_report("Guest RAM was passed to another process, "
+                     "not resuming the VM");
+        return;
+    }
     if (!runstate_is_running()) {
         cpu_enable_ticks();
         runstate_set(RUN_STATE_RUNNING);
@@ -2896,6 +2955,7 @@ int main(int argc, char **argv, char **envp)
     int i;
     int snapshot, linux_boot;
     const char *icount_option = NULL;
+    QemuOpts *tcg_opts = NULL;
     const char *initrd_filename;
     const char *kernel_filename, *kernel_cmdline;
     const char *boot_order = NULL;
@@ -2959,6 +3019,8 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_object_opts);
     qemu_add_opts(&qemu_tpmdev_opts);
     qemu_add_opts(&qemu_realtime_opts);
+    qemu_add_opts(&qemu_aio_poll_opts);
+    qemu_add_opts(&qemu_tcg_opts);
     qemu_add_opts(&qemu_msg_opts);
 
     runstate_init();
@@ -2981,6 +3043,7 @@ int main(int argc, char **argv, char **envp)
 
     for (i = 0; i < MAX_NODES; i++) {
         node_mem[i] = 0;
+        node_host_node[i] = -1;
         node_cpumask[i] = bitmap_new(MAX_CPUMASK_BITS);
     }
 
@@ -3283,6 +3346,9 @@ int main(int argc, char **argv, char **envp)
                 mem_prealloc = 1;
                 break;
 #endif
+            case QEMU_OPTION_mem_shared:
+                mem_shared = 1;
+                break;
             case QEMU_OPTION_d:
                 log_mask = optarg;
                 break;
@@ -3856,6 +3922,19 @@ int main(int argc, char **argv, char **envp)
                 }
                 configure_realtime(opts);
                 break;
+            case QEMU_OPTION_aio_poll:
+                opts = qemu_opts_parse(qemu_find_opts("aio-poll"), optarg, 1);
+                if (!opts) {
+                    exit(1);
+                }
+                configure_aio_poll(opts);
+                break;
+            case QEMU_OPTION_tcg:
+                tcg_opts = qemu_opts_parse(qemu_find_opts("tcg"), optarg, 1);
+                if (!tcg_opts) {
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_msg:
                 opts = qemu_opts_parse(qemu_find_opts("msg"), optarg, 0);
                 if (!opts) {
@@ -4181,6 +4260,14 @@ int main(int argc, char **argv, char **envp)
     }
     configure_icount(icount_option);
 
+    if (tcg_opts) {
+        if (!tcg_enabled()) {
+            fprintf(stderr, "-tcg is only allowed with the TCG accelerator\n");
+            exit(1);
+        }
+        qemu_tcg_configure(tcg_opts);
+    }
+
     /* clean up network at qemu process termination */
     atexit(&net_cleanup);
 